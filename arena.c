@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+struct arena_chunk {
+    arena_chunk* next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+void arena_init(arena* a, size_t chunk_size) {
+    a->chunks = NULL;
+    a->chunk_size = chunk_size;
+    a->capacity = 0;
+}
+
+char* arena_strdup(arena* a, const char* text) {
+    size_t length = strlen(text) + 1;
+    arena_chunk* chunk = a->chunks;
+
+    if (chunk == NULL || chunk->size - chunk->used < length) {
+        size_t size = chunk ? chunk->size * 2 : a->chunk_size;
+        while (size < length) {
+            size *= 2;
+        }
+        if ((chunk = malloc(sizeof(arena_chunk) + size)) == NULL) {
+            return NULL;
+        }
+        chunk->next = a->chunks;
+        chunk->size = size;
+        chunk->used = 0;
+        a->chunks = chunk;
+        a->capacity += size;
+    }
+    char* copy = chunk->data + chunk->used;
+    memcpy(copy, text, length);
+    chunk->used += length;
+    return copy;
+}
+
+void arena_reset(arena* a) {
+    if (a->chunks == NULL) {
+        return;
+    }
+    // The newest chunk is the largest one
+    arena_chunk* keep = a->chunks;
+    arena_chunk* chunk = keep->next;
+    while (chunk) {
+        arena_chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    keep->next = NULL;
+    keep->used = 0;
+    a->capacity = keep->size;
+}
+
+void arena_free(arena* a) {
+    arena_chunk* chunk = a->chunks;
+    while (chunk) {
+        arena_chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    a->chunks = NULL;
+    a->capacity = 0;
+}
@@ -0,0 +1,29 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump allocator for the cell text of a PCB row batch. Strings are appended
+ * to the current chunk; a new chunk (at least twice the previous one) is
+ * only allocated when it is full, so a batch of 1024 rows costs a handful of
+ * mallocs instead of one per cell. Everything is released at once by
+ * arena_reset (chunks kept for reuse) or arena_free.
+ */
+
+typedef struct arena_chunk arena_chunk;
+
+typedef struct {
+    arena_chunk* chunks;    // current chunk first
+    size_t chunk_size;      // size of the first chunk
+    size_t capacity;        // bytes held by all chunks
+} arena;
+
+void arena_init(arena* a, size_t chunk_size);
+// Copy of text inside the arena, NULL when out of memory
+char* arena_strdup(arena* a, const char* text);
+// Forget every string but keep the largest chunk for the next ones
+void arena_reset(arena* a);
+void arena_free(arena* a);
+
+#endif
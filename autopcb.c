@@ -0,0 +1,260 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "autopcb.h"
+#include "column_kernels.h"
+#include "column_plan.h"
+#include "lookup_set.h"
+
+struct autopcb_tables {
+    lookup_set set;
+    lookup_source source;
+    int week;
+    int fb_column;      // all_weeks: matrix column of the week, -1 if FB lacks it
+};
+
+struct autopcb_plan {
+    column_plan plan;
+    const autopcb_tables* tables;
+    int header_count;
+};
+
+struct autopcb_evaluator {
+    const autopcb_plan* plan;
+    column_vectors* vectors;
+    // Rows of one pass as evaluate_columns reads them: the plan inputs
+    // gathered from the caller's cells, then the two cells SQLite fills in
+    // modif --db, always NULL here
+    int width;
+    char** cells;
+    stats_lookup abc;   // lookups counted by evaluate_columns, not reported
+    stats_lookup fb;
+};
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+// The best vector kernels of the CPU, chosen before the first evaluation
+static void select_kernels(void) {
+    column_kernels_select(NULL);
+}
+
+static void set_error(char* error, size_t error_size, const char* message, const char* detail) {
+    if (error && error_size > 0) {
+        snprintf(error, error_size, "%s%s", message, detail ? detail : "");
+    }
+}
+
+static autopcb_cell to_cell(const output_cell* cell) {
+    autopcb_cell out;
+    out.kind = cell->kind == CELL_NUMBER ? AUTOPCB_NUMBER : cell->kind == CELL_TEXT ? AUTOPCB_TEXT : AUTOPCB_EMPTY;
+    out.text = cell->kind == CELL_TEXT ? cell->text : NULL;
+    out.number = cell->kind == CELL_NUMBER ? cell->number : 0;
+    return out;
+}
+
+// A lookup value as modif writes it: the number when there is one, else the text
+static autopcb_cell lookup_cell(const char* text, number_cell number) {
+    autopcb_cell cell;
+    cell.kind = !number.null ? AUTOPCB_NUMBER : text && *text ? AUTOPCB_TEXT : AUTOPCB_EMPTY;
+    cell.text = cell.kind == AUTOPCB_TEXT ? text : NULL;
+    cell.number = cell.kind == AUTOPCB_NUMBER ? number.value : 0;
+    return cell;
+}
+
+///////////////////////// tables /////////////////////////
+
+autopcb_tables* autopcb_open(const autopcb_options* options, char* error, size_t error_size) {
+    autopcb_tables* tables;
+
+    if (!options || !options->abc_path || !options->fb_path || options->week < 1 || options->week > 53) {
+        set_error(error, error_size, "ABC and FB paths and a week from 1 to 53 are required", NULL);
+        return NULL;
+    }
+    pthread_once(&kernels_once, select_kernels);
+    if (!(tables = calloc(1, sizeof(autopcb_tables)))) {
+        set_error(error, error_size, "out of memory", NULL);
+        return NULL;
+    }
+    tables->source.abc_path = options->abc_path;
+    tables->source.fb_path = options->fb_path;
+    tables->source.abc_snapshot = options->abc_snapshot;
+    tables->source.fb_snapshot = options->fb_snapshot;
+    tables->source.reader_threads = options->reader_threads;
+    tables->source.quiet = !options->verbose;
+    tables->week = options->week;
+    tables->fb_column = -1;
+
+    if (!load_abc_hash_table(&tables->set, &tables->source)) {
+        set_error(error, error_size, "could not load ABC from ", options->abc_path);
+        autopcb_close(tables);
+        return NULL;
+    }
+    if (options->all_weeks ? !load_fb_matrix(&tables->set, &tables->source)
+                           : !load_fb_hash_table(&tables->set, &tables->source, options->week)) {
+        set_error(error, error_size, "could not load FB from ", options->fb_path);
+        autopcb_close(tables);
+        return NULL;
+    }
+    if (options->all_weeks) {
+        tables->fb_column = fb_matrix_column_of_week(&tables->set.fb_weeks, options->week);
+    }
+    if (!build_key_dictionary(&tables->set)) {
+        set_error(error, error_size, "out of memory building the key dictionary", NULL);
+        autopcb_close(tables);
+        return NULL;
+    }
+    if (options->verbose) {
+        print_key_dictionary(&tables->set);
+    }
+    return tables;
+}
+
+void autopcb_close(autopcb_tables* tables) {
+    if (tables) {
+        clear_lookup_set(&tables->set);
+        free(tables);
+    }
+}
+
+size_t autopcb_lookup_batch(const autopcb_tables* tables, const char* const* widfs, size_t count,
+                            autopcb_lookup* results) {
+    const lookup_set* set = &tables->set;
+    size_t found = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t key = find_key(set, widfs[i]);
+        number_cell abc, fb;
+        const char* abc_text = get_wlom_value_by_key(set, key, &abc);
+        const char* fb_text = NULL;
+
+        if (set->fb_weeks_loaded) {
+            // The week matrix only keeps numbers
+            uint32_t row = key != KEY_DICT_NONE ? set->fb_row_by_key[key] : KEY_DICT_NONE;
+            fb = vector_cell(row != KEY_DICT_NONE && tables->fb_column >= 0
+                             ? fb_matrix_get(&set->fb_weeks, row, tables->fb_column) : NAN);
+        } else {
+            fb_text = get_fb_value_by_key(set, key, &fb);
+        }
+        results[i].abc = lookup_cell(abc_text, abc);
+        results[i].fb = lookup_cell(fb_text, fb);
+        found += abc_text || fb_text || !fb.null;
+    }
+    return found;
+}
+
+///////////////////////// plans /////////////////////////
+
+autopcb_plan* autopcb_plan_compile(const autopcb_tables* tables, const char* spec, const char* const* header,
+                                   int header_count, const int* weeks, int week_count,
+                                   char* error, size_t error_size) {
+    int columns, instructions;
+    int current_week[1];
+
+    if (week_count < 0 || week_count > MAX_HORIZON_WEEKS || (week_count > 0 && !tables->set.fb_weeks_loaded)) {
+        set_error(error, error_size, "a horizon of weeks needs tables opened with all_weeks", NULL);
+        return NULL;
+    }
+    column_spec* parsed = column_spec_parse(spec ? spec : week_count > 0 ? default_horizon_column_spec
+                                                                         : default_column_spec,
+                                            spec ? "spec" : "default spec");
+    if (!parsed) {
+        set_error(error, error_size, "the column spec does not parse", NULL);
+        return NULL;
+    }
+    column_spec_size(parsed, week_count, &columns, &instructions);
+    if (columns > MAX_OUTPUT_COLS || instructions > MAX_PLAN_CODE) {
+        column_spec_free(parsed);
+        set_error(error, error_size, "the column spec expands to too many columns or instructions", NULL);
+        return NULL;
+    }
+
+    autopcb_plan* plan = malloc(sizeof(autopcb_plan));
+    if (!plan) {
+        column_spec_free(parsed);
+        set_error(error, error_size, "out of memory", NULL);
+        return NULL;
+    }
+    // Tables with every week read fb from the matrix: without a horizon the
+    // plan gets the week of the tables as its only one, which writes the
+    // same columns
+    if (week_count == 0 && tables->set.fb_weeks_loaded) {
+        current_week[0] = tables->week;
+        weeks = current_week;
+        week_count = 1;
+    }
+    plan->tables = tables;
+    plan->header_count = header_count;
+    compile_column_plan(&plan->plan, parsed, (const char**)header, header_count, tables->week, weeks, week_count, 1);
+    bind_fb_matrix(&plan->plan, &tables->set);
+    column_spec_free(parsed);
+    return plan;
+}
+
+int autopcb_plan_columns(const autopcb_plan* plan) {
+    return plan->plan.count;
+}
+
+const char* autopcb_plan_column_name(const autopcb_plan* plan, int column) {
+    return column >= 0 && column < plan->plan.count ? plan->plan.steps[column].name : NULL;
+}
+
+void autopcb_plan_free(autopcb_plan* plan) {
+    free(plan);
+}
+
+///////////////////////// evaluation /////////////////////////
+
+autopcb_evaluator* autopcb_evaluator_new(const autopcb_plan* plan) {
+    autopcb_evaluator* evaluator = calloc(1, sizeof(autopcb_evaluator));
+    if (!evaluator) {
+        return NULL;
+    }
+    evaluator->plan = plan;
+    evaluator->width = plan->plan.input_count + 2;
+    evaluator->vectors = new_column_vectors(&plan->plan);
+    evaluator->cells = calloc((size_t)COLUMN_VECTOR_ROWS * evaluator->width, sizeof(char*));
+    if (!evaluator->vectors || !evaluator->cells) {
+        autopcb_evaluator_free(evaluator);
+        return NULL;
+    }
+    return evaluator;
+}
+
+void autopcb_evaluate(autopcb_evaluator* evaluator, const char* const* cells, size_t rows, autopcb_cell* out) {
+    const column_plan* plan = &evaluator->plan->plan;
+    const lookup_set* set = &evaluator->plan->tables->set;
+    int header_count = evaluator->plan->header_count;
+    int width = evaluator->width;
+
+    for (size_t first = 0; first < rows; first += COLUMN_VECTOR_ROWS) {
+        int count = rows - first < COLUMN_VECTOR_ROWS ? (int)(rows - first) : COLUMN_VECTOR_ROWS;
+
+        // The cells are only read; the joined cells past the inputs stay NULL
+        for (int r = 0; r < count; r++) {
+            const char* const* row = cells + (first + r) * header_count;
+            for (int i = 0; i < plan->input_count; i++) {
+                evaluator->cells[(size_t)r * width + i] = (char*)row[plan->inputs[i]];
+            }
+        }
+        evaluate_columns(plan, evaluator->vectors, set, evaluator->cells, width, count, 0,
+                         &evaluator->abc, &evaluator->fb);
+        for (int r = 0; r < count; r++) {
+            output_cell row_out[MAX_OUTPUT_COLS];
+            autopcb_cell* cells_out = out + (first + r) * plan->count;
+            fill_output_row(plan, evaluator->vectors, r, evaluator->cells + (size_t)r * width, width, row_out);
+            for (int c = 0; c < plan->count; c++) {
+                cells_out[c] = to_cell(&row_out[c]);
+            }
+        }
+    }
+}
+
+void autopcb_evaluator_free(autopcb_evaluator* evaluator) {
+    if (evaluator) {
+        free_column_vectors(evaluator->vectors);
+        free(evaluator->cells);
+        free(evaluator);
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef AUTOPCB_H
+#define AUTOPCB_H
+
+#include <stddef.h>
+
+/*
+ * libautopcb (make libautopcb.a): the ABC and FB lookups and the column
+ * plans of modif as a library, for services that compute coverage
+ * in-process instead of running modif over files. modif is built from the
+ * same modules.
+ *
+ *   autopcb_tables     ABC and FB loaded once, with their key dictionary
+ *   autopcb_plan       a column spec compiled against a PCB header
+ *   autopcb_evaluator  the column vectors one thread evaluates rows in
+ *
+ * Tables and plans are only read once opened or compiled: any number of
+ * threads may look up in the same tables and evaluate rows of the same plan
+ * at once, without locks. An evaluator is used by one thread at a time.
+ * Tables outlive their plans, plans their evaluators. Texts handed back
+ * point into the tables or into the rows given and live as long as they do.
+ *
+ * Nothing is printed unless verbose is set; a spec that does not parse is
+ * reported on stderr as modif --columns does.
+ */
+
+typedef struct autopcb_tables autopcb_tables;
+typedef struct autopcb_plan autopcb_plan;
+typedef struct autopcb_evaluator autopcb_evaluator;
+
+typedef struct {
+    const char* abc_path;       // ABC.xlsx
+    const char* fb_path;        // FB.xlsx
+    const char* abc_snapshot;   // snapshot of the ABC table to reuse or write, NULL for none
+    const char* fb_snapshot;    // of the FB week, not used with all_weeks
+    int week;                   // FB week of the fb lookup, 1-53
+    int all_weeks;              // load every week column of FB, for plans with a horizon
+    int reader_threads;         // > 0: parse the xlsx with the parallel reader on that many threads
+    int verbose;                // print what modif prints while loading
+} autopcb_options;
+
+typedef enum {
+    AUTOPCB_EMPTY,
+    AUTOPCB_TEXT,
+    AUTOPCB_NUMBER
+} autopcb_cell_kind;
+
+typedef struct {
+    autopcb_cell_kind kind;
+    const char* text;   // AUTOPCB_TEXT
+    double number;      // AUTOPCB_NUMBER
+} autopcb_cell;
+
+typedef struct {
+    autopcb_cell abc;   // WKQCO of the WIDF in ABC, a number when it is one
+    autopcb_cell fb;    // FB value of the WIDF for the week of the tables
+} autopcb_lookup;
+
+// Load ABC and FB; NULL with the reason in error when either cannot be loaded
+autopcb_tables* autopcb_open(const autopcb_options* options, char* error, size_t error_size);
+void autopcb_close(autopcb_tables* tables);
+// Look up count WIDFs (NULL ones miss) into results; returns how many are
+// in ABC or in FB
+size_t autopcb_lookup_batch(const autopcb_tables* tables, const char* const* widfs, size_t count,
+                            autopcb_lookup* results);
+
+// Compile a column spec (see column_spec.h; NULL for the default layout of
+// modif) against a PCB header, for the week of the tables and a horizon of
+// weeks (week_count 0 for none; a horizon needs tables with all_weeks)
+autopcb_plan* autopcb_plan_compile(const autopcb_tables* tables, const char* spec, const char* const* header,
+                                   int header_count, const int* weeks, int week_count,
+                                   char* error, size_t error_size);
+int autopcb_plan_columns(const autopcb_plan* plan);
+const char* autopcb_plan_column_name(const autopcb_plan* plan, int column);
+void autopcb_plan_free(autopcb_plan* plan);
+
+autopcb_evaluator* autopcb_evaluator_new(const autopcb_plan* plan);
+// Evaluate rows laid out as the header of the plan: row r is the
+// header_count cells at cells[r * header_count], NULL for an empty cell.
+// out receives rows * autopcb_plan_columns(plan) cells, row by row.
+void autopcb_evaluate(autopcb_evaluator* evaluator, const char* const* cells, size_t rows, autopcb_cell* out);
+void autopcb_evaluator_free(autopcb_evaluator* evaluator);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef BATCH_QUEUE_H
+#define BATCH_QUEUE_H
+
+#include <pthread.h>
+
+/*
+ * Bounded blocking FIFO used to hand row batches from one pipeline stage to
+ * the next. push blocks while the queue is full, pop blocks while it is
+ * empty and returns NULL once the producer closed the queue and every item
+ * has been taken.
+ */
+
+typedef struct {
+    void** items;
+    int capacity;
+    int head;
+    int count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} batch_queue;
+
+int batch_queue_init(batch_queue* queue, int capacity);
+void batch_queue_push(batch_queue* queue, void* item);
+void* batch_queue_pop(batch_queue* queue);
+void batch_queue_close(batch_queue* queue);
+void batch_queue_destroy(batch_queue* queue);
+
+#endif
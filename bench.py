@@ -0,0 +1,156 @@
+"""Benchmark modif on synthetic data of increasing size.
+
+For every size the data is generated once with generate_bench_data.py into
+bench/<rows>/ (input/*.xlsx plus bench.db) and modif is run in that directory:
+
+- xlsx-cold: --reload, the ABC/FB snapshots are rebuilt
+- xlsx-warm: the snapshots of the cold run are mapped
+- db:        --db bench.db
+
+Each run writes --stats-json; one JSON object per run is printed and appended
+to bench/results.jsonl with rows/sec, the phase times and the peak RSS.
+
+--readers compares the sheet readers instead: every input sheet is scanned
+with --scan-sheet through xlsxio and through --fast-reader at each
+--reader-threads count. The cell digests must be identical (the script exits
+with status 1 otherwise); the cells/s of each run show the parse throughput
+scaling with the threads.
+"""
+
+import argparse
+import json
+import re
+import subprocess
+import sys
+import time
+from pathlib import Path
+
+BENCH_DIR = Path("bench")
+MODES = {
+    "xlsx-cold": ["--reload"],
+    "xlsx-warm": [],
+    "db": ["--db", "bench.db"],
+}
+
+
+def git_revision() -> str:
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], capture_output=True,
+                              text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def generate(rows: int, args) -> Path:
+    work = BENCH_DIR / str(rows)
+    params = {"rows": rows, "hit_rate": args.hit_rate, "dup_rate": args.dup_rate, "seed": args.seed}
+    meta = work / "params.json"
+    if meta.exists() and json.loads(meta.read_text()) == params and (work / "bench.db").exists():
+        return work
+    print(f"Generating {rows} rows into {work}...", file=sys.stderr)
+    subprocess.run([sys.executable, "generate_bench_data.py", "--rows", str(rows), "--out", str(work),
+                    "--db", str(work / "bench.db"), "--hit-rate", str(args.hit_rate),
+                    "--dup-rate", str(args.dup_rate), "--seed", str(args.seed)],
+                   check=True, stdout=subprocess.DEVNULL)
+    meta.write_text(json.dumps(params))
+    return work
+
+
+def run_modif(work: Path, rows: int, mode: str, extra, modif: Path, revision: str) -> dict:
+    stats_path = work / f"stats-{mode}.json"
+    started = time.monotonic()
+    # The per-row traces go to /dev/null, they would dominate the timings otherwise
+    subprocess.run([str(modif), *MODES[mode], *extra, "--stats-json", stats_path.name],
+                   cwd=work, check=True, stdout=subprocess.DEVNULL)
+    wall = time.monotonic() - started
+    stats = json.loads(stats_path.read_text())
+    return {
+        "revision": revision,
+        "size": rows,
+        "mode": mode,
+        "rows": stats["rows"],
+        "wall_seconds": round(wall, 6),
+        "total_seconds": stats["total_seconds"],
+        "rows_per_sec": round(stats["rows"] / stats["total_seconds"]) if stats["total_seconds"] else None,
+        "phases": stats["phases"],
+        "peak_rss_kb": stats["peak_rss_kb"],
+        "output_bytes": stats.get("output_bytes"),
+        "streaming": stats.get("streaming"),
+        "lookups": stats["lookups"],
+    }
+
+
+SCAN_LINE = re.compile(r"(\d+) rows, (\d+) cells, digest ([0-9a-f]+), ([0-9.]+) s")
+
+
+def scan_sheet(work: Path, sheet: str, modif: Path, threads: int) -> dict:
+    # threads 0 reads through xlsxio
+    reader = ["--reader-threads", str(threads)] if threads else []
+    out = subprocess.run([str(modif), *reader, "--scan-sheet", sheet], cwd=work, check=True,
+                         capture_output=True, text=True).stdout
+    rows, cells, digest, seconds = SCAN_LINE.search(out).groups()
+    return {"rows": int(rows), "cells": int(cells), "digest": digest, "seconds": float(seconds)}
+
+
+def compare_readers(work: Path, rows: int, threads, modif: Path, revision: str, log) -> bool:
+    same = True
+    for sheet in ("input/PCB.xlsx", "input/ABC.xlsx", "input/FB.xlsx"):
+        reference = scan_sheet(work, sheet, modif, 0)
+        for count in [0, *threads]:
+            scan = reference if count == 0 else scan_sheet(work, sheet, modif, count)
+            result = {
+                "revision": revision,
+                "size": rows,
+                "mode": "readers",
+                "sheet": sheet,
+                "reader": f"fast/{count}" if count else "xlsxio",
+                "cells": scan["cells"],
+                "seconds": scan["seconds"],
+                "cells_per_sec": round(scan["cells"] / scan["seconds"]) if scan["seconds"] else None,
+                "identical": scan["digest"] == reference["digest"] and scan["rows"] == reference["rows"],
+            }
+            same = same and result["identical"]
+            line = json.dumps(result)
+            print(line)
+            log.write(line + "\n")
+            log.flush()
+    return same
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--sizes", type=int, nargs="+", default=[1000, 10000, 100000])
+    parser.add_argument("--modes", nargs="+", choices=sorted(MODES), default=list(MODES))
+    parser.add_argument("--hit-rate", type=float, default=0.99)
+    parser.add_argument("--dup-rate", type=float, default=0.01)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--modif", type=Path, default=Path("modif"))
+    parser.add_argument("--modif-args", default="", help="extra arguments for every modif run")
+    parser.add_argument("--readers", action="store_true", help="compare xlsxio with the fast reader")
+    parser.add_argument("--reader-threads", type=int, nargs="+", default=[1, 2, 4, 8])
+    args = parser.parse_args()
+
+    modif = args.modif.resolve()
+    revision = git_revision()
+    results = BENCH_DIR / "results.jsonl"
+    BENCH_DIR.mkdir(exist_ok=True)
+    identical = True
+    with results.open("a") as log:
+        for rows in args.sizes:
+            work = generate(rows, args)
+            if args.readers:
+                identical = compare_readers(work, rows, args.reader_threads, modif, revision, log) and identical
+                continue
+            for mode in args.modes:
+                result = run_modif(work, rows, mode, args.modif_args.split(), modif, revision)
+                line = json.dumps(result)
+                print(line)
+                log.write(line + "\n")
+                log.flush()
+    if not identical:
+        print("The fast reader and xlsxio read different cells", file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
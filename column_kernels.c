@@ -0,0 +1,180 @@
+#include <math.h>
+#include <string.h>
+#include "column_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLUMN_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+// Written by main before the evaluation threads start, only read after
+static kernel_set kernels = KERNELS_SCALAR;
+
+static const char* kernel_names[] = { "scalar", "sse2", "avx2" };
+
+static int kernels_supported(kernel_set set) {
+#ifdef COLUMN_KERNELS_X86
+    __builtin_cpu_init();
+    if (set == KERNELS_AVX2) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (set == KERNELS_SSE2) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return set == KERNELS_SCALAR;
+}
+
+int column_kernels_select(const char* name) {
+    if (!name) {
+        kernels = kernels_supported(KERNELS_AVX2) ? KERNELS_AVX2
+                : kernels_supported(KERNELS_SSE2) ? KERNELS_SSE2 : KERNELS_SCALAR;
+        return 1;
+    }
+    for (int set = KERNELS_SCALAR; set <= KERNELS_AVX2; set++) {
+        if (strcmp(name, kernel_names[set]) == 0 && kernels_supported((kernel_set)set)) {
+            kernels = (kernel_set)set;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char* column_kernels_name(void) {
+    return kernel_names[kernels];
+}
+
+///////////////////////// plain C /////////////////////////
+
+// One element of each kernel; the vector versions use these for the tail
+static inline double scalar_div(double x, double y) {
+    return y == 0.0 ? NAN : x / y;
+}
+
+static inline double scalar_max(double x, double y) {
+    return isnan(x) ? y : (isnan(y) || x >= y) ? x : y;
+}
+
+static inline double scalar_min(double x, double y) {
+    return isnan(x) ? y : (isnan(y) || x <= y) ? x : y;
+}
+
+static inline double scalar_coalesce(double x, double y) {
+    return isnan(x) ? y : x;
+}
+
+// Elements from on; tail expressions index with i
+#define SCALAR_LOOP(from, expression) \
+    for (size_t i = (from); i < n; i++) { a[i] = (expression); }
+
+///////////////////////// SSE2 and AVX2 /////////////////////////
+
+#ifdef COLUMN_KERNELS_X86
+
+// x where mask is set, else y
+__attribute__((target("sse2")))
+static inline __m128d select_sse2(__m128d mask, __m128d x, __m128d y) {
+    return _mm_or_pd(_mm_and_pd(mask, x), _mm_andnot_pd(mask, y));
+}
+
+#define SSE2_KERNEL(name, body, tail) \
+    __attribute__((target("sse2"))) \
+    static void name##_sse2(double* a, const double* b, size_t n) { \
+        size_t v = 0; \
+        for (; v + 2 <= n; v += 2) { \
+            __m128d x = _mm_loadu_pd(a + v); \
+            __m128d y = _mm_loadu_pd(b + v); \
+            _mm_storeu_pd(a + v, (body)); \
+        } \
+        SCALAR_LOOP(v, tail) \
+    }
+
+#define AVX2_KERNEL(name, body, tail) \
+    __attribute__((target("avx2"))) \
+    static void name##_avx2(double* a, const double* b, size_t n) { \
+        size_t v = 0; \
+        for (; v + 4 <= n; v += 4) { \
+            __m256d x = _mm256_loadu_pd(a + v); \
+            __m256d y = _mm256_loadu_pd(b + v); \
+            _mm256_storeu_pd(a + v, (body)); \
+        } \
+        SCALAR_LOOP(v, tail) \
+    }
+
+// NaN propagates through + - * and /, so only the zero divisor is masked
+SSE2_KERNEL(add, _mm_add_pd(x, y), a[i] + b[i])
+SSE2_KERNEL(sub, _mm_sub_pd(x, y), a[i] - b[i])
+SSE2_KERNEL(mul, _mm_mul_pd(x, y), a[i] * b[i])
+SSE2_KERNEL(div, select_sse2(_mm_cmpeq_pd(y, _mm_setzero_pd()), _mm_set1_pd(NAN), _mm_div_pd(x, y)),
+            scalar_div(a[i], b[i]))
+// x wins when it is not smaller (ordered, so false on a null), or when y is null
+SSE2_KERNEL(max, select_sse2(_mm_or_pd(_mm_cmpge_pd(x, y), _mm_cmpunord_pd(y, y)), x, y),
+            scalar_max(a[i], b[i]))
+SSE2_KERNEL(min, select_sse2(_mm_or_pd(_mm_cmple_pd(x, y), _mm_cmpunord_pd(y, y)), x, y),
+            scalar_min(a[i], b[i]))
+SSE2_KERNEL(coalesce, select_sse2(_mm_cmpunord_pd(x, x), y, x), scalar_coalesce(a[i], b[i]))
+
+AVX2_KERNEL(add, _mm256_add_pd(x, y), a[i] + b[i])
+AVX2_KERNEL(sub, _mm256_sub_pd(x, y), a[i] - b[i])
+AVX2_KERNEL(mul, _mm256_mul_pd(x, y), a[i] * b[i])
+AVX2_KERNEL(div, _mm256_blendv_pd(_mm256_div_pd(x, y), _mm256_set1_pd(NAN),
+                                  _mm256_cmp_pd(y, _mm256_setzero_pd(), _CMP_EQ_OQ)),
+            scalar_div(a[i], b[i]))
+AVX2_KERNEL(max, _mm256_blendv_pd(y, x, _mm256_or_pd(_mm256_cmp_pd(x, y, _CMP_GE_OQ), _mm256_cmp_pd(y, y, _CMP_UNORD_Q))),
+            scalar_max(a[i], b[i]))
+AVX2_KERNEL(min, _mm256_blendv_pd(y, x, _mm256_or_pd(_mm256_cmp_pd(x, y, _CMP_LE_OQ), _mm256_cmp_pd(y, y, _CMP_UNORD_Q))),
+            scalar_min(a[i], b[i]))
+AVX2_KERNEL(coalesce, _mm256_blendv_pd(x, y, _mm256_cmp_pd(x, x, _CMP_UNORD_Q)), scalar_coalesce(a[i], b[i]))
+
+#define DISPATCH(name, tail) \
+    if (kernels == KERNELS_AVX2) { \
+        name##_avx2(a, b, n); \
+    } else if (kernels == KERNELS_SSE2) { \
+        name##_sse2(a, b, n); \
+    } else { \
+        SCALAR_LOOP(0, tail) \
+    }
+
+#else
+
+#define DISPATCH(name, tail) SCALAR_LOOP(0, tail)
+
+#endif
+
+///////////////////////// kernels /////////////////////////
+
+void column_kernel_fill(double* a, double value, size_t n) {
+    SCALAR_LOOP(0, value)
+}
+
+void column_kernel_neg(double* a, size_t n) {
+    SCALAR_LOOP(0, -a[i])
+}
+
+void column_kernel_add(double* a, const double* b, size_t n) {
+    DISPATCH(add, a[i] + b[i])
+}
+
+void column_kernel_sub(double* a, const double* b, size_t n) {
+    DISPATCH(sub, a[i] - b[i])
+}
+
+void column_kernel_mul(double* a, const double* b, size_t n) {
+    DISPATCH(mul, a[i] * b[i])
+}
+
+void column_kernel_div(double* a, const double* b, size_t n) {
+    DISPATCH(div, scalar_div(a[i], b[i]))
+}
+
+void column_kernel_max(double* a, const double* b, size_t n) {
+    DISPATCH(max, scalar_max(a[i], b[i]))
+}
+
+void column_kernel_min(double* a, const double* b, size_t n) {
+    DISPATCH(min, scalar_min(a[i], b[i]))
+}
+
+void column_kernel_coalesce(double* a, const double* b, size_t n) {
+    DISPATCH(coalesce, scalar_coalesce(a[i], b[i]))
+}
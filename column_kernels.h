@@ -0,0 +1,42 @@
+#ifndef COLUMN_KERNELS_H
+#define COLUMN_KERNELS_H
+
+#include <stddef.h>
+
+/*
+ * Vector kernels of the columnar row evaluation. A column vector holds one
+ * double per row of a batch, NaN for a null cell as in fb_matrix. Every
+ * kernel computes a op= b element-wise with the null rules of the column
+ * specs (see column_spec.h):
+ *
+ *   add, sub, mul, div   null if either side is null, div also on a zero divisor
+ *   max, min             skip a null side; a wins ties
+ *   coalesce             a unless it is null, then b
+ *
+ * Each kernel exists as AVX2, SSE2 and plain C, chosen once at startup
+ * with column_kernels_select (plain C until then). All give the same values.
+ */
+
+typedef enum {
+    KERNELS_SCALAR,
+    KERNELS_SSE2,
+    KERNELS_AVX2
+} kernel_set;
+
+// Use a kernel set by name ("avx2", "sse2", "scalar"), or the best one the
+// CPU supports for NULL. Call before any thread evaluates rows. Returns 0
+// for an unknown name or a set the CPU lacks.
+int column_kernels_select(const char* name);
+const char* column_kernels_name(void);
+
+void column_kernel_fill(double* a, double value, size_t n);
+void column_kernel_neg(double* a, size_t n);
+void column_kernel_add(double* a, const double* b, size_t n);
+void column_kernel_sub(double* a, const double* b, size_t n);
+void column_kernel_mul(double* a, const double* b, size_t n);
+void column_kernel_div(double* a, const double* b, size_t n);
+void column_kernel_max(double* a, const double* b, size_t n);
+void column_kernel_min(double* a, const double* b, size_t n);
+void column_kernel_coalesce(double* a, const double* b, size_t n);
+
+#endif
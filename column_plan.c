@@ -0,0 +1,531 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "column_kernels.h"
+#include "column_plan.h"
+
+// Without --columns: the columns of the original converter
+const char* const default_column_spec =
+    "WSTB = WSTB\n"
+    "WIDF = WIDF\n"
+    "WFOR = WFOR\n"
+    "WGES = WGES\n"
+    "WPIV = WPIV\n"
+    "WDES = WDES\n"
+    "WCOF = WCOF\n"
+    "WLOM = abc\n"
+    "WCMJ = number(WCMJ)\n"
+    "WSTKG = number(WSTKG)\n"
+    "FB = fb\n"
+    "MAX = max(fb, WCMJ)\n"
+    "Inventaire =\n"
+    "couv = WSTKG / MAX\n";
+
+// With a --weeks horizon FB, MAX and couv move to the end, once per week
+const char* const default_horizon_column_spec =
+    "WSTB = WSTB\n"
+    "WIDF = WIDF\n"
+    "WFOR = WFOR\n"
+    "WGES = WGES\n"
+    "WPIV = WPIV\n"
+    "WDES = WDES\n"
+    "WCOF = WCOF\n"
+    "WLOM = abc\n"
+    "WCMJ = number(WCMJ)\n"
+    "WSTKG = number(WSTKG)\n"
+    "Inventaire =\n"
+    "FB_{week} = fb\n"
+    "MAX_{week} = max(fb, WCMJ)\n"
+    "couv_{week} = WSTKG / MAX_{week}\n";
+
+// Messages of the plan compiler, on stdout unless the plan is quiet
+static void plan_note(const column_plan* plan, const char* format, ...) {
+    va_list args;
+    if (plan->quiet) {
+        return;
+    }
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+///////////////////////// compiling a spec /////////////////////////
+
+int find_column_index(const char* name, const char** header, int header_count) {
+    for (int i = 0; i < header_count; i++) {
+        if (strcmp(name, header[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// Input reading a PCB column, added on first use; -1 for a missing column
+static int plan_input(column_plan* plan, int column) {
+    if (column < 0) {
+        return -1;
+    }
+    for (int i = 0; i < plan->input_count; i++) {
+        if (plan->inputs[i] == column) {
+            return i;
+        }
+    }
+    if (plan->input_count == MAX_OUTPUT_COLS) {
+        plan_note(plan, "Warning: more than %d PCB columns read, column %d is left empty\n", MAX_OUTPUT_COLS, column);
+        return -1;
+    }
+    plan->inputs[plan->input_count] = column;
+    return plan->input_count++;
+}
+
+// Input of a PCB column an expression reads as a number
+static int plan_numeric_input(column_plan* plan, int column) {
+    int input = plan_input(plan, column);
+    if (input < 0) {
+        return -1;
+    }
+    for (int i = 0; i < plan->numeric_count; i++) {
+        if (plan->numeric_inputs[i] == input) {
+            return input;
+        }
+    }
+    plan->numeric_inputs[plan->numeric_count++] = input;
+    return input;
+}
+
+static column_step* add_step(column_plan* plan, column_kind kind, const char* name, int slot) {
+    column_step* step = &plan->steps[plan->count++];
+    step->kind = kind;
+    step->source = -1;
+    step->slot = slot;
+    step->numeric = 0;
+    step->code = 0;
+    step->length = 0;
+    snprintf(step->name, sizeof(step->name), "%s", name);
+    return step;
+}
+
+// Latest column of that name with a value an expression can read (a lookup,
+// an expression or a number() column); -1 if there is none
+static int find_computed_step(const column_plan* plan, const char* name) {
+    for (int i = plan->count - 1; i >= 0; i--) {
+        const column_step* step = &plan->steps[i];
+        if (strcmp(step->name, name) == 0 && step->kind != COLUMN_EMPTY
+            && (step->kind != COLUMN_SOURCE || step->numeric)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// FB slot of the fb of a column: its horizon week, or for a column that is
+// not per week the current week, added to the slots on first use. -1 without
+// a horizon, where fb comes from the FB table of the current week.
+static int plan_fb_slot(column_plan* plan, int horizon_slot, int week) {
+    if (plan->week_count == 0) {
+        return -1;
+    }
+    if (horizon_slot >= 0) {
+        return horizon_slot;
+    }
+    for (int w = 0; w < plan->week_count; w++) {
+        if (plan->weeks[w] == week) {
+            return w;
+        }
+    }
+    plan->weeks[plan->week_count] = week;
+    plan->fb_columns[plan->week_count] = -1;
+    return plan->week_count++;
+}
+
+typedef struct {
+    const char** header;
+    int header_count;
+    int week;           // of the column being added, the current week unless per week
+    int horizon_slot;   // horizon slot of a per-week column, -1 otherwise
+    int current_week;
+} spec_context;
+
+// Copy the code of a spec column into the plan with its names resolved:
+// an earlier computed column, else a PCB column. Returns 0 when the plan
+// has no room left.
+static int resolve_expression(column_plan* plan, const column_spec* spec, const spec_column* column,
+                              const spec_context* context, column_step* step) {
+    if (plan->code_length + column->length > MAX_PLAN_CODE) {
+        return 0;
+    }
+    step->code = plan->code_length;
+    step->length = column->length;
+    for (int i = 0; i < column->length; i++) {
+        expr_instr* instr = &plan->code[plan->code_length++];
+        *instr = column->code[i];
+        if (instr->op == EXPR_ABC) {
+            plan->needs_abc = 1;
+        } else if (instr->op == EXPR_FB) {
+            plan->needs_fb = 1;
+            instr->arg = plan_fb_slot(plan, context->horizon_slot, context->current_week);
+        } else if (instr->op == EXPR_NAME) {
+            char name[COLUMN_SPEC_NAME_SIZE];
+            column_spec_week_name(spec->names[instr->arg], context->week, name, sizeof(name));
+            int computed = find_computed_step(plan, name);
+            if (computed >= 0) {
+                instr->op = EXPR_COLUMN;
+                instr->arg = computed;
+            } else {
+                int index = find_column_index(name, context->header, context->header_count);
+                if (index < 0) {
+                    plan_note(plan, "Warning: column '%s' read by %s is not in PCB, it is empty\n", name, step->name);
+                }
+                instr->op = EXPR_INPUT;
+                instr->arg = plan_numeric_input(plan, index);
+            }
+        }
+    }
+    return 1;
+}
+
+// Add the output column of a spec line, for one week if it is per week
+static void add_spec_column(column_plan* plan, const column_spec* spec, const spec_column* column,
+                            const spec_context* context) {
+    char name[COLUMN_SPEC_NAME_SIZE];
+    const expr_instr* first = &column->code[0];
+    int report = !column->per_week || context->horizon_slot <= 0;
+    column_step* step;
+
+    column_spec_week_name(column->name, context->week, name, sizeof(name));
+    if (plan->count == MAX_OUTPUT_COLS) {
+        plan_note(plan, "Warning: more than %d output columns, '%s' is left out\n", MAX_OUTPUT_COLS, name);
+        return;
+    }
+    if (column->form == SPEC_EMPTY) {
+        add_step(plan, COLUMN_EMPTY, name, -1);
+        return;
+    }
+    if (column->form != SPEC_EXPR && first->op == EXPR_ABC) {
+        add_step(plan, COLUMN_ABC, name, -1);
+        plan->needs_abc = 1;
+    } else if (column->form != SPEC_EXPR && first->op == EXPR_FB) {
+        add_step(plan, COLUMN_FB, name, plan_fb_slot(plan, context->horizon_slot, context->current_week));
+        plan->needs_fb = 1;
+    } else {
+        // A name alone copies the PCB column unless it names a computed column
+        char source[COLUMN_SPEC_NAME_SIZE];
+        if (column->form != SPEC_EXPR && first->op == EXPR_NAME) {
+            column_spec_week_name(spec->names[first->arg], context->week, source, sizeof(source));
+        }
+        if (column->form != SPEC_EXPR && first->op == EXPR_NAME && find_computed_step(plan, source) < 0) {
+            int index = find_column_index(source, context->header, context->header_count);
+            step = add_step(plan, COLUMN_SOURCE, name, -1);
+            step->numeric = column->form == SPEC_TYPED;
+            step->source = step->numeric ? plan_numeric_input(plan, index) : plan_input(plan, index);
+            plan_note(plan, "Column '%s' found at index %d\n", name, index);
+            return;
+        }
+        step = add_step(plan, COLUMN_EXPR, name, -1);
+        if (!resolve_expression(plan, spec, column, context, step)) {
+            plan_note(plan, "Warning: the column spec has more than %d instructions, '%s' is left empty\n",
+                      MAX_PLAN_CODE, name);
+            step->kind = COLUMN_EMPTY;
+            return;
+        }
+        if (report) {
+            plan_note(plan, "Column '%s' computed\n", column->per_week ? column->name : name);
+        }
+        return;
+    }
+    if (report) {
+        plan_note(plan, "Column '%s' computed from lookups\n", column->per_week ? column->name : name);
+    }
+}
+
+// Resolve a column spec against the PCB header. Lines with {week} are
+// repeated for every week of a --weeks horizon, a run of them week by week;
+// without a horizon they are written once, for the current week. A quiet
+// plan prints nothing, neither here nor when its rows are filled.
+void compile_column_plan(column_plan* plan, const column_spec* spec, const char** header, int header_count,
+                         int current_week, const int* weeks, int week_count, int quiet) {
+    int widf_index = find_column_index("WIDF", header, header_count);
+    spec_context context;
+    plan->quiet = quiet;
+    plan->count = 0;
+    plan->code_length = 0;
+    plan->input_count = 0;
+    plan->numeric_count = 0;
+    plan->widf_col = plan_input(plan, widf_index);
+    plan->needs_abc = 0;
+    plan->needs_fb = 0;
+    plan->week_count = week_count;
+    for (int w = 0; w < week_count; w++) {
+        plan->weeks[w] = weeks[w];
+        plan->fb_columns[w] = -1;
+    }
+    context.header = header;
+    context.header_count = header_count;
+    context.current_week = current_week;
+
+    for (int i = 0; i < spec->count;) {
+        int end = i + 1;
+        int copies = 1;
+        if (spec->columns[i].per_week) {
+            while (end < spec->count && spec->columns[end].per_week) {
+                end++;
+            }
+            copies = week_count > 0 ? week_count : 1;
+        }
+        for (int w = 0; w < copies; w++) {
+            int per_week = spec->columns[i].per_week && week_count > 0;
+            context.horizon_slot = per_week ? w : -1;
+            context.week = per_week ? weeks[w] : current_week;
+            for (int c = i; c < end; c++) {
+                add_spec_column(plan, spec, &spec->columns[c], &context);
+            }
+        }
+        i = end;
+    }
+    plan_note(plan, "Lookup key WIDF at index %d\n", widf_index);
+    plan_note(plan, "Reading %d of %d PCB columns\n", plan->input_count, header_count);
+}
+
+// Resolve the FB weeks to FB matrix columns, once the matrix is loaded.
+// A week FB does not have is reported, never replaced by another week.
+void bind_fb_matrix(column_plan* plan, const lookup_set* lookups) {
+    for (int w = 0; w < plan->week_count; w++) {
+        plan->fb_columns[w] = lookups->fb_weeks_loaded ? fb_matrix_column_of_week(&lookups->fb_weeks, plan->weeks[w]) : -1;
+        if (plan->fb_columns[w] < 0) {
+            plan_note(plan, "Warning: week %d not found in FB, its FB values are left empty\n", plan->weeks[w]);
+        }
+    }
+}
+
+///////////////////////// evaluation /////////////////////////
+
+// Output a typed value: the number when there is one, else the text as read
+static void set_typed_cell(output_cell* out, number_cell number, const char* text) {
+    if (!number.null) {
+        out->kind = CELL_NUMBER;
+        out->number = number.value;
+    } else if (text && *text) {
+        out->kind = CELL_TEXT;
+        out->text = text;
+    }
+}
+
+column_vectors* new_column_vectors(const column_plan* plan) {
+    column_vectors* vectors = calloc(1, sizeof(column_vectors));
+    int expressions = 0;
+    for (int i = 0; i < plan->count; i++) {
+        expressions += plan->steps[i].kind == COLUMN_EXPR;
+    }
+    // Inputs, abc, fb, weeks, expressions, the null vector and the stack
+    size_t count = (size_t)plan->numeric_count + 2 + plan->week_count + expressions + 1 + COLUMN_EXPR_STACK;
+    if (!vectors || !(vectors->storage = malloc(count * COLUMN_VECTOR_ROWS * sizeof(double)))) {
+        free(vectors);
+        return NULL;
+    }
+    double* next = vectors->storage;
+#define NEXT_VECTOR() (next += COLUMN_VECTOR_ROWS, next - COLUMN_VECTOR_ROWS)
+    for (int i = 0; i < plan->numeric_count; i++) {
+        vectors->inputs[plan->numeric_inputs[i]] = NEXT_VECTOR();
+    }
+    vectors->abc = NEXT_VECTOR();
+    vectors->fb = NEXT_VECTOR();
+    for (int w = 0; w < plan->week_count; w++) {
+        vectors->fb_weeks[w] = NEXT_VECTOR();
+    }
+    // Missing PCB columns all read this one
+    double* nulls = NEXT_VECTOR();
+    column_kernel_fill(nulls, NAN, COLUMN_VECTOR_ROWS);
+    for (int i = 0; i < plan->count; i++) {
+        const column_step* step = &plan->steps[i];
+        switch (step->kind) {
+            case COLUMN_ABC:
+                vectors->columns[i] = vectors->abc;
+                break;
+            case COLUMN_FB:
+                vectors->columns[i] = step->slot >= 0 ? vectors->fb_weeks[step->slot] : vectors->fb;
+                break;
+            case COLUMN_EXPR:
+                vectors->columns[i] = NEXT_VECTOR();
+                break;
+            case COLUMN_SOURCE:
+                if (step->numeric) {
+                    vectors->columns[i] = step->source >= 0 ? vectors->inputs[step->source] : nulls;
+                }
+                break;
+            case COLUMN_EMPTY:
+                break;
+        }
+    }
+    vectors->stack = next;
+#undef NEXT_VECTOR
+    return vectors;
+}
+
+void free_column_vectors(column_vectors* vectors) {
+    if (vectors) {
+        free(vectors->storage);
+        free(vectors);
+    }
+}
+
+number_cell vector_cell(double value) {
+    number_cell cell;
+    cell.value = value;
+    cell.null = isnan(value);
+    return cell;
+}
+
+// Gather the lookups and numeric inputs of every row into the column
+// vectors, then run the expressions over them
+void gather_columns(const column_plan* plan, column_vectors* vectors, const lookup_set* lookups, char** cells,
+                    int width, int rows, int db_mode, stats_lookup* abc_counts, stats_lookup* fb_counts) {
+#define ROW_CELL(index) ((index) >= 0 && (index) < width - 2 ? row_values[(index)] : NULL)
+
+    for (int r = 0; r < rows; r++) {
+        char** row_values = cells + (size_t)r * width;
+
+        // The WIDF is hashed once into a key id; ABC, FB and the week matrix
+        // are then read by id. In --db mode SQLite already joined ABC and FB
+        // into the row. Numeric inputs are parsed once here, lookup values
+        // at load time.
+        const char* widf_value = ROW_CELL(plan->widf_col);
+        uint32_t key = find_key(lookups, widf_value);
+        for (int i = 0; i < plan->numeric_count; i++) {
+            int input = plan->numeric_inputs[i];
+            number_cell number = number_cell_parse(ROW_CELL(input));
+            vectors->inputs[input][r] = number.null ? NAN : number.value;
+        }
+        const char* wlom_value = NULL;
+        const char* fb_value = NULL;
+        number_cell wlom = number_cell_null();
+        number_cell fb = number_cell_null();
+        if (widf_value && plan->needs_abc) {
+            if (db_mode) {
+                wlom_value = row_values[width - 2];
+                wlom = number_cell_parse(wlom_value);
+            } else {
+                wlom_value = get_wlom_value_by_key(lookups, key, &wlom);
+            }
+            if (wlom_value) {
+                abc_counts->hits++;
+            } else {
+                abc_counts->misses++;
+            }
+        }
+        vectors->abc[r] = wlom.null ? NAN : wlom.value;
+        vectors->abc_text[r] = wlom_value;
+
+        // With a horizon, one matrix probe serves every week
+        if (plan->week_count > 0) {
+            int64_t matrix_row = key != KEY_DICT_NONE && lookups->fb_row_by_key && lookups->fb_row_by_key[key] != KEY_DICT_NONE
+                               ? (int64_t)lookups->fb_row_by_key[key] : -1;
+            if (widf_value) {
+                if (matrix_row >= 0) {
+                    fb_counts->hits++;
+                } else {
+                    fb_counts->misses++;
+                }
+            }
+            for (int w = 0; w < plan->week_count; w++) {
+                vectors->fb_weeks[w][r] = matrix_row >= 0 && plan->fb_columns[w] >= 0
+                                        ? fb_matrix_get(&lookups->fb_weeks, (uint32_t)matrix_row, plan->fb_columns[w]) : NAN;
+            }
+        } else if (widf_value && plan->needs_fb) {
+            if (db_mode) {
+                fb_value = row_values[width - 1];
+                fb = number_cell_parse(fb_value);
+            } else {
+                fb_value = get_fb_value_by_key(lookups, key, &fb);
+            }
+            if (fb_value) {
+                fb_counts->hits++;
+            } else {
+                fb_counts->misses++;
+            }
+        }
+        vectors->fb[r] = fb.null ? NAN : fb.value;
+        vectors->fb_text[r] = fb_value;
+    }
+}
+
+void evaluate_expressions(const column_plan* plan, column_vectors* vectors, int rows) {
+    // Every expression over the whole batch, in column order so that each
+    // reads the columns before it
+    expr_vectors env;
+    env.inputs = vectors->inputs;
+    env.columns = vectors->columns;
+    env.abc = vectors->abc;
+    env.fb = vectors->fb;
+    env.fb_weeks = vectors->fb_weeks;
+    for (int i = 0; i < plan->count; i++) {
+        const column_step* step = &plan->steps[i];
+        if (step->kind == COLUMN_EXPR) {
+            column_expr_eval_batch(plan->code + step->code, step->length, &env, (size_t)rows, vectors->stack,
+                                   vectors->columns[i]);
+        }
+    }
+}
+
+void evaluate_columns(const column_plan* plan, column_vectors* vectors, const lookup_set* lookups, char** cells,
+                      int width, int rows, int db_mode, stats_lookup* abc_counts, stats_lookup* fb_counts) {
+    gather_columns(plan, vectors, lookups, cells, width, rows, db_mode, abc_counts, fb_counts);
+    evaluate_expressions(plan, vectors, rows);
+}
+
+void fill_output_row(const column_plan* plan, const column_vectors* vectors, int r, char** row_values, int width,
+                     output_cell* out) {
+    const char* widf_value = ROW_CELL(plan->widf_col);
+    const char* wlom_value = vectors->abc_text[r];
+    const char* fb_value = vectors->fb_text[r];
+
+    for (int i = 0; i < plan->count; i++) {
+        const column_step* step = &plan->steps[i];
+        out[i].kind = CELL_EMPTY;
+        switch (step->kind) {
+            case COLUMN_ABC:
+                if (!widf_value) {
+                    break;
+                }
+                if (wlom_value) {
+                    set_typed_cell(&out[i], vector_cell(vectors->abc[r]), wlom_value);
+                    plan_note(plan, "Found %s value for WIDF %s: %s\n", step->name, widf_value, wlom_value);
+                } else {
+                    plan_note(plan, "No %s value found for WIDF: %s\n", step->name, widf_value);
+                }
+                break;
+            case COLUMN_FB:
+                if (step->slot >= 0) {
+                    set_typed_cell(&out[i], vector_cell(vectors->fb_weeks[step->slot][r]), NULL);
+                    break;
+                }
+                if (!widf_value) {
+                    break;
+                }
+                if (fb_value) {
+                    set_typed_cell(&out[i], vector_cell(vectors->fb[r]), fb_value);
+                    plan_note(plan, "Found %s value for WIDF %s: %s\n", step->name, widf_value, fb_value);
+                } else {
+                    plan_note(plan, "No %s value found for WIDF: %s\n", step->name, widf_value);
+                }
+                break;
+            case COLUMN_EXPR:
+                set_typed_cell(&out[i], vector_cell(vectors->columns[i][r]), NULL);
+                break;
+            case COLUMN_SOURCE: {
+                const char* text = ROW_CELL(step->source);
+                if (step->numeric) {
+                    set_typed_cell(&out[i], vector_cell(vectors->columns[i][r]), text);
+                } else if (text) {
+                    out[i].kind = CELL_TEXT;
+                    out[i].text = text;
+                }
+                break;
+            }
+            case COLUMN_EMPTY:
+                break;
+        }
+    }
+}
+
+#undef ROW_CELL
@@ -0,0 +1,117 @@
+#ifndef COLUMN_PLAN_H
+#define COLUMN_PLAN_H
+
+#include "column_spec.h"
+#include "lookup_set.h"
+#include "output_sink.h"
+#include "run_stats.h"
+
+/*
+ * Execution plan compiled once from a column spec and the PCB header, and
+ * the column vectors rows are evaluated through. A plan is only read once
+ * compiled and bound to its lookups, so threads share it; each evaluating
+ * thread has column vectors of its own.
+ */
+
+// Longest --weeks horizon: one full ISO year
+#define MAX_HORIZON_WEEKS 53
+// Columns of an expanded spec; the default horizon layout takes 11 + 3 per week
+#define MAX_OUTPUT_COLS 192
+// Expression instructions of an expanded spec
+#define MAX_PLAN_CODE 2048
+// Rows one set of column vectors holds
+#define COLUMN_VECTOR_ROWS 1024
+
+// The output layouts without --columns, with and without a --weeks horizon
+extern const char* const default_column_spec;
+extern const char* const default_horizon_column_spec;
+
+// How an output column gets its value
+typedef enum {
+    COLUMN_SOURCE,  // copied from a PCB column
+    COLUMN_ABC,     // ABC lookup on WIDF
+    COLUMN_FB,      // FB lookup on WIDF
+    COLUMN_EXPR,    // computed by an expression of the spec
+    COLUMN_EMPTY    // left empty, e.g. Inventaire, filled in by hand
+} column_kind;
+
+typedef struct {
+    column_kind kind;
+    int source;     // plan input for COLUMN_SOURCE, -1 when missing
+    int slot;       // horizon slot of COLUMN_FB in --weeks mode, -1 otherwise
+    int numeric;    // COLUMN_SOURCE written as a number when it parses as one
+    int code;       // COLUMN_EXPR: first instruction in the plan's code
+    int length;
+    char name[COLUMN_SPEC_NAME_SIZE];  // output header
+} column_step;
+
+// Every output column is resolved to a PCB index, a lookup or a stretch of
+// expression code whose names are resolved too, so the row loop only
+// indexes. Only the PCB columns listed in inputs are read; the row loop sees
+// them as input 0, 1, ... in that order.
+typedef struct {
+    column_step steps[MAX_OUTPUT_COLS];
+    int count;
+    expr_instr code[MAX_PLAN_CODE];     // of every COLUMN_EXPR, back to back
+    int code_length;
+    int inputs[MAX_OUTPUT_COLS]; // PCB column of each input
+    int input_count;
+    int numeric_inputs[MAX_OUTPUT_COLS]; // inputs read as numbers, parsed once per row
+    int numeric_count;
+    int widf_col;   // input holding the lookup key for ABC and FB
+    int needs_abc;  // some column reads abc
+    int needs_fb;   // some column reads fb
+    // --weeks: FB slots, one per horizon week plus the current week when a
+    // column that is not per week reads fb; 0 without a horizon
+    int week_count;
+    int weeks[MAX_HORIZON_WEEKS + 1];
+    int fb_columns[MAX_HORIZON_WEEKS + 1]; // fb_matrix column of each week, -1 if FB lacks it
+    int quiet;      // no messages, nor a trace of every lookup of the rows filled
+} column_plan;
+
+// Column vectors a batch is evaluated through, one double per row and NaN
+// for null: the numeric inputs, the lookup values and every computed column.
+// Expressions then run column by column over the whole batch with the
+// kernels of column_kernels.c instead of row by row. One set serves one
+// evaluating thread; it is sized for the plan it was made for.
+typedef struct {
+    double* storage;
+    double* inputs[MAX_OUTPUT_COLS];    // numeric inputs of the plan, NULL for the others
+    double* abc;
+    double* fb;                         // current week, without a horizon
+    double* fb_weeks[MAX_HORIZON_WEEKS + 1];
+    double* columns[MAX_OUTPUT_COLS];   // value of each output column an expression can read
+    double* stack;                      // COLUMN_EXPR_STACK vectors
+    const char* abc_text[COLUMN_VECTOR_ROWS];   // lookup values as read, for the output
+    const char* fb_text[COLUMN_VECTOR_ROWS];
+} column_vectors;
+
+int find_column_index(const char* name, const char** header, int header_count);
+// Resolve a column spec against the PCB header for the current week and a
+// --weeks horizon (week_count 0 for none)
+void compile_column_plan(column_plan* plan, const column_spec* spec, const char** header, int header_count,
+                         int current_week, const int* weeks, int week_count, int quiet);
+// Resolve the FB weeks to FB matrix columns, once the matrix is loaded
+void bind_fb_matrix(column_plan* plan, const lookup_set* lookups);
+
+column_vectors* new_column_vectors(const column_plan* plan);
+void free_column_vectors(column_vectors* vectors);
+number_cell vector_cell(double value);
+
+// Gather the lookups and numeric inputs of up to COLUMN_VECTOR_ROWS rows
+// into the vectors, counting the lookups. Row r is the width cells at
+// cells[r * width]: the plan inputs, NULL when empty, then two cells with
+// the ABC and FB values SQLite joined, only read in db_mode.
+void gather_columns(const column_plan* plan, column_vectors* vectors, const lookup_set* lookups, char** cells,
+                    int width, int rows, int db_mode, stats_lookup* abc_counts, stats_lookup* fb_counts);
+// Run every expression over the gathered rows
+void evaluate_expressions(const column_plan* plan, column_vectors* vectors, int rows);
+// Both of the above
+void evaluate_columns(const column_plan* plan, column_vectors* vectors, const lookup_set* lookups, char** cells,
+                      int width, int rows, int db_mode, stats_lookup* abc_counts, stats_lookup* fb_counts);
+// Fill the output cells of row r from its cells and the evaluated vectors;
+// texts point into the row and the lookup tables
+void fill_output_row(const column_plan* plan, const column_vectors* vectors, int r, char** row_values, int width,
+                     output_cell* out);
+
+#endif
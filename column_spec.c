@@ -0,0 +1,477 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "column_kernels.h"
+#include "column_spec.h"
+
+#define WEEK_PLACEHOLDER "{week}"
+
+typedef struct {
+    column_spec* spec;
+    spec_column* column;
+    const char* at;         // next character of the line
+    const char* source;
+    int line;
+    int depth;              // values on the stack after the code so far
+    int max_depth;
+    int failed;
+} spec_parser;
+
+static void parse_error(spec_parser* parser, const char* message, const char* detail) {
+    if (!parser->failed) {
+        fprintf(stderr, "%s:%d: %s%s%s\n", parser->source, parser->line, message,
+                detail ? " " : "", detail ? detail : "");
+    }
+    parser->failed = 1;
+}
+
+static void skip_spaces(spec_parser* parser) {
+    while (*parser->at == ' ' || *parser->at == '\t' || *parser->at == '\r') {
+        parser->at++;
+    }
+}
+
+static void expect(spec_parser* parser, char c, const char* message) {
+    skip_spaces(parser);
+    if (*parser->at == c) {
+        parser->at++;
+    } else {
+        parse_error(parser, message, NULL);
+    }
+}
+
+// Letters, digits, _, bytes of UTF-8 sequences and {week}
+static int name_char(const char* at) {
+    unsigned char c = (unsigned char)*at;
+    return isalnum(c) || c == '_' || c >= 0x80 || strncmp(at, WEEK_PLACEHOLDER, strlen(WEEK_PLACEHOLDER)) == 0;
+}
+
+// A bare or "quoted" name into out: 1 for a bare one, 2 for a quoted one,
+// 0 if there is none
+static int parse_name(spec_parser* parser, char* out) {
+    size_t n = 0;
+    skip_spaces(parser);
+    if (*parser->at == '"') {
+        const char* end = strchr(parser->at + 1, '"');
+        if (!end) {
+            parse_error(parser, "unterminated quoted name", NULL);
+            return 0;
+        }
+        n = (size_t)(end - parser->at - 1);
+        if (n == 0 || n >= COLUMN_SPEC_NAME_SIZE) {
+            parse_error(parser, "quoted name is empty or too long", NULL);
+            return 0;
+        }
+        memcpy(out, parser->at + 1, n);
+        out[n] = '\0';
+        parser->at = end + 1;
+        return 2;
+    }
+    if (isdigit((unsigned char)*parser->at) || !name_char(parser->at)) {
+        return 0;
+    }
+    while (name_char(parser->at)) {
+        size_t length = *parser->at == '{' ? strlen(WEEK_PLACEHOLDER) : 1;
+        if (n + length >= COLUMN_SPEC_NAME_SIZE) {
+            parse_error(parser, "name too long", NULL);
+            return 0;
+        }
+        memcpy(out + n, parser->at, length);
+        n += length;
+        parser->at += length;
+    }
+    out[n] = '\0';
+    return 1;
+}
+
+static void emit(spec_parser* parser, expr_op op, int arg, double constant, int pushed) {
+    spec_column* column = parser->column;
+    if (column->length == COLUMN_EXPR_MAX_CODE) {
+        parse_error(parser, "expression too long", NULL);
+        return;
+    }
+    column->code[column->length].op = op;
+    column->code[column->length].arg = arg;
+    column->code[column->length].constant = constant;
+    column->length++;
+    parser->depth += pushed;
+    if (parser->depth > parser->max_depth) {
+        parser->max_depth = parser->depth;
+    }
+}
+
+static void emit_name(spec_parser* parser, const char* name) {
+    column_spec* spec = parser->spec;
+    int number;
+    if (strcmp(name, "abc") == 0) {
+        emit(parser, EXPR_ABC, 0, 0.0, 1);
+        return;
+    }
+    if (strcmp(name, "fb") == 0) {
+        emit(parser, EXPR_FB, -1, 0.0, 1);
+        return;
+    }
+    if (strstr(name, WEEK_PLACEHOLDER) && !parser->column->per_week) {
+        parse_error(parser, "{week} in a column that is not per week:", name);
+        return;
+    }
+    for (number = 0; number < spec->name_count; number++) {
+        if (strcmp(spec->names[number], name) == 0) {
+            break;
+        }
+    }
+    if (number == spec->name_count) {
+        if (spec->name_count == COLUMN_SPEC_MAX_NAMES) {
+            parse_error(parser, "too many names", NULL);
+            return;
+        }
+        snprintf(spec->names[spec->name_count++], COLUMN_SPEC_NAME_SIZE, "%s", name);
+    }
+    emit(parser, EXPR_NAME, number, 0.0, 1);
+}
+
+static void parse_sum(spec_parser* parser);
+
+// Arguments of max, min and coalesce up to the closing parenthesis
+static int parse_arguments(spec_parser* parser) {
+    int count = 0;
+    skip_spaces(parser);
+    if (*parser->at == ')') {
+        parser->at++;
+        return 0;
+    }
+    while (!parser->failed) {
+        parse_sum(parser);
+        count++;
+        skip_spaces(parser);
+        if (*parser->at == ',') {
+            parser->at++;
+        } else if (*parser->at == ')') {
+            parser->at++;
+            break;
+        } else {
+            parse_error(parser, "expected , or ) after an argument", NULL);
+        }
+    }
+    return count;
+}
+
+static void parse_call(spec_parser* parser, const char* function) {
+    expr_op op;
+    if (strcmp(function, "number") == 0) {
+        // number(x) is x in an expression; as a whole column it keeps the text
+        char name[COLUMN_SPEC_NAME_SIZE];
+        if (!parse_name(parser, name)) {
+            parse_error(parser, "number() takes a column name", NULL);
+            return;
+        }
+        emit_name(parser, name);
+        expect(parser, ')', "expected ) after the argument of number()");
+        return;
+    }
+    if (strcmp(function, "max") == 0) {
+        op = EXPR_MAX;
+    } else if (strcmp(function, "min") == 0) {
+        op = EXPR_MIN;
+    } else if (strcmp(function, "coalesce") == 0) {
+        op = EXPR_COALESCE;
+    } else {
+        parse_error(parser, "unknown function", function);
+        return;
+    }
+    int count = parse_arguments(parser);
+    if (count == 0 && !parser->failed) {
+        parse_error(parser, "function without arguments:", function);
+        return;
+    }
+    emit(parser, op, count, 0.0, 1 - count);
+}
+
+static void parse_primary(spec_parser* parser) {
+    char name[COLUMN_SPEC_NAME_SIZE];
+    int name_kind;
+    skip_spaces(parser);
+    if (*parser->at == '(') {
+        parser->at++;
+        parse_sum(parser);
+        expect(parser, ')', "expected )");
+    } else if (*parser->at == '-') {
+        parser->at++;
+        parse_primary(parser);
+        emit(parser, EXPR_NEG, 0, 0.0, 0);
+    } else if (isdigit((unsigned char)*parser->at) || *parser->at == '.') {
+        char* end;
+        double value = strtod(parser->at, &end);
+        parser->at = end;
+        emit(parser, EXPR_CONST, 0, value, 1);
+    } else if ((name_kind = parse_name(parser, name)) != 0) {
+        skip_spaces(parser);
+        if (*parser->at == '(' && name_kind == 1) {
+            parser->at++;
+            parse_call(parser, name);
+        } else {
+            emit_name(parser, name);
+        }
+    } else if (!parser->failed) {
+        parse_error(parser, "expected a number, a name or (", NULL);
+    }
+}
+
+static void parse_product(spec_parser* parser) {
+    parse_primary(parser);
+    for (;;) {
+        skip_spaces(parser);
+        char op = *parser->at;
+        if (parser->failed || (op != '*' && op != '/')) {
+            return;
+        }
+        parser->at++;
+        parse_primary(parser);
+        emit(parser, op == '*' ? EXPR_MUL : EXPR_DIV, 0, 0.0, -1);
+    }
+}
+
+static void parse_sum(spec_parser* parser) {
+    parse_product(parser);
+    for (;;) {
+        skip_spaces(parser);
+        char op = *parser->at;
+        if (parser->failed || (op != '+' && op != '-')) {
+            return;
+        }
+        parser->at++;
+        parse_product(parser);
+        emit(parser, op == '+' ? EXPR_ADD : EXPR_SUB, 0, 0.0, -1);
+    }
+}
+
+// Form of a parsed column: a lone name or number(name) keeps the text of
+// the cell, anything else is computed
+static spec_form column_form(const spec_column* column, const char* rhs) {
+    if (column->length == 0) {
+        return SPEC_EMPTY;
+    }
+    if (column->length == 1 && column->code[0].op != EXPR_CONST) {
+        while (*rhs == ' ' || *rhs == '\t') {
+            rhs++;
+        }
+        if (strncmp(rhs, "number", 6) != 0) {
+            return SPEC_NAME;
+        }
+        rhs += 6;
+        while (*rhs == ' ' || *rhs == '\t') {
+            rhs++;
+        }
+        return *rhs == '(' ? SPEC_TYPED : SPEC_NAME;
+    }
+    return SPEC_EXPR;
+}
+
+static void parse_line(spec_parser* parser, const char* line) {
+    column_spec* spec = parser->spec;
+    parser->at = line;
+    skip_spaces(parser);
+    if (*parser->at == '\0' || *parser->at == '#') {
+        return;
+    }
+    if (spec->count == COLUMN_SPEC_MAX_COLUMNS) {
+        parse_error(parser, "too many columns", NULL);
+        return;
+    }
+    spec_column* column = &spec->columns[spec->count];
+    memset(column, 0, sizeof(spec_column));
+    parser->column = column;
+    parser->depth = 0;
+    parser->max_depth = 0;
+    if (!parse_name(parser, column->name)) {
+        parse_error(parser, "expected a column name", NULL);
+        return;
+    }
+    column->per_week = strstr(column->name, WEEK_PLACEHOLDER) != NULL;
+    skip_spaces(parser);
+    if (*parser->at != '=') {
+        parse_error(parser, "expected = after", column->name);
+        return;
+    }
+    parser->at++;
+    const char* rhs = parser->at;
+    skip_spaces(parser);
+    if (*parser->at != '\0' && *parser->at != '#') {
+        parse_sum(parser);
+        skip_spaces(parser);
+        if (!parser->failed && *parser->at != '\0' && *parser->at != '#') {
+            parse_error(parser, "unexpected text:", parser->at);
+        }
+    }
+    if (parser->max_depth > COLUMN_EXPR_STACK) {
+        parse_error(parser, "expression nested too deep", NULL);
+    }
+    if (!parser->failed) {
+        column->form = column_form(column, rhs);
+        spec->count++;
+    }
+}
+
+column_spec* column_spec_parse(const char* text, const char* source) {
+    column_spec* spec = calloc(1, sizeof(column_spec));
+    spec_parser parser;
+    char line[1024];
+
+    if (!spec) {
+        return NULL;
+    }
+    memset(&parser, 0, sizeof(parser));
+    parser.spec = spec;
+    parser.source = source;
+    while (*text && !parser.failed) {
+        size_t length = strcspn(text, "\n");
+        parser.line++;
+        if (length >= sizeof(line)) {
+            parse_error(&parser, "line too long", NULL);
+            break;
+        }
+        memcpy(line, text, length);
+        line[length] = '\0';
+        parse_line(&parser, line);
+        text += length + (text[length] == '\n');
+    }
+    if (!parser.failed && spec->count == 0) {
+        parse_error(&parser, "no columns", NULL);
+    }
+    if (parser.failed) {
+        free(spec);
+        return NULL;
+    }
+    return spec;
+}
+
+column_spec* column_spec_load(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (!text || fread(text, 1, (size_t)size, file) != (size_t)size) {
+        fprintf(stderr, "Error: cannot read %s\n", path);
+        free(text);
+        fclose(file);
+        return NULL;
+    }
+    text[size] = '\0';
+    fclose(file);
+    column_spec* spec = column_spec_parse(text, path);
+    free(text);
+    return spec;
+}
+
+void column_spec_free(column_spec* spec) {
+    free(spec);
+}
+
+void column_spec_size(const column_spec* spec, int weeks, int* columns, int* instructions) {
+    *columns = 0;
+    *instructions = 0;
+    for (int i = 0; i < spec->count; i++) {
+        int copies = spec->columns[i].per_week ? (weeks > 0 ? weeks : 1) : 1;
+        *columns += copies;
+        *instructions += copies * spec->columns[i].length;
+    }
+}
+
+void column_spec_week_name(const char* name, int week, char* out, size_t size) {
+    const char* at = strstr(name, WEEK_PLACEHOLDER);
+    if (!at) {
+        snprintf(out, size, "%s", name);
+        return;
+    }
+    snprintf(out, size, "%.*s%d%s", (int)(at - name), name, week, at + strlen(WEEK_PLACEHOLDER));
+}
+
+// Push a copy of a vector, or nulls for a missing one
+static void push_vector(double* slot, const double* vector, size_t rows) {
+    if (vector) {
+        memcpy(slot, vector, rows * sizeof(double));
+    } else {
+        column_kernel_fill(slot, NAN, rows);
+    }
+}
+
+void column_expr_eval_batch(const expr_instr* code, int length, const expr_vectors* env, size_t rows,
+                            double* stack, double* result) {
+    int top = 0;    // vectors on the stack
+
+#define SLOT(index) (stack + (size_t)(index) * rows)
+
+    for (int i = 0; i < length; i++) {
+        const expr_instr* instr = &code[i];
+        double* a = SLOT(top - 2);
+        const double* b = SLOT(top - 1);
+        switch (instr->op) {
+            case EXPR_NAME:
+                // Resolved before a plan runs; an unresolved name reads as empty
+                push_vector(SLOT(top++), NULL, rows);
+                break;
+            case EXPR_INPUT:
+                push_vector(SLOT(top++), instr->arg >= 0 ? env->inputs[instr->arg] : NULL, rows);
+                break;
+            case EXPR_COLUMN:
+                push_vector(SLOT(top++), env->columns[instr->arg], rows);
+                break;
+            case EXPR_ABC:
+                push_vector(SLOT(top++), env->abc, rows);
+                break;
+            case EXPR_FB:
+                push_vector(SLOT(top++), instr->arg >= 0 ? env->fb_weeks[instr->arg] : env->fb, rows);
+                break;
+            case EXPR_CONST:
+                column_kernel_fill(SLOT(top++), instr->constant, rows);
+                break;
+            case EXPR_NEG:
+                column_kernel_neg(SLOT(top - 1), rows);
+                break;
+            case EXPR_ADD:
+                column_kernel_add(a, b, rows);
+                top--;
+                break;
+            case EXPR_SUB:
+                column_kernel_sub(a, b, rows);
+                top--;
+                break;
+            case EXPR_MUL:
+                column_kernel_mul(a, b, rows);
+                top--;
+                break;
+            case EXPR_DIV:
+                column_kernel_div(a, b, rows);
+                top--;
+                break;
+            case EXPR_MAX:
+            case EXPR_MIN:
+            case EXPR_COALESCE: {
+                // Fold the arguments left to right into the first one
+                double* first = SLOT(top - instr->arg);
+                for (int j = 1; j < instr->arg; j++) {
+                    const double* next = SLOT(top - instr->arg + j);
+                    if (instr->op == EXPR_MAX) {
+                        column_kernel_max(first, next, rows);
+                    } else if (instr->op == EXPR_MIN) {
+                        column_kernel_min(first, next, rows);
+                    } else {
+                        column_kernel_coalesce(first, next, rows);
+                    }
+                }
+                top -= instr->arg - 1;
+                break;
+            }
+        }
+    }
+    push_vector(result, top > 0 ? SLOT(top - 1) : NULL, rows);
+
+#undef SLOT
+}
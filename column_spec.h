@@ -0,0 +1,111 @@
+#ifndef COLUMN_SPEC_H
+#define COLUMN_SPEC_H
+
+#include <stddef.h>
+#include "typed_value.h"
+
+/*
+ * Output column specs (--columns): one output column per line, in order.
+ *
+ *   # comment
+ *   WSTB        = WSTB                 PCB column copied as read
+ *   WCMJ        = number(WCMJ)         its number, or its text if it is none
+ *   WLOM        = abc                  ABC value (WKQCO) of the row's WIDF
+ *   FB          = fb                   FB value of the row's WIDF
+ *   MAX         = max(fb, WCMJ)
+ *   Inventaire  =                      left empty
+ *   couv        = WSTKG / MAX
+ *   FB_{week}   = fb                   one column per week of the horizon
+ *
+ * An expression computes a number from constants, PCB columns, the abc and
+ * fb lookups and earlier computed columns, with + - * and /, max(), min()
+ * and coalesce(). A null operand (an empty or non-numeric cell, a missing
+ * lookup) makes + - * / null, and so does a division by zero; max and min
+ * skip nulls and coalesce takes the first non-null. A name is an earlier
+ * computed column if there is one, else a PCB column; "..." quotes a name
+ * with other characters.
+ *
+ * Lines whose name holds {week} are repeated for every week of the --weeks
+ * horizon (once for the current week without one), a run of such lines
+ * week by week. Inside them {week} is the week in names and fb its value.
+ *
+ * A spec is parsed once into postfix code whose names are resolved against
+ * each PCB header (see compile_column_plan in column_plan.c). The code runs a
+ * whole batch at a time on a stack of column vectors.
+ */
+
+#define COLUMN_SPEC_MAX_COLUMNS 96
+#define COLUMN_SPEC_MAX_NAMES 256
+#define COLUMN_SPEC_NAME_SIZE 32
+#define COLUMN_EXPR_MAX_CODE 64     // instructions of one expression
+#define COLUMN_EXPR_STACK 16
+
+typedef enum {
+    EXPR_NAME,      // name not resolved yet: arg is its number in the spec
+    EXPR_INPUT,     // number of a PCB input (arg)
+    EXPR_COLUMN,    // value of an earlier output column (arg)
+    EXPR_ABC,       // ABC value of the row's WIDF
+    EXPR_FB,        // FB value of the row's WIDF: arg is the horizon slot, -1 for the current week
+    EXPR_CONST,
+    EXPR_NEG,
+    EXPR_ADD,
+    EXPR_SUB,
+    EXPR_MUL,
+    EXPR_DIV,
+    EXPR_MAX,       // of the top arg values
+    EXPR_MIN,
+    EXPR_COALESCE
+} expr_op;
+
+typedef struct {
+    expr_op op;
+    int arg;
+    double constant;
+} expr_instr;
+
+typedef enum {
+    SPEC_EMPTY,     // nothing after the =
+    SPEC_NAME,      // a single name: a PCB column copied as read, or an earlier column
+    SPEC_TYPED,     // number(name)
+    SPEC_EXPR
+} spec_form;
+
+typedef struct {
+    char name[COLUMN_SPEC_NAME_SIZE];   // output header, may hold {week}
+    int per_week;
+    spec_form form;
+    expr_instr code[COLUMN_EXPR_MAX_CODE];
+    int length;
+} spec_column;
+
+typedef struct {
+    spec_column columns[COLUMN_SPEC_MAX_COLUMNS];
+    int count;
+    char names[COLUMN_SPEC_MAX_NAMES][COLUMN_SPEC_NAME_SIZE];  // of EXPR_NAME
+    int name_count;
+} column_spec;
+
+// What an expression reads for a batch of rows: column vectors of one
+// double per row, NaN for null (see column_kernels.h)
+typedef struct {
+    double* const* inputs;          // numbers of the PCB inputs
+    double* const* columns;         // values of the output columns computed so far
+    const double* abc;
+    const double* fb;               // current week
+    double* const* fb_weeks;        // by horizon slot
+} expr_vectors;
+
+// Parse a spec; errors go to stderr as source:line and give NULL
+column_spec* column_spec_parse(const char* text, const char* source);
+column_spec* column_spec_load(const char* path);
+void column_spec_free(column_spec* spec);
+// Output columns and instructions of the spec for a horizon of weeks
+void column_spec_size(const column_spec* spec, int weeks, int* columns, int* instructions);
+// A name with {week} replaced by week
+void column_spec_week_name(const char* name, int week, char* out, size_t size);
+// Run an expression over rows into result; stack holds COLUMN_EXPR_STACK
+// vectors of rows doubles
+void column_expr_eval_batch(const expr_instr* code, int length, const expr_vectors* env, size_t rows,
+                            double* stack, double* result);
+
+#endif
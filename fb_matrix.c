@@ -0,0 +1,86 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fb_matrix.h"
+
+static int grow_columns(fb_matrix* matrix, uint32_t rows) {
+    for (int c = 0; c < matrix->week_count; c++) {
+        double* column = realloc(matrix->columns[c], (size_t)rows * sizeof(double));
+        if (!column) {
+            return 0;
+        }
+        for (uint32_t r = matrix->row_capacity; r < rows; r++) {
+            column[r] = NAN;
+        }
+        matrix->columns[c] = column;
+    }
+    matrix->row_capacity = rows;
+    return 1;
+}
+
+int fb_matrix_init(fb_matrix* matrix, const int* weeks, int week_count, uint32_t expected_rows) {
+    memset(matrix, 0, sizeof(fb_matrix));
+    if (week_count > FB_MATRIX_MAX_WEEKS) {
+        week_count = FB_MATRIX_MAX_WEEKS;
+    }
+    matrix->week_count = week_count;
+    memcpy(matrix->weeks, weeks, week_count * sizeof(int));
+    if (!hash_index_init(&matrix->refs, expected_rows)) {
+        return 0;
+    }
+    return grow_columns(matrix, expected_rows > 0 ? expected_rows : 1024);
+}
+
+int64_t fb_matrix_add_ref(fb_matrix* matrix, const char* ref) {
+    int64_t row = hash_index_find(&matrix->refs, ref);
+    if (row >= 0) {
+        // Last row wins: forget the values of the earlier occurrence
+        for (int c = 0; c < matrix->week_count; c++) {
+            matrix->columns[c][row] = NAN;
+        }
+        return row;
+    }
+    // Make room for the new row first, so a ref is never indexed without one
+    row = matrix->refs.count;
+    if ((uint32_t)row >= matrix->row_capacity && !grow_columns(matrix, matrix->row_capacity * 2)) {
+        return -1;
+    }
+    if (!hash_index_put(&matrix->refs, ref, "")) {
+        return -1;
+    }
+    return row;
+}
+
+void fb_matrix_set(fb_matrix* matrix, uint32_t row, int column, double value) {
+    matrix->columns[column][row] = value;
+}
+
+int64_t fb_matrix_find(const fb_matrix* matrix, const char* ref) {
+    return hash_index_find(&matrix->refs, ref);
+}
+
+int fb_matrix_column_of_week(const fb_matrix* matrix, int week) {
+    for (int c = 0; c < matrix->week_count; c++) {
+        if (matrix->weeks[c] == week) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+double fb_matrix_get(const fb_matrix* matrix, uint32_t row, int column) {
+    return matrix->columns[column][row];
+}
+
+size_t fb_matrix_memory(const fb_matrix* matrix) {
+    return hash_index_memory(&matrix->refs)
+         + (size_t)matrix->week_count * matrix->row_capacity * sizeof(double);
+}
+
+void fb_matrix_free(fb_matrix* matrix) {
+    hash_index_free(&matrix->refs);
+    for (int c = 0; c < matrix->week_count; c++) {
+        free(matrix->columns[c]);
+    }
+    memset(matrix, 0, sizeof(fb_matrix));
+}
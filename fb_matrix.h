@@ -0,0 +1,36 @@
+#ifndef FB_MATRIX_H
+#define FB_MATRIX_H
+
+#include <stdint.h>
+#include "hash_index.h"
+
+/*
+ * Every week column of FB.xlsx (or the fb table) loaded in one pass, for the
+ * multi-week horizon mode. REFs are numbered through a hash_index and each
+ * week is a column of doubles indexed by that number; NaN marks an empty
+ * cell. A REF seen twice keeps the values of its last row.
+ */
+
+#define FB_MATRIX_MAX_WEEKS 64
+
+typedef struct {
+    hash_index refs;                        // REF -> row number (entry number)
+    int week_count;
+    int weeks[FB_MATRIX_MAX_WEEKS];         // week number of each column, in source order
+    double* columns[FB_MATRIX_MAX_WEEKS];   // columns[c][row]
+    uint32_t row_capacity;
+} fb_matrix;
+
+int fb_matrix_init(fb_matrix* matrix, const int* weeks, int week_count, uint32_t expected_rows);
+// Row of a REF, added (all weeks empty) if new; -1 on allocation failure
+int64_t fb_matrix_add_ref(fb_matrix* matrix, const char* ref);
+void fb_matrix_set(fb_matrix* matrix, uint32_t row, int column, double value);
+int64_t fb_matrix_find(const fb_matrix* matrix, const char* ref);
+// Column holding a week number, -1 if the source has no such week
+int fb_matrix_column_of_week(const fb_matrix* matrix, int week);
+double fb_matrix_get(const fb_matrix* matrix, uint32_t row, int column);
+// Heap bytes held by the matrix and its REF index
+size_t fb_matrix_memory(const fb_matrix* matrix);
+void fb_matrix_free(fb_matrix* matrix);
+
+#endif
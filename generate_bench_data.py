@@ -0,0 +1,228 @@
+"""Generate synthetic PCB.xlsx, ABC.xlsx and FB.xlsx for benchmarking modif.
+
+The column sets and the value pools come from data.db (24 pcb columns, 39 abc
+columns, REF + week columns in fb), so the files look like the real extracts
+at any size. Key columns are synthesized:
+
+- PCB WIDF is unique per row
+- --hit-rate of the PCB keys also appear in ABC (WKIDF) and FB (REF); the
+  other lookup rows get keys PCB never asks for, so the lookup tables keep
+  their real size ratio to PCB
+- --dup-rate of the ABC and FB rows repeat a key of an earlier row
+
+Sheets are written as raw worksheet XML streamed into the zip, so a 10M row
+PCB.xlsx does not have to fit in memory. With --db the same rows also go to
+the pcb, abc and fb tables of a SQLite database for `modif --db`.
+"""
+
+import argparse
+import random
+import sqlite3
+import zipfile
+from pathlib import Path
+from xml.sax.saxutils import escape
+
+DB_PATH = Path("data.db")
+
+# Column sets of data.db, used when it is not available
+DEFAULT_COLUMNS = {
+    "pcb": ["WSTB", "WFOR", "WGES", "WPIV", "WNBJ", "WCLM", "WIDF", "WDES", "WCOF", "WLOM",
+            "WCMJ", "WSCO", "WSTKP", "WSTKM", "WSTKG", "WSTKW", "WENG", "WCOUV1", "WCOUV2",
+            "WCOUV3", "WCOUV4", "WECAR1", "WECAR2", "WSTKC"],
+    "abc": ["WKIDF", "WKDES", "NATURE", "RETRAIT", "WKCMJ", "WKPRU", "WKCMD", "WKQCO", "PFLOT",
+            "WKSCO", "WKQTG", "WKQTMC", "WKQTMV", "WKQTMN", "WKQTP", "WKQTM", "WKQTMD", "WKQTZ",
+            "WKQTW", "STKGV", "STKWV", "WKCJG", "WKCJA", "WKCJT", "WKGES", "WKFOR", "WKNOM",
+            "PFCOF", "WKFRE", "WKDFE", "FREQJ", "CMJM", "WKFRL", "STK_TOT_QTY", "STK_TOT_VALEUR",
+            "MAX_STOCK_QTY", "MAX_VALEUR", "GAP_QTY", "GAP_VALEUR"],
+    "fb": ["REF"] + [str(w) for w in range(34, 53)] + [str(w) for w in range(1, 9)] + ["Total_général"],
+}
+KEY_COLUMN = {"pcb": "WIDF", "abc": "WKIDF", "fb": "REF"}
+SHEET_FILE = {"pcb": "PCB.xlsx", "abc": "ABC.xlsx", "fb": "FB.xlsx"}
+# Lookup rows per PCB row in data.db
+SIZE_RATIO = {"pcb": 1.0, "abc": 3141 / 2690, "fb": 2762 / 2690}
+POOL_SIZE = 2000
+
+CONTENT_TYPES = (
+    '<?xml version="1.0" encoding="UTF-8" standalone="yes"?>\n'
+    '<Types xmlns="http://schemas.openxmlformats.org/package/2006/content-types">'
+    '<Default Extension="rels" ContentType="application/vnd.openxmlformats-package.relationships+xml"/>'
+    '<Default Extension="xml" ContentType="application/xml"/>'
+    '<Override PartName="/xl/workbook.xml" '
+    'ContentType="application/vnd.openxmlformats-officedocument.spreadsheetml.sheet.main+xml"/>'
+    '<Override PartName="/xl/worksheets/sheet1.xml" '
+    'ContentType="application/vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml"/>'
+    '</Types>'
+)
+ROOT_RELS = (
+    '<?xml version="1.0" encoding="UTF-8" standalone="yes"?>\n'
+    '<Relationships xmlns="http://schemas.openxmlformats.org/package/2006/relationships">'
+    '<Relationship Id="rId1" '
+    'Type="http://schemas.openxmlformats.org/officeDocument/2006/relationships/officeDocument" '
+    'Target="xl/workbook.xml"/>'
+    '</Relationships>'
+)
+WORKBOOK = (
+    '<?xml version="1.0" encoding="UTF-8" standalone="yes"?>\n'
+    '<workbook xmlns="http://schemas.openxmlformats.org/spreadsheetml/2006/main" '
+    'xmlns:r="http://schemas.openxmlformats.org/officeDocument/2006/relationships">'
+    '<sheets><sheet name="{name}" sheetId="1" r:id="rId1"/></sheets></workbook>'
+)
+WORKBOOK_RELS = (
+    '<?xml version="1.0" encoding="UTF-8" standalone="yes"?>\n'
+    '<Relationships xmlns="http://schemas.openxmlformats.org/package/2006/relationships">'
+    '<Relationship Id="rId1" '
+    'Type="http://schemas.openxmlformats.org/officeDocument/2006/relationships/worksheet" '
+    'Target="worksheets/sheet1.xml"/>'
+    '</Relationships>'
+)
+
+
+def column_letter(index: int) -> str:
+    letters = ""
+    index += 1
+    while index:
+        index, rem = divmod(index - 1, 26)
+        letters = chr(65 + rem) + letters
+    return letters
+
+
+def load_columns_and_pools(db_path: Path, rng: random.Random):
+    """Column names and a pool of real values per column, for each table."""
+    columns = {}
+    pools = {}
+    if not db_path.exists():
+        print(f"{db_path} not found, using built-in column sets and generated values")
+        for table, names in DEFAULT_COLUMNS.items():
+            columns[table] = names
+            pools[table] = [[round(rng.uniform(0, 10000), 3) for _ in range(50)] for _ in names]
+        return columns, pools
+
+    with sqlite3.connect(db_path.as_posix()) as conn:
+        for table in DEFAULT_COLUMNS:
+            names = [row[1] for row in conn.execute(f'PRAGMA table_info("{table}")')]
+            if not names:
+                names = DEFAULT_COLUMNS[table]
+                pools[table] = [[None] for _ in names]
+            else:
+                rows = conn.execute(f'SELECT * FROM "{table}" ORDER BY RANDOM() LIMIT {POOL_SIZE}').fetchall()
+                pools[table] = [[row[i] for row in rows] or [None] for i in range(len(names))]
+            columns[table] = names
+    return columns, pools
+
+
+def cell_xml(ref: str, value) -> str:
+    if value is None or value == "":
+        return ""
+    if isinstance(value, (int, float)):
+        return f'<c r="{ref}"><v>{value!r}</v></c>'
+    return f'<c r="{ref}" t="inlineStr"><is><t>{escape(str(value))}</t></is></c>'
+
+
+def lookup_keys(rows: int, pcb_rows: int, hit_rate: float, dup_rate: float, rng: random.Random, prefix: str):
+    """Key of every row of a lookup table, in a scrambled order."""
+    # round(pcb_rows * hit_rate) PCB keys, visited as i -> i * step mod pcb_rows
+    # (step is prime, so no key repeats) and spread evenly over the rows that
+    # are not duplicates; the other rows get keys PCB never asks for
+    step = 7919 if pcb_rows % 7919 else 7907
+    wanted = min(round(pcb_rows * hit_rate), rows)
+    unique_rows = max(1, round(rows * (1 - dup_rate)))
+    recent = []  # ring of the last keys, duplicates repeat one of them
+    unique = hits = misses = 0
+    for i in range(rows):
+        if recent and (unique >= unique_rows or rng.random() < dup_rate):
+            key = recent[rng.randrange(len(recent))]
+        else:
+            if hits < wanted and hits * unique_rows < (unique + 1) * wanted:
+                key = f"P{(hits * step) % pcb_rows:08d}"
+                hits += 1
+            else:
+                key = f"{prefix}{misses:08d}"
+                misses += 1
+            unique += 1
+        if len(recent) < 65536:
+            recent.append(key)
+        else:
+            recent[i % 65536] = key
+        yield key
+
+
+def table_rows(table: str, rows: int, pcb_rows: int, columns, pools, args, rng: random.Random):
+    names = columns[table]
+    key_index = names.index(KEY_COLUMN[table]) if KEY_COLUMN[table] in names else 0
+    if table == "pcb":
+        keys = (f"P{i:08d}" for i in range(rows))
+    else:
+        keys = lookup_keys(rows, pcb_rows, args.hit_rate, args.dup_rate, rng, "Q" if table == "abc" else "R")
+    table_pools = pools[table]
+    for key in keys:
+        row = [rng.choice(pool) for pool in table_pools]
+        row[key_index] = key
+        yield row
+
+
+def write_xlsx(path: Path, sheet_name: str, names, rows_iter, row_count: int, level: int) -> None:
+    letters = [column_letter(i) for i in range(len(names))]
+    with zipfile.ZipFile(path, "w", zipfile.ZIP_DEFLATED, compresslevel=level) as zf:
+        zf.writestr("[Content_Types].xml", CONTENT_TYPES)
+        zf.writestr("_rels/.rels", ROOT_RELS)
+        zf.writestr("xl/workbook.xml", WORKBOOK.format(name=escape(sheet_name)))
+        zf.writestr("xl/_rels/workbook.xml.rels", WORKBOOK_RELS)
+        with zf.open("xl/worksheets/sheet1.xml", "w", force_zip64=True) as sheet:
+            sheet.write((
+                '<?xml version="1.0" encoding="UTF-8" standalone="yes"?>\n'
+                '<worksheet xmlns="http://schemas.openxmlformats.org/spreadsheetml/2006/main">'
+                f'<dimension ref="A1:{letters[-1]}{row_count + 1}"/><sheetData>'
+            ).encode())
+            header = "".join(cell_xml(f"{letters[i]}1", str(name)) for i, name in enumerate(names))
+            sheet.write(f'<row r="1">{header}</row>'.encode())
+            chunk = []
+            for r, row in enumerate(rows_iter, start=2):
+                cells = "".join(cell_xml(f"{letters[i]}{r}", value) for i, value in enumerate(row))
+                chunk.append(f'<row r="{r}">{cells}</row>')
+                if len(chunk) == 4096:
+                    sheet.write("".join(chunk).encode())
+                    chunk = []
+            sheet.write(("".join(chunk) + "</sheetData></worksheet>").encode())
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--rows", type=int, default=10000, help="PCB rows (1000 to 10000000)")
+    parser.add_argument("--out", type=Path, default=Path("bench/data"), help="directory for input/*.xlsx")
+    parser.add_argument("--hit-rate", type=float, default=0.99, help="share of PCB keys found in ABC and FB")
+    parser.add_argument("--dup-rate", type=float, default=0.01, help="share of ABC/FB rows repeating a key")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--source-db", type=Path, default=DB_PATH, help="database the columns are taken from")
+    parser.add_argument("--db", type=Path, help="also write the tables to this SQLite database")
+    parser.add_argument("--compress-level", type=int, default=6, help="deflate level of the xlsx files")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    columns, pools = load_columns_and_pools(args.source_db, rng)
+    input_dir = args.out / "input"
+    input_dir.mkdir(parents=True, exist_ok=True)
+    if args.db and args.db.exists():
+        args.db.unlink()
+
+    for table in ("abc", "fb", "pcb"):
+        rows = max(1, round(args.rows * SIZE_RATIO[table]))
+        names = columns[table]
+        path = input_dir / SHEET_FILE[table]
+        write_xlsx(path, table, names,
+                   table_rows(table, rows, args.rows, columns, pools, args, random.Random(f"{args.seed}-{table}")),
+                   rows, args.compress_level)
+        print(f"Generated {rows} rows x {len(names)} columns -> {path}")
+
+        if args.db:
+            with sqlite3.connect(args.db.as_posix()) as conn:
+                quoted = ", ".join('"' + name.replace('"', '""') + '"' for name in names)
+                conn.execute(f'CREATE TABLE "{table}" ({quoted})')
+                conn.executemany(
+                    f'INSERT INTO "{table}" VALUES ({", ".join("?" * len(names))})',
+                    table_rows(table, rows, args.rows, columns, pools, args, random.Random(f"{args.seed}-{table}")),
+                )
+            print(f"Generated table {table} -> {args.db}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash_index.h"
+
+// FNV-1a, also stored in snapshots so it must stay stable
+uint32_t hash_index_hash(const char* key) {
+    uint32_t hash = 2166136261u;
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// keys is at most HASH_INDEX_MAX_KEYS, so this stops at 2^31 slots
+static uint32_t slots_for(uint32_t keys) {
+    uint32_t slots = 16;
+    while (slots < (uint64_t)keys * 2) {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+static int rehash(hash_index* index, uint32_t slot_count) {
+    uint32_t* slots = malloc(slot_count * sizeof(uint32_t));
+    if (!slots) {
+        return 0;
+    }
+    memset(slots, 0xFF, slot_count * sizeof(uint32_t));
+    for (uint32_t e = 0; e < index->count; e++) {
+        uint32_t i = index->entries[e].hash & (slot_count - 1);
+        while (slots[i] != HASH_INDEX_EMPTY_SLOT) {
+            i = (i + 1) & (slot_count - 1);
+        }
+        slots[i] = e;
+    }
+    free(index->slots);
+    index->slots = slots;
+    index->slot_count = slot_count;
+    return 1;
+}
+
+static int arena_append(hash_index* index, const char* text, uint32_t* offset) {
+    size_t length = strlen(text) + 1;
+    // Offsets are 32 bits: the arena ends at 4 GiB
+    if (index->arena_size + length > HASH_INDEX_MAX_ARENA) {
+        return 0;
+    }
+    if (index->arena_size + length > index->arena_capacity) {
+        size_t capacity = index->arena_capacity ? index->arena_capacity * 2 : 4096;
+        while (capacity < index->arena_size + length) {
+            capacity *= 2;
+        }
+        char* arena = realloc(index->arena, capacity);
+        if (!arena) {
+            return 0;
+        }
+        index->arena = arena;
+        index->arena_capacity = capacity;
+    }
+    *offset = (uint32_t)index->arena_size;
+    memcpy(index->arena + index->arena_size, text, length);
+    index->arena_size += length;
+    return 1;
+}
+
+int hash_index_init(hash_index* index, uint32_t expected_keys) {
+    memset(index, 0, sizeof(hash_index));
+    index->owned = 1;
+    if (expected_keys > HASH_INDEX_MAX_KEYS) {
+        expected_keys = HASH_INDEX_MAX_KEYS;
+    }
+    if (expected_keys > 0) {
+        index->entries = malloc(expected_keys * sizeof(hash_index_entry));
+        if (!index->entries) {
+            return 0;
+        }
+        index->entry_capacity = expected_keys;
+        // Keys and values of the reference tables average well under 16 bytes each
+        index->arena = malloc((size_t)expected_keys * 32);
+        index->arena_capacity = index->arena ? (size_t)expected_keys * 32 : 0;
+    }
+    if (!rehash(index, slots_for(expected_keys))) {
+        hash_index_free(index);
+        return 0;
+    }
+    return 1;
+}
+
+// Slot holding the key, or the empty slot where it would be inserted
+static uint32_t find_slot(const hash_index* index, const char* key, uint32_t hash) {
+    uint32_t mask = index->slot_count - 1;
+    uint32_t i = hash & mask;
+    while (index->slots[i] != HASH_INDEX_EMPTY_SLOT) {
+        const hash_index_entry* entry = &index->entries[index->slots[i]];
+        if (entry->hash == hash && strcmp(index->arena + entry->key_offset, key) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+int hash_index_put(hash_index* index, const char* key, const char* value) {
+    uint32_t hash = hash_index_hash(key);
+    uint32_t slot = find_slot(index, key, hash);
+
+    if (!index->owned) {
+        return 0;
+    }
+    if (index->slots[slot] != HASH_INDEX_EMPTY_SLOT) {
+        return arena_append(index, value, &index->entries[index->slots[slot]].value_offset);
+    }
+
+    if (index->count >= HASH_INDEX_MAX_KEYS) {
+        return 0;
+    }
+    // Grow before inserting, so that a failed rehash leaves the key out
+    if ((uint64_t)(index->count + 1) * 2 > index->slot_count) {
+        if (!rehash(index, index->slot_count * 2)) {
+            return 0;
+        }
+        slot = find_slot(index, key, hash);
+    }
+    if (index->count == index->entry_capacity) {
+        uint32_t capacity = index->entry_capacity ? index->entry_capacity * 2 : 1024;
+        if (capacity > HASH_INDEX_MAX_KEYS) {
+            capacity = HASH_INDEX_MAX_KEYS;
+        }
+        hash_index_entry* entries = realloc(index->entries, capacity * sizeof(hash_index_entry));
+        if (!entries) {
+            return 0;
+        }
+        index->entries = entries;
+        index->entry_capacity = capacity;
+    }
+
+    hash_index_entry* entry = &index->entries[index->count];
+    size_t arena_size = index->arena_size;
+    entry->hash = hash;
+    if (!arena_append(index, key, &entry->key_offset) || !arena_append(index, value, &entry->value_offset)) {
+        index->arena_size = arena_size;
+        return 0;
+    }
+    index->slots[slot] = index->count++;
+    return 1;
+}
+
+const char* hash_index_get(const hash_index* index, const char* key) {
+    if (index->slot_count == 0) {
+        return NULL;
+    }
+    uint32_t slot = find_slot(index, key, hash_index_hash(key));
+    if (index->slots[slot] == HASH_INDEX_EMPTY_SLOT) {
+        return NULL;
+    }
+    return index->arena + index->entries[index->slots[slot]].value_offset;
+}
+
+int64_t hash_index_find(const hash_index* index, const char* key) {
+    if (index->slot_count == 0) {
+        return -1;
+    }
+    uint32_t slot = find_slot(index, key, hash_index_hash(key));
+    if (index->slots[slot] == HASH_INDEX_EMPTY_SLOT) {
+        return -1;
+    }
+    return index->slots[slot];
+}
+
+void hash_index_free(hash_index* index) {
+    if (index->owned) {
+        free(index->slots);
+        free(index->entries);
+        free(index->arena);
+    }
+    memset(index, 0, sizeof(hash_index));
+}
+
+void hash_index_view(hash_index* index, uint32_t* slots, uint32_t slot_count,
+                     hash_index_entry* entries, uint32_t count, char* arena, size_t arena_size) {
+    memset(index, 0, sizeof(hash_index));
+    index->slots = slots;
+    index->slot_count = slot_count;
+    index->entries = entries;
+    index->count = count;
+    index->entry_capacity = count;
+    index->arena = arena;
+    index->arena_size = arena_size;
+    index->arena_capacity = arena_size;
+    index->owned = 0;
+}
+
+void hash_index_get_stats(const hash_index* index, hash_index_stats* stats) {
+    uint64_t total_probe = 0;
+    uint32_t mask = index->slot_count - 1;
+
+    memset(stats, 0, sizeof(hash_index_stats));
+    stats->count = index->count;
+    stats->slot_count = index->slot_count;
+    stats->arena_size = index->arena_size;
+    if (index->slot_count == 0) {
+        return;
+    }
+    stats->load_factor = (double)index->count / index->slot_count;
+
+    // Probe length of a key = distance from its home slot + 1
+    for (uint32_t i = 0; i < index->slot_count; i++) {
+        if (index->slots[i] == HASH_INDEX_EMPTY_SLOT) {
+            continue;
+        }
+        uint32_t home = index->entries[index->slots[i]].hash & mask;
+        uint32_t probe = ((i - home) & mask) + 1;
+        total_probe += probe;
+        if (probe > stats->max_probe) {
+            stats->max_probe = probe;
+        }
+        stats->probe_histogram[probe < HASH_INDEX_PROBE_BUCKETS ? probe - 1 : HASH_INDEX_PROBE_BUCKETS - 1]++;
+    }
+    if (index->count > 0) {
+        stats->mean_probe = (double)total_probe / index->count;
+    }
+}
+
+size_t hash_index_memory(const hash_index* index) {
+    if (!index->owned) {
+        return 0;
+    }
+    return (size_t)index->slot_count * sizeof(uint32_t)
+         + (size_t)index->entry_capacity * sizeof(hash_index_entry)
+         + index->arena_capacity;
+}
+
+void hash_index_print_stats(const char* name, const hash_index* index) {
+    hash_index_stats stats;
+    hash_index_get_stats(index, &stats);
+    printf("%s index: %u keys, %u slots, load factor %.2f, probes mean %.2f max %u, arena %zu bytes\n",
+           name, stats.count, stats.slot_count, stats.load_factor, stats.mean_probe,
+           stats.max_probe, stats.arena_size);
+}
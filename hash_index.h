@@ -0,0 +1,83 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * String -> string index used for the ABC and FB lookup tables.
+ *
+ * Open addressing with linear probing over a power-of-two slot array. Slots
+ * hold entry numbers; entries hold the key hash and the offsets of the key
+ * and value inside one arena, so a table of N refs costs three allocations
+ * instead of 3N. The slot array doubles whenever it would become more than
+ * half full. Putting an existing key replaces its value (last row wins, as
+ * with the old chained tables).
+ *
+ * Offsets into the arena are 32 bits, as in snapshots, so keys and values
+ * (replaced ones included) share at most 4 GiB of text: a put that would
+ * go past it fails and leaves the index as it was.
+ *
+ * Lookups return pointers into the arena; they stay valid until the next
+ * put or until the index is freed. An index can also be a read-only view
+ * over memory it does not own (a mapped snapshot, see snapshot.h).
+ */
+
+#define HASH_INDEX_EMPTY_SLOT 0xFFFFFFFFu
+#define HASH_INDEX_PROBE_BUCKETS 8
+#define HASH_INDEX_MAX_ARENA ((size_t)UINT32_MAX)
+// Keys per index: the slot array then stays within 2^31 slots
+#define HASH_INDEX_MAX_KEYS (1u << 30)
+
+typedef struct {
+    uint32_t hash;
+    uint32_t key_offset;
+    uint32_t value_offset;
+} hash_index_entry;
+
+typedef struct {
+    uint32_t* slots;
+    uint32_t slot_count;
+    hash_index_entry* entries;
+    uint32_t count;
+    uint32_t entry_capacity;
+    char* arena;
+    size_t arena_size;
+    size_t arena_capacity;
+    int owned;
+} hash_index;
+
+typedef struct {
+    uint32_t count;
+    uint32_t slot_count;
+    size_t arena_size;
+    double load_factor;
+    double mean_probe;      // slots inspected by a successful lookup, on average
+    uint32_t max_probe;
+    uint32_t probe_histogram[HASH_INDEX_PROBE_BUCKETS]; // 1, 2, ..., >= 8 probes
+} hash_index_stats;
+
+uint32_t hash_index_hash(const char* key);
+
+// Presize for an expected number of keys (0 if unknown, at most
+// HASH_INDEX_MAX_KEYS are presized); returns 0 on allocation failure, with
+// nothing left to free
+int hash_index_init(hash_index* index, uint32_t expected_keys);
+// Returns 0, with the index as it was, when out of memory, past
+// HASH_INDEX_MAX_ARENA or past HASH_INDEX_MAX_KEYS keys
+int hash_index_put(hash_index* index, const char* key, const char* value);
+const char* hash_index_get(const hash_index* index, const char* key);
+// Entry number of a key (entries are numbered in insertion order), -1 if absent
+int64_t hash_index_find(const hash_index* index, const char* key);
+void hash_index_free(hash_index* index);
+
+// Wrap arrays that live elsewhere (e.g. in an mmapped file) as a read-only index
+void hash_index_view(hash_index* index, uint32_t* slots, uint32_t slot_count,
+                     hash_index_entry* entries, uint32_t count, char* arena, size_t arena_size);
+
+void hash_index_get_stats(const hash_index* index, hash_index_stats* stats);
+// Heap bytes held by an index, 0 for a view
+size_t hash_index_memory(const hash_index* index);
+void hash_index_print_stats(const char* name, const hash_index* index);
+
+#endif
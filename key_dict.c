@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+#include "key_dict.h"
+
+static uint32_t slots_for(uint32_t keys) {
+    uint32_t slots = 16;
+    while (slots < keys * 2) {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+static int rehash(key_dict* dict, uint32_t slot_count) {
+    uint32_t* slots = malloc(slot_count * sizeof(uint32_t));
+    if (!slots) {
+        return 0;
+    }
+    memset(slots, 0xFF, slot_count * sizeof(uint32_t));
+    for (uint32_t id = 0; id < dict->count; id++) {
+        uint32_t i = dict->hashes[id] & (slot_count - 1);
+        while (slots[i] != KEY_DICT_NONE) {
+            i = (i + 1) & (slot_count - 1);
+        }
+        slots[i] = id;
+    }
+    free(dict->slots);
+    dict->slots = slots;
+    dict->slot_count = slot_count;
+    return 1;
+}
+
+static int grow(key_dict* dict, uint32_t capacity) {
+    const char** keys = realloc(dict->keys, capacity * sizeof(char*));
+    if (!keys) {
+        return 0;
+    }
+    dict->keys = keys;
+    uint32_t* hashes = realloc(dict->hashes, capacity * sizeof(uint32_t));
+    if (!hashes) {
+        return 0;
+    }
+    dict->hashes = hashes;
+    dict->capacity = capacity;
+    return 1;
+}
+
+int key_dict_init(key_dict* dict, uint32_t expected_keys) {
+    memset(dict, 0, sizeof(key_dict));
+    if (expected_keys > 0 && !grow(dict, expected_keys)) {
+        return 0;
+    }
+    return rehash(dict, slots_for(expected_keys));
+}
+
+// Slot holding the key, or the empty slot where it would be inserted
+static uint32_t find_slot(const key_dict* dict, const char* key, uint32_t hash) {
+    uint32_t mask = dict->slot_count - 1;
+    uint32_t i = hash & mask;
+    while (dict->slots[i] != KEY_DICT_NONE) {
+        uint32_t id = dict->slots[i];
+        if (dict->hashes[id] == hash && strcmp(dict->keys[id], key) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+uint32_t key_dict_add(key_dict* dict, const char* key, uint32_t hash) {
+    uint32_t slot = find_slot(dict, key, hash);
+
+    if (dict->slots[slot] != KEY_DICT_NONE) {
+        return dict->slots[slot];
+    }
+    if (dict->count == dict->capacity && !grow(dict, dict->capacity ? dict->capacity * 2 : 1024)) {
+        return KEY_DICT_NONE;
+    }
+    uint32_t id = dict->count++;
+    dict->keys[id] = key;
+    dict->hashes[id] = hash;
+    dict->slots[slot] = id;
+    if (dict->count * 2 > dict->slot_count && !rehash(dict, dict->slot_count * 2)) {
+        return KEY_DICT_NONE;
+    }
+    return id;
+}
+
+uint32_t key_dict_find(const key_dict* dict, const char* key, uint32_t hash) {
+    if (dict->slot_count == 0) {
+        return KEY_DICT_NONE;
+    }
+    return dict->slots[find_slot(dict, key, hash)];
+}
+
+size_t key_dict_memory(const key_dict* dict) {
+    return (size_t)dict->slot_count * sizeof(uint32_t)
+         + (size_t)dict->capacity * (sizeof(char*) + sizeof(uint32_t));
+}
+
+void key_dict_free(key_dict* dict) {
+    free(dict->slots);
+    free(dict->keys);
+    free(dict->hashes);
+    memset(dict, 0, sizeof(key_dict));
+}
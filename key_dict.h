@@ -0,0 +1,42 @@
+#ifndef KEY_DICT_H
+#define KEY_DICT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Dictionary of item keys. WIDF (PCB), WKIDF (ABC) and REF (FB) are one
+ * code domain: every distinct key of the loaded reference tables gets a
+ * dense id, in insertion order, and each table keeps what it knows about a
+ * key in arrays indexed by that id. A PCB row then hashes its WIDF once and
+ * reads ABC, FB and the week matrix with array lookups, and another
+ * reference table only costs one more array.
+ *
+ * Keys are not copied: the dictionary points at the key text of the tables
+ * it is built from (their arenas or mapped snapshots), which must stay
+ * loaded and unchanged while it is used. Hashes are hash_index_hash values,
+ * so a table's stored hashes are reused when its keys are added.
+ */
+
+#define KEY_DICT_NONE 0xFFFFFFFFu
+
+typedef struct {
+    uint32_t* slots;        // id of each slot, KEY_DICT_NONE when empty
+    uint32_t slot_count;
+    const char** keys;      // key text of every id
+    uint32_t* hashes;       // hash of every id
+    uint32_t count;
+    uint32_t capacity;
+} key_dict;
+
+// Presize for an expected number of keys (0 if unknown); returns 0 on allocation failure
+int key_dict_init(key_dict* dict, uint32_t expected_keys);
+// Id of a key, added if new; hash must be hash_index_hash(key). KEY_DICT_NONE on allocation failure
+uint32_t key_dict_add(key_dict* dict, const char* key, uint32_t hash);
+// Id of a key, KEY_DICT_NONE if absent
+uint32_t key_dict_find(const key_dict* dict, const char* key, uint32_t hash);
+// Heap bytes held by the dictionary
+size_t key_dict_memory(const key_dict* dict);
+void key_dict_free(key_dict* dict);
+
+#endif
@@ -0,0 +1,588 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lookup_set.h"
+
+// Progress messages of the loaders, on stdout unless the source is quiet
+static void report(const lookup_source* source, const char* format, ...) {
+    va_list args;
+    if (source->quiet) {
+        return;
+    }
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+///////////////////////// ABC and FB /////////////////////////
+
+// Week number of an FB header cell ("34"), 0 for REF, Total_général and the like
+int fb_header_week(const char* name) {
+    char* end;
+    long week = strtol(name, &end, 10);
+    if (end == name || *end != '\0' || week < 1 || week > 53) {
+        return 0;
+    }
+    return (int)week;
+}
+
+// Drop the key dictionary and the arrays by key id. They point into the
+// tables, so this goes with every table that is cleared.
+void clear_key_dictionary(lookup_set* lookups) {
+    key_dict_free(&lookups->keys);
+    free(lookups->abc_by_key);
+    free(lookups->abc_number_by_key);
+    free(lookups->fb_by_key);
+    free(lookups->fb_number_by_key);
+    free(lookups->fb_row_by_key);
+    lookups->abc_by_key = NULL;
+    lookups->abc_number_by_key = NULL;
+    lookups->fb_by_key = NULL;
+    lookups->fb_number_by_key = NULL;
+    lookups->fb_row_by_key = NULL;
+    lookups->keys_cover = 0;
+}
+
+// Write a snapshot of a freshly loaded table; failures only cost the next run a re-parse
+static int save_snapshot(const lookup_source* source, const hash_index* table, const char* path,
+                         uint64_t source_hash, uint64_t source_size, int week) {
+    if (!path || source_size == 0) {
+        return 0;
+    }
+    if (!snapshot_write(table, path, source_hash, source_size, (uint32_t)week)) {
+        report(source, "Warning: could not write snapshot %s\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+// Read the ABC header row to find the WKIDF and WKQCO columns (-1 if absent)
+void read_abc_header(sheet_reader* reader, const lookup_source* source, int* wkidf_col, int* wlom_col) {
+    const char* value;
+
+    *wkidf_col = -1;
+    *wlom_col = -1; // Will be set to WKQCO column
+    if (sheet_next_row(reader)) {
+        int col = 0;
+        report(source, "ABC.xlsx header columns:\n");
+        while ((value = sheet_next_cell(reader)) != NULL) {
+            report(source, "  [%d] %s\n", col, value);
+            if (strcmp(value, "WKIDF") == 0) {
+                *wkidf_col = col;
+                report(source, "    -> Found WKIDF at column %d\n", col);
+            } else if (strcmp(value, "WKQCO") == 0) {
+                *wlom_col = col;
+                report(source, "    -> Found WKQCO at column %d (using for WLOM)\n", col);
+            } else if (strcmp(value, "WLOM") == 0) {
+                // Keep WLOM as fallback if WKQCO not found
+                if (*wlom_col == -1) {
+                    *wlom_col = col;
+                    report(source, "    -> Found WLOM at column %d (fallback)\n", col);
+                }
+            }
+            col++;
+        }
+        report(source, "ABC.xlsx has %d columns\n", col);
+    }
+}
+
+// Open the first sheet of ABC.xlsx; warns and returns 0 if it cannot be read
+int open_abc_sheet(sheet_reader* reader, lookup_source* source) {
+    if (!open_workbook(reader, source->abc_path, source->reader_threads)) {
+        if (!source->abc_warned) {
+            report(source, "Warning: Could not open ABC.xlsx file\n");
+            source->abc_warned = 1;
+        }
+        return 0;
+    }
+
+    if (!open_first_sheet(reader)) {
+        report(source, "Warning: Could not read ABC.xlsx sheet\n");
+        close_sheet_reader(reader);
+        return 0;
+    }
+    return 1;
+}
+
+// Function to load ABC data into hash table
+int load_abc_hash_table(lookup_set* lookups, lookup_source* source) {
+    const char* abc_file = source->abc_path;
+    sheet_reader reader;
+    uint64_t source_size;
+    uint64_t source_hash = snapshot_source_hash(abc_file, &source_size);
+    
+    if (!source->rebuild_snapshots && source->abc_snapshot && source_size > 0
+        && (lookups->abc_snapshot = snapshot_open(source->abc_snapshot, source_hash, source_size, 0)) != NULL) {
+        lookups->abc_table = *snapshot_index(lookups->abc_snapshot);
+        lookups->abc_numbers = parse_index_values(&lookups->abc_table);
+        lookups->abc_loaded = 1;
+        report(source, "Loaded %u ABC entries from snapshot %s\n", lookups->abc_table.count, source->abc_snapshot);
+        if (!source->quiet) {
+            hash_index_print_stats("ABC", &lookups->abc_table);
+        }
+        return 1;
+    }
+    
+    if (!open_abc_sheet(&reader, source)) {
+        return 0;
+    }
+
+    // Read header row to find WKIDF and WKQCO columns
+    int wkidf_col, wlom_col;
+    read_abc_header(&reader, source, &wkidf_col, &wlom_col);
+
+    // Load data into hash table
+    if (wkidf_col >= 0 && wlom_col >= 0 && hash_index_init(&lookups->abc_table, expected_data_rows(abc_file))) {
+        int loaded_count = 0;
+        const char* wkidf_val;
+        const char* wlom_val;
+        while (read_key_value(&reader, wkidf_col, wlom_col, &wkidf_val, &wlom_val)) {
+            // Keys and values are copied into the index arena
+            if (wkidf_val && wlom_val && hash_index_put(&lookups->abc_table, wkidf_val, wlom_val)) {
+                loaded_count++;
+            }
+        }
+        
+        lookups->abc_numbers = parse_index_values(&lookups->abc_table);
+        lookups->abc_loaded = 1;
+        report(source, "Loaded %d ABC entries into hash table\n", loaded_count);
+        if (!source->quiet) {
+            hash_index_print_stats("ABC", &lookups->abc_table);
+        }
+        
+        if (save_snapshot(source, &lookups->abc_table, source->abc_snapshot, source_hash, source_size, 0)) {
+            report(source, "Saved ABC snapshot to %s\n", source->abc_snapshot);
+        }
+        
+        // Show some sample WKIDF values for debugging
+        if (lookups->abc_table.count > 0) {
+            report(source, "Sample WKIDF values from 'ABC.xlsx':\n");
+            for (uint32_t i = 0; i < lookups->abc_table.count && i < 5; i++) {
+                report(source, "  %s\n", lookups->abc_table.arena + lookups->abc_table.entries[i].key_offset);
+            }
+        }
+    }
+    
+    close_sheet_reader(&reader);
+    return lookups->abc_loaded;
+}
+
+// Function to get WLOM value from ABC by key id (see find_key): the text
+// (NULL if the key is not in ABC or ABC is not loaded), pointing into the
+// table, and its number parsed at load time. Only reads the set, so it is
+// safe from any thread.
+const char* get_wlom_value_by_key(const lookup_set* lookups, uint32_t key, number_cell* number) {
+    *number = number_cell_null();
+    if (key == KEY_DICT_NONE || !lookups->abc_by_key || !lookups->abc_by_key[key]) {
+        return NULL;
+    }
+    *number = lookups->abc_number_by_key[key];
+    return lookups->abc_by_key[key];
+}
+
+// Function to clear ABC hash table (for reloading data)
+void clear_abc_hash_table(lookup_set* lookups) {
+    clear_key_dictionary(lookups);
+    hash_index_free(&lookups->abc_table);
+    free(lookups->abc_numbers);
+    lookups->abc_numbers = NULL;
+    snapshot_close(lookups->abc_snapshot);
+    lookups->abc_snapshot = NULL;
+    lookups->abc_loaded = 0;
+}
+
+// Read the FB header row to find the REF column (column 0 unless named) and
+// the column of the target week, or of the first week column when FB does
+// not have the target week (-1 if there is none)
+void read_fb_header(sheet_reader* reader, const lookup_source* source, int week, int* ref_col, int* week_col) {
+    const char* value;
+
+    *ref_col = 0; // Use row labels (column 0) as REF
+    *week_col = -1;
+    if (sheet_next_row(reader)) {
+        int col = 0;
+        int first_available_week = -1;
+        int first_available_week_col = -1;
+        int target_week_found = 0;
+
+        report(source, "FB.xlsx header columns:\n");
+        while ((value = sheet_next_cell(reader)) != NULL) {
+            report(source, "  [%d] %s\n", col, value);
+            if (strcmp(value, "REF") == 0) {
+                *ref_col = col;
+                report(source, "    -> Found REF at column %d\n", col);
+            } else if (strcmp(value, "Étiquettes de lignes") == 0) {
+                // Handle French column name - treat it as REF column
+                *ref_col = col;
+                report(source, "    -> Found 'Étiquettes de lignes' at column %d (treating as REF)\n", col);
+            } else {
+                // Check if this is a week number (1 to 53, ISO weeks)
+                int week_num = fb_header_week(value);
+                if (week_num > 0) {
+                    // Store first available week for fallback
+                    if (first_available_week == -1) {
+                        first_available_week = week_num;
+                        first_available_week_col = col;
+                        report(source, "    -> First available week: %d at column %d\n", week_num, col);
+                    }
+
+                    // Check if this is our target week
+                    if (week_num == week) {
+                        *week_col = col;
+                        target_week_found = 1;
+                        report(source, "    -> Found target week %d at column %d\n", week_num, col);
+                    }
+                }
+            }
+            col++;
+        }
+        report(source, "FB.xlsx has %d columns\n", col);
+
+        // If target week not found, use first available week
+        if (!target_week_found && first_available_week != -1) {
+            *week_col = first_available_week_col;
+            report(source, "Warning: target week %d not found in FB.xlsx, using first available week %d at column %d\n",
+                   week, first_available_week, *week_col);
+        }
+    }
+}
+
+// Open the first sheet of FB.xlsx; warns and returns 0 if it cannot be read
+int open_fb_sheet(sheet_reader* reader, lookup_source* source) {
+    if (!open_workbook(reader, source->fb_path, source->reader_threads)) {
+        if (!source->fb_warned) {
+            report(source, "Warning: Could not open FB.xlsx file\n");
+            source->fb_warned = 1;
+        }
+        return 0;
+    }
+
+    if (!open_first_sheet(reader)) {
+        report(source, "Warning: Could not read FB.xlsx sheet\n");
+        close_sheet_reader(reader);
+        return 0;
+    }
+    return 1;
+}
+
+// Function to load FB data into hash table
+int load_fb_hash_table(lookup_set* lookups, lookup_source* source, int week) {
+    const char* fb_file = source->fb_path;
+    sheet_reader reader;
+    uint64_t source_size;
+    uint64_t source_hash = snapshot_source_hash(fb_file, &source_size);
+    
+    if (!source->rebuild_snapshots && source->fb_snapshot && source_size > 0
+        && (lookups->fb_snapshot = snapshot_open(source->fb_snapshot, source_hash, source_size, week)) != NULL) {
+        lookups->fb_table = *snapshot_index(lookups->fb_snapshot);
+        lookups->fb_numbers = parse_index_values(&lookups->fb_table);
+        lookups->fb_loaded = 1;
+        report(source, "Loaded %u FB entries for week %d from snapshot %s\n", lookups->fb_table.count, week, source->fb_snapshot);
+        if (!source->quiet) {
+            hash_index_print_stats("FB", &lookups->fb_table);
+        }
+        return 1;
+    }
+    
+    if (!open_fb_sheet(&reader, source)) {
+        return 0;
+    }
+
+    // Read header row to find REF column and week column
+    int ref_col, week_col;
+    read_fb_header(&reader, source, week, &ref_col, &week_col);
+
+    // Load data into hash table
+    if (ref_col >= 0 && week_col >= 0 && hash_index_init(&lookups->fb_table, expected_data_rows(fb_file))) {
+        int loaded_count = 0;
+        const char* ref_val;
+        const char* week_val;
+        while (read_key_value(&reader, ref_col, week_col, &ref_val, &week_val)) {
+            // Keys and values are copied into the index arena
+            if (ref_val && week_val && hash_index_put(&lookups->fb_table, ref_val, week_val)) {
+                loaded_count++;
+            }
+        }
+        
+        lookups->fb_numbers = parse_index_values(&lookups->fb_table);
+        lookups->fb_loaded = 1;
+        report(source, "Loaded %d FB entries into hash table for week %d\n", loaded_count, week);
+        if (!source->quiet) {
+            hash_index_print_stats("FB", &lookups->fb_table);
+        }
+        
+        if (save_snapshot(source, &lookups->fb_table, source->fb_snapshot, source_hash, source_size, week)) {
+            report(source, "Saved FB snapshot to %s\n", source->fb_snapshot);
+        }
+        
+        // Show some sample REF values for debugging
+        if (lookups->fb_table.count > 0) {
+            report(source, "Sample REF values from FB.xlsx:\n");
+            for (uint32_t i = 0; i < lookups->fb_table.count && i < 5; i++) {
+                report(source, "  %s -> %s\n", lookups->fb_table.arena + lookups->fb_table.entries[i].key_offset,
+                       lookups->fb_table.arena + lookups->fb_table.entries[i].value_offset);
+            }
+        }
+    }
+    
+    close_sheet_reader(&reader);
+    return lookups->fb_loaded;
+}
+
+// Function to get FB value by key id, as get_wlom_value_by_key does for ABC
+const char* get_fb_value_by_key(const lookup_set* lookups, uint32_t key, number_cell* number) {
+    *number = number_cell_null();
+    if (key == KEY_DICT_NONE || !lookups->fb_by_key || !lookups->fb_by_key[key]) {
+        return NULL;
+    }
+    *number = lookups->fb_number_by_key[key];
+    return lookups->fb_by_key[key];
+}
+
+// Function to clear hash table (for reloading data)
+void clear_fb_hash_table(lookup_set* lookups) {
+    clear_key_dictionary(lookups);
+    hash_index_free(&lookups->fb_table);
+    free(lookups->fb_numbers);
+    lookups->fb_numbers = NULL;
+    snapshot_close(lookups->fb_snapshot);
+    lookups->fb_snapshot = NULL;
+    lookups->fb_loaded = 0;
+}
+
+// Parse a matrix cell; empty and non-numeric cells stay empty (NaN)
+double fb_cell_value(const char* text) {
+    char* end;
+    double number;
+    if (!text || !*text) {
+        return NAN;
+    }
+    number = strtod(text, &end);
+    return end == text ? NAN : number;
+}
+
+void print_fb_matrix_summary(const lookup_source* source, const lookup_set* lookups, const char* path) {
+    report(source, "Loaded %u FB refs x %d weeks from %s (weeks", lookups->fb_weeks.refs.count, lookups->fb_weeks.week_count, path);
+    for (int c = 0; c < lookups->fb_weeks.week_count; c++) {
+        report(source, " %d", lookups->fb_weeks.weeks[c]);
+    }
+    report(source, ")\n");
+    if (!source->quiet) {
+        hash_index_print_stats("FB", &lookups->fb_weeks.refs);
+    }
+}
+
+// Read the FB header row: the REF column and the matrix column of every
+// sheet column (-1 for the columns that are not weeks). Returns how many
+// sheet columns are read, at most FB_SHEET_MAX_COLS.
+int read_fb_week_header(sheet_reader* reader, int* ref_col, int* week_of_col, int* weeks, int* week_count) {
+    const char* value;
+    int col_count = 0;
+
+    *ref_col = 0; // Use row labels (column 0) as REF
+    *week_count = 0;
+    if (sheet_next_row(reader)) {
+        while ((value = sheet_next_cell(reader)) != NULL) {
+            if (col_count < FB_SHEET_MAX_COLS) {
+                int week = fb_header_week(value);
+                week_of_col[col_count] = -1;
+                if (strcmp(value, "REF") == 0 || strcmp(value, "Étiquettes de lignes") == 0) {
+                    *ref_col = col_count;
+                } else if (week && *week_count < FB_MATRIX_MAX_WEEKS) {
+                    week_of_col[col_count] = *week_count;
+                    weeks[(*week_count)++] = week;
+                }
+            }
+            col_count++;
+        }
+    }
+    return col_count > FB_SHEET_MAX_COLS ? FB_SHEET_MAX_COLS : col_count;
+}
+
+// Load every week column of FB.xlsx in a single pass over the sheet
+int load_fb_matrix(lookup_set* lookups, lookup_source* source) {
+    const char* fb_file = source->fb_path;
+    sheet_reader reader;
+    int ref_col;
+    int week_of_col[FB_SHEET_MAX_COLS];
+    int weeks[FB_MATRIX_MAX_WEEKS];
+    int week_count;
+
+    if (!open_workbook(&reader, fb_file, source->reader_threads)) {
+        report(source, "Warning: Could not open FB.xlsx file\n");
+        return 0;
+    }
+    if (!open_first_sheet(&reader)) {
+        report(source, "Warning: Could not read FB.xlsx sheet\n");
+        close_sheet_reader(&reader);
+        return 0;
+    }
+
+    // Header: REF column and the matrix column of every week column
+    int col_count = read_fb_week_header(&reader, &ref_col, week_of_col, weeks, &week_count);
+
+    if (week_count > 0 && fb_matrix_init(&lookups->fb_weeks, weeks, week_count, expected_data_rows(fb_file))) {
+        const char* cells[FB_SHEET_MAX_COLS];
+        while (read_row_cells(&reader, col_count, cells)) {
+            int64_t matrix_row = cells[ref_col] ? fb_matrix_add_ref(&lookups->fb_weeks, cells[ref_col]) : -1;
+            for (int c = 0; c < col_count; c++) {
+                if (matrix_row >= 0 && week_of_col[c] >= 0) {
+                    fb_matrix_set(&lookups->fb_weeks, (uint32_t)matrix_row, week_of_col[c], fb_cell_value(cells[c]));
+                }
+            }
+        }
+        lookups->fb_weeks_loaded = 1;
+        print_fb_matrix_summary(source, lookups, fb_file);
+    } else {
+        report(source, "Warning: no week columns found in FB.xlsx\n");
+    }
+
+    close_sheet_reader(&reader);
+    return lookups->fb_weeks_loaded;
+}
+
+void clear_fb_matrix(lookup_set* lookups) {
+    clear_key_dictionary(lookups);
+    if (lookups->fb_weeks_loaded) {
+        fb_matrix_free(&lookups->fb_weeks);
+        lookups->fb_weeks_loaded = 0;
+    }
+}
+
+///////////////////////// key dictionary /////////////////////////
+
+#define KEYS_ABC 1
+#define KEYS_FB 2
+#define KEYS_FB_WEEKS 4
+
+static int loaded_key_tables(const lookup_set* lookups) {
+    return (lookups->abc_loaded ? KEYS_ABC : 0) | (lookups->fb_loaded ? KEYS_FB : 0)
+         | (lookups->fb_weeks_loaded ? KEYS_FB_WEEKS : 0);
+}
+
+static void add_table_keys(key_dict* keys, const hash_index* table, int* ok) {
+    for (uint32_t e = 0; *ok && e < table->count; e++) {
+        *ok = key_dict_add(keys, table->arena + table->entries[e].key_offset, table->entries[e].hash) != KEY_DICT_NONE;
+    }
+}
+
+// Values of a table by key id: text and number of every entry, NULL for the
+// keys the table does not have
+static int spread_table_values(const key_dict* keys, const hash_index* table, const number_cell* numbers,
+                               const char*** text_by_key, number_cell** number_by_key) {
+    *text_by_key = calloc(keys->count ? keys->count : 1, sizeof(char*));
+    *number_by_key = malloc((keys->count ? keys->count : 1) * sizeof(number_cell));
+    if (!*text_by_key || !*number_by_key) {
+        return 0;
+    }
+    for (uint32_t e = 0; e < table->count; e++) {
+        const hash_index_entry* entry = &table->entries[e];
+        uint32_t id = key_dict_find(keys, table->arena + entry->key_offset, entry->hash);
+        (*text_by_key)[id] = table->arena + entry->value_offset;
+        (*number_by_key)[id] = numbers ? numbers[e] : number_cell_null();
+    }
+    return 1;
+}
+
+// Heap bytes of the dictionary and of the arrays by key id
+size_t key_dictionary_memory(const lookup_set* lookups) {
+    size_t per_key = (lookups->abc_by_key ? sizeof(char*) + sizeof(number_cell) : 0)
+                   + (lookups->fb_by_key ? sizeof(char*) + sizeof(number_cell) : 0)
+                   + (lookups->fb_row_by_key ? sizeof(uint32_t) : 0);
+    return key_dict_memory(&lookups->keys) + (size_t)lookups->keys.count * per_key;
+}
+
+// Heap bytes of the loaded tables, their parsed values and the key dictionary
+size_t lookup_set_memory(const lookup_set* lookups) {
+    size_t bytes = key_dictionary_memory(lookups);
+    if (lookups->abc_loaded) {
+        bytes += hash_index_memory(&lookups->abc_table) + lookups->abc_table.count * sizeof(number_cell);
+    }
+    if (lookups->fb_loaded) {
+        bytes += hash_index_memory(&lookups->fb_table) + lookups->fb_table.count * sizeof(number_cell);
+    }
+    if (lookups->fb_weeks_loaded) {
+        bytes += fb_matrix_memory(&lookups->fb_weeks);
+    }
+    return bytes;
+}
+
+// Number every key of the loaded tables and lay their values out by key id.
+// Runs once loading is done, and again only if a table was loaded since.
+int build_key_dictionary(lookup_set* lookups) {
+    int tables = loaded_key_tables(lookups);
+    if (tables == lookups->keys_cover) {
+        return 0;
+    }
+    clear_key_dictionary(lookups);
+    if (tables == 0) {
+        return 0;
+    }
+
+    uint32_t expected = (lookups->abc_loaded ? lookups->abc_table.count : 0)
+                      + (lookups->fb_loaded ? lookups->fb_table.count : 0)
+                      + (lookups->fb_weeks_loaded ? lookups->fb_weeks.refs.count : 0);
+    int ok = key_dict_init(&lookups->keys, expected);
+    if (ok && lookups->abc_loaded) {
+        add_table_keys(&lookups->keys, &lookups->abc_table, &ok);
+    }
+    if (ok && lookups->fb_loaded) {
+        add_table_keys(&lookups->keys, &lookups->fb_table, &ok);
+    }
+    if (ok && lookups->fb_weeks_loaded) {
+        add_table_keys(&lookups->keys, &lookups->fb_weeks.refs, &ok);
+    }
+
+    if (ok && lookups->abc_loaded) {
+        ok = spread_table_values(&lookups->keys, &lookups->abc_table, lookups->abc_numbers,
+                                 &lookups->abc_by_key, &lookups->abc_number_by_key);
+    }
+    if (ok && lookups->fb_loaded) {
+        ok = spread_table_values(&lookups->keys, &lookups->fb_table, lookups->fb_numbers,
+                                 &lookups->fb_by_key, &lookups->fb_number_by_key);
+    }
+    if (ok && lookups->fb_weeks_loaded) {
+        const hash_index* refs = &lookups->fb_weeks.refs;
+        ok = (lookups->fb_row_by_key = malloc((lookups->keys.count ? lookups->keys.count : 1) * sizeof(uint32_t))) != NULL;
+        for (uint32_t id = 0; ok && id < lookups->keys.count; id++) {
+            lookups->fb_row_by_key[id] = KEY_DICT_NONE;
+        }
+        for (uint32_t e = 0; ok && e < refs->count; e++) {
+            uint32_t id = key_dict_find(&lookups->keys, refs->arena + refs->entries[e].key_offset, refs->entries[e].hash);
+            lookups->fb_row_by_key[id] = e;
+        }
+    }
+
+    if (!ok) {
+        // Every lookup misses rather than reading a half-built dictionary
+        fprintf(stderr, "Error: out of memory building the key dictionary\n");
+        clear_key_dictionary(lookups);
+        return 0;
+    }
+    lookups->keys_cover = tables;
+    return 1;
+}
+
+void print_key_dictionary(const lookup_set* lookups) {
+    printf("Key dictionary: %u keys (ABC %u, FB %u), %.1f KB\n", lookups->keys.count,
+           lookups->abc_loaded ? lookups->abc_table.count : 0,
+           lookups->fb_weeks_loaded ? lookups->fb_weeks.refs.count : (lookups->fb_loaded ? lookups->fb_table.count : 0),
+           key_dictionary_memory(lookups) / 1024.0);
+}
+
+// Id of a WIDF, KEY_DICT_NONE if no loaded table has it. The only hash of
+// the key a row computes.
+uint32_t find_key(const lookup_set* lookups, const char* widf_value) {
+    if (!widf_value || lookups->keys.count == 0) {
+        return KEY_DICT_NONE;
+    }
+    return key_dict_find(&lookups->keys, widf_value, hash_index_hash(widf_value));
+}
+
+void clear_lookup_set(lookup_set* lookups) {
+    clear_fb_hash_table(lookups);
+    clear_abc_hash_table(lookups);
+    clear_fb_matrix(lookups);
+}
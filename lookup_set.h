@@ -0,0 +1,109 @@
+#ifndef LOOKUP_SET_H
+#define LOOKUP_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fb_matrix.h"
+#include "hash_index.h"
+#include "key_dict.h"
+#include "sheet_reader.h"
+#include "snapshot.h"
+#include "typed_value.h"
+
+/*
+ * Everything loaded from ABC and FB. A normal run fills one set while the
+ * PCB header is parsed; --batch shares one loaded set between its workers
+ * and --watch swaps in a rebuilt set when ABC or FB changes; libautopcb
+ * (autopcb.h) serves lookups from one. Once loaded and its key dictionary
+ * built a set is only read, so any number of threads may look up in it
+ * without a lock.
+ */
+
+// Where a set is loaded from and how. The ABC and FB loaders may run on two
+// threads at once with the same source: each only writes its own warned flag.
+typedef struct {
+    const char* abc_path;       // ABC.xlsx
+    const char* fb_path;        // FB.xlsx
+    const char* abc_snapshot;   // binary snapshot of the ABC table (see snapshot.h), NULL for none
+    const char* fb_snapshot;
+    int reader_threads;         // > 0: parse with the fast reader on that many threads
+    int rebuild_snapshots;      // re-parse the xlsx even where a snapshot is valid
+    int quiet;                  // no progress messages on stdout
+    int abc_warned;             // "Could not open" already shown, shown once per source
+    int fb_warned;
+} lookup_source;
+
+typedef struct {
+    hash_index abc_table;       // ABC: WKIDF -> WKQCO
+    number_cell* abc_numbers;   // WKQCO values parsed at load, by entry number
+    snapshot* abc_snapshot;
+    int abc_loaded;
+    hash_index fb_table;        // FB: REF -> value of the selected week column
+    number_cell* fb_numbers;    // FB values parsed at load, by entry number
+    snapshot* fb_snapshot;
+    int fb_loaded;
+    fb_matrix fb_weeks;         // all week columns of FB for --weeks (see fb_matrix.h)
+    int fb_weeks_loaded;
+    // Once loading is done every key gets an id (see key_dict.h) and each
+    // table its values as arrays by id, so a row hashes its WIDF only once
+    key_dict keys;
+    const char** abc_by_key;    // WKQCO text of every key id, NULL if not in ABC
+    number_cell* abc_number_by_key;
+    const char** fb_by_key;     // FB week value of every key id, NULL if not in FB
+    number_cell* fb_number_by_key;
+    uint32_t* fb_row_by_key;    // fb_weeks row of every key id, KEY_DICT_NONE if absent
+    int keys_cover;             // tables the dictionary was built from, 0 if not built
+} lookup_set;
+
+// Columns of FB.xlsx read into the week matrix
+#define FB_SHEET_MAX_COLS 512
+
+// Week number of an FB header cell ("34"), 0 for REF, Total_général and the like
+int fb_header_week(const char* name);
+// Parse a matrix cell; empty and non-numeric cells stay empty (NaN)
+double fb_cell_value(const char* text);
+
+// Open the first sheet of ABC or FB; warn and return 0 if it cannot be read
+int open_abc_sheet(sheet_reader* reader, lookup_source* source);
+int open_fb_sheet(sheet_reader* reader, lookup_source* source);
+// Read the ABC header row to find the WKIDF and WKQCO columns (-1 if absent)
+void read_abc_header(sheet_reader* reader, const lookup_source* source, int* wkidf_col, int* wlom_col);
+// Read the FB header row to find the REF column (column 0 unless named) and
+// the column of the target week, or of the first week column when FB does
+// not have the target week (-1 if there is none)
+void read_fb_header(sheet_reader* reader, const lookup_source* source, int week, int* ref_col, int* week_col);
+// Read the FB header row: the REF column and the matrix column of every
+// sheet column (-1 for the columns that are not weeks). Returns how many
+// sheet columns are read, at most FB_SHEET_MAX_COLS.
+int read_fb_week_header(sheet_reader* reader, int* ref_col, int* week_of_col, int* weeks, int* week_count);
+
+// Load a table into the set; 0 if it could not be loaded
+int load_abc_hash_table(lookup_set* lookups, lookup_source* source);
+int load_fb_hash_table(lookup_set* lookups, lookup_source* source, int week);
+int load_fb_matrix(lookup_set* lookups, lookup_source* source);
+// "Loaded ... FB refs x ... weeks from path" and the index stats of the matrix
+void print_fb_matrix_summary(const lookup_source* source, const lookup_set* lookups, const char* path);
+
+// Number every key of the loaded tables and lay their values out by key id.
+// Returns 1 when it built a new dictionary, 0 when the one there covers the
+// loaded tables already or it could not be built.
+int build_key_dictionary(lookup_set* lookups);
+void print_key_dictionary(const lookup_set* lookups);
+// Id of a WIDF, KEY_DICT_NONE if no loaded table has it
+uint32_t find_key(const lookup_set* lookups, const char* widf_value);
+// ABC and FB values of a key id: the text (NULL if absent), pointing into
+// the table, and its number parsed at load time. Only read the set.
+const char* get_wlom_value_by_key(const lookup_set* lookups, uint32_t key, number_cell* number);
+const char* get_fb_value_by_key(const lookup_set* lookups, uint32_t key, number_cell* number);
+// Heap bytes of the key dictionary with the arrays by key id, and of the
+// loaded tables with their parsed values and the dictionary
+size_t key_dictionary_memory(const lookup_set* lookups);
+size_t lookup_set_memory(const lookup_set* lookups);
+
+void clear_key_dictionary(lookup_set* lookups);
+void clear_abc_hash_table(lookup_set* lookups);
+void clear_fb_hash_table(lookup_set* lookups);
+void clear_fb_matrix(lookup_set* lookups);
+void clear_lookup_set(lookup_set* lookups);
+
+#endif
@@ -1,18 +1,33 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-int main(void) {
+int main(int argc, char* argv[]) {
     int rc;
 
-    printf("Exporting tables to input/*.xlsx...\n");
-    rc = system("python3 export_sqlite_to_xlsx.py");
-    if (rc != 0) {
-        fprintf(stderr, "export_sqlite_to_xlsx.py failed\n");
-        return 1;
+    // Legacy path: export data.db to input/*.xlsx and convert those files
+    if (argc > 1 && strcmp(argv[1], "--xlsx") == 0) {
+        printf("Exporting tables to input/*.xlsx...\n");
+        rc = system("python3 export_sqlite_to_xlsx.py");
+        if (rc != 0) {
+            fprintf(stderr, "export_sqlite_to_xlsx.py failed\n");
+            return 1;
+        }
+
+        printf("Running modif...\n");
+        rc = system("./modif");
+        if (rc != 0) {
+            fprintf(stderr, "modif failed\n");
+            return 1;
+        }
+
+        printf("Done.\n");
+        return 0;
     }
 
-    printf("Running modif...\n");
-    rc = system("./modif");
+    // modif reads the abc, fb and pcb tables directly, no intermediate xlsx
+    printf("Running modif on data.db...\n");
+    rc = system("./modif --db data.db");
     if (rc != 0) {
         fprintf(stderr, "modif failed\n");
         return 1;
@@ -20,4 +35,4 @@ int main(void) {
 
     printf("Done.\n");
     return 0;
-}
\ No newline at end of file
+}
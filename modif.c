@@ -1,9 +1,42 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 #include <xlsxio_read.h>
-#include <xlsxwriter.h>
+#include <sqlite3.h>
+#include "arena.h"
+#include "batch_queue.h"
+#include "column_kernels.h"
+#include "column_plan.h"
+#include "column_spec.h"
+#include "fb_matrix.h"
+#include "hash_index.h"
+#include "key_dict.h"
+#include "lookup_set.h"
+#include "output_diff.h"
+#include "output_sink.h"
+#include "perf_counters.h"
+#include "row_cache.h"
+#include "run_stats.h"
+#include "sheet_reader.h"
+#include "snapshot.h"
+#include "spill.h"
+#include "summary_report.h"
+#include "typed_value.h"
+#include "work_pool.h"
+#include "xlsx_fast.h"
+#include "xlsx_zip.h"
 
 // Provide a portable strdup for C99 without POSIX prototype
 static char* safe_strdup(const char* source) {
@@ -22,736 +55,3255 @@ static char* safe_strdup(const char* source) {
 #define strdup safe_strdup
 
 /*
- * This program extracts specific columns from PCB.xlsx and creates Excel formulas
- * for FB and MAX columns instead of pre-calculating values.
- * 
- * FB column: Uses VLOOKUP to get values from FB.xlsx based on WIDF (REF) and current week
- * WLOM column: Uses lookup to get values from ABC.xlsx WKQCO column based on WKIDF matching WIDF
- * MAX column: Uses Excel's MAX function to compare FB and WCMJ values
+ * This program extracts columns from PCB.xlsx and computes the lookup and
+ * derived columns from ABC.xlsx and FB.xlsx. The output columns come from a
+ * column spec (see column_spec.h): the one given with --columns, or one of
+ * the default layouts of column_plan.c.
+ *
+ * WLOM: WKQCO of the ABC row whose WKIDF matches WIDF
+ * FB: value of the current week in the FB row whose REF matches WIDF
+ * MAX: the larger of FB and WCMJ; couv: WSTKG / MAX
 */
 
+// Number of ISO 8601 weeks in a year: 53 when the year starts on a Thursday,
+// or on a Wednesday in a leap year, 52 otherwise
+static int iso_weeks_in_year(int year) {
+    int dec31 = (year + year / 4 - year / 100 + year / 400) % 7;
+    int prev = year - 1;
+    int prev_dec31 = (prev + prev / 4 - prev / 100 + prev / 400) % 7;
+    return (dec31 == 4 || prev_dec31 == 3) ? 53 : 52;
+}
 
-const char* wanted_cols[] = {
-    "WSTB","WIDF","WFOR","WGES","WPIV","WDES","WCOF","WLOM",
-    "WCMJ","WSTKG","FB","MAX"
-};
-#define NUM_COLS (sizeof(wanted_cols)/sizeof(wanted_cols[0]))
-
-int col_indices[NUM_COLS]; // Store matching indices
+// ISO 8601 week of a date. Weeks start on Monday and week 1 holds the first
+// Thursday of the year, so 29-31 December may belong to week 1 of the next
+// year and 1-3 January to week 52 or 53 of the previous one.
+static int iso_week(const struct tm* date, int* iso_year) {
+    int weekday = (date->tm_wday + 6) % 7; // Monday = 0
+    int year = date->tm_year + 1900;
+    int week = (date->tm_yday - weekday + 10) / 7;
 
-// Function to get current week number
+    if (week < 1) {
+        year--;
+        week = iso_weeks_in_year(year);
+    } else if (week > iso_weeks_in_year(year)) {
+        year++;
+        week = 1;
+    }
+    if (iso_year) {
+        *iso_year = year;
+    }
+    return week;
+}
 
-int get_current_week() {
+// Function to get current week number (ISO 8601) and its ISO year
+int get_current_week(int* iso_year) {
     time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    
-    // Calculate week number (ISO 8601 week)
-    int day_of_year = tm_info->tm_yday + 1;
-    
-    // Simple week calculation (you might want to use ISO 8601 for more accuracy)
-    int week = (day_of_year + 6) / 7;
+    struct tm tm_info;
+    // localtime_r: the --watch builder and watcher threads both ask
+    localtime_r(&now, &tm_info);
     
     // Return calculated week - will be automatically detected in FB.xlsx
-    return week;
+    return iso_week(&tm_info, iso_year);
+}
+
+// Parse a --weeks horizon into consecutive ISO weeks:
+//   "34-8"  weeks 34 to 8, wrapping from the last week of the year to week 1
+//   "+4"    the current week and the 3 following ones
+//   "42"    a single week
+// A range that ends before the current week without wrapping is taken to
+// be next ISO year's; any other range starts this year, so a range holding
+// the current week is always this year's. Whether week 53 exists is decided
+// by the year the range runs through.
+// Returns the number of weeks, 0 if the spec is invalid.
+static int parse_week_horizon(const char* spec, int current_week, int iso_year, int* weeks) {
+    char* end;
+    int first, count;
+
+    if (spec[0] == '+') {
+        count = (int)strtol(spec + 1, &end, 10);
+        if (*end != '\0' || count < 1 || count > MAX_HORIZON_WEEKS) {
+            return 0;
+        }
+        first = current_week;
+    } else {
+        int last;
+        first = (int)strtol(spec, &end, 10);
+        if (*end == '-') {
+            last = (int)strtol(end + 1, &end, 10);
+        } else {
+            last = first;
+        }
+        if (*end != '\0' || first < 1 || last < 1) {
+            return 0;
+        }
+        if (last >= first && last < current_week) {
+            iso_year++;
+        }
+        if (first > iso_weeks_in_year(iso_year) || last > iso_weeks_in_year(iso_year + (last < first))) {
+            return 0;
+        }
+        count = last >= first ? last - first + 1 : iso_weeks_in_year(iso_year) - first + 1 + last;
+        if (count > MAX_HORIZON_WEEKS) {
+            return 0;
+        }
+    }
+
+    for (int i = 0, week = first; i < count; i++) {
+        weeks[i] = week;
+        if (++week > iso_weeks_in_year(iso_year)) {
+            week = 1;
+            iso_year++;
+        }
+    }
+    return count;
+}
+
+
+// Phase timings and counters, reported with --stats / --stats-json
+static run_stats stats;
+
+// --perf-counters: counters the probe in main could open, 0 when off
+static unsigned perf_counters_available = 0;
+
+// Count the calling thread into a perf phase of the run (see perf_counters.h);
+// the tracker does nothing without --perf-counters
+static void open_perf_tracker(perf_tracker* tracker, int phase) {
+    if (!perf_counters_available || !perf_tracker_open(tracker, phase)) {
+        perf_tracker_inert(tracker);
+    }
 }
 
+static lookup_set run_lookups;
 
-// Global flag to show warning only once
-static int fb_warning_shown = 0;
-static int abc_warning_shown = 0;
+// ABC and FB of every run, and the binary snapshots of their tables, mmapped
+// instead of re-parsing the xlsx when the source contents did not change
+// (see snapshot.h). --reload sets rebuild_snapshots for the first load.
+static lookup_source reference_files = {
+    .abc_path = "input/ABC.xlsx",
+    .fb_path = "input/FB.xlsx",
+    .abc_snapshot = "input/ABC.xlsx.snap",
+    .fb_snapshot = "input/FB.xlsx.snap"
+};
+
+///////////////////////// sheet readers /////////////////////////
 
+// Sheets are read through xlsxio, or with --fast-reader by the built-in
+// parallel reader (see sheet_reader.h)
 
-// Simple hash table for FB data
-#define HASH_SIZE 10000
+static int fast_reader_threads = 0; // --fast-reader: parse threads, 0 reads with xlsxio
+static int fast_writer_threads = 0; // --fast-writer: deflate threads, 0 writes with libxlsxwriter
+static int deflate_level = 6;       // --deflate-level of the --fast-writer output
 
-typedef struct fb_hash_entry {
-    char* ref;
-    char* value;
-    struct fb_hash_entry* next;
-} fb_hash_entry;
+// --scan-sheet: read every cell of a sheet with the selected reader and print
+// a digest of the cell stream, so the two readers can be compared
+static int scan_sheet(const char* path) {
+    sheet_reader reader;
+    uint64_t digest = ROW_CACHE_SEED;
+    uint64_t rows = 0, cells = 0;
+    double started = stats_now();
+
+    if (!open_workbook(&reader, path, fast_reader_threads) || !open_first_sheet(&reader)) {
+        fprintf(stderr, "Error opening %s\n", path);
+        close_sheet_reader(&reader);
+        return 1;
+    }
+    while (sheet_next_row(&reader)) {
+        const char* value;
+        while ((value = sheet_next_cell(&reader)) != NULL) {
+            digest = row_cache_hash_text(digest, value);
+            cells++;
+        }
+        // Row boundaries are part of the digest
+        digest = row_cache_hash_text(digest, NULL);
+        rows++;
+    }
+    int ok = !reader.fast || !xlsx_fast_failed(reader.fast);
+    int fast = reader.fast != NULL;
+    close_sheet_reader(&reader);
+    double seconds = stats_now() - started;
 
-static fb_hash_entry* fb_hash_table[HASH_SIZE] = {NULL};
-static int fb_cache_loaded = 0;
+    printf("%s: %llu rows, %llu cells, digest %016llx, %.3f s, %.2f M cells/s (%s",
+           path, (unsigned long long)rows, (unsigned long long)cells, (unsigned long long)digest,
+           seconds, seconds > 0 ? cells / seconds / 1e6 : 0.0, fast ? "fast reader" : "xlsxio");
+    if (fast) {
+        printf(", %d threads", fast_reader_threads);
+    }
+    printf(")\n");
+    if (!ok) {
+        fprintf(stderr, "Error: %s could not be read to the end\n", path);
+    }
+    return ok ? 0 : 1;
+}
 
-// Simple hash table for ABC data
-typedef struct abc_hash_entry {
-    char* wkidf;
-    char* wlom_value;
-    struct abc_hash_entry* next;
-} abc_hash_entry;
+///////////////////////// spilled tables (--mem-limit) /////////////////////////
 
-static abc_hash_entry* abc_hash_table[HASH_SIZE] = {NULL};
-static int abc_cache_loaded = 0;
+// When ABC and FB would not fit in --mem-limit they are not loaded whole:
+// their rows are written to partition files by key hash (spill.h), the PCB
+// rows are partitioned the same way while they are read, and every partition
+// of the tables is then loaded on its own and joined with its PCB rows (see
+// run_spilled_join). A grace hash join: one partition in memory at a time.
+typedef struct {
+    spill_set* abc;         // per row: WKIDF, WKQCO
+    spill_set* fb;          // per row: REF and the week value, or with a horizon REF and a double per week
+    spill_set* pcb;         // per row: the plan inputs
+    spill_set* output;      // per row: WIDF and fingerprint (--incremental), then the output cells
+    spill_set* order;       // partition of every PCB row, in PCB order (a single partition)
+    uint32_t abc_rows[SPILL_MAX_PARTITIONS];
+    uint32_t fb_rows[SPILL_MAX_PARTITIONS];
+    uint64_t pcb_rows[SPILL_MAX_PARTITIONS];
+    int abc_spilled;
+    int fb_spilled;
+    int fb_weeks[FB_MATRIX_MAX_WEEKS];  // horizon: week of each spilled value
+    int fb_week_count;
+    uint64_t mem_limit;
+    int shift;              // hash bits used by the joins this one was split from
+    int no_split;           // its split put every row in one partition: not split again
+    int splits;             // partitions split again, in this join and the joins split from it
+    uint64_t split_bytes;   // spilled by the joins split from it
+    size_t peak_bytes;      // largest partition of the tables once loaded
+} spilled_join;
 
-// Simple hash function
-unsigned int hash_string(const char* str) {
-    unsigned int hash = 5381;
-    int c;
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c;
+static void free_spilled_join(spilled_join* join) {
+    if (!join) {
+        return;
     }
-    return hash % HASH_SIZE;
+    spill_close(join->abc);
+    spill_close(join->fb);
+    spill_close(join->pcb);
+    spill_close(join->output);
+    spill_close(join->order);
+    free(join);
 }
 
-// Function to load ABC data into hash table
-int load_abc_hash_table() {
-    const char* abc_file = "input/ABC.xlsx";
-    xlsxioreader reader;
-    xlsxioreadersheet sheet;
-    
-    if ((reader = xlsxioread_open(abc_file)) == NULL) {
-        if (!abc_warning_shown) {
-            printf("Warning: Could not open ABC.xlsx file\n");
-            abc_warning_shown = 1;
-        }
-        return 0;
+static spilled_join* create_spilled_join(int partitions, uint64_t mem_limit) {
+    spilled_join* join = calloc(1, sizeof(spilled_join));
+    if (!join) {
+        return NULL;
+    }
+    join->mem_limit = mem_limit;
+    join->abc = spill_create(partitions);
+    join->fb = spill_create(partitions);
+    join->pcb = spill_create(partitions);
+    join->output = spill_create(partitions);
+    join->order = spill_create(1);
+    if (!join->abc || !join->fb || !join->pcb || !join->output || !join->order) {
+        free_spilled_join(join);
+        return NULL;
     }
+    return join;
+}
 
-int load_db(){
-    const char* backup_FB = "FB.xlsx.backup";
-    
+static int spilled_partition(const spilled_join* join, const char* key) {
+    return spill_partition_of(join->pcb, hash_index_hash(key) << join->shift);
 }
-    
-    if ((sheet = xlsxioread_sheet_open(reader, NULL, XLSXIOREAD_SKIP_EMPTY_ROWS)) == NULL) {
-        printf("Warning: Could not read ABC.xlsx sheet\n");
-        xlsxioread_close(reader);
+
+static uint64_t spilled_join_bytes(const spilled_join* join) {
+    return spill_bytes(join->abc) + spill_bytes(join->fb) + spill_bytes(join->pcb)
+         + spill_bytes(join->output) + spill_bytes(join->order) + join->split_bytes;
+}
+
+static int spilled_join_failed(const spilled_join* join) {
+    return spill_failed(join->abc) || spill_failed(join->fb) || spill_failed(join->pcb)
+        || spill_failed(join->output) || spill_failed(join->order);
+}
+
+static void spill_pair(spill_set* set, uint32_t* rows, int partition, const char* key, const char* value) {
+    spill_write_text(set, partition, key);
+    spill_write_text(set, partition, value);
+    rows[partition]++;
+}
+
+// Partition the WKIDF -> WKQCO rows of ABC.xlsx, as load_abc_hash_table reads them
+static int spill_abc_table(spilled_join* join) {
+    sheet_reader reader;
+
+    if (!open_abc_sheet(&reader, &reference_files)) {
         return 0;
     }
-    
-    char* value;
-    int wkidf_col = -1;
-    int wlom_col = -1; // Will be set to WKQCO column
-    
-    // Read header row to find WKIDF and WKQCO columns
-    if (xlsxioread_sheet_next_row(sheet)) {
-        int col = 0;
-        printf("ABC.xlsx header columns:\n");
-        while ((value = xlsxioread_sheet_next_cell(sheet)) != NULL) {
-            printf("  [%d] %s\n", col, value);
-            if (strcmp(value, "WKIDF") == 0) {
-                wkidf_col = col;
-                printf("    -> Found WKIDF at column %d\n", col);
-            } else if (strcmp(value, "WKQCO") == 0) {
-                wlom_col = col;
-                printf("    -> Found WKQCO at column %d (using for WLOM)\n", col);
-            } else if (strcmp(value, "WLOM") == 0) {
-                // Keep WLOM as fallback if WKQCO not found
-                if (wlom_col == -1) {
-                    wlom_col = col;
-                    printf("    -> Found WLOM at column %d (fallback)\n", col);
-                }
-            }
-            free(value);
-            col++;
-        }
-        printf("ABC.xlsx has %d columns\n", col);
-    }
-    
-    // Load data into hash table
+    int wkidf_col, wlom_col;
+    read_abc_header(&reader, &reference_files, &wkidf_col, &wlom_col);
     if (wkidf_col >= 0 && wlom_col >= 0) {
-        int loaded_count = 0;
-        while (xlsxioread_sheet_next_row(sheet)) {
-            char* wkidf_val = NULL;
-            char* wlom_val = NULL;
-            int col = 0;
-            
-            while ((value = xlsxioread_sheet_next_cell(sheet)) != NULL) {
-                if (col == wkidf_col) {
-                    wkidf_val = strdup(value);
-                } else if (col == wlom_col) {
-                    wlom_val = strdup(value);
-                }
-                free(value);
-                col++;
-            }
-            
+        uint64_t spilled = 0;
+        const char* wkidf_val;
+        const char* wlom_val;
+        while (read_key_value(&reader, wkidf_col, wlom_col, &wkidf_val, &wlom_val)) {
             if (wkidf_val && wlom_val) {
-                // Create hash entry
-                abc_hash_entry* entry = malloc(sizeof(abc_hash_entry));
-                if (entry) {
-                    entry->wkidf = wkidf_val;
-                    entry->wlom_value = wlom_val;
-                    
-                    // Insert into hash table
-                    unsigned int hash = hash_string(wkidf_val);
-                    entry->next = abc_hash_table[hash];
-                    abc_hash_table[hash] = entry;
-                    loaded_count++;
-                } else {
-                    free(wkidf_val);
-                    free(wlom_val);
-                }
-            } else {
-                if (wkidf_val) free(wkidf_val);
-                if (wlom_val) free(wlom_val);
-            }
-        }
-        
-        abc_cache_loaded = 1;
-        printf("Loaded %d ABC entries into hash table\n", loaded_count);
-        
-        // Show some sample WKIDF values for debugging
-        if (loaded_count > 0) {
-            printf("Sample WKIDF values from 'ABC.xlsx':\n");
-            int sample_count = 0;
-            for (int i = 0; i < HASH_SIZE && sample_count < 5; i++) {
-                abc_hash_entry* entry = abc_hash_table[i];
-                while (entry && sample_count < 5) {
-                    printf("  %s\n", entry->wkidf);
-                    sample_count++;
-                    entry = entry->next;
-                }
+                spill_pair(join->abc, join->abc_rows, spilled_partition(join, wkidf_val), wkidf_val, wlom_val);
+                spilled++;
             }
         }
+        join->abc_spilled = 1;
+        printf("Spilled %llu ABC entries into %d partitions\n", (unsigned long long)spilled,
+               spill_partitions(join->abc));
     }
-    
-    xlsxioread_sheet_close(sheet);
-    xlsxioread_close(reader);
-    return abc_cache_loaded;
+    close_sheet_reader(&reader);
+    return join->abc_spilled;
 }
 
-// Function to get WLOM value from ABC hash table
-char* get_wlom_value_by_widf(const char* widf_value) {
-    // Load hash table if not loaded
-    if (!abc_cache_loaded) {
-        if (!load_abc_hash_table()) {
-            return NULL;
-        }
+// Partition the REF -> week value rows of FB.xlsx, as load_fb_hash_table reads them
+static int spill_fb_table(spilled_join* join, int week) {
+    sheet_reader reader;
+
+    if (!open_fb_sheet(&reader, &reference_files)) {
+        return 0;
     }
-    
-    // Search in hash table
-    unsigned int hash = hash_string(widf_value);
-    abc_hash_entry* entry = abc_hash_table[hash];
-    
-    while (entry) {
-        if (strcmp(entry->wkidf, widf_value) == 0) {
-            return strdup(entry->wlom_value);
+    int ref_col, week_col;
+    read_fb_header(&reader, &reference_files, week, &ref_col, &week_col);
+    if (ref_col >= 0 && week_col >= 0) {
+        uint64_t spilled = 0;
+        const char* ref_val;
+        const char* week_val;
+        while (read_key_value(&reader, ref_col, week_col, &ref_val, &week_val)) {
+            if (ref_val && week_val) {
+                spill_pair(join->fb, join->fb_rows, spilled_partition(join, ref_val), ref_val, week_val);
+                spilled++;
+            }
         }
-        entry = entry->next;
+        join->fb_spilled = 1;
+        printf("Spilled %llu FB entries for week %d into %d partitions\n", (unsigned long long)spilled, week,
+               spill_partitions(join->fb));
     }
-    
-    return NULL;
+    close_sheet_reader(&reader);
+    return join->fb_spilled;
 }
 
-// Function to clear ABC hash table (for reloading data)
-void clear_abc_hash_table() {
-    for (int i = 0; i < HASH_SIZE; i++) {
-        abc_hash_entry* entry = abc_hash_table[i];
-        while (entry) {
-            abc_hash_entry* next = entry->next;
-            free(entry->wkidf);
-            free(entry->wlom_value);
-            free(entry);
-            entry = next;
-        }
-        abc_hash_table[i] = NULL;
-    }
-    abc_cache_loaded = 0;
-}
+// Partition the FB rows with every week column, as load_fb_matrix reads them
+static int spill_fb_week_rows(spilled_join* join) {
+    sheet_reader reader;
+    int ref_col;
+    int week_of_col[FB_SHEET_MAX_COLS];
 
-// Function to load FB data into hash table
-int load_fb_hash_table(int week) {
-    const char* fb_file = "input/FB.xlsx";
-    xlsxioreader reader;
-    xlsxioreadersheet sheet;
-    
-    if ((reader = xlsxioread_open(fb_file)) == NULL) {
-        if (!fb_warning_shown) {
-            printf("Warning: Could not open FB.xlsx file\n");
-            fb_warning_shown = 1;
-        }
+    if (!open_workbook(&reader, reference_files.fb_path, reference_files.reader_threads)) {
+        printf("Warning: Could not open FB.xlsx file\n");
         return 0;
     }
-    
-    if ((sheet = xlsxioread_sheet_open(reader, NULL, XLSXIOREAD_SKIP_EMPTY_ROWS)) == NULL) {
+    if (!open_first_sheet(&reader)) {
         printf("Warning: Could not read FB.xlsx sheet\n");
-        xlsxioread_close(reader);
+        close_sheet_reader(&reader);
         return 0;
     }
-    
-    char* value;
-    int ref_col = 0; // Use row labels (column 0) as REF
-    int week_col = -1;
-    
-    // Read header row to find REF column and week column
-    if (xlsxioread_sheet_next_row(sheet)) {
-        int col = 0;
-        int first_available_week = -1;
-        int first_available_week_col = -1;
-        int target_week_found = 0;
-        
-        printf("FB.xlsx header columns:\n");
-        while ((value = xlsxioread_sheet_next_cell(sheet)) != NULL) {
-            printf("  [%d] %s\n", col, value);
-            if (strcmp(value, "REF") == 0) {
-                ref_col = col;
-                printf("    -> Found REF at column %d\n", col);
-            } else if (strcmp(value, "Étiquettes de lignes") == 0) {
-                // Handle French column name - treat it as REF column
-                ref_col = col;
-                printf("    -> Found 'Étiquettes de lignes' at column %d (treating as REF)\n", col);
-            } else {
-                // Check if this is a week number
-                int week_num = atoi(value);
-                if (week_num >= 1 && week_num <= 52) {
-                    // Store first available week for fallback
-                    if (first_available_week == -1) {
-                        first_available_week = week_num;
-                        first_available_week_col = col;
-                        printf("    -> First available week: %d at column %d\n", week_num, col);
-                    }
-                    
-                    // Check if this is our target week
-                    if (week_num == week) {
-                        week_col = col;
-                        target_week_found = 1;
-                        printf("    -> Found target week %d at column %d\n", week_num, col);
-                    }
-                }
-            }
-            free(value);
-            col++;
-        }
-        printf("FB.xlsx has %d columns\n", col);
-        
-        // If target week not found, use first available week
-        if (!target_week_found && first_available_week != -1) {
-            week_col = first_available_week_col;
-            printf("    -> Target week %d not found, using first available week %d at column %d\n", 
-                   week, first_available_week, week_col);
-        }
-    }
-    
-    // Load data into hash table
-    if (ref_col >= 0 && week_col >= 0) {
-        int loaded_count = 0;
-        while (xlsxioread_sheet_next_row(sheet)) {
-            char* ref_val = NULL;
-            char* week_val = NULL;
-            int col = 0;
-            
-            while ((value = xlsxioread_sheet_next_cell(sheet)) != NULL) {
-                if (col == ref_col) {
-                    ref_val = strdup(value);
-                } else if (col == week_col) {
-                    week_val = strdup(value);
-                }
-                free(value);
-                col++;
-            }
-            
-            if (ref_val && week_val) {
-                // Create hash entry
-                fb_hash_entry* entry = malloc(sizeof(fb_hash_entry));
-                if (entry) {
-                    entry->ref = ref_val;
-                    entry->value = week_val;
-                    
-                    // Insert into hash table
-                    unsigned int hash = hash_string(ref_val);
-                    entry->next = fb_hash_table[hash];
-                    fb_hash_table[hash] = entry;
-                    loaded_count++;
-                } else {
-                    free(ref_val);
-                    free(week_val);
-                }
-            } else {
-                if (ref_val) free(ref_val);
-                if (week_val) free(week_val);
+
+    int col_count = read_fb_week_header(&reader, &ref_col, week_of_col, join->fb_weeks, &join->fb_week_count);
+    if (join->fb_week_count > 0) {
+        const char* cells[FB_SHEET_MAX_COLS];
+        double values[FB_MATRIX_MAX_WEEKS];
+        uint64_t spilled = 0;
+        while (read_row_cells(&reader, col_count, cells)) {
+            if (!cells[ref_col]) {
+                continue;
             }
-        }
-        
-        fb_cache_loaded = 1;
-        printf("Loaded %d FB entries into hash table for week %d\n", loaded_count, week);
-        
-        // Show some sample REF values for debugging
-        if (loaded_count > 0) {
-            printf("Sample REF values from FB.xlsx:\n");
-            int sample_count = 0;
-            for (int i = 0; i < HASH_SIZE && sample_count < 5; i++) {
-                fb_hash_entry* entry = fb_hash_table[i];
-                while (entry && sample_count < 5) {
-                    printf("  %s -> %s\n", entry->ref, entry->value);
-                    sample_count++;
-                    entry = entry->next;
+            for (int c = 0; c < col_count; c++) {
+                if (week_of_col[c] >= 0) {
+                    values[week_of_col[c]] = fb_cell_value(cells[c]);
                 }
             }
+            int partition = spilled_partition(join, cells[ref_col]);
+            spill_write_text(join->fb, partition, cells[ref_col]);
+            spill_write(join->fb, partition, values, join->fb_week_count * sizeof(double));
+            join->fb_rows[partition]++;
+            spilled++;
         }
+        join->fb_spilled = 1;
+        printf("Spilled %llu FB refs x %d weeks into %d partitions\n", (unsigned long long)spilled,
+               join->fb_week_count, spill_partitions(join->fb));
+    } else {
+        printf("Warning: no week columns found in FB.xlsx\n");
     }
-    
-    xlsxioread_sheet_close(sheet);
-    xlsxioread_close(reader);
-    return fb_cache_loaded;
+    close_sheet_reader(&reader);
+    return join->fb_spilled;
 }
 
-// Function to get FB value from hash table
-char* get_fb_value_by_widf(const char* widf_value, int week) {
-    // Load hash table if not loaded
-    if (!fb_cache_loaded) {
-        if (!load_fb_hash_table(week)) {
-            return NULL;
-        }
+// Read one partition of spilled pairs back into an index, in the order they
+// were spilled (so the last row of a key still wins)
+static int load_spilled_pairs(spill_set* set, int partition, uint32_t rows, hash_index* index, arena* text) {
+    const char* key;
+    const char* value;
+
+    if (!spill_rewind(set, partition)) {
+        return 0;
     }
-    
-    // Search in hash table
-    unsigned int hash = hash_string(widf_value);
-    fb_hash_entry* entry = fb_hash_table[hash];
-    
-    while (entry) {
-        if (strcmp(entry->ref, widf_value) == 0) {
-            return strdup(entry->value);
+    for (uint32_t i = 0; i < rows; i++) {
+        if (!spill_read_text(set, partition, text, &key) || !spill_read_text(set, partition, text, &value)
+            || !hash_index_put(index, key, value)) {
+            return 0;
         }
-        entry = entry->next;
+        arena_reset(text);
     }
-    
-    return NULL;
+    return 1;
 }
 
-// Function to clear hash table (for reloading data)
-void clear_fb_hash_table() {
-    for (int i = 0; i < HASH_SIZE; i++) {
-        fb_hash_entry* entry = fb_hash_table[i];
-        while (entry) {
-            fb_hash_entry* next = entry->next;
-            free(entry->ref);
-            free(entry->value);
-            free(entry);
-            entry = next;
+static int load_spilled_week_rows(spilled_join* join, int partition, fb_matrix* matrix, arena* text) {
+    const char* ref;
+    double values[FB_MATRIX_MAX_WEEKS];
+
+    if (!spill_rewind(join->fb, partition)) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < join->fb_rows[partition]; i++) {
+        if (!spill_read_text(join->fb, partition, text, &ref)
+            || !spill_read(join->fb, partition, values, join->fb_week_count * sizeof(double))) {
+            return 0;
+        }
+        int64_t matrix_row = fb_matrix_add_ref(matrix, ref);
+        if (matrix_row < 0) {
+            return 0;
         }
-        fb_hash_table[i] = NULL;
+        for (int c = 0; c < join->fb_week_count; c++) {
+            fb_matrix_set(matrix, (uint32_t)matrix_row, c, values[c]);
+        }
+        arena_reset(text);
     }
-    fb_cache_loaded = 0;
+    return 1;
 }
 
-// Function to get the maximum value between FB and WCMJ
-char* get_max_value(const char* fb_value, const char* wcmj_value) {
-    if (!fb_value && !wcmj_value) {
-        return NULL;
+// Load one partition of the spilled tables into an empty lookup set, and
+// give its disk space back. Returns 0 if it cannot be read back or does not
+// fit in memory.
+static int load_spilled_partition(spilled_join* join, int partition, lookup_set* lookups) {
+    arena text;
+    int ok = 1;
+
+    arena_init(&text, 4096);
+    if (join->abc_spilled) {
+        ok = hash_index_init(&lookups->abc_table, join->abc_rows[partition]);
+        lookups->abc_loaded = ok;
+        ok = ok && load_spilled_pairs(join->abc, partition, join->abc_rows[partition], &lookups->abc_table, &text);
+        lookups->abc_numbers = ok ? parse_index_values(&lookups->abc_table) : NULL;
+        spill_drop(join->abc, partition);
     }
-    
-    if (!fb_value) {
-        return strdup(wcmj_value);
+    if (ok && join->fb_spilled && join->fb_week_count > 0) {
+        ok = fb_matrix_init(&lookups->fb_weeks, join->fb_weeks, join->fb_week_count, join->fb_rows[partition]);
+        lookups->fb_weeks_loaded = ok;
+        ok = ok && load_spilled_week_rows(join, partition, &lookups->fb_weeks, &text);
+        spill_drop(join->fb, partition);
+    } else if (ok && join->fb_spilled) {
+        ok = hash_index_init(&lookups->fb_table, join->fb_rows[partition]);
+        lookups->fb_loaded = ok;
+        ok = ok && load_spilled_pairs(join->fb, partition, join->fb_rows[partition], &lookups->fb_table, &text);
+        lookups->fb_numbers = ok ? parse_index_values(&lookups->fb_table) : NULL;
+        spill_drop(join->fb, partition);
     }
-    
-    if (!wcmj_value) {
-        return strdup(fb_value);
+    arena_free(&text);
+    return ok;
+}
+
+///////////////////////// SQLite input (--db) /////////////////////////
+
+// In --db mode the pcb table is read straight from SQLite and the two lookups
+// are evaluated by SQLite as index probes, so no xlsx is written or parsed.
+// Result columns of the PCB query that hold the joined lookup values.
+static int db_wlom_col = -1;
+static int db_fb_col = -1;
+
+// Quote an SQL identifier ("34", "Total_général", ...) for use in a query
+static void quote_identifier(char* buf, size_t size, const char* name) {
+    size_t n = 0;
+    if (size < 3) {
+        buf[0] = '\0';
+        return;
     }
-    
-    // Convert strings to double for comparison
-    double fb_num = atof(fb_value);
-    double wcmj_num = atof(wcmj_value);
-    
-    if (fb_num >= wcmj_num) {
-        return strdup(fb_value);
-    } else {
-        return strdup(wcmj_value);
+    buf[n++] = '"';
+    for (const char* p = name; *p && n + 3 < size; p++) {
+        if (*p == '"') {
+            buf[n++] = '"';
+        }
+        buf[n++] = *p;
     }
+    buf[n++] = '"';
+    buf[n] = '\0';
 }
 
-int find_column_index(const char* name, const char** header, int header_count) {
-    for (int i = 0; i < header_count; i++) {
-        if (strcmp(name, header[i]) == 0)
-            return i;
+// Text of a column of the current result row, or NULL for SQL NULL.
+// Numbers are formatted into buf; text points into the statement and stays
+// valid until the next step. Floats use the shortest form that round-trips,
+// which is also how the exported xlsx stores them (400.0 -> "400").
+static const char* db_column_text(sqlite3_stmt* stmt, int col, char* buf, size_t size) {
+    switch (sqlite3_column_type(stmt, col)) {
+        case SQLITE_NULL:
+            return NULL;
+        case SQLITE_INTEGER:
+            snprintf(buf, size, "%lld", (long long)sqlite3_column_int64(stmt, col));
+            return buf;
+        case SQLITE_FLOAT:
+            format_number(buf, size, sqlite3_column_double(stmt, col));
+            return buf;
+        default:
+            return (const char*)sqlite3_column_text(stmt, col);
     }
-    return -1;
 }
 
-///////////////////////// the main function /////////////////////////
-
-int main(int argc, char* argv[]) {
-    const char* input_file = "PCB.xlsx";
-    const char* output_file = "output.xlsx";
-    
-    // Check for reload flag
-    int force_reload = 0;
-    if (argc > 1 && strcmp(argv[1], "--reload") == 0) {
-        force_reload = 1;
-        printf("Force reload mode: will reload FB and ABC data\n");
+// Check that a table exists in the database
+static int db_table_exists(sqlite3* db, const char* table) {
+    sqlite3_stmt* stmt;
+    int found = 0;
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type='table' AND name=?",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        return 0;
     }
-    
-    // Check for file preprocessing flag
-    int preprocess_files = 0;
-    if (argc > 1 && strcmp(argv[1], "--preprocess") == 0) {
-        preprocess_files = 1;
-        printf("Preprocessing mode: will check and fix file issues\n");
+    sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+    found = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// Find the key and value columns of the abc table (WKIDF -> WKQCO, WLOM as fallback)
+static int db_find_abc_columns(sqlite3* db, char* key_col, char* value_col, size_t size) {
+    sqlite3_stmt* stmt;
+    int have_key = 0, have_value = 0;
+    if (sqlite3_prepare_v2(db, "PRAGMA table_info(\"abc\")", -1, &stmt, NULL) != SQLITE_OK) {
+        return 0;
     }
-    
-    // Get current week
-    int current_week = get_current_week();
-    printf("Current week: %d\n", current_week);
-    
-    // Check if required files exist
-    printf("Checking required files...\n");
-    
-    // Check PCB file (try both extensions)
-    FILE* pcb_test = fopen("input/PCB.xlsx", "r");
-    if (pcb_test) {
-        fclose(pcb_test);
-        input_file = "input/PCB.xlsx";
-        printf("Found PCB.xlsx in input folder\n");
-    } else {
-        pcb_test = fopen("input/PCB.xls", "r");
-        if (pcb_test) {
-            fclose(pcb_test);
-            input_file = "input/PCB.xls";
-            printf("Found PCB.xls in input folder\n");
-        } else {
-            printf("Error: PCB file not found (input/PCB.xls or input/PCB.xlsx)\n");
-            printf("Please ensure PCB.xls or PCB.xlsx exists in the input folder\n");
-            return 1;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* name = (const char*)sqlite3_column_text(stmt, 1);
+        if (strcmp(name, "WKIDF") == 0) {
+            snprintf(key_col, size, "%s", name);
+            have_key = 1;
+        } else if (strcmp(name, "WKQCO") == 0) {
+            snprintf(value_col, size, "%s", name);
+            have_value = 2;
+        } else if (strcmp(name, "WLOM") == 0 && have_value == 0) {
+            snprintf(value_col, size, "%s", name);
+            have_value = 1;
         }
     }
-    
-    // Check ABC file
-    FILE* abc_test = fopen("input/ABC.xlsx", "r");
-    if (!abc_test) {
-        printf("Error: ABC.xlsx file not found in input folder\n");
-        printf("Please ensure ABC.xlsx exists in the input folder\n");
-        return 1;
+    sqlite3_finalize(stmt);
+    if (have_key && have_value) {
+        printf("abc table: WKIDF -> %s\n", value_col);
     }
+    return have_key && have_value;
+}
 
-    fclose(abc_test);
-    printf("Found ABC.xlsx in input folder\n");
-    
-    // Check FB file
-    FILE* fb_test = fopen("input/FB.xlsx", "r");
-    if (!fb_test) {
-        printf("Error: FB.xlsx file not found in input folder\n");
-        printf("Please ensure FB.xlsx exists in the input folder\n");
-        return 1;
+// Find the REF column and the week column of the fb table, with the same
+// rules as load_fb_hash_table (first available week when the target is missing)
+static int db_find_fb_columns(sqlite3* db, int week, char* ref_col, char* week_col, size_t size) {
+    sqlite3_stmt* stmt;
+    int col = 0, have_week = 0;
+    if (sqlite3_prepare_v2(db, "PRAGMA table_info(\"fb\")", -1, &stmt, NULL) != SQLITE_OK) {
+        return 0;
     }
-    fclose(fb_test);
-    printf("Found FB.xlsx in input folder\n");
-
-    // Open XLSX for reading
-    xlsxioreader reader;
-    printf("Opening %s file...\n", input_file);
-    if ((reader = xlsxioread_open(input_file)) == NULL) {
-        fprintf(stderr, "Error opening %s\n", input_file);
-        return 1;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* name = (const char*)sqlite3_column_text(stmt, 1);
+        if (col == 0 || strcmp(name, "REF") == 0 || strcmp(name, "Étiquettes de lignes") == 0) {
+            snprintf(ref_col, size, "%s", name);
+        } else {
+            int week_num = fb_header_week(name);
+            if (week_num > 0 && (!have_week || week_num == week)) {
+                snprintf(week_col, size, "%s", name);
+                have_week = week_num == week ? 2 : 1;
+            }
+        }
+        col++;
     }
-    printf("%s opened successfully\n", input_file);
-
-
-    // Prepare XLSX writer
-    lxw_workbook  *workbook  = workbook_new(output_file);
-    lxw_worksheet *worksheet = workbook_add_worksheet(workbook, NULL);
+    sqlite3_finalize(stmt);
+    if (have_week == 1) {
+        printf("Warning: target week %d not found in fb table, using first available week %s\n", week, week_col);
+    }
+    if (have_week) {
+        printf("fb table: %s -> week %s\n", ref_col, week_col);
+    }
+    return have_week != 0;
+}
 
+// Load every week column of the fb table into the FB matrix in one scan
+static int db_load_fb_matrix(sqlite3* db, lookup_set* lookups) {
+    sqlite3_stmt* stmt;
+    int weeks[FB_MATRIX_MAX_WEEKS];
+    int week_of_col[512];
+    int week_count = 0, ref_col = 0, col_count;
 
-    // Open first sheet
-    xlsxioreadersheet sheet;
-    printf("Opening sheet...\n");
-    if ((sheet = xlsxioread_sheet_open(reader, NULL, XLSXIOREAD_SKIP_EMPTY_ROWS)) == NULL) {
-        fprintf(stderr, "Error reading sheet\n");
-        return 1;
+    if (!db_table_exists(db, "fb")
+        || sqlite3_prepare_v2(db, "SELECT * FROM \"fb\" ORDER BY rowid", -1, &stmt, NULL) != SQLITE_OK) {
+        printf("Warning: fb table not found, FB will be empty\n");
+        return 0;
+    }
+    col_count = sqlite3_column_count(stmt);
+    if (col_count > 512) {
+        col_count = 512;
+    }
+    for (int col = 0; col < col_count; col++) {
+        const char* name = sqlite3_column_name(stmt, col);
+        int week = fb_header_week(name);
+        week_of_col[col] = -1;
+        if (strcmp(name, "REF") == 0 || strcmp(name, "Étiquettes de lignes") == 0) {
+            ref_col = col;
+        } else if (week && week_count < FB_MATRIX_MAX_WEEKS) {
+            week_of_col[col] = week_count;
+            weeks[week_count++] = week;
+        }
     }
 
-    printf("Sheet opened successfully\n");
+    if (week_count > 0 && fb_matrix_init(&lookups->fb_weeks, weeks, week_count, 0)) {
+        char buf[64];
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* ref = db_column_text(stmt, ref_col, buf, sizeof(buf));
+            int64_t matrix_row = ref ? fb_matrix_add_ref(&lookups->fb_weeks, ref) : -1;
+            if (matrix_row < 0) {
+                continue;
+            }
+            for (int col = 0; col < col_count; col++) {
+                if (week_of_col[col] < 0) {
+                    continue;
+                }
+                int type = sqlite3_column_type(stmt, col);
+                double number = NAN;
+                if (type == SQLITE_INTEGER || type == SQLITE_FLOAT) {
+                    number = sqlite3_column_double(stmt, col);
+                } else if (type == SQLITE_TEXT) {
+                    number = fb_cell_value((const char*)sqlite3_column_text(stmt, col));
+                }
+                fb_matrix_set(&lookups->fb_weeks, (uint32_t)matrix_row, week_of_col[col], number);
+            }
+        }
+        lookups->fb_weeks_loaded = 1;
+        print_fb_matrix_summary(&reference_files, lookups, "fb table");
+    } else {
+        printf("Warning: no week columns found in fb table\n");
+    }
+    sqlite3_finalize(stmt);
+    return lookups->fb_weeks_loaded;
+}
 
-    char* value;
-    int row = 0;
+// Prepare the PCB query. Each pcb row comes back with two extra columns:
+// ABC.WKQCO for WKIDF = WIDF and the FB week value for REF = WIDF.
+// Each lookup is a left join on the last row of every key (max rowid), so
+// there is exactly one output row per PCB row and on duplicate keys the
+// last loaded row wins like in the xlsx hash tables. SQLite probes the
+// joins through automatic indexes, so the database needs no index of its
+// own and is only read.
+// With join_fb = 0 (--weeks, FB comes from the matrix) the FB column is NULL.
+sqlite3_stmt* db_prepare_pcb_query(sqlite3* db, int week, int join_fb) {
+    char abc_key[128], abc_value[128], fb_ref[128], fb_week[128];
+    char q1[256], q2[256];
+    char wlom_expr[16] = "NULL";
+    char fb_expr[16] = "NULL";
+    char abc_join[1024] = "";
+    char fb_join[1024] = "";
+    char sql[3072];
+    sqlite3_stmt* stmt = NULL;
 
-    // Read header row
-    const char* header[500];
-    int header_count = 0;
+    if (!db_table_exists(db, "pcb")) {
+        fprintf(stderr, "Error: table pcb not found in database\n");
+        return NULL;
+    }
 
-    printf("Attempting to read header row...\n");
-    if (xlsxioread_sheet_next_row(sheet)) {
-        printf("Header row found!\n");
-        int col = 0;
-        while ((value = xlsxioread_sheet_next_cell(sheet)) != NULL) {
-            header[header_count++] = strdup(value);
-            free(value);
-            col++;
-        }
-        printf("Found %d columns in header\n", header_count);
-        
-        // Match indices
-        printf("\nLooking for required columns:\n");
-        for (size_t i = 0; i < NUM_COLS; i++) {
-            col_indices[i] = find_column_index(wanted_cols[i], header, header_count);
-            printf("Column '%s' found at index %d\n", wanted_cols[i], col_indices[i]);
-        }
-        
-        printf("\nAvailable columns in PCB.xls:\n");
-        for (int i = 0; i < header_count; i++) {
-            printf("[%d] %s\n", i, header[i]);
-        }
+    if (!db_table_exists(db, "abc") || !db_find_abc_columns(db, abc_key, abc_value, sizeof(abc_key))) {
+        printf("Warning: abc table with WKIDF/WKQCO not found, WLOM will be empty\n");
+    } else {
+        quote_identifier(q1, sizeof(q1), abc_key);
+        quote_identifier(q2, sizeof(q2), abc_value);
+        snprintf(wlom_expr, sizeof(wlom_expr), "a.v");
+        snprintf(abc_join, sizeof(abc_join),
+                 " LEFT JOIN (SELECT %s AS k, %s AS v FROM \"abc\" WHERE rowid IN"
+                 " (SELECT max(rowid) FROM \"abc\" GROUP BY %s)) a ON a.k = p.\"WIDF\"",
+                 q1, q2, q1);
+    }
 
-        // Write header to output
-        for (size_t i = 0; i < NUM_COLS; i++)
-            worksheet_write_string(worksheet, row, i, wanted_cols[i], NULL );
-        // Extra columns
-        worksheet_write_string(worksheet, row, NUM_COLS, "Inventaire", NULL);
-        worksheet_write_string(worksheet, row, NUM_COLS + 1, "couv", NULL);
-        row++;
-        printf("Header written to output, starting data rows...\n");
+    if (!join_fb) {
+        // FB values come from db_load_fb_matrix
+    } else if (!db_table_exists(db, "fb") || !db_find_fb_columns(db, week, fb_ref, fb_week, sizeof(fb_ref))) {
+        printf("Warning: fb table with week columns not found, FB will be empty\n");
     } else {
-        printf("No header row found!\n");
+        quote_identifier(q1, sizeof(q1), fb_ref);
+        quote_identifier(q2, sizeof(q2), fb_week);
+        snprintf(fb_expr, sizeof(fb_expr), "f.v");
+        snprintf(fb_join, sizeof(fb_join),
+                 " LEFT JOIN (SELECT %s AS k, %s AS v FROM \"fb\" WHERE rowid IN"
+                 " (SELECT max(rowid) FROM \"fb\" GROUP BY %s)) f ON f.k = p.\"WIDF\"",
+                 q1, q2, q1);
     }
 
-    // Read and write data rows
-    int data_row_count = 0;
-    while (xlsxioread_sheet_next_row(sheet)) {
-        int col = 0;
-        char* row_values[500] = {0};
+    snprintf(sql, sizeof(sql), "SELECT p.*, %s, %s FROM \"pcb\" p%s%s ORDER BY p.rowid",
+             wlom_expr, fb_expr, abc_join, fb_join);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Error preparing PCB query: %s\n", sqlite3_errmsg(db));
+        return NULL;
+    }
+    db_wlom_col = sqlite3_column_count(stmt) - 2;
+    db_fb_col = sqlite3_column_count(stmt) - 1;
+    return stmt;
+}
 
-        while ((value = xlsxioread_sheet_next_cell(sheet)) != NULL) {
-            row_values[col++] = strdup(value);
-            free(value);
-        }
-        
-        data_row_count++;
-        if (data_row_count <= 3) {
-            printf("Processing row %d with %d columns\n", data_row_count, col);
-        }
+///////////////////////// row pipeline /////////////////////////
 
+// PCB rows travel through the converter in batches:
+//   reader (main thread) -> parsed queue -> evaluator -> evaluated queue -> writer
+// ABC and FB are loaded by their own threads while the reader parses PCB;
+// the evaluator waits for them before the first lookup. The writer thread
+// is the only one touching the workbook once the rows start flowing.
+#define PCB_BATCH_ROWS COLUMN_VECTOR_ROWS  // evaluated in one pass over the column vectors
+#define PIPELINE_QUEUE_DEPTH 8
 
-        
-        for (size_t i = 0; i < NUM_COLS; i++) {
-            if (strcmp(wanted_cols[i], "WLOM") == 0) {
-                // Get WIDF value from the current row
-                char* widf_value = NULL;
-                if (col_indices[1] >= 0 && col_indices[1] < col && row_values[col_indices[1]]) {
-                    widf_value = strdup(row_values[col_indices[1]]);
-                }
-                
-                // Use C function to get WLOM value by checking WIDF against WKIDF in ABC.xlsx
-                char* wlom_value = NULL;
-                if (widf_value) {
-                    // Force reload if requested
-                    if (force_reload && abc_cache_loaded) {
-                        clear_abc_hash_table();
-                    }
-                    wlom_value = get_wlom_value_by_widf(widf_value);
-                    if (wlom_value) {
-                        worksheet_write_string(worksheet, row, i, wlom_value, NULL);
-                        printf("Found WLOM value for WIDF %s: %s\n", widf_value, wlom_value);
-                        free(wlom_value);
-                    } else {
-                        printf("No WLOM value found for WIDF: %s\n", widf_value);
-                    }
-                    free(widf_value);
-                }
-                
-            } else if (strcmp(wanted_cols[i], "FB") == 0) {
-                // Get WIDF value from the current row
-                char* widf_value = NULL;
-                if (col_indices[1] >= 0 && col_indices[1] < col && row_values[col_indices[1]]) {
-                    widf_value = strdup(row_values[col_indices[1]]);
-                }
-                
-                // Use C function to get FB value by checking WIDF against REF in FB.xlsx
-                char* fb_value = NULL;
-                if (widf_value) {
-                    // Force reload if requested
-                    if (force_reload && fb_cache_loaded) {
-                        clear_fb_hash_table();
-                    }
-                    fb_value = get_fb_value_by_widf(widf_value, current_week);
-                    if (fb_value) {
-                        worksheet_write_string(worksheet, row, i, fb_value, NULL);
-                        printf("Found FB value for WIDF %s: %s\n", widf_value, fb_value);
-                        free(fb_value);
-                    } else {
-                        printf("No FB value found for WIDF: %s\n", widf_value);
-                    }
-                    free(widf_value);
-                }
-                
-            } else if (strcmp(wanted_cols[i], "MAX") == 0) {
-                // Get WCMJ value from the current row
-                char* wcmj_value = NULL;
-                if (col_indices[8] >= 0 && col_indices[8] < col && row_values[col_indices[8]]) {
-                    wcmj_value = strdup(row_values[col_indices[8]]);
-                }
-                
-                // Get FB value for this row (we need to calculate it again for MAX)
-                char* fb_value = NULL;
-                char* widf_value = NULL;
-                if (col_indices[1] >= 0 && col_indices[1] < col && row_values[col_indices[1]]) {
-                    widf_value = strdup(row_values[col_indices[1]]);
-                    fb_value = get_fb_value_by_widf(widf_value, current_week);
-                }
-                
-                // Calculate MAX value using C function
-                char* max_value = get_max_value(fb_value, wcmj_value);
-                if (max_value) {
-                    worksheet_write_string(worksheet, row, i, max_value, NULL);
-                    printf("MAX value: %s (FB: %s, WCMJ: %s)\n", max_value, fb_value ? fb_value : "NULL", wcmj_value ? wcmj_value : "NULL");
-                    free(max_value);
-                }
-///////////////////////////////the divel is here !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!               
-                // Clean up
-                if (fb_value) free(fb_value);
-                if (wcmj_value) free(wcmj_value);
-                if (widf_value) free(widf_value);
-                
-            } else if (col_indices[i] >= 0 && col_indices[i] < col && row_values[col_indices[i]]) {
-                worksheet_write_string(worksheet, row, i, row_values[col_indices[i]], NULL);
-            }
-        }
+typedef struct {
+    int rows;
+    int width;              // plan inputs + the two joined lookup values (--db)
+    int output_width;       // output columns of the plan
+    char** cells;           // rows * width cells, NULL when missing
+    output_cell* output;    // rows * output_width
+    uint64_t* fingerprints; // --incremental: what each output row was computed from
+    arena text;             // text of every cell of the batch
+} pcb_batch;
 
+// Receives every full batch, and the last partial one
+typedef void (*batch_handler)(pcb_batch* batch, void* data);
 
+// Where PCB rows come from: the xlsx sheet or the --db query. The xlsx is
+// pushed through sheet_process_rows, whose cell values are only borrowed:
+// cells of columns the plan does not read are never copied, the others are
+// copied into the arena of the batch instead of one malloc each.
+typedef struct {
+    sheet_reader* sheet;
+    sqlite3_stmt* stmt;
+    const column_plan* plan;
+    int header_count;
+    int* input_of_column;   // plan input of every PCB column, -1 if not read
+    int rows_read;
+    int failed;
+    run_stats* stats;       // batch memory counter
+    pcb_batch* batch;       // batch being filled
+    batch_handler handler;
+    void* handler_data;
+} pcb_reader;
 
+// Arena chunk of a fresh batch; 1024 rows of a dozen short cells fit in it
+#define PCB_BATCH_TEXT_BYTES (64 * 1024)
 
-        // Write extra columns for this row
-        const char* wstkg_val_str = NULL;
-        const char* max_val_str = NULL;
-        if (col_indices[9] >= 0 && col_indices[9] < col && row_values[col_indices[9]])
-            wstkg_val_str = row_values[col_indices[9]];
-        if (col_indices[11] >= 0 && col_indices[11] < col) {
-            // MAX may have been calculated and written above; try to read from output where possible is complex,
-            // so recompute using helper already used for MAX calculation when available
-            // Fall back to parsed string from row if present
-            max_val_str = NULL; // we will recompute via get_max_value inputs above already wrote string value
-        }
+static pcb_batch* new_batch(int width, int output_width, run_stats* counters) {
+    pcb_batch* batch = malloc(sizeof(pcb_batch));
+    if (!batch) {
+        return NULL;
+    }
+    batch->rows = 0;
+    batch->width = width;
+    batch->output_width = output_width;
+    batch->cells = calloc((size_t)PCB_BATCH_ROWS * width, sizeof(char*));
+    batch->output = malloc((size_t)PCB_BATCH_ROWS * output_width * sizeof(output_cell));
+    batch->fingerprints = malloc(PCB_BATCH_ROWS * sizeof(uint64_t));
+    arena_init(&batch->text, PCB_BATCH_TEXT_BYTES);
+    counters->batch_bytes += (uint64_t)PCB_BATCH_ROWS
+                           * (width * sizeof(char*) + output_width * sizeof(output_cell) + sizeof(uint64_t));
+    if (!batch->cells || !batch->output || !batch->fingerprints) {
+        free(batch->cells);
+        free(batch->output);
+        free(batch->fingerprints);
+        free(batch);
+        return NULL;
+    }
+    return batch;
+}
 
-        // Leave Inventaire empty
-        // (no write to column NUM_COLS)
+static void free_batch(pcb_batch* batch) {
+    arena_free(&batch->text);
+    free(batch->cells);
+    free(batch->output);
+    free(batch->fingerprints);
+    free(batch);
+}
 
-        // Compute couv = WSTKG / MAX using values we wrote: parse numeric strings
-        double wstkg_num = 0.0;
-        double max_num = 0.0;
-        int have_wstkg = 0, have_max = 0;
-        if (wstkg_val_str && strlen(wstkg_val_str) > 0) { wstkg_num = atof(wstkg_val_str); have_wstkg = 1; }
-        // For MAX, attempt to reuse the computed string by recalculating again
-        // Recompute MAX: need WCMJ and FB
-        const char* wcmj_str = NULL;
-        const char* widf_for_row = NULL;
-        char* fb_val_tmp = NULL;
-        if (col_indices[8] >= 0 && col_indices[8] < col && row_values[col_indices[8]])
-            wcmj_str = row_values[col_indices[8]];
-        if (col_indices[1] >= 0 && col_indices[1] < col && row_values[col_indices[1]])
-            widf_for_row = row_values[col_indices[1]];
-        if (widf_for_row) {
-            char* fb_calc = get_fb_value_by_widf(widf_for_row, current_week);
-            fb_val_tmp = fb_calc;
-        }
-        char* max_calc = get_max_value(fb_val_tmp, (char*)wcmj_str);
-        if (max_calc && strlen(max_calc) > 0) { max_num = atof(max_calc); have_max = 1; }
-        if (fb_val_tmp) free(fb_val_tmp);
-        if (max_calc) free(max_calc);
+static int init_pcb_reader(pcb_reader* reader, sheet_reader* sheet, sqlite3_stmt* stmt, const column_plan* plan,
+                           int header_count, run_stats* counters, batch_handler handler, void* handler_data) {
+    memset(reader, 0, sizeof(pcb_reader));
+    reader->stats = counters;
+    reader->sheet = sheet;
+    reader->stmt = stmt;
+    reader->plan = plan;
+    reader->header_count = header_count;
+    reader->handler = handler;
+    reader->handler_data = handler_data;
+    reader->input_of_column = malloc((header_count + 1) * sizeof(int));
+    if (!reader->input_of_column) {
+        return 0;
+    }
+    for (int i = 0; i < header_count; i++) {
+        reader->input_of_column[i] = -1;
+    }
+    for (int i = 0; i < plan->input_count; i++) {
+        reader->input_of_column[plan->inputs[i]] = i;
+    }
+    return 1;
+}
+
+// Hand the batch being filled to the handler
+static void flush_batch(pcb_reader* reader) {
+    pcb_batch* batch = reader->batch;
+    reader->batch = NULL;
+    if (batch == NULL) {
+        return;
+    }
+    if (batch->rows == 0) {
+        free_batch(batch);
+        return;
+    }
+    reader->stats->batch_bytes += batch->text.capacity;
+    reader->handler(batch, reader->handler_data);
+}
 
-        if (have_wstkg && have_max && max_num != 0.0) {
-            worksheet_write_number(worksheet, row, NUM_COLS + 1, wstkg_num / max_num, NULL);
+// Cells of the row being read; a batch is started when none is being filled
+static char** current_row(pcb_reader* reader) {
+    if (reader->batch == NULL) {
+        reader->batch = new_batch(reader->plan->input_count + 2, reader->plan->count, reader->stats);
+        if (reader->batch == NULL) {
+            fprintf(stderr, "Error: out of memory reading PCB rows\n");
+            reader->failed = 1;
+            return NULL;
         }
+    }
+    return reader->batch->cells + (size_t)reader->batch->rows * reader->batch->width;
+}
 
-        for (int i = 0; i < col; i++)
-            free(row_values[i]);
-        row++;
+static void set_cell(pcb_reader* reader, char** row, int input, const char* text) {
+    if (text && (row[input] = arena_strdup(&reader->batch->text, text)) == NULL) {
+        fprintf(stderr, "Error: out of memory reading PCB rows\n");
+        reader->failed = 1;
     }
+}
 
-    // Cleanup
-    xlsxioread_sheet_close(sheet);
-    xlsxioread_close(reader);
-    workbook_close(workbook);
-    clear_fb_hash_table(); // Clear the FB hash table
-    clear_abc_hash_table(); // Clear the ABC hash table
-
-    printf("Processed %d data rows\n", data_row_count);
-    printf("Extraction complete: %s\n", output_file);
-    
-    return 0;
+static void end_row(pcb_reader* reader, int columns) {
+    reader->rows_read++;
+    if (reader->rows_read <= 3) {
+        printf("Processing row %d with %d columns\n", reader->rows_read, columns);
+    }
+    if (++reader->batch->rows == PCB_BATCH_ROWS) {
+        flush_batch(reader);
+    }
+}
+
+static int pcb_cell_callback(size_t row, size_t col, const char* value, void* data) {
+    pcb_reader* reader = data;
+    char** cells;
+    (void)row;
+
+    // Cells past the header and columns outside the plan are never projected
+    if (col == 0 || col > (size_t)reader->header_count
+        || reader->input_of_column[col - 1] < 0) {
+        return 0;
+    }
+    if ((cells = current_row(reader)) == NULL) {
+        return 1;
+    }
+    set_cell(reader, cells, reader->input_of_column[col - 1], value);
+    return reader->failed;
+}
+
+static int pcb_row_callback(size_t row, size_t maxcol, void* data) {
+    pcb_reader* reader = data;
+    (void)row;
+
+    if (current_row(reader) == NULL) {
+        return 1;
+    }
+    end_row(reader, (int)maxcol);
+    return reader->failed;
+}
+
+static void read_db_rows(pcb_reader* reader) {
+    const column_plan* plan = reader->plan;
+    char buf[64];
+
+    while (!reader->failed && sqlite3_step(reader->stmt) == SQLITE_ROW) {
+        char** cells = current_row(reader);
+        if (cells == NULL) {
+            break;
+        }
+        for (int i = 0; i < plan->input_count; i++) {
+            set_cell(reader, cells, i, db_column_text(reader->stmt, plan->inputs[i], buf, sizeof(buf)));
+        }
+        set_cell(reader, cells, plan->input_count, db_column_text(reader->stmt, db_wlom_col, buf, sizeof(buf)));
+        set_cell(reader, cells, plan->input_count + 1, db_column_text(reader->stmt, db_fb_col, buf, sizeof(buf)));
+        end_row(reader, reader->header_count);
+    }
+}
+
+// Read every PCB data row, in batches of PCB_BATCH_ROWS; returns 0 on failure
+static int read_pcb_rows(pcb_reader* reader) {
+    if (reader->stmt) {
+        read_db_rows(reader);
+    } else if (!sheet_process_rows(reader->sheet, pcb_cell_callback, pcb_row_callback, reader) && !reader->failed) {
+        fprintf(stderr, "Error reading the PCB sheet\n");
+        reader->failed = 1;
+    }
+    flush_batch(reader);
+    free(reader->input_of_column);
+    reader->input_of_column = NULL;
+    return !reader->failed;
+}
+
+// First row of the sheet as a growable array of column names (no column
+// limit); *found is 0 when the sheet has no row at all
+static char** read_xlsx_header(sheet_reader* sheet, int* count, int* found) {
+    char** header = NULL;
+    int capacity = 0;
+    const char* value;
+
+    *count = 0;
+    *found = 0;
+    if (!sheet_next_row(sheet)) {
+        return NULL;
+    }
+    while ((value = sheet_next_cell(sheet)) != NULL) {
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char** grown = realloc(header, capacity * sizeof(char*));
+            if (!grown) {
+                break;
+            }
+            header = grown;
+        }
+        header[(*count)++] = strdup(value);
+    }
+    *found = 1;
+    return header;
+}
+
+static void free_header(char** header, int count) {
+    for (int i = 0; i < count; i++) {
+        free(header[i]);
+    }
+    free(header);
+}
+
+// --incremental: rows of the previous run to reuse, and where the rows of
+// this run are kept for the next one
+typedef struct {
+    row_cache* previous;        // NULL on a first run or after a plan change
+    row_cache_writer* next;
+    hash_index* reported;       // WIDFs whose change is logged, each once however many rows it has
+    run_stats* counters;        // where the changed WIDFs are counted
+} incremental_rows;
+
+// Log and count the change of a WIDF the first time one of its rows shows it
+static void report_key_change(const incremental_rows* incremental, const char* key, row_change change) {
+    if (hash_index_find(incremental->reported, key) >= 0) {
+        return;
+    }
+    // Out of memory a key may only be logged again
+    hash_index_put(incremental->reported, key, "");
+    if (change == ROW_UPDATED) {
+        incremental->counters->keys_updated++;
+        printf("Updated WIDF %s\n", key);
+    } else {
+        incremental->counters->keys_inserted++;
+        printf("Inserted WIDF %s\n", key);
+    }
+}
+
+// What an output row is computed from: its PCB inputs and the lookup values
+// it got. An unchanged fingerprint means an unchanged output row.
+static uint64_t row_fingerprint(char** row_values, int input_count, const char* wlom_value,
+                                const char* fb_value, const number_cell* horizon_fb, int week_count) {
+    uint64_t hash = ROW_CACHE_SEED;
+    for (int i = 0; i < input_count; i++) {
+        hash = row_cache_hash_text(hash, row_values[i]);
+    }
+    hash = row_cache_hash_text(hash, wlom_value);
+    hash = row_cache_hash_text(hash, fb_value);
+    for (int w = 0; w < week_count; w++) {
+        // Field by field: the struct has padding
+        hash = row_cache_hash(hash, &horizon_fb[w].null, sizeof(int));
+        if (!horizon_fb[w].null) {
+            hash = row_cache_hash(hash, &horizon_fb[w].value, sizeof(double));
+        }
+    }
+    return hash;
+}
+
+// Evaluate the column plan for every row of a batch, counting the lookups:
+// the lookups and numeric inputs of every row are gathered into the column
+// vectors, the expressions run over them, and the output rows are filled
+// from them (see column_plan.c). --incremental matches every row against the
+// row cache of the last run from what was gathered, before the expressions:
+// a row whose fingerprint is cached is not filled, and a batch of only such
+// rows skips the expressions as well.
+static void evaluate_batch(const column_plan* plan, column_vectors* vectors, pcb_batch* batch,
+                           const lookup_set* lookups, int db_mode, const incremental_rows* incremental,
+                           run_stats* counters) {
+    row_change changes[PCB_BATCH_ROWS];
+    int evaluated_rows = batch->rows;
+
+    gather_columns(plan, vectors, lookups, batch->cells, batch->width, batch->rows, db_mode,
+                   &counters->abc, &counters->fb);
+    if (incremental) {
+        for (int r = 0; r < batch->rows; r++) {
+            char** row_values = batch->cells + (size_t)r * batch->width;
+            output_cell* out = batch->output + (size_t)r * batch->output_width;
+            const char* widf_value = plan->widf_col >= 0 && plan->widf_col < batch->width - 2
+                                   ? row_values[plan->widf_col] : NULL;
+            number_cell horizon_fb[MAX_HORIZON_WEEKS + 1];
+            for (int w = 0; w < plan->week_count; w++) {
+                horizon_fb[w] = vector_cell(vectors->fb_weeks[w][r]);
+            }
+            batch->fingerprints[r] = row_fingerprint(row_values, batch->width - 2, vectors->abc_text[r],
+                                                     vectors->fb_text[r], horizon_fb, plan->week_count);
+            changes[r] = !widf_value ? ROW_INSERTED : !incremental->previous ? ROW_INSERTED
+                       : row_cache_match(incremental->previous, widf_value, batch->fingerprints[r], out);
+            if (changes[r] == ROW_UNCHANGED) {
+                counters->rows_reused++;
+                evaluated_rows--;
+            }
+        }
+    }
+    if (evaluated_rows > 0) {
+        evaluate_expressions(plan, vectors, batch->rows);
+    }
+
+    for (int r = 0; r < batch->rows; r++) {
+        char** row_values = batch->cells + (size_t)r * batch->width;
+        output_cell* out = batch->output + (size_t)r * batch->output_width;
+
+        if (incremental) {
+            if (changes[r] == ROW_UNCHANGED) {
+                continue;
+            }
+            if (plan->widf_col >= 0 && plan->widf_col < batch->width - 2 && row_values[plan->widf_col]) {
+                report_key_change(incremental, row_values[plan->widf_col], changes[r]);
+            }
+        }
+        fill_output_row(plan, vectors, r, row_values, batch->width, out);
+    }
+}
+
+static void write_plan_header(output_sink* output, const column_plan* plan) {
+    const char* names[MAX_OUTPUT_COLS];
+    for (int i = 0; i < plan->count; i++)
+        names[i] = plan->steps[i].name;
+    output_sink_write_header(output, names, plan->count);
+}
+
+// --summary: group totals and lowest coverages of the rows written, for
+// the columns of the plan
+static summary_report* open_summary(const column_plan* plan, int lowest_rows) {
+    const char* names[MAX_OUTPUT_COLS];
+    for (int i = 0; i < plan->count; i++)
+        names[i] = plan->steps[i].name;
+    return summary_report_new(names, plan->count, lowest_rows);
+}
+
+static void write_batch(output_sink* output, const column_plan* plan, const incremental_rows* incremental,
+                        summary_report* summary, const pcb_batch* batch) {
+    for (int r = 0; r < batch->rows; r++) {
+        const output_cell* out = batch->output + (size_t)r * batch->output_width;
+        output_sink_write_row(output, out, batch->output_width);
+        if (summary) {
+            summary_report_add(summary, out);
+        }
+        // Rows without a WIDF cannot be matched next time and are not kept
+        const char* widf_value = plan->widf_col >= 0 ? batch->cells[(size_t)r * batch->width + plan->widf_col] : NULL;
+        if (incremental && widf_value) {
+            row_cache_add(incremental->next, widf_value, batch->fingerprints[r], out);
+        }
+    }
+}
+
+typedef struct {
+    column_plan* plan;
+    int week;
+    int horizon;    // --weeks: FB comes from the week matrix
+    int db_mode;
+    int loaders_started;
+    pthread_t abc_loader;
+    pthread_t fb_loader;
+    batch_queue parsed;
+    batch_queue evaluated;
+    output_sink* output;
+    lookup_set* lookups;
+    const incremental_rows* incremental;   // --incremental, NULL otherwise
+    summary_report* summary;    // --summary, fed by the thread writing the output; NULL otherwise
+    spilled_join* spill;    // --mem-limit: tables joined partition by partition, NULL when loaded whole
+    int fb_bound;           // --mem-limit: FB weeks bound to the matrix columns of the first partition loaded
+    uint64_t mem_limit;     // --mem-limit, 0 without
+    run_stats* stats;   // phases, lookup and batch counters of this conversion
+    perf_tracker* reader_perf;  // counters of the thread reading PCB rows, which runs them with --serial
+    column_vectors* vectors;    // of the one thread evaluating batches at a time
+} pipeline;
+
+// Batch handlers: hand the batch to the evaluator thread, or run it through
+// evaluation and output right away (--serial)
+static void queue_batch(pcb_batch* batch, void* data) {
+    pipeline* p = data;
+    batch_queue_push(&p->parsed, batch);
+}
+
+static void run_batch(pcb_batch* batch, void* data) {
+    pipeline* p = data;
+    perf_tracker_switch(p->reader_perf, p->stats->perf, STATS_PERF_EVALUATE);
+    evaluate_batch(p->plan, p->vectors, batch, p->lookups, p->db_mode, p->incremental, p->stats);
+    perf_tracker_switch(p->reader_perf, p->stats->perf, STATS_PERF_OUTPUT);
+    write_batch(p->output, p->plan, p->incremental, p->summary, batch);
+    free_batch(batch);
+    perf_tracker_switch(p->reader_perf, p->stats->perf, STATS_PERF_PCB_READ);
+}
+
+// Parts already in the set (--batch, --watch) are not loaded again. With
+// --mem-limit "loading" a table means partitioning it into spill files.
+static int abc_part_loaded(const pipeline* p) {
+    return p->spill ? p->spill->abc_spilled : p->lookups->abc_loaded;
+}
+
+static int fb_part_loaded(const pipeline* p) {
+    if (p->spill) {
+        return p->spill->fb_spilled;
+    }
+    return p->horizon ? p->lookups->fb_weeks_loaded : p->lookups->fb_loaded;
+}
+
+static void load_abc(pipeline* p) {
+    if (abc_part_loaded(p)) {
+        return;
+    }
+    double started = stats_now();
+    perf_tracker perf;
+    open_perf_tracker(&perf, STATS_PERF_ABC_LOAD);
+    if (p->spill) {
+        spill_abc_table(p->spill);
+    } else {
+        load_abc_hash_table(p->lookups, &reference_files);
+    }
+    perf_tracker_close(&perf, p->stats->perf);
+    run_stats_add_phase(p->stats, STATS_ABC_LOAD, started);
+}
+
+static void load_fb(pipeline* p) {
+    if (fb_part_loaded(p)) {
+        return;
+    }
+    double started = stats_now();
+    perf_tracker perf;
+    open_perf_tracker(&perf, STATS_PERF_FB_LOAD);
+    if (p->spill && p->horizon) {
+        spill_fb_week_rows(p->spill);
+    } else if (p->spill) {
+        spill_fb_table(p->spill, p->week);
+    } else if (p->horizon) {
+        load_fb_matrix(p->lookups, &reference_files);
+    } else {
+        load_fb_hash_table(p->lookups, &reference_files, p->week);
+    }
+    perf_tracker_close(&perf, p->stats->perf);
+    run_stats_add_phase(p->stats, STATS_FB_LOAD, started);
+}
+
+static void* abc_loader_main(void* arg) {
+    load_abc(arg);
+    return NULL;
+}
+
+static void* fb_loader_main(void* arg) {
+    load_fb(arg);
+    return NULL;
+}
+
+// Start loading ABC and FB in the background (xlsx mode only)
+static void start_loaders(pipeline* p) {
+    if (abc_part_loaded(p) && fb_part_loaded(p)) {
+        return;
+    }
+    if (pthread_create(&p->abc_loader, NULL, abc_loader_main, p) != 0) {
+        return;
+    }
+    if (pthread_create(&p->fb_loader, NULL, fb_loader_main, p) != 0) {
+        pthread_join(p->abc_loader, NULL);
+        return;
+    }
+    p->loaders_started = 1;
+}
+
+static void join_loaders(pipeline* p) {
+    if (p->loaders_started) {
+        pthread_join(p->abc_loader, NULL);
+        pthread_join(p->fb_loader, NULL);
+        p->loaders_started = 0;
+    }
+}
+
+// Wait for the lookups before the first row is evaluated. Whatever no loader
+// thread built (--serial, or a thread that did not start) is loaded here and
+// the key dictionary is built over the tables, so the row loop only ever
+// reads the set. Spilled tables are indexed partition by partition instead.
+static void finish_loading(pipeline* p) {
+    join_loaders(p);
+    if (!p->db_mode) {
+        load_abc(p);
+        load_fb(p);
+    }
+    if (p->spill) {
+        return;
+    }
+    if (build_key_dictionary(p->lookups)) {
+        print_key_dictionary(p->lookups);
+    }
+    // The tables were kept in memory on an estimate from the rows the sheets declare
+    size_t table_bytes = lookup_set_memory(p->lookups);
+    if (p->mem_limit > 0 && table_bytes > p->mem_limit) {
+        printf("Warning: the lookup tables take %.1f MB, over --mem-limit %.1f MB\n",
+               table_bytes / (1024.0 * 1024.0), p->mem_limit / (1024.0 * 1024.0));
+    }
+    if (p->plan) {
+        bind_fb_matrix(p->plan, p->lookups);
+    }
+}
+
+static void* evaluator_main(void* arg) {
+    pipeline* p = arg;
+    pcb_batch* batch;
+    perf_tracker perf;
+
+    finish_loading(p);
+    // Waiting for a batch is not counted
+    open_perf_tracker(&perf, PERF_NO_PHASE);
+    while ((batch = batch_queue_pop(&p->parsed)) != NULL) {
+        perf_tracker_switch(&perf, p->stats->perf, STATS_PERF_EVALUATE);
+        evaluate_batch(p->plan, p->vectors, batch, p->lookups, p->db_mode, p->incremental, p->stats);
+        perf_tracker_switch(&perf, p->stats->perf, PERF_NO_PHASE);
+        batch_queue_push(&p->evaluated, batch);
+    }
+    perf_tracker_close(&perf, p->stats->perf);
+    batch_queue_close(&p->evaluated);
+    return NULL;
+}
+
+static void* writer_main(void* arg) {
+    pipeline* p = arg;
+    pcb_batch* batch;
+    perf_tracker perf;
+
+    open_perf_tracker(&perf, PERF_NO_PHASE);
+    while ((batch = batch_queue_pop(&p->evaluated)) != NULL) {
+        perf_tracker_switch(&perf, p->stats->perf, STATS_PERF_OUTPUT);
+        write_batch(p->output, p->plan, p->incremental, p->summary, batch);
+        free_batch(batch);
+        perf_tracker_switch(&perf, p->stats->perf, PERF_NO_PHASE);
+    }
+    perf_tracker_close(&perf, p->stats->perf);
+    return NULL;
+}
+
+///////////////////////// memory-bounded join (--mem-limit) /////////////////////////
+
+// Heap bytes a loaded reference row costs: index entry and slots, key and
+// value text, parsed number and key dictionary arrays: 60 to 120 measured
+// on the bench data, depending on how full the power-of-two slot arrays are
+#define REFERENCE_ROW_BYTES 128
+
+static uint64_t estimate_table_bytes(const char* path, uint64_t row_bytes) {
+    uint32_t rows = xlsx_sheet_dimension_rows(path);
+    struct stat st;
+    if (rows > 0) {
+        return (uint64_t)rows * row_bytes;
+    }
+    // Without a declared dimension: the compressed workbook, larger than
+    // the table built from a few of its columns
+    return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+// What ABC and FB would take once loaded; with a horizon FB holds a double
+// for each of its week columns, at most one per ISO week
+static uint64_t estimate_reference_bytes(int horizon) {
+    return estimate_table_bytes("input/ABC.xlsx", REFERENCE_ROW_BYTES)
+         + estimate_table_bytes("input/FB.xlsx", REFERENCE_ROW_BYTES + (horizon ? 53 * sizeof(double) : 0));
+}
+
+// One partition of the tables is loaded at a time and gets half the limit;
+// the rest is left to the row batch, the spill buffers and the output
+static int spill_partition_count(uint64_t estimate, uint64_t mem_limit) {
+    int partitions = 2;
+    while (partitions < SPILL_MAX_PARTITIONS && estimate / partitions > mem_limit / 2) {
+        partitions *= 2;
+    }
+    return partitions;
+}
+
+// Batch handler while the tables are spilled: every row goes to the
+// partition of its WIDF (rows without one to partition 0, they look nothing
+// up) and the order file records where it went
+static void spill_pcb_batch(pcb_batch* batch, void* data) {
+    pipeline* p = data;
+    spilled_join* join = p->spill;
+    int inputs = batch->width - 2;
+
+    for (int r = 0; r < batch->rows; r++) {
+        char** row_values = batch->cells + (size_t)r * batch->width;
+        const char* widf_value = p->plan->widf_col >= 0 ? row_values[p->plan->widf_col] : NULL;
+        unsigned char partition = widf_value ? (unsigned char)spilled_partition(join, widf_value) : 0;
+        spill_write(join->order, 0, &partition, 1);
+        for (int i = 0; i < inputs; i++) {
+            spill_write_text(join->pcb, partition, row_values[i]);
+        }
+        join->pcb_rows[partition]++;
+    }
+    free_batch(batch);
+}
+
+static void spill_output_row(spill_set* set, int partition, int incremental, const char* widf_value,
+                             uint64_t fingerprint, const output_cell* cells, int count) {
+    if (incremental) {
+        spill_write_text(set, partition, widf_value);
+        spill_write(set, partition, &fingerprint, sizeof(uint64_t));
+    }
+    for (int i = 0; i < count; i++) {
+        unsigned char kind = (unsigned char)cells[i].kind;
+        spill_write(set, partition, &kind, 1);
+        if (cells[i].kind == CELL_TEXT) {
+            spill_write_text(set, partition, cells[i].text);
+        } else if (cells[i].kind == CELL_NUMBER) {
+            spill_write(set, partition, &cells[i].number, sizeof(double));
+        }
+    }
+}
+
+// Keep the evaluated rows of a partition until every partition is done
+static void spill_output_rows(spilled_join* join, int partition, const column_plan* plan,
+                              const incremental_rows* incremental, const pcb_batch* batch) {
+    for (int r = 0; r < batch->rows; r++) {
+        const output_cell* out = batch->output + (size_t)r * batch->output_width;
+        const char* widf_value = plan->widf_col >= 0 ? batch->cells[(size_t)r * batch->width + plan->widf_col] : NULL;
+        spill_output_row(join->output, partition, incremental != NULL, widf_value,
+                         incremental ? batch->fingerprints[r] : 0, out, batch->output_width);
+    }
+}
+
+static int read_spilled_cell(spill_set* set, int partition, arena* text, output_cell* cell) {
+    unsigned char kind;
+    if (!spill_read(set, partition, &kind, 1)) {
+        return 0;
+    }
+    cell->kind = (cell_kind)kind;
+    if (cell->kind == CELL_TEXT) {
+        return spill_read_text(set, partition, text, &cell->text);
+    }
+    if (cell->kind == CELL_NUMBER) {
+        return spill_read(set, partition, &cell->number, sizeof(double));
+    }
+    return 1;
+}
+
+// Read back a row written by spill_output_row
+static int read_spilled_row(spill_set* set, int partition, int incremental, arena* text,
+                            const char** widf_value, uint64_t* fingerprint, output_cell* cells, int count) {
+    int ok = 1;
+    *widf_value = NULL;
+    *fingerprint = 0;
+    if (incremental) {
+        ok = spill_read_text(set, partition, text, widf_value)
+          && spill_read(set, partition, fingerprint, sizeof(uint64_t));
+    }
+    for (int i = 0; ok && i < count; i++) {
+        ok = read_spilled_cell(set, partition, text, &cells[i]);
+    }
+    return ok;
+}
+
+// What a partition of the tables will take once loaded, from the rows it
+// actually got rather than the row counts the sheets declare
+static uint64_t partition_table_bytes(const spilled_join* join, int partition) {
+    uint64_t fb_row_bytes = REFERENCE_ROW_BYTES + (uint64_t)join->fb_week_count * sizeof(double);
+    return (uint64_t)join->abc_rows[partition] * REFERENCE_ROW_BYTES + (uint64_t)join->fb_rows[partition] * fb_row_bytes;
+}
+
+static int partition_bits(int partitions) {
+    int bits = 0;
+    while ((1 << bits) < partitions) {
+        bits++;
+    }
+    return bits;
+}
+
+// Spill the rows of one partition again, tables and PCB rows, by the next
+// hash bits into a join of its own. The partition's files are given back.
+// Returns NULL if a file cannot be created or read back.
+static spilled_join* split_partition(pipeline* p, spilled_join* join, pcb_batch* batch, int partition,
+                                     uint64_t estimate) {
+    int shift = join->shift + partition_bits(spill_partitions(join->pcb));
+    int partitions = spill_partition_count(estimate, join->mem_limit);
+    while (shift + partition_bits(partitions) > 32) {
+        partitions /= 2;
+    }
+    spilled_join* sub = create_spilled_join(partitions, join->mem_limit);
+    if (!sub) {
+        return NULL;
+    }
+    sub->shift = shift;
+    sub->abc_spilled = join->abc_spilled;
+    sub->fb_spilled = join->fb_spilled;
+    memcpy(sub->fb_weeks, join->fb_weeks, sizeof(join->fb_weeks));
+    sub->fb_week_count = join->fb_week_count;
+
+    arena text;
+    const char* key;
+    const char* value;
+    double values[FB_MATRIX_MAX_WEEKS];
+    int ok = 1;
+
+    arena_init(&text, 4096);
+    if (join->abc_spilled) {
+        ok = spill_rewind(join->abc, partition);
+        for (uint32_t i = 0; ok && i < join->abc_rows[partition]; i++) {
+            ok = spill_read_text(join->abc, partition, &text, &key) && spill_read_text(join->abc, partition, &text, &value);
+            if (ok) {
+                spill_pair(sub->abc, sub->abc_rows, spilled_partition(sub, key), key, value);
+            }
+            arena_reset(&text);
+        }
+        spill_drop(join->abc, partition);
+    }
+    if (ok && join->fb_spilled) {
+        ok = spill_rewind(join->fb, partition);
+        for (uint32_t i = 0; ok && i < join->fb_rows[partition]; i++) {
+            ok = spill_read_text(join->fb, partition, &text, &key);
+            if (ok && join->fb_week_count > 0) {
+                ok = spill_read(join->fb, partition, values, join->fb_week_count * sizeof(double));
+                if (ok) {
+                    int sub_partition = spilled_partition(sub, key);
+                    spill_write_text(sub->fb, sub_partition, key);
+                    spill_write(sub->fb, sub_partition, values, join->fb_week_count * sizeof(double));
+                    sub->fb_rows[sub_partition]++;
+                }
+            } else if (ok) {
+                ok = spill_read_text(join->fb, partition, &text, &value);
+                if (ok) {
+                    spill_pair(sub->fb, sub->fb_rows, spilled_partition(sub, key), key, value);
+                }
+            }
+            arena_reset(&text);
+        }
+        spill_drop(join->fb, partition);
+    }
+    arena_free(&text);
+
+    // The batch only holds one row at a time here
+    ok = ok && spill_rewind(join->pcb, partition);
+    for (uint64_t row = 0; ok && row < join->pcb_rows[partition]; row++) {
+        char** row_values = batch->cells;
+        for (int i = 0; ok && i < p->plan->input_count; i++) {
+            const char* input;
+            ok = spill_read_text(join->pcb, partition, &batch->text, &input);
+            row_values[i] = (char*)input;
+        }
+        if (ok) {
+            const char* widf_value = p->plan->widf_col >= 0 ? row_values[p->plan->widf_col] : NULL;
+            unsigned char sub_partition = widf_value ? (unsigned char)spilled_partition(sub, widf_value) : 0;
+            spill_write(sub->order, 0, &sub_partition, 1);
+            for (int i = 0; i < p->plan->input_count; i++) {
+                spill_write_text(sub->pcb, sub_partition, row_values[i]);
+            }
+            sub->pcb_rows[sub_partition]++;
+        }
+        arena_reset(&batch->text);
+    }
+    spill_drop(join->pcb, partition);
+
+    // Rows of one key always land together: if they all did, splitting
+    // again would not make the partition any smaller
+    uint32_t rows = join->abc_rows[partition] + join->fb_rows[partition];
+    for (int i = 0; i < partitions; i++) {
+        if (sub->abc_rows[i] + sub->fb_rows[i] == rows) {
+            sub->no_split = 1;
+        }
+    }
+    if (!ok || spilled_join_failed(sub)) {
+        free_spilled_join(sub);
+        return NULL;
+    }
+    return sub;
+}
+
+static int join_partition(pipeline* p, spilled_join* join, pcb_batch* batch, int partition, const char* parent_label);
+
+// Join the partitions of a split partition, then append their rows to the
+// partition's output in PCB order, as merge_spilled_rows does for the whole join
+static int join_split_partition(pipeline* p, spilled_join* join, pcb_batch* batch, int partition,
+                                const char* label, uint64_t estimate) {
+    spilled_join* sub = split_partition(p, join, batch, partition, estimate);
+    if (!sub) {
+        fprintf(stderr, "Error: partition %s of the lookup tables could not be split\n", label);
+        return 0;
+    }
+    int partitions = spill_partitions(sub->pcb);
+    printf("Partition %s: %u ABC and %u FB keys, about %.1f MB of tables, split into %d partitions\n", label,
+           join->abc_rows[partition], join->fb_rows[partition], estimate / (1024.0 * 1024.0), partitions);
+
+    int ok = 1;
+    for (int i = 0; ok && i < partitions; i++) {
+        ok = join_partition(p, sub, batch, i, label);
+    }
+
+    output_cell cells[MAX_OUTPUT_COLS];
+    unsigned char sub_partition;
+    arena text;
+    ok = ok && spill_rewind(sub->order, 0);
+    for (int i = 0; ok && i < partitions; i++) {
+        ok = spill_rewind(sub->output, i);
+    }
+    arena_init(&text, 4096);
+    while (ok && spill_read(sub->order, 0, &sub_partition, 1)) {
+        const char* widf_value;
+        uint64_t fingerprint;
+        ok = read_spilled_row(sub->output, sub_partition, p->incremental != NULL, &text, &widf_value, &fingerprint,
+                              cells, p->plan->count);
+        if (ok) {
+            spill_output_row(join->output, partition, p->incremental != NULL, widf_value, fingerprint, cells,
+                             p->plan->count);
+        }
+        arena_reset(&text);
+    }
+    arena_free(&text);
+    if (!ok) {
+        fprintf(stderr, "Error: rows of split partition %s could not be read back\n", label);
+    } else if (spilled_join_failed(sub)) {
+        fprintf(stderr, "Error: could not write the spill files (disk full?)\n");
+        ok = 0;
+    }
+    join->splits += 1 + sub->splits;
+    join->split_bytes += spilled_join_bytes(sub);
+    if (sub->peak_bytes > join->peak_bytes) {
+        join->peak_bytes = sub->peak_bytes;
+    }
+    free_spilled_join(sub);
+    return ok;
+}
+
+// Evaluate the PCB rows of one partition against its part of the tables,
+// with the same evaluate_batch as the in-memory path. A partition whose rows
+// would take more than its half of --mem-limit is split first.
+static int join_partition(pipeline* p, spilled_join* join, pcb_batch* batch, int partition, const char* parent_label) {
+    lookup_set* lookups = p->lookups;
+    int partitions = spill_partitions(join->pcb);
+    char label[64];
+
+    if (parent_label) {
+        snprintf(label, sizeof(label), "%s.%d", parent_label, partition + 1);
+    } else {
+        snprintf(label, sizeof(label), "%d", partition + 1);
+    }
+    uint64_t estimate = partition_table_bytes(join, partition);
+    if (estimate > join->mem_limit / 2 && !join->no_split
+        && join->shift + partition_bits(partitions) < 32) {
+        return join_split_partition(p, join, batch, partition, label, estimate);
+    }
+    if (!load_spilled_partition(join, partition, lookups)) {
+        fprintf(stderr, "Error: partition %s of the lookup tables could not be loaded\n", label);
+        clear_lookup_set(lookups);
+        return 0;
+    }
+    if (build_key_dictionary(lookups)) {
+        print_key_dictionary(lookups);
+    }
+    if (!p->fb_bound) {
+        // Every partition has the same week columns
+        bind_fb_matrix(p->plan, lookups);
+        p->fb_bound = 1;
+    }
+    size_t bytes = lookup_set_memory(lookups);
+    if (bytes > join->peak_bytes) {
+        join->peak_bytes = bytes;
+    }
+    printf("Partition %s/%d: %llu PCB rows, %u ABC and %u FB keys, %.1f MB of tables\n", label, partitions,
+           (unsigned long long)join->pcb_rows[partition], join->abc_rows[partition], join->fb_rows[partition],
+           bytes / (1024.0 * 1024.0));
+    if (bytes > join->mem_limit / 2) {
+        printf("Warning: partition %s takes %.1f MB, more than the half of --mem-limit planned per partition\n",
+               label, bytes / (1024.0 * 1024.0));
+    }
+
+    int ok = spill_rewind(join->pcb, partition);
+    batch->rows = 0;
+    arena_reset(&batch->text);
+    for (uint64_t row = 0; ok && row < join->pcb_rows[partition]; row++) {
+        char** row_values = batch->cells + (size_t)batch->rows * batch->width;
+        for (int i = 0; ok && i < p->plan->input_count; i++) {
+            const char* text;
+            ok = spill_read_text(join->pcb, partition, &batch->text, &text);
+            row_values[i] = (char*)text;
+        }
+        if (ok && (++batch->rows == PCB_BATCH_ROWS || row + 1 == join->pcb_rows[partition])) {
+            evaluate_batch(p->plan, p->vectors, batch, lookups, 0, p->incremental, p->stats);
+            spill_output_rows(join, partition, p->plan, p->incremental, batch);
+            batch->rows = 0;
+            arena_reset(&batch->text);
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: PCB rows of partition %s could not be read back\n", label);
+    }
+    spill_drop(join->pcb, partition);
+    clear_lookup_set(lookups);
+    return ok;
+}
+
+// Write the evaluated rows in PCB order: the order file says which partition
+// holds the next row, and each partition holds its rows in PCB order
+static int merge_spilled_rows(pipeline* p) {
+    spilled_join* join = p->spill;
+    output_cell cells[MAX_OUTPUT_COLS];
+    unsigned char partition;
+    arena text;
+    int ok = spill_rewind(join->order, 0);
+
+    for (int i = 0; ok && i < spill_partitions(join->output); i++) {
+        ok = spill_rewind(join->output, i);
+    }
+    arena_init(&text, 4096);
+    while (ok && spill_read(join->order, 0, &partition, 1)) {
+        const char* widf_value;
+        uint64_t fingerprint;
+        ok = read_spilled_row(join->output, partition, p->incremental != NULL, &text, &widf_value, &fingerprint,
+                              cells, p->plan->count);
+        if (ok) {
+            output_sink_write_row(p->output, cells, p->plan->count);
+            if (p->summary) {
+                summary_report_add(p->summary, cells);
+            }
+            if (p->incremental && widf_value) {
+                row_cache_add(p->incremental->next, widf_value, fingerprint, cells);
+            }
+        }
+        arena_reset(&text);
+    }
+    arena_free(&text);
+    if (!ok) {
+        fprintf(stderr, "Error: evaluated rows could not be read back\n");
+    }
+    return ok;
+}
+
+// Join the partitioned PCB rows with the spilled tables one partition at a
+// time, then write every row in PCB order. Returns 0 if a spill file could
+// not be written or read back.
+static int run_spilled_join(pipeline* p) {
+    spilled_join* join = p->spill;
+    int partitions = spill_partitions(join->pcb);
+    pcb_batch* batch = new_batch(p->plan->input_count + 2, p->plan->count, p->stats);
+    int ok = batch != NULL;
+
+    // Loading a partition's tables counts as evaluation, the merge as output
+    perf_tracker_switch(p->reader_perf, p->stats->perf, STATS_PERF_EVALUATE);
+    for (int i = 0; ok && i < partitions; i++) {
+        ok = join_partition(p, join, batch, i, NULL);
+    }
+    if (batch) {
+        free_batch(batch);
+    }
+    perf_tracker_switch(p->reader_perf, p->stats->perf, STATS_PERF_OUTPUT);
+    ok = ok && merge_spilled_rows(p);
+    perf_tracker_switch(p->reader_perf, p->stats->perf, PERF_NO_PHASE);
+
+    uint64_t spilled = spilled_join_bytes(join);
+    if (spilled_join_failed(join)) {
+        fprintf(stderr, "Error: could not write the spill files (disk full?)\n");
+        ok = 0;
+    }
+    p->stats->spill_partitions = partitions;
+    p->stats->spill_bytes = spilled;
+    p->stats->index_bytes += join->peak_bytes;
+    printf("Memory-bounded join: %d partitions (%d split again), %.1f MB spilled, largest partition %.1f MB of tables\n",
+           partitions, join->splits, spilled / (1024.0 * 1024.0), join->peak_bytes / (1024.0 * 1024.0));
+    return ok;
+}
+
+///////////////////////// output workbook /////////////////////////
+
+// From this many PCB rows on the workbook is streamed: libxlsxwriter's
+// constant_memory mode flushes every row to a temporary file as soon as the
+// next row starts, instead of keeping the whole sheet until workbook_close.
+// It requires rows in order, which the single writer guarantees.
+#define STREAMING_ROW_THRESHOLD 100000
+// Past this many rows the xlsx may exceed 4 GB and needs ZIP64
+#define ZIP64_ROW_THRESHOLD 1000000
+
+// PCB rows to expect, 0 if unknown; cheap estimates, not a count
+static uint32_t expected_pcb_rows(sqlite3* db, const char* input_file) {
+    uint32_t rows = 0;
+    if (db) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "SELECT max(rowid) FROM \"pcb\"", -1, &stmt, NULL) == SQLITE_OK) {
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                rows = (uint32_t)sqlite3_column_int64(stmt, 0);
+            }
+            sqlite3_finalize(stmt);
+        }
+    } else {
+        rows = expected_data_rows(input_file);
+    }
+    return rows;
+}
+
+// Open the output sink; in --db mode writing back into the input database
+// reuses its connection, whose PCB query keeps a read transaction open that
+// would block the commits of a second connection.
+static output_sink* open_output(output_format format, const char* output_file, int streaming,
+                                uint32_t expected_rows, sqlite3* db, const char* db_path) {
+    output_sink_options options;
+    memset(&options, 0, sizeof(options));
+    if (format == OUTPUT_XLSX && fast_writer_threads > 0) {
+        // Always streamed: rows go straight into the deflate chunks
+        options.deflate_threads = fast_writer_threads;
+        options.deflate_level = deflate_level;
+        options.use_zip64 = expected_rows >= ZIP64_ROW_THRESHOLD;
+    } else if (format == OUTPUT_XLSX && streaming) {
+        options.streaming = 1;
+        options.use_zip64 = expected_rows >= ZIP64_ROW_THRESHOLD;
+        printf("Streaming output: constant memory mode%s\n", options.use_zip64 ? " with ZIP64" : "");
+    }
+    if (format == OUTPUT_SQLITE && db && strcmp(output_file, db_path) == 0) {
+        options.db = db;
+    }
+    return output_sink_open(format, output_file, &options);
+}
+
+// Probe histograms and memory of the lookup tables, taken before they are freed
+static void collect_index_stats(const lookup_set* lookups) {
+    if (lookups->abc_loaded) {
+        hash_index_get_stats(&lookups->abc_table, &stats.abc_index);
+        stats.index_bytes += hash_index_memory(&lookups->abc_table);
+        stats.have_abc_index = 1;
+    }
+    if (lookups->fb_weeks_loaded) {
+        hash_index_get_stats(&lookups->fb_weeks.refs, &stats.fb_index);
+        stats.index_bytes += fb_matrix_memory(&lookups->fb_weeks);
+        stats.have_fb_index = 1;
+    } else if (lookups->fb_loaded) {
+        hash_index_get_stats(&lookups->fb_table, &stats.fb_index);
+        stats.index_bytes += hash_index_memory(&lookups->fb_table);
+        stats.have_fb_index = 1;
+    }
+    stats.index_bytes += key_dictionary_memory(lookups);
+}
+
+///////////////////////// one conversion /////////////////////////
+
+// What one conversion reads and writes, filled in from the command line
+typedef struct {
+    const char* input_file;     // PCB workbook, unused with db_path
+    const char* db_path;        // --db: abc, fb and pcb tables of this database
+    const char* output_file;
+    output_format format;
+    int streaming;              // -1: decided from the input size
+    int serial;                 // load, evaluate and write on the calling thread
+    int week;
+    const int* horizon_weeks;   // --weeks, none when horizon_count is 0
+    int horizon_count;
+    const column_spec* columns; // output columns: --columns or the default layout
+    const char* cache_file;     // --incremental: rows of the previous run, NULL for a full run
+    uint64_t mem_limit;         // --mem-limit: bytes ABC and FB may take in memory, 0 for no limit
+    int summary;                // --summary: group totals and lowest coverages as extra sheets
+    int lowest_rows;            // rows of the lowest couv sheet
+} convert_options;
+
+// Identifies a column plan in the row cache: the output columns, how each is
+// computed (expression code included), and the PCB columns read for it
+static uint64_t plan_signature(const column_plan* plan, char** header) {
+    uint64_t hash = row_cache_hash(ROW_CACHE_SEED, &plan->count, sizeof(int));
+    for (int i = 0; i < plan->count; i++) {
+        const column_step* step = &plan->steps[i];
+        int fields[4] = { (int)step->kind, step->source, step->slot, step->numeric };
+        hash = row_cache_hash(hash, fields, sizeof(fields));
+        hash = row_cache_hash_text(hash, step->name);
+        // Field by field: the instructions have padding
+        for (int c = step->code; c < step->code + step->length; c++) {
+            int op[2] = { (int)plan->code[c].op, plan->code[c].arg };
+            hash = row_cache_hash(hash, op, sizeof(op));
+            hash = row_cache_hash(hash, &plan->code[c].constant, sizeof(double));
+        }
+    }
+    for (int i = 0; i < plan->input_count; i++) {
+        hash = row_cache_hash_text(hash, header[plan->inputs[i]]);
+    }
+    int keys[2] = { plan->widf_col, plan->week_count };
+    hash = row_cache_hash(hash, keys, sizeof(keys));
+    return row_cache_hash(hash, plan->weeks, plan->week_count * sizeof(int));
+}
+
+// A WIDF of the last run with rows this run did not match: gone, or with
+// fewer rows than before
+static void report_unseen_key(const char* key, int deleted, void* data) {
+    if (deleted) {
+        printf("Deleted WIDF %s\n", key);
+    } else {
+        report_key_change(data, key, ROW_UPDATED);
+    }
+}
+
+// Convert one PCB input into one output. ABC and FB are loaded into lookups
+// unless the set is loaded already (--batch and --watch share loaded sets);
+// with a database SQLite joins them instead. Phase times and counters go to
+// counters. Returns 1 when the whole output was written.
+static int run_conversion(const convert_options* options, lookup_set* lookups, run_stats* counters) {
+    sheet_reader reader;
+    sqlite3* db = NULL;
+    sqlite3_stmt* pcb_stmt = NULL;
+    const char* output_file = options->output_file;
+    pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.week = options->week;
+    p.horizon = options->horizon_count > 0;
+    p.db_mode = options->db_path != NULL;
+    p.lookups = lookups;
+    p.stats = counters;
+    memset(&reader, 0, sizeof(reader));
+
+    // --mem-limit: tables that would not fit are joined through spill files
+    if (options->mem_limit > 0 && !options->db_path) {
+        p.mem_limit = options->mem_limit;
+        uint64_t estimate = estimate_reference_bytes(p.horizon);
+        if (estimate > options->mem_limit) {
+            int partitions = spill_partition_count(estimate, options->mem_limit);
+            if ((p.spill = create_spilled_join(partitions, options->mem_limit)) == NULL) {
+                fprintf(stderr, "Error: could not create the spill files (set TMPDIR to a writable directory)\n");
+                return 0;
+            }
+            printf("Lookup tables estimated at %.1f MB, over --mem-limit %.1f MB: joining in %d partitions\n",
+                   estimate / (1024.0 * 1024.0), options->mem_limit / (1024.0 * 1024.0), partitions);
+        } else {
+            printf("Lookup tables estimated at %.1f MB, within --mem-limit %.1f MB: joining in memory\n",
+                   estimate / (1024.0 * 1024.0), options->mem_limit / (1024.0 * 1024.0));
+        }
+    }
+
+    double phase_started = stats_now();
+    if (options->db_path) {
+        // Only read, unless the output table goes into the same database
+        int writes_back = options->format == OUTPUT_SQLITE && strcmp(options->output_file, options->db_path) == 0;
+        printf("Opening database %s...\n", options->db_path);
+        if (sqlite3_open_v2(options->db_path, &db, writes_back ? SQLITE_OPEN_READWRITE : SQLITE_OPEN_READONLY,
+                            NULL) != SQLITE_OK) {
+            fprintf(stderr, "Error opening database %s: %s\n", options->db_path, sqlite3_errmsg(db));
+            sqlite3_close(db);
+            return 0;
+        }
+        if ((pcb_stmt = db_prepare_pcb_query(db, options->week, !p.horizon)) == NULL) {
+            sqlite3_close(db);
+            return 0;
+        }
+        printf("%s opened successfully\n", options->db_path);
+    } else {
+        // Build the ABC and FB indexes while the PCB sheet is being parsed
+        if (!options->serial) {
+            start_loaders(&p);
+        }
+
+        // Open XLSX for reading
+        printf("Opening %s file...\n", options->input_file);
+        if (!open_workbook(&reader, options->input_file, fast_reader_threads)) {
+            fprintf(stderr, "Error opening %s\n", options->input_file);
+            join_loaders(&p);
+            free_spilled_join(p.spill);
+            return 0;
+        }
+        printf("%s opened successfully\n", options->input_file);
+
+        // Open first sheet
+        printf("Opening sheet...\n");
+        if (!open_first_sheet(&reader)) {
+            fprintf(stderr, "Error reading sheet\n");
+            close_sheet_reader(&reader);
+            join_loaders(&p);
+            free_spilled_join(p.spill);
+            return 0;
+        }
+
+        printf("Sheet opened successfully\n");
+    }
+    run_stats_add_phase(counters, STATS_FILE_CHECKS, phase_started);
+
+    if (db && p.horizon && !lookups->fb_weeks_loaded) {
+        perf_tracker perf;
+        phase_started = stats_now();
+        open_perf_tracker(&perf, STATS_PERF_FB_LOAD);
+        db_load_fb_matrix(db, lookups);
+        perf_tracker_close(&perf, counters->perf);
+        run_stats_add_phase(counters, STATS_FB_LOAD, phase_started);
+    }
+
+    // Prepare the output; an xlsx is streamed for large inputs, and under
+    // --mem-limit, where a sheet kept in memory would defeat the limit
+    uint32_t expected_rows = expected_pcb_rows(db, options->input_file);
+    int streaming = options->streaming;
+    if (streaming < 0) {
+        streaming = expected_rows >= STREAMING_ROW_THRESHOLD || options->mem_limit > 0;
+    }
+    // The built-in writer always streams
+    streaming = (streaming || fast_writer_threads > 0) && options->format == OUTPUT_XLSX;
+    output_sink* output = open_output(options->format, output_file, streaming, expected_rows, db, options->db_path);
+    if (output == NULL) {
+        fprintf(stderr, "Error creating %s\n", output_file);
+        if (pcb_stmt) {
+            sqlite3_finalize(pcb_stmt);
+            sqlite3_close(db);
+        } else {
+            close_sheet_reader(&reader);
+        }
+        join_loaders(&p);
+        free_spilled_join(p.spill);
+        return 0;
+    }
+    counters->streaming = streaming;
+
+    // Read header row; any number of columns
+    char** header = NULL;
+    int header_count = 0;
+    int have_header = 0;
+    column_plan plan;
+
+    phase_started = stats_now();
+    printf("Attempting to read header row...\n");
+    if (pcb_stmt) {
+        // Column names of the pcb table, without the two joined lookup columns
+        header = malloc((db_wlom_col + 1) * sizeof(char*));
+        for (int i = 0; header && i < db_wlom_col; i++) {
+            header[header_count++] = strdup(sqlite3_column_name(pcb_stmt, i));
+        }
+        have_header = header_count > 0;
+    } else {
+        header = read_xlsx_header(&reader, &header_count, &have_header);
+    }
+
+    if (have_header) {
+        printf("Header row found!\n");
+        printf("Found %d columns in header\n", header_count);
+        
+        // Match indices
+        printf("\nLooking for required columns:\n");
+        compile_column_plan(&plan, options->columns, (const char**)header, header_count, options->week,
+                            options->horizon_weeks, options->horizon_count, 0);
+        
+        printf("\nAvailable columns in PCB.xls:\n");
+        for (int i = 0; i < header_count; i++) {
+            printf("[%d] %s\n", i, header[i]);
+        }
+
+        // Write header to output
+        write_plan_header(output, &plan);
+        printf("Header written to output, starting data rows...\n");
+        if (options->summary && (p.summary = open_summary(&plan, options->lowest_rows)) != NULL) {
+            summary_report_print(p.summary);
+        } else if (options->summary) {
+            printf("Summary: the output has no WGES, WFOR or couv column, nothing to summarize\n");
+        }
+    } else {
+        printf("No header row found!\n");
+        compile_column_plan(&plan, options->columns, NULL, 0, options->week, options->horizon_weeks,
+                            options->horizon_count, 0);
+    }
+
+    // --incremental: rows whose inputs and lookup values are unchanged since
+    // the last run are taken from its row cache instead of being evaluated
+    incremental_rows incremental;
+    hash_index reported_keys;
+    memset(&incremental, 0, sizeof(incremental));
+    memset(&reported_keys, 0, sizeof(reported_keys));
+    if (options->cache_file && have_header && hash_index_init(&reported_keys, 0)) {
+        incremental.reported = &reported_keys;
+        incremental.counters = counters;
+        uint64_t signature = plan_signature(&plan, header);
+        incremental.previous = row_cache_open(options->cache_file, signature, (uint32_t)plan.count);
+        incremental.next = row_cache_create(options->cache_file, signature, (uint32_t)plan.count);
+        if (!incremental.next) {
+            fprintf(stderr, "Warning: cannot write %s, converting without it\n", options->cache_file);
+            row_cache_close(incremental.previous);
+            incremental.previous = NULL;
+        } else {
+            if (incremental.previous) {
+                printf("Incremental: %llu rows of the previous run in %s\n",
+                       (unsigned long long)row_cache_rows(incremental.previous), options->cache_file);
+            } else {
+                printf("Incremental: no usable %s, every row is computed\n", options->cache_file);
+            }
+            p.incremental = &incremental;
+            counters->incremental = 1;
+        }
+    }
+
+    run_stats_add_phase(counters, STATS_PCB_HEADER, phase_started);
+
+    // Read and write data rows
+    phase_started = stats_now();
+    pcb_reader pcb;
+    pthread_t evaluator, writer;
+    perf_tracker reader_perf;
+    memset(&pcb, 0, sizeof(pcb));
+    int pipelined = 0;
+
+    p.plan = &plan;
+    p.output = output;
+    p.vectors = have_header ? new_column_vectors(&plan) : NULL;
+    // Loading on this thread counts in the load phases instead
+    open_perf_tracker(&reader_perf, PERF_NO_PHASE);
+    p.reader_perf = &reader_perf;
+    // With spilled tables the rows are only partitioned while they are read
+    if (!options->serial && !p.spill && batch_queue_init(&p.parsed, PIPELINE_QUEUE_DEPTH)
+        && batch_queue_init(&p.evaluated, PIPELINE_QUEUE_DEPTH)) {
+        if (pthread_create(&evaluator, NULL, evaluator_main, &p) == 0) {
+            if (pthread_create(&writer, NULL, writer_main, &p) == 0) {
+                pipelined = 1;
+            } else {
+                batch_queue_close(&p.parsed);
+                pthread_join(evaluator, NULL);
+            }
+        }
+    }
+
+    if (!pipelined && !p.spill) {
+        finish_loading(&p);
+    }
+    perf_tracker_switch(&reader_perf, counters->perf, STATS_PERF_PCB_READ);
+    int rows_ok = 1;
+    if (!have_header) {
+        // Nothing to read
+    } else if (!p.vectors || !init_pcb_reader(&pcb, &reader, pcb_stmt, &plan, header_count, counters,
+                                p.spill ? spill_pcb_batch : (pipelined ? queue_batch : run_batch), &p)) {
+        fprintf(stderr, "Error: out of memory reading PCB rows\n");
+        rows_ok = 0;
+    } else {
+        rows_ok = read_pcb_rows(&pcb);
+    }
+    if (p.spill && have_header && rows_ok) {
+        // The loader threads partitioned the tables meanwhile
+        perf_tracker_switch(&reader_perf, counters->perf, PERF_NO_PHASE);
+        finish_loading(&p);
+        rows_ok = run_spilled_join(&p);
+    }
+    perf_tracker_switch(&reader_perf, counters->perf, PERF_NO_PHASE);
+    if (pipelined) {
+        batch_queue_close(&p.parsed);
+        pthread_join(evaluator, NULL);
+        pthread_join(writer, NULL);
+    }
+    // Loader threads are joined by the evaluator; this covers a run without one
+    join_loaders(&p);
+    if (p.parsed.items) {
+        batch_queue_destroy(&p.parsed);
+    }
+    if (p.evaluated.items) {
+        batch_queue_destroy(&p.evaluated);
+    }
+    run_stats_add_phase(counters, STATS_ROW_LOOP, phase_started);
+    counters->rows = pcb.rows_read;
+
+    // Cleanup
+    if (pcb_stmt) {
+        sqlite3_finalize(pcb_stmt);
+    } else {
+        close_sheet_reader(&reader);
+    }
+    free_header(header, header_count);
+    free_spilled_join(p.spill);
+    free_column_vectors(p.vectors);
+    // Closing writes the xlsx, flushes the csv or commits and indexes the table
+    phase_started = stats_now();
+    perf_tracker_switch(&reader_perf, counters->perf, STATS_PERF_OUTPUT);
+    int summary_ok = 1;
+    if (p.summary && rows_ok) {
+        uint32_t wges_groups, wfor_groups;
+        int lowest_rows;
+        summary_ok = summary_report_write(p.summary, output);
+        summary_report_counts(p.summary, &wges_groups, &wfor_groups, &lowest_rows);
+        printf("Summary: %u WGES groups, %u WFOR groups, %d lowest couv rows\n", wges_groups, wfor_groups,
+               lowest_rows);
+    }
+    summary_report_free(p.summary);
+    int output_ok = output_sink_close(output) && summary_ok;
+    perf_tracker_close(&reader_perf, counters->perf);
+    run_stats_add_phase(counters, STATS_WORKBOOK_CLOSE, phase_started);
+    if (db) {
+        sqlite3_close(db);
+    }
+    if (!output_ok) {
+        fprintf(stderr, "Error writing %s\n", output_file);
+    }
+    if (p.incremental) {
+        // Keys of the last run no row asked for, or fewer rows of them; the
+        // cache is replaced only when this run's output is complete
+        if (incremental.previous) {
+            counters->keys_deleted = row_cache_unseen(incremental.previous, report_unseen_key, &incremental);
+        }
+        if (!row_cache_finish(incremental.next, output_ok && rows_ok)) {
+            fprintf(stderr, "Warning: could not write %s, the next run computes every row\n",
+                    options->cache_file);
+        }
+        row_cache_close(incremental.previous);
+        printf("Incremental: %llu rows reused, %llu inserted, %llu updated, %llu deleted\n",
+               (unsigned long long)counters->rows_reused, (unsigned long long)counters->keys_inserted,
+               (unsigned long long)counters->keys_updated, (unsigned long long)counters->keys_deleted);
+    }
+    hash_index_free(&reported_keys);
+    struct stat output_stat;
+    if (stat(output_file, &output_stat) == 0) {
+        counters->output_bytes = (uint64_t)output_stat.st_size;
+    }
+    char kind[64];
+    if (options->format != OUTPUT_XLSX) {
+        snprintf(kind, sizeof(kind), "%s", options->format == OUTPUT_CSV ? "csv" : "sqlite table output");
+    } else if (fast_writer_threads > 0) {
+        snprintf(kind, sizeof(kind), "xlsx, deflated on %d threads", fast_writer_threads);
+    } else {
+        snprintf(kind, sizeof(kind), "%s", streaming ? "xlsx, streamed" : "xlsx, in memory");
+    }
+    printf("Wrote %llu bytes to %s (%s), closing the output took %.3f s\n",
+           (unsigned long long)counters->output_bytes, output_file, kind,
+           counters->phase_seconds[STATS_WORKBOOK_CLOSE]);
+    return output_ok && rows_ok;
+}
+
+///////////////////////// batch mode (--batch) /////////////////////////
+
+// --batch converts many PCB files against a single load of ABC and FB. The
+// lookups are built before the workers start and only read afterwards, so
+// the files share them without locking. Each file is converted serially on
+// one worker of a work-stealing pool (see work_pool.h) and written next to
+// the others in the output directory, named after the input.
+
+typedef struct {
+    char* path;
+    char output[4096];
+    off_t size;
+    int rows;
+    int ok;
+    double seconds;
+} batch_file;
+
+typedef struct {
+    batch_file* files;
+    int count;
+    int capacity;
+    int week;
+    const int* horizon_weeks;
+    int horizon_count;
+    const column_spec* columns;
+    output_format format;
+    int streaming;          // -1: decided per file from its size
+    int summary;            // --summary sheets in every output
+    int lowest_rows;
+    pthread_mutex_t lock;   // merging the per-file stats into the run's
+} batch_run;
+
+// Directory entries taken as PCB files: .xlsx/.xls, but not the reference
+// files themselves nor Excel lock files
+static int is_batch_input(const char* name) {
+    const char* extension = strrchr(name, '.');
+    if (!extension || (strcmp(extension, ".xlsx") != 0 && strcmp(extension, ".xls") != 0)) {
+        return 0;
+    }
+    return strncmp(name, "~$", 2) != 0 && strcmp(name, "ABC.xlsx") != 0 && strcmp(name, "FB.xlsx") != 0;
+}
+
+static int add_batch_file(batch_run* run, const char* path, off_t size) {
+    if (run->count == run->capacity) {
+        int capacity = run->capacity ? run->capacity * 2 : 16;
+        batch_file* files = realloc(run->files, capacity * sizeof(batch_file));
+        if (!files) {
+            return 0;
+        }
+        run->files = files;
+        run->capacity = capacity;
+    }
+    batch_file* file = &run->files[run->count];
+    memset(file, 0, sizeof(batch_file));
+    if ((file->path = strdup(path)) == NULL) {
+        return 0;
+    }
+    file->size = size;
+    run->count++;
+    return 1;
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Largest file first, so the pool starts with the longest conversions
+static int compare_batch_files(const void* a, const void* b) {
+    const batch_file* x = a;
+    const batch_file* y = b;
+    if (x->size != y->size) {
+        return x->size > y->size ? -1 : 1;
+    }
+    return strcmp(x->path, y->path);
+}
+
+// Expand the --batch arguments (PCB files or directories of them)
+static int collect_batch_inputs(batch_run* run, char** inputs, int input_count) {
+    for (int i = 0; i < input_count; i++) {
+        struct stat st;
+        if (stat(inputs[i], &st) != 0) {
+            fprintf(stderr, "Error: %s not found\n", inputs[i]);
+            return 0;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            if (!add_batch_file(run, inputs[i], st.st_size)) {
+                return 0;
+            }
+            continue;
+        }
+
+        DIR* dir = opendir(inputs[i]);
+        struct dirent* entry;
+        char** names = NULL;
+        int name_count = 0, name_capacity = 0, ok = 1;
+        if (!dir) {
+            fprintf(stderr, "Error: cannot read directory %s\n", inputs[i]);
+            return 0;
+        }
+        while (ok && (entry = readdir(dir)) != NULL) {
+            if (!is_batch_input(entry->d_name)) {
+                continue;
+            }
+            if (name_count == name_capacity) {
+                name_capacity = name_capacity ? name_capacity * 2 : 64;
+                char** grown = realloc(names, name_capacity * sizeof(char*));
+                if (!grown) {
+                    ok = 0;
+                    break;
+                }
+                names = grown;
+            }
+            ok = (names[name_count++] = strdup(entry->d_name)) != NULL;
+        }
+        closedir(dir);
+        qsort(names, name_count, sizeof(char*), compare_names);
+        for (int n = 0; n < name_count; n++) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", inputs[i], names[n]);
+            if (ok && stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+                ok = add_batch_file(run, path, st.st_size);
+            }
+            free(names[n]);
+        }
+        free(names);
+        if (!ok) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// <output_dir>/<input name without extension>.<extension of the format>;
+// two inputs may not map to the same output
+static int assign_batch_outputs(batch_run* run, const char* output_dir) {
+    const char* extension = strrchr(output_format_default_path(run->format), '.');
+    for (int i = 0; i < run->count; i++) {
+        batch_file* file = &run->files[i];
+        const char* name = strrchr(file->path, '/');
+        name = name ? name + 1 : file->path;
+        const char* dot = strrchr(name, '.');
+        int stem = dot && dot != name ? (int)(dot - name) : (int)strlen(name);
+        snprintf(file->output, sizeof(file->output), "%s/%.*s%s", output_dir, stem, name, extension);
+        for (int j = 0; j < i; j++) {
+            if (strcmp(run->files[j].output, file->output) == 0) {
+                fprintf(stderr, "Error: %s and %s would both be written to %s\n",
+                        run->files[j].path, file->path, file->output);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Build the lookups every file reads before any worker starts; loads the
+// loader threads did not do (--serial) happen here
+static int load_shared_lookups(pipeline* p, int serial) {
+    if (!serial) {
+        start_loaders(p);
+    }
+    finish_loading(p);
+    return p->lookups->abc_loaded && fb_part_loaded(p);
+}
+
+// Convert one PCB file; runs on a pool worker, counters are the file's own
+static int convert_pcb_file(const batch_run* run, batch_file* file, run_stats* counters) {
+    sheet_reader reader;
+    column_plan plan;
+    int header_count, have_header;
+
+    // Files are already converted in parallel, each is parsed on one thread
+    if (!open_workbook(&reader, file->path, fast_reader_threads > 0)) {
+        fprintf(stderr, "Error opening %s\n", file->path);
+        return 0;
+    }
+    if (!open_first_sheet(&reader)) {
+        fprintf(stderr, "Error reading sheet of %s\n", file->path);
+        close_sheet_reader(&reader);
+        return 0;
+    }
+    char** header = read_xlsx_header(&reader, &header_count, &have_header);
+    compile_column_plan(&plan, run->columns, (const char**)header, header_count, run->week, run->horizon_weeks,
+                        run->horizon_count, 0);
+    bind_fb_matrix(&plan, &run_lookups);
+
+    uint32_t expected_rows = expected_data_rows(file->path);
+    int streaming = run->streaming < 0 ? expected_rows >= STREAMING_ROW_THRESHOLD : run->streaming;
+    streaming = (streaming || fast_writer_threads > 0) && run->format == OUTPUT_XLSX;
+    output_sink* output = open_output(run->format, file->output, streaming, expected_rows, NULL, NULL);
+    int ok = output != NULL;
+    perf_tracker perf;
+    open_perf_tracker(&perf, STATS_PERF_PCB_READ);
+    if (!output) {
+        fprintf(stderr, "Error creating %s\n", file->output);
+    } else if (have_header) {
+        pipeline p;
+        pcb_reader pcb;
+        memset(&p, 0, sizeof(p));
+        memset(&pcb, 0, sizeof(pcb));
+        p.plan = &plan;
+        p.week = run->week;
+        p.horizon = run->horizon_count > 0;
+        p.output = output;
+        p.lookups = &run_lookups;
+        p.stats = counters;
+        p.reader_perf = &perf;
+        p.vectors = new_column_vectors(&plan);
+        p.summary = run->summary ? open_summary(&plan, run->lowest_rows) : NULL;
+        write_plan_header(output, &plan);
+        ok = p.vectors && init_pcb_reader(&pcb, &reader, NULL, &plan, header_count, counters, run_batch, &p)
+          && read_pcb_rows(&pcb);
+        if (!p.vectors) {
+            fprintf(stderr, "Error: out of memory reading PCB rows\n");
+        }
+        if (p.summary && ok) {
+            ok = summary_report_write(p.summary, output);
+        }
+        summary_report_free(p.summary);
+        free_column_vectors(p.vectors);
+        counters->rows = pcb.rows_read;
+    }
+    if (output) {
+        perf_tracker_switch(&perf, counters->perf, STATS_PERF_OUTPUT);
+        ok = output_sink_close(output) && ok;
+    }
+    perf_tracker_close(&perf, counters->perf);
+    close_sheet_reader(&reader);
+    free_header(header, header_count);
+
+    struct stat output_stat;
+    if (stat(file->output, &output_stat) == 0) {
+        counters->output_bytes = (uint64_t)output_stat.st_size;
+    }
+    counters->streaming = streaming;
+    return ok;
+}
+
+static void convert_batch_item(int item, int worker, void* data) {
+    batch_run* run = data;
+    batch_file* file = &run->files[item];
+    run_stats counters;
+    double started = stats_now();
+
+    memset(&counters, 0, sizeof(counters));
+    counters.perf_counters = perf_counters_available;
+    file->ok = convert_pcb_file(run, file, &counters);
+    file->seconds = stats_now() - started;
+    file->rows = (int)counters.rows;
+
+    pthread_mutex_lock(&run->lock);
+    run_stats_merge(&stats, &counters);
+    pthread_mutex_unlock(&run->lock);
+    printf("[worker %d] %s -> %s: %d rows in %.3f s%s\n", worker, file->path, file->output,
+           file->rows, file->seconds, file->ok ? "" : " (FAILED)");
+}
+
+// Convert every PCB file of the --batch arguments; returns the exit status
+static int run_batch_mode(batch_run* run, char** inputs, int input_count, const char* output_dir,
+                          int jobs, int serial, int collect_stats) {
+    double phase_started = stats_now();
+    if (!collect_batch_inputs(run, inputs, input_count)) {
+        return 1;
+    }
+    if (run->count == 0) {
+        fprintf(stderr, "Error: no PCB files (.xlsx/.xls) found for --batch\n");
+        return 1;
+    }
+    qsort(run->files, run->count, sizeof(batch_file), compare_batch_files);
+    if (mkdir(output_dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: cannot create output directory %s\n", output_dir);
+        return 1;
+    }
+    if (!assign_batch_outputs(run, output_dir)) {
+        return 1;
+    }
+    printf("Batch mode: %d PCB files -> %s/\n", run->count, output_dir);
+    run_stats_add_phase(&stats, STATS_FILE_CHECKS, phase_started);
+
+    pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.week = run->week;
+    p.horizon = run->horizon_count > 0;
+    p.lookups = &run_lookups;
+    p.stats = &stats;
+    if (!load_shared_lookups(&p, serial)) {
+        fprintf(stderr, "Error: ABC.xlsx and FB.xlsx could not be loaded\n");
+        return 1;
+    }
+
+    if (serial) {
+        jobs = 1;
+    } else if (jobs <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cores > 0 ? (int)cores : 1;
+    }
+    phase_started = stats_now();
+    pthread_mutex_init(&run->lock, NULL);
+    stats.threads = work_pool_run(run->count, jobs, convert_batch_item, run);
+    pthread_mutex_destroy(&run->lock);
+    run_stats_add_phase(&stats, STATS_ROW_LOOP, phase_started);
+
+    int failed = 0;
+    for (int i = 0; i < run->count; i++) {
+        failed += !run->files[i].ok;
+        free(run->files[i].path);
+    }
+    free(run->files);
+    printf("Batch complete: %d files, %llu data rows on %d threads in %.3f s%s\n",
+           run->count, (unsigned long long)stats.rows, stats.threads, stats.phase_seconds[STATS_ROW_LOOP],
+           failed ? "" : ", all converted");
+    if (failed) {
+        fprintf(stderr, "Error: %d of %d files failed\n", failed, run->count);
+    }
+
+    if (collect_stats) {
+        collect_index_stats(&run_lookups);
+    }
+    clear_lookup_set(&run_lookups);
+    return failed ? 1 : 0;
+}
+
+///////////////////////// watch mode (--watch) /////////////////////////
+
+#define WATCH_DEBOUNCE_MS 250       // quiet time after the last event before inputs are compared
+#define WATCH_WEEK_CHECK_MS 60000   // wake up this often to notice a new ISO week
+
+// One complete lookup set and the week it was built for. The watch state
+// holds a reference to the current generation and every conversion pins the
+// one it started with, so publishing a rebuilt set never waits for a
+// conversion; the last reference to a replaced generation frees it.
+typedef struct {
+    lookup_set set;
+    int week;
+    int horizon_weeks[MAX_HORIZON_WEEKS];
+    int horizon_count;
+    int refs;
+} lookup_generation;
+
+typedef struct {
+    convert_options options;    // template of every conversion
+    const char* weeks_spec;     // --weeks, resolved again for every generation
+    int print_stats;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    lookup_generation* current;
+    int rebuild;                // ABC, FB, the database or the week changed
+    int reconvert;              // PCB changed or a new generation was published
+    int stopping;
+    int week;                   // week the current inputs were compared for
+    uint64_t abc_print, fb_print, pcb_print, db_print;  // input contents last acted on
+} watch_state;
+
+static volatile sig_atomic_t watch_stop = 0;
+
+static void stop_watching(int signal_number) {
+    (void)signal_number;
+    watch_stop = 1;
+}
+
+static void free_generation(lookup_generation* gen) {
+    clear_lookup_set(&gen->set);
+    free(gen);
+}
+
+// Drop one reference; called with the lock held, returns 1 when the caller
+// must free the generation after unlocking
+static int unpin_generation(lookup_generation* gen) {
+    return --gen->refs == 0;
+}
+
+// Content of a file, 0 when it does not exist
+static uint64_t file_fingerprint(const char* path) {
+    uint64_t size;
+    uint64_t hash = snapshot_source_hash(path, &size);
+    return hash ^ (size * 1099511628211ull);
+}
+
+static const char* watched_pcb_path(void) {
+    struct stat st;
+    return stat("input/PCB.xlsx", &st) == 0 ? "input/PCB.xlsx" : "input/PCB.xls";
+}
+
+// Load a complete set for the current week; NULL when ABC or FB (or the fb
+// table of the database) could not be loaded
+static lookup_generation* build_generation(const watch_state* w) {
+    lookup_generation* gen = calloc(1, sizeof(lookup_generation));
+    run_stats counters;
+    pipeline p;
+    int iso_year, ok;
+    double started = stats_now();
+
+    if (!gen) {
+        return NULL;
+    }
+    gen->week = get_current_week(&iso_year);
+    if (w->weeks_spec) {
+        gen->horizon_count = parse_week_horizon(w->weeks_spec, gen->week, iso_year, gen->horizon_weeks);
+    }
+    run_stats_init(&counters);
+    counters.perf_counters = perf_counters_available;
+    memset(&p, 0, sizeof(p));
+    p.week = gen->week;
+    p.horizon = gen->horizon_count > 0;
+    p.db_mode = w->options.db_path != NULL;
+    p.lookups = &gen->set;
+    p.stats = &counters;
+
+    if (!p.db_mode) {
+        if (!w->options.serial) {
+            start_loaders(&p);
+        }
+        finish_loading(&p);
+        ok = gen->set.abc_loaded && fb_part_loaded(&p);
+    } else if (p.horizon) {
+        // The FB week matrix is the only lookup kept in memory with --db
+        sqlite3* db = NULL;
+        ok = sqlite3_open_v2(w->options.db_path, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK
+          && db_load_fb_matrix(db, &gen->set);
+        sqlite3_close(db);
+    } else {
+        ok = 1;
+    }
+    if (!ok) {
+        free_generation(gen);
+        return NULL;
+    }
+    printf("Watch: lookups for week %d built in %.3f s\n", gen->week, stats_now() - started);
+    gen->refs = 1;
+    return gen;
+}
+
+static void* builder_main(void* arg) {
+    watch_state* w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->stopping && !w->rebuild) {
+            pthread_cond_wait(&w->changed, &w->lock);
+        }
+        if (w->stopping) {
+            break;
+        }
+        w->rebuild = 0;
+        pthread_mutex_unlock(&w->lock);
+
+        lookup_generation* gen = build_generation(w);
+        // --reload applies to the first build; later builds reuse valid snapshots
+        reference_files.rebuild_snapshots = 0;
+        if (!gen) {
+            fprintf(stderr, "Watch: lookups could not be loaded, keeping the previous ones\n");
+            pthread_mutex_lock(&w->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        lookup_generation* old = w->current;
+        w->current = gen;
+        w->reconvert = 1;
+        pthread_cond_broadcast(&w->changed);
+        int drop = old && unpin_generation(old);
+        pthread_mutex_unlock(&w->lock);
+        if (drop) {
+            free_generation(old);
+        }
+        pthread_mutex_lock(&w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+// Convert with a pinned generation; the output is written next to its final
+// path and renamed over it, so readers never see a half-written file
+static void convert_watched(const watch_state* w, lookup_generation* gen) {
+    convert_options options = w->options;
+    char tmp_path[4096];
+    run_stats counters;
+    // A SQLite output table is replaced inside one transaction instead
+    int replace = options.format != OUTPUT_SQLITE;
+
+    run_stats_init(&counters);
+    counters.perf_counters = perf_counters_available;
+    options.week = gen->week;
+    options.horizon_weeks = gen->horizon_weeks;
+    options.horizon_count = gen->horizon_count;
+    if (!options.db_path) {
+        options.input_file = watched_pcb_path();
+    }
+    if (replace) {
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", w->options.output_file);
+        options.output_file = tmp_path;
+    }
+
+    int ok = run_conversion(&options, &gen->set, &counters);
+    if (ok && replace && rename(tmp_path, w->options.output_file) != 0) {
+        fprintf(stderr, "Error: cannot rename %s to %s\n", tmp_path, w->options.output_file);
+        ok = 0;
+    }
+    if (!ok && replace) {
+        remove(tmp_path);
+    }
+    run_stats_finish(&counters);
+    if (ok) {
+        printf("Watch: wrote %s, %llu data rows in %.3f s\n", w->options.output_file,
+               (unsigned long long)counters.rows, counters.total_seconds);
+    } else {
+        fprintf(stderr, "Watch: conversion failed, %s left unchanged\n", w->options.output_file);
+    }
+    if (w->print_stats) {
+        run_stats_print(&counters, stdout);
+    } else if (counters.perf_counters) {
+        run_stats_print_perf(&counters, stdout);
+    }
+}
+
+static void* converter_main(void* arg) {
+    watch_state* w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->stopping && !(w->reconvert && w->current)) {
+            pthread_cond_wait(&w->changed, &w->lock);
+        }
+        if (w->stopping) {
+            break;
+        }
+        w->reconvert = 0;
+        lookup_generation* gen = w->current;
+        gen->refs++;
+        pthread_mutex_unlock(&w->lock);
+
+        convert_watched(w, gen);
+
+        pthread_mutex_lock(&w->lock);
+        if (unpin_generation(gen)) {
+            pthread_mutex_unlock(&w->lock);
+            free_generation(gen);
+            pthread_mutex_lock(&w->lock);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+// Compare the inputs with what was last acted on; touching or rewriting a
+// file with the same content does nothing. Without compare_files only the
+// week is checked.
+static void check_inputs(watch_state* w, int compare_files) {
+    int iso_year;
+    int week = get_current_week(&iso_year);
+    int first = w->week == 0;
+    int new_week = !first && week != w->week;
+    int rebuild = new_week;
+    int reconvert = 0;
+
+    if (!compare_files) {
+        // Contents are compared when an event arrives
+    } else if (w->options.db_path) {
+        uint64_t db_print = file_fingerprint(w->options.db_path);
+        rebuild = rebuild || db_print != w->db_print;
+        w->db_print = db_print;
+    } else {
+        uint64_t abc_print = file_fingerprint("input/ABC.xlsx");
+        uint64_t fb_print = file_fingerprint("input/FB.xlsx");
+        uint64_t pcb_print = file_fingerprint(watched_pcb_path());
+        rebuild = rebuild || abc_print != w->abc_print || fb_print != w->fb_print;
+        reconvert = pcb_print != w->pcb_print;
+        w->abc_print = abc_print;
+        w->fb_print = fb_print;
+        w->pcb_print = pcb_print;
+    }
+    w->week = week;
+    if (first) {
+        return;
+    }
+    if (rebuild || reconvert) {
+        printf("Watch: %s changed\n", new_week ? "week" : w->options.db_path ? "database"
+                                     : rebuild ? "reference data" : "PCB");
+        pthread_mutex_lock(&w->lock);
+        w->rebuild |= rebuild;
+        w->reconvert |= reconvert;
+        pthread_cond_broadcast(&w->changed);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+// Whether an event names one of the watched inputs
+static int is_watched_name(const watch_state* w, const char* name) {
+    if (w->options.db_path) {
+        const char* base = strrchr(w->options.db_path, '/');
+        return strcmp(name, base ? base + 1 : w->options.db_path) == 0;
+    }
+    return strcmp(name, "ABC.xlsx") == 0 || strcmp(name, "FB.xlsx") == 0
+        || strcmp(name, "PCB.xlsx") == 0 || strcmp(name, "PCB.xls") == 0;
+}
+
+// Read pending inotify events; returns 1 if one of them names a watched input
+static int drain_events(int fd, const watch_state* w) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int relevant = 0;
+    ssize_t length;
+
+    while ((length = read(fd, buf, sizeof(buf))) > 0) {
+        for (char* at = buf; at < buf + length; ) {
+            const struct inotify_event* event = (const struct inotify_event*)at;
+            if (event->len > 0 && is_watched_name(w, event->name)) {
+                relevant = 1;
+            }
+            at += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return relevant;
+}
+
+// Keep the lookups loaded and rewrite the output whenever an input changes,
+// until SIGINT or SIGTERM; returns the exit status
+static int run_watch_mode(const convert_options* options, const char* weeks_spec, int print_stats) {
+    watch_state w;
+    char dir[4096];
+    pthread_t builder, converter;
+
+    // A daemon's log is read while it runs
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    memset(&w, 0, sizeof(w));
+    w.options = *options;
+    w.weeks_spec = weeks_spec;
+    w.print_stats = print_stats;
+
+    // Watch the directory: editors and exports replace files by renaming
+    if (options->db_path) {
+        const char* slash = strrchr(options->db_path, '/');
+        snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - options->db_path) : 1,
+                 slash ? options->db_path : ".");
+    } else {
+        snprintf(dir, sizeof(dir), "input");
+    }
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "Error: cannot watch %s: %s\n", dir, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_watching;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.changed, NULL);
+    check_inputs(&w, 1);
+    w.rebuild = 1;
+    w.reconvert = 1;
+    if (pthread_create(&builder, NULL, builder_main, &w) != 0) {
+        fprintf(stderr, "Error: cannot start the lookup builder\n");
+        close(fd);
+        return 1;
+    }
+    if (pthread_create(&converter, NULL, converter_main, &w) != 0) {
+        fprintf(stderr, "Error: cannot start the converter\n");
+        pthread_mutex_lock(&w.lock);
+        w.stopping = 1;
+        pthread_cond_broadcast(&w.changed);
+        pthread_mutex_unlock(&w.lock);
+        pthread_join(builder, NULL);
+        close(fd);
+        return 1;
+    }
+    printf("Watching %s for changes (Ctrl-C to stop)\n", dir);
+
+    struct pollfd poll_fd = { fd, POLLIN, 0 };
+    while (!watch_stop) {
+        int ready = poll(&poll_fd, 1, WATCH_WEEK_CHECK_MS);
+        if (ready < 0) {
+            continue;   // EINTR; the loop condition sees the signal
+        }
+        if (ready == 0) {
+            check_inputs(&w, 0);
+            continue;
+        }
+        if (!drain_events(fd, &w)) {
+            continue;
+        }
+        // Let a burst of writes settle before comparing contents
+        while (!watch_stop && poll(&poll_fd, 1, WATCH_DEBOUNCE_MS) > 0) {
+            drain_events(fd, &w);
+        }
+        check_inputs(&w, 1);
+    }
+
+    printf("Watch: stopping\n");
+    pthread_mutex_lock(&w.lock);
+    w.stopping = 1;
+    pthread_cond_broadcast(&w.changed);
+    pthread_mutex_unlock(&w.lock);
+    pthread_join(converter, NULL);
+    pthread_join(builder, NULL);
+    if (w.current) {
+        free_generation(w.current);
+    }
+    pthread_cond_destroy(&w.changed);
+    pthread_mutex_destroy(&w.lock);
+    close(fd);
+    return 0;
+}
+
+///////////////////////// the main function /////////////////////////
+
+// Finish the run statistics and print them (--stats) or write them as JSON
+static void report_stats(int print_stats, const char* stats_json) {
+    run_stats_finish(&stats);
+    if (print_stats) {
+        run_stats_print(&stats, stdout);
+    } else if (stats.perf_counters) {
+        run_stats_print_perf(&stats, stdout);
+    }
+    if (stats_json) {
+        FILE* json = strcmp(stats_json, "-") == 0 ? stdout : fopen(stats_json, "w");
+        if (json) {
+            run_stats_write_json(&stats, json);
+            if (json != stdout) {
+                fclose(json);
+            }
+        } else {
+            fprintf(stderr, "Warning: could not write %s\n", stats_json);
+        }
+    }
+}
+
+// Parse a byte size such as 512M, 2G or 100000 (bytes); 0 if invalid
+static uint64_t parse_byte_size(const char* text) {
+    char* end;
+    double size = strtod(text, &end);
+    if (end == text || size <= 0) {
+        return 0;
+    }
+    switch (*end) {
+        case 'K': case 'k': size *= 1024.0; end++; break;
+        case 'M': case 'm': size *= 1024.0 * 1024.0; end++; break;
+        case 'G': case 'g': size *= 1024.0 * 1024.0 * 1024.0; end++; break;
+        default: break;
+    }
+    return *end == '\0' ? (uint64_t)size : 0;
+}
+
+///////////////////////// diff of two outputs /////////////////////////
+
+// modif diff old.xlsx new.xlsx: the cells that changed between two outputs
+// (see output_diff.h), written through an output sink like a conversion
+static int run_diff(const diff_options* options, output_format format, const char* output_file) {
+    output_sink_options sink_options;
+    diff_counts counts;
+
+    memset(&sink_options, 0, sizeof(sink_options));
+    // The differences of two large outputs can be large too
+    sink_options.streaming = 1;
+    sink_options.deflate_threads = format == OUTPUT_XLSX ? fast_writer_threads : 0;
+    sink_options.deflate_level = deflate_level;
+    sink_options.table = "diff";
+    output_sink* output = output_sink_open(format, output_file, &sink_options);
+    if (!output) {
+        fprintf(stderr, "Error creating %s\n", output_file);
+        return 1;
+    }
+    int ok = diff_outputs(options, output, &counts);
+    ok = output_sink_close(output) && ok;
+
+    printf("Diff: %llu rows in %s, %llu in %s\n", (unsigned long long)counts.old_rows, options->old_path,
+           (unsigned long long)counts.new_rows, options->new_path);
+    printf("Diff: %llu added, %llu removed, %llu changed (%llu cells), %llu unchanged\n",
+           (unsigned long long)counts.added, (unsigned long long)counts.removed,
+           (unsigned long long)counts.changed, (unsigned long long)counts.changed_cells,
+           (unsigned long long)counts.unchanged);
+    if (counts.skipped > 0) {
+        printf("Diff: %llu rows without a WIDF skipped\n", (unsigned long long)counts.skipped);
+    }
+    if (counts.repeated > 0) {
+        printf("Diff: %llu rows repeat a WIDF of %s, matched in order\n",
+               (unsigned long long)counts.repeated, options->old_path);
+    }
+    if (ok) {
+        printf("Diff written to %s\n", output_file);
+    }
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    const char* input_file = "PCB.xlsx";
+    const char* output_file = NULL;
+    output_format format = OUTPUT_XLSX;
+    
+    // Parse command line flags
+    int force_reload = 0;
+    int preprocess_files = 0;
+    const char* db_path = NULL;
+    const char* weeks_spec = NULL;
+    int serial = 0;
+    int print_stats = 0;
+    const char* stats_json = NULL;
+    int streaming = -1; // -1: decided from the input size
+    char** batch_inputs = NULL;
+    int batch_input_count = 0;
+    const char* output_dir = "output";
+    int jobs = 0;       // --batch workers, 0: one per core
+    int watch = 0;
+    int incremental = 0;
+    int fast_reader = 0;
+    int reader_threads = 0; // --fast-reader parse threads, 0: one per core
+    int fast_writer = 0;
+    int writer_threads = 0; // --fast-writer deflate threads, 0: one per core
+    const char* scan_path = NULL;
+    uint64_t mem_limit = 0;
+    int perf_counters = 0;
+    const char* columns_path = NULL;
+    const char* kernels_name = NULL;   // --kernels, NULL: the best the CPU has
+    int summary = 0;
+    int lowest_rows = SUMMARY_LOWEST_ROWS;
+    diff_options diff;
+    memset(&diff, 0, sizeof(diff));
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--reload") == 0) {
+            force_reload = 1;
+            printf("Force reload mode: will rebuild the FB and ABC snapshots\n");
+        } else if (strcmp(argv[a], "--preprocess") == 0) {
+            preprocess_files = 1;
+            printf("Preprocessing mode: will check and fix file issues\n");
+        } else if (strcmp(argv[a], "--db") == 0 && a + 1 < argc) {
+            db_path = argv[++a];
+            printf("Database mode: reading abc, fb and pcb tables from %s\n", db_path);
+        } else if (strcmp(argv[a], "--weeks") == 0 && a + 1 < argc) {
+            weeks_spec = argv[++a];
+        } else if (strcmp(argv[a], "--serial") == 0) {
+            serial = 1;
+            printf("Serial mode: loading, evaluation and writing run on one thread\n");
+        } else if (strcmp(argv[a], "--output") == 0 && a + 1 < argc) {
+            if (!output_format_parse(argv[++a], &format)) {
+                fprintf(stderr, "Unknown output format '%s' (xlsx, csv or sqlite)\n", argv[a]);
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--output-file") == 0 && a + 1 < argc) {
+            output_file = argv[++a];
+        } else if (strcmp(argv[a], "--streaming") == 0) {
+            streaming = 1;
+        } else if (strcmp(argv[a], "--no-streaming") == 0) {
+            streaming = 0;
+        } else if (strcmp(argv[a], "--stats") == 0) {
+            print_stats = 1;
+        } else if (strcmp(argv[a], "--stats-json") == 0 && a + 1 < argc) {
+            stats_json = argv[++a];
+        } else if (strcmp(argv[a], "--perf-counters") == 0) {
+            perf_counters = 1;
+        } else if (strcmp(argv[a], "--columns") == 0 && a + 1 < argc) {
+            columns_path = argv[++a];
+        } else if (strcmp(argv[a], "--kernels") == 0 && a + 1 < argc) {
+            kernels_name = argv[++a];
+        } else if (strcmp(argv[a], "--batch") == 0 && a + 1 < argc) {
+            // Every following argument up to the next flag is a file or directory
+            batch_inputs = &argv[a + 1];
+            while (a + 1 < argc && strncmp(argv[a + 1], "--", 2) != 0) {
+                batch_input_count++;
+                a++;
+            }
+        } else if (strcmp(argv[a], "--jobs") == 0 && a + 1 < argc) {
+            jobs = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--output-dir") == 0 && a + 1 < argc) {
+            output_dir = argv[++a];
+        } else if (strcmp(argv[a], "--watch") == 0) {
+            watch = 1;
+        } else if (strcmp(argv[a], "--incremental") == 0) {
+            incremental = 1;
+        } else if (strcmp(argv[a], "--fast-reader") == 0) {
+            fast_reader = 1;
+        } else if (strcmp(argv[a], "--reader-threads") == 0 && a + 1 < argc) {
+            fast_reader = 1;
+            reader_threads = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--fast-writer") == 0) {
+            fast_writer = 1;
+        } else if (strcmp(argv[a], "--writer-threads") == 0 && a + 1 < argc) {
+            fast_writer = 1;
+            writer_threads = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--deflate-level") == 0 && a + 1 < argc) {
+            char* end;
+            deflate_level = (int)strtol(argv[++a], &end, 10);
+            if (*end != '\0' || end == argv[a] || deflate_level < 0 || deflate_level > 9) {
+                fprintf(stderr, "Invalid --deflate-level '%s' (expected 0 to 9)\n", argv[a]);
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--scan-sheet") == 0 && a + 1 < argc) {
+            scan_path = argv[++a];
+        } else if (strcmp(argv[a], "diff") == 0 && a + 2 < argc) {
+            diff.old_path = argv[++a];
+            diff.new_path = argv[++a];
+        } else if (strcmp(argv[a], "--sorted") == 0) {
+            diff.sorted = 1;
+        } else if (strcmp(argv[a], "--summary") == 0) {
+            summary = 1;
+        } else if (strcmp(argv[a], "--lowest") == 0 && a + 1 < argc) {
+            char* end;
+            summary = 1;
+            lowest_rows = (int)strtol(argv[++a], &end, 10);
+            if (*end != '\0' || end == argv[a] || lowest_rows < 0) {
+                fprintf(stderr, "Invalid --lowest '%s' (expected a number of rows)\n", argv[a]);
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--mem-limit") == 0 && a + 1 < argc) {
+            if ((mem_limit = parse_byte_size(argv[++a])) == 0) {
+                fprintf(stderr, "Invalid --mem-limit '%s' (expected e.g. 512M or 2G)\n", argv[a]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Usage: %s [--reload] [--preprocess] [--db data.db] [--weeks 34-8|+N] [--serial]"
+                            "\n       [--output xlsx|csv|sqlite] [--output-file path] [--streaming|--no-streaming]"
+                            " [--stats] [--stats-json file|-] [--perf-counters]"
+                            "\n       [--batch pcb_dir_or_files... [--jobs N] [--output-dir dir]] [--watch] [--incremental]"
+                            "\n       [--fast-reader [--reader-threads N]] [--scan-sheet file.xlsx] [--mem-limit 512M]"
+                            " [--columns spec]"
+                            "\n       [--kernels avx2|sse2|scalar] [--fast-writer [--writer-threads N] [--deflate-level 0-9]]"
+                            "\n       [--summary [--lowest N]]"
+                            "\n   or: %s diff old.xlsx new.xlsx [--sorted] [--output xlsx|csv|sqlite] [--output-file path]\n",
+                    argv[0], argv[0]);
+            return 1;
+        }
+    }
+    
+    if (fast_reader) {
+        if (reader_threads <= 0) {
+            long cores = sysconf(_SC_NPROCESSORS_ONLN);
+            reader_threads = cores > 0 ? (int)cores : 1;
+        }
+        fast_reader_threads = reader_threads;
+        reference_files.reader_threads = reader_threads;
+        printf("Fast reader: sheets are parsed on %d threads\n", fast_reader_threads);
+    }
+    if (fast_writer && format == OUTPUT_XLSX) {
+        if (writer_threads <= 0) {
+            long cores = sysconf(_SC_NPROCESSORS_ONLN);
+            writer_threads = cores > 0 ? (int)cores : 1;
+        }
+        fast_writer_threads = writer_threads;
+        printf("Fast writer: the sheet is deflated on %d threads at level %d\n", fast_writer_threads, deflate_level);
+    }
+    if (scan_path) {
+        return scan_sheet(scan_path);
+    }
+    if (diff.old_path) {
+        diff.reader_threads = fast_reader_threads;
+        return run_diff(&diff, format, output_file ? output_file
+                                     : format == OUTPUT_XLSX ? "diff.xlsx"
+                                     : format == OUTPUT_CSV ? "diff.csv" : output_format_default_path(format));
+    }
+    if (!column_kernels_select(kernels_name)) {
+        fprintf(stderr, "Error: --kernels %s is unknown or not supported by this CPU (avx2, sse2 or scalar)\n",
+                kernels_name);
+        return 1;
+    }
+    if (kernels_name || print_stats) {
+        printf("Vector kernels: %s\n", column_kernels_name());
+    }
+
+    int output_file_given = output_file != NULL;
+    if (output_file == NULL) {
+        output_file = output_format_default_path(format);
+    }
+
+    // Re-parse ABC.xlsx and FB.xlsx once instead of trusting the snapshots
+    reference_files.rebuild_snapshots = force_reload;
+    run_stats_init(&stats);
+    if (perf_counters) {
+        char reason[256];
+        perf_counters_available = perf_counters_probe(reason, sizeof(reason));
+        if (perf_counters_available == 0) {
+            fprintf(stderr, "Warning: --perf-counters: cannot open perf counters: %s; only times are reported\n",
+                    reason);
+        } else {
+            printf("Perf counters:");
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+                if (perf_counters_available & (1u << c)) {
+                    printf(" %s", perf_counter_name((perf_counter)c));
+                }
+            }
+            if (reason[0]) {
+                printf(" (others unavailable: %s)", reason);
+            }
+            printf("\n");
+        }
+        stats.perf_counters = perf_counters_available;
+    }
+
+    // Get current week
+    int iso_year;
+    int current_week = get_current_week(&iso_year);
+    printf("Current week: %d (%d)\n", current_week, iso_year);
+
+    // Resolve the --weeks horizon to ISO week numbers
+    int horizon_weeks[MAX_HORIZON_WEEKS];
+    int horizon_count = 0;
+    if (weeks_spec) {
+        horizon_count = parse_week_horizon(weeks_spec, current_week, iso_year, horizon_weeks);
+        if (horizon_count == 0) {
+            fprintf(stderr, "Error: invalid --weeks '%s' (expected e.g. 34-8, 42 or +4)\n", weeks_spec);
+            return 1;
+        }
+        printf("Week horizon: %d weeks (%d to %d)\n", horizon_count,
+               horizon_weeks[0], horizon_weeks[horizon_count - 1]);
+    }
+
+    // The output columns: a --columns spec, or the default layout
+    column_spec* columns = columns_path ? column_spec_load(columns_path)
+                         : column_spec_parse(weeks_spec ? default_horizon_column_spec : default_column_spec,
+                                             "default columns");
+    if (!columns) {
+        return 1;
+    }
+    int column_count, instruction_count;
+    column_spec_size(columns, horizon_count, &column_count, &instruction_count);
+    if (column_count > MAX_OUTPUT_COLS || instruction_count > MAX_PLAN_CODE) {
+        fprintf(stderr, "Error: the columns expand to %d columns and %d instructions (at most %d and %d)\n",
+                column_count, instruction_count, MAX_OUTPUT_COLS, MAX_PLAN_CODE);
+        column_spec_free(columns);
+        return 1;
+    }
+    if (columns_path) {
+        printf("Columns: %d output columns from %s\n", column_count, columns_path);
+    }
+
+    convert_options options;
+    memset(&options, 0, sizeof(options));
+    options.input_file = input_file;
+    options.db_path = db_path;
+    options.output_file = output_file;
+    options.format = format;
+    options.streaming = streaming;
+    options.serial = serial;
+    options.week = current_week;
+    options.horizon_weeks = horizon_weeks;
+    options.horizon_count = horizon_count;
+    options.columns = columns;
+    // The row cache sits next to the output it describes
+    char cache_file[4096];
+    if (incremental) {
+        snprintf(cache_file, sizeof(cache_file), "%s.rows", output_file);
+        options.cache_file = cache_file;
+    }
+    options.mem_limit = mem_limit;
+    options.summary = summary;
+    options.lowest_rows = lowest_rows;
+    if (mem_limit > 0 && (watch || batch_inputs)) {
+        fprintf(stderr, "Error: --mem-limit converts one PCB file; --watch and --batch keep the lookups loaded\n");
+        return 1;
+    }
+    if (mem_limit > 0 && db_path) {
+        printf("Note: --mem-limit has no effect with --db, SQLite joins ABC and FB\n");
+    }
+
+    if (watch) {
+        if (batch_inputs) {
+            fprintf(stderr, "Error: --watch and --batch do not combine\n");
+            return 1;
+        }
+        if (format == OUTPUT_SQLITE && db_path && strcmp(output_file, db_path) == 0) {
+            fprintf(stderr, "Error: --watch cannot write its output into the database it watches\n");
+            return 1;
+        }
+        int status = run_watch_mode(&options, weeks_spec, print_stats);
+        column_spec_free(columns);
+        return status;
+    }
+
+    if (batch_inputs) {
+        if (incremental) {
+            fprintf(stderr, "Error: --incremental converts one PCB file and does not combine with --batch\n");
+            return 1;
+        }
+        if (db_path || output_file_given) {
+            fprintf(stderr, "Error: --batch reads input/ABC.xlsx and input/FB.xlsx and writes to --output-dir;"
+                            " it does not combine with --db or --output-file\n");
+            return 1;
+        }
+        if (batch_input_count == 0) {
+            fprintf(stderr, "Error: --batch needs PCB files or directories\n");
+            return 1;
+        }
+        batch_run run;
+        memset(&run, 0, sizeof(run));
+        run.week = current_week;
+        run.horizon_weeks = horizon_weeks;
+        run.horizon_count = horizon_count;
+        run.columns = columns;
+        run.format = format;
+        run.streaming = streaming;
+        run.summary = summary;
+        run.lowest_rows = lowest_rows;
+        int status = run_batch_mode(&run, batch_inputs, batch_input_count, output_dir,
+                                    jobs, serial, print_stats || stats_json);
+        report_stats(print_stats, stats_json);
+        column_spec_free(columns);
+        return status;
+    }
+
+    if (!db_path) {
+        double phase_started = stats_now();
+        // Check if required files exist
+        printf("Checking required files...\n");
+    
+        // Check PCB file (try both extensions)
+        FILE* pcb_test = fopen("input/PCB.xlsx", "r");
+        if (pcb_test) {
+            fclose(pcb_test);
+            options.input_file = "input/PCB.xlsx";
+            printf("Found PCB.xlsx in input folder\n");
+        } else {
+            pcb_test = fopen("input/PCB.xls", "r");
+            if (pcb_test) {
+                fclose(pcb_test);
+                options.input_file = "input/PCB.xls";
+                printf("Found PCB.xls in input folder\n");
+            } else {
+                printf("Error: PCB file not found (input/PCB.xls or input/PCB.xlsx)\n");
+                printf("Please ensure PCB.xls or PCB.xlsx exists in the input folder\n");
+                return 1;
+            }
+        }
+    
+        // Check ABC file
+        FILE* abc_test = fopen("input/ABC.xlsx", "r");
+        if (!abc_test) {
+            printf("Error: ABC.xlsx file not found in input folder\n");
+            printf("Please ensure ABC.xlsx exists in the input folder\n");
+            return 1;
+        }
+
+        fclose(abc_test);
+        printf("Found ABC.xlsx in input folder\n");
+    
+        // Check FB file
+        FILE* fb_test = fopen("input/FB.xlsx", "r");
+        if (!fb_test) {
+            printf("Error: FB.xlsx file not found in input folder\n");
+            printf("Please ensure FB.xlsx exists in the input folder\n");
+            return 1;
+        }
+        fclose(fb_test);
+        printf("Found FB.xlsx in input folder\n");
+        run_stats_add_phase(&stats, STATS_FILE_CHECKS, phase_started);
+    }
+
+    int converted = run_conversion(&options, &run_lookups, &stats);
+
+    if (print_stats || stats_json) {
+        collect_index_stats(&run_lookups);
+    }
+    clear_lookup_set(&run_lookups);
+
+    printf("Processed %llu data rows\n", (unsigned long long)stats.rows);
+    if (converted) {
+        printf("Extraction complete: %s\n", output_file);
+    }
+
+    report_stats(print_stats, stats_json);
+    column_spec_free(columns);
+    
+    return converted ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,493 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "hash_index.h"
+#include "output_diff.h"
+#include "sheet_reader.h"
+#include "typed_value.h"
+
+// Output header, one row per differing cell
+#define DIFF_COLS 6
+// Relative difference below which two numbers are the same
+#define DIFF_NUMBER_TOLERANCE 1e-14
+
+// One of the two files, streamed row by row
+typedef struct {
+    const char* path;
+    sheet_reader reader;
+    int opened;
+    char** header;
+    int header_count;
+    int key_col;
+    const char** cells;     // current row, borrowed until the next
+    const char* key;
+    char* last_key;         // sorted: key of the row before, to check the order
+    size_t last_key_size;
+    uint64_t* rows;
+    uint64_t* skipped;
+    uint64_t* repeated;     // sorted: rows with the key of the row before, counted for the old file
+} diff_side;
+
+// The compared columns: their names and where each side has them
+typedef struct {
+    int count;
+    const char** names;
+    int* old_cols;
+    int* new_cols;
+} diff_columns;
+
+#define DIFF_NO_ROW 0xFFFFFFFFu
+
+// The old file by WIDF: the compared cells of each row, in file order, and
+// the rows of each key chained in that order (a WIDF can repeat)
+typedef struct {
+    hash_index keys;
+    output_cell* cells;     // by row
+    uint32_t* next;         // by row: next row of the same key, DIFF_NO_ROW after the last
+    uint32_t* entry_of;     // by row: its key
+    unsigned char* seen;    // by row: matched by a new row
+    uint32_t rows;
+    uint32_t capacity;
+    uint32_t* pending;      // by key entry: first row not matched yet
+    uint32_t* last;         // by key entry: last row, to chain the next
+    uint32_t key_capacity;
+    arena text;
+} diff_table;
+
+///////////////////////// reading /////////////////////////
+
+static int open_side(diff_side* side, const char* path, int threads) {
+    const char* value;
+    int capacity = 0;
+
+    side->path = path;
+    side->key_col = -1;
+    if (!open_workbook(&side->reader, path, threads)) {
+        fprintf(stderr, "Error opening %s\n", path);
+        return 0;
+    }
+    side->opened = 1;
+    if (!open_first_sheet(&side->reader) || !sheet_next_row(&side->reader)) {
+        fprintf(stderr, "Error reading the header of %s\n", path);
+        return 0;
+    }
+    while ((value = sheet_next_cell(&side->reader)) != NULL) {
+        if (side->header_count == capacity) {
+            capacity = capacity ? capacity * 2 : 32;
+            char** header = realloc(side->header, capacity * sizeof(char*));
+            if (!header) {
+                return 0;
+            }
+            side->header = header;
+        }
+        side->header[side->header_count] = strdup(value);
+        if (!side->header[side->header_count]) {
+            return 0;
+        }
+        if (side->key_col < 0 && strcmp(value, "WIDF") == 0) {
+            side->key_col = side->header_count;
+        }
+        side->header_count++;
+    }
+    if (side->key_col < 0) {
+        fprintf(stderr, "Error: %s has no WIDF column\n", path);
+        return 0;
+    }
+    side->cells = malloc(side->header_count * sizeof(char*));
+    return side->cells != NULL;
+}
+
+static void close_side(diff_side* side) {
+    if (side->opened) {
+        close_sheet_reader(&side->reader);
+    }
+    for (int i = 0; i < side->header_count; i++) {
+        free(side->header[i]);
+    }
+    free(side->header);
+    free(side->cells);
+    free(side->last_key);
+}
+
+// Next row with a WIDF; 0 after the last one
+static int next_row(diff_side* side) {
+    while (read_row_cells(&side->reader, side->header_count, side->cells)) {
+        (*side->rows)++;
+        side->key = side->cells[side->key_col];
+        if (side->key && *side->key) {
+            return 1;
+        }
+        (*side->skipped)++;
+    }
+    side->key = NULL;
+    return 0;
+}
+
+// sorted: the next row, which must not come before the one before it (a
+// repeated WIDF has its rows next to each other)
+static int next_sorted_row(diff_side* side, int* in_order) {
+    if (!next_row(side)) {
+        return 0;
+    }
+    if (side->last_key && strcmp(side->key, side->last_key) < 0) {
+        fprintf(stderr, "Error: %s is not sorted by WIDF (%s after %s), diff it without --sorted\n",
+                side->path, side->key, side->last_key);
+        *in_order = 0;
+        return 0;
+    }
+    if (side->last_key && side->repeated && strcmp(side->key, side->last_key) == 0) {
+        (*side->repeated)++;
+    }
+    size_t size = strlen(side->key) + 1;
+    if (size > side->last_key_size) {
+        char* last_key = realloc(side->last_key, size);
+        if (!last_key) {
+            *in_order = 0;
+            return 0;
+        }
+        side->last_key = last_key;
+        side->last_key_size = size;
+    }
+    memcpy(side->last_key, side->key, size);
+    return 1;
+}
+
+// Columns of the new header the old one has too, in the new order
+static int match_columns(const diff_side* old_side, const diff_side* new_side, diff_columns* columns) {
+    int size = new_side->header_count;
+    columns->names = malloc(size * sizeof(char*));
+    columns->old_cols = malloc(size * sizeof(int));
+    columns->new_cols = malloc(size * sizeof(int));
+    if (!columns->names || !columns->old_cols || !columns->new_cols) {
+        return 0;
+    }
+    for (int n = 0; n < new_side->header_count; n++) {
+        int found = -1;
+        for (int o = 0; o < old_side->header_count && found < 0; o++) {
+            if (strcmp(old_side->header[o], new_side->header[n]) == 0) {
+                found = o;
+            }
+        }
+        if (n == new_side->key_col) {
+            continue;
+        }
+        if (found < 0) {
+            printf("Diff: column %s is only in %s\n", new_side->header[n], new_side->path);
+            continue;
+        }
+        columns->names[columns->count] = new_side->header[n];
+        columns->old_cols[columns->count] = found;
+        columns->new_cols[columns->count] = n;
+        columns->count++;
+    }
+    for (int o = 0; o < old_side->header_count; o++) {
+        int found = 0;
+        for (int n = 0; n < new_side->header_count && !found; n++) {
+            found = strcmp(old_side->header[o], new_side->header[n]) == 0;
+        }
+        if (!found) {
+            printf("Diff: column %s is only in %s\n", old_side->header[o], old_side->path);
+        }
+    }
+    return 1;
+}
+
+///////////////////////// cells /////////////////////////
+
+// A cell as read: a number when it is one, empty when there is nothing
+static output_cell parse_cell(const char* text) {
+    output_cell cell;
+    number_cell number = text ? number_cell_parse(text) : number_cell_null();
+    cell.kind = !number.null ? CELL_NUMBER : text && *text ? CELL_TEXT : CELL_EMPTY;
+    cell.text = cell.kind == CELL_TEXT ? text : NULL;
+    cell.number = number.null ? 0 : number.value;
+    return cell;
+}
+
+static void parse_row(const diff_side* side, const int* cols, int count, output_cell* cells) {
+    for (int i = 0; i < count; i++) {
+        cells[i] = parse_cell(side->cells[cols[i]]);
+    }
+}
+
+// Numbers compare by value, so 5 and 5.0 are the same cell, and only as
+// closely as the 15 digits Excel keeps: an output saved again from Excel
+// has not changed
+static int same_number(double a, double b) {
+    double scale = fabs(a) > fabs(b) ? fabs(a) : fabs(b);
+    return a == b || fabs(a - b) <= DIFF_NUMBER_TOLERANCE * scale;
+}
+
+static int same_cell(const output_cell* a, const output_cell* b) {
+    if (a->kind != b->kind) {
+        return 0;
+    }
+    if (a->kind == CELL_NUMBER) {
+        return same_number(a->number, b->number);
+    }
+    return a->kind == CELL_EMPTY || strcmp(a->text, b->text) == 0;
+}
+
+static const output_cell empty_cell = { CELL_EMPTY, NULL, 0 };
+
+static void write_change(output_sink* sink, const char* key, const char* change, const char* column,
+                         const output_cell* old_cell, const output_cell* new_cell) {
+    output_cell row[DIFF_COLS];
+    row[0].kind = CELL_TEXT;
+    row[0].text = key;
+    row[1].kind = CELL_TEXT;
+    row[1].text = change;
+    row[2].kind = column ? CELL_TEXT : CELL_EMPTY;
+    row[2].text = column;
+    row[3] = old_cell ? *old_cell : empty_cell;
+    row[4] = new_cell ? *new_cell : empty_cell;
+    row[5] = empty_cell;
+    if (old_cell && new_cell && old_cell->kind == CELL_NUMBER && new_cell->kind == CELL_NUMBER) {
+        row[5].kind = CELL_NUMBER;
+        row[5].number = new_cell->number - old_cell->number;
+    }
+    output_sink_write_row(sink, row, DIFF_COLS);
+}
+
+// A WIDF on one side only: a row for each of its cells with a value, or
+// one without a column when it has none
+static void write_one_sided(output_sink* sink, const diff_columns* columns, const char* key, const char* change,
+                            const output_cell* cells, int is_old) {
+    int written = 0;
+    for (int i = 0; i < columns->count; i++) {
+        if (cells[i].kind != CELL_EMPTY) {
+            write_change(sink, key, change, columns->names[i], is_old ? &cells[i] : NULL, is_old ? NULL : &cells[i]);
+            written = 1;
+        }
+    }
+    if (!written) {
+        write_change(sink, key, change, NULL, NULL, NULL);
+    }
+}
+
+// Both present: a row for each differing cell
+static void write_pair(output_sink* sink, const diff_columns* columns, const char* key,
+                       const output_cell* old_cells, const output_cell* new_cells, diff_counts* counts) {
+    uint64_t changed = 0;
+    for (int i = 0; i < columns->count; i++) {
+        if (!same_cell(&old_cells[i], &new_cells[i])) {
+            write_change(sink, key, "changed", columns->names[i], &old_cells[i], &new_cells[i]);
+            changed++;
+        }
+    }
+    counts->changed_cells += changed;
+    if (changed) {
+        counts->changed++;
+    } else {
+        counts->unchanged++;
+    }
+}
+
+///////////////////////// hash join /////////////////////////
+
+static int grow_rows(diff_table* table, int count) {
+    uint32_t capacity = table->capacity ? table->capacity * 2 : 1024;
+    output_cell* cells = realloc(table->cells, (size_t)capacity * count * sizeof(output_cell));
+    if (!cells) {
+        return 0;
+    }
+    table->cells = cells;
+    uint32_t* next = realloc(table->next, capacity * sizeof(uint32_t));
+    if (!next) {
+        return 0;
+    }
+    table->next = next;
+    uint32_t* entry_of = realloc(table->entry_of, capacity * sizeof(uint32_t));
+    if (!entry_of) {
+        return 0;
+    }
+    table->entry_of = entry_of;
+    table->capacity = capacity;
+    return 1;
+}
+
+static int grow_keys(diff_table* table) {
+    uint32_t capacity = table->key_capacity ? table->key_capacity * 2 : 1024;
+    uint32_t* pending = realloc(table->pending, capacity * sizeof(uint32_t));
+    if (!pending) {
+        return 0;
+    }
+    table->pending = pending;
+    uint32_t* last = realloc(table->last, capacity * sizeof(uint32_t));
+    if (!last) {
+        return 0;
+    }
+    table->last = last;
+    table->key_capacity = capacity;
+    return 1;
+}
+
+// Read the whole old file into the table: its keys and compared cells
+static int load_old_rows(diff_side* side, const diff_columns* columns, diff_table* table, diff_counts* counts) {
+    int count = columns->count;
+    if (!hash_index_init(&table->keys, expected_data_rows(side->path))) {
+        return 0;
+    }
+    arena_init(&table->text, 1 << 16);
+    while (next_row(side)) {
+        if (table->rows == DIFF_NO_ROW || (table->rows == table->capacity && !grow_rows(table, count))) {
+            return 0;
+        }
+        uint32_t row = table->rows;
+        int64_t entry = hash_index_find(&table->keys, side->key);
+        if (entry >= 0) {
+            counts->repeated++;
+            table->next[table->last[entry]] = row;
+        } else {
+            if (table->keys.count == table->key_capacity && !grow_keys(table)) {
+                return 0;
+            }
+            entry = table->keys.count;
+            if (!hash_index_put(&table->keys, side->key, "")) {
+                return 0;
+            }
+            table->pending[entry] = row;
+        }
+        table->last[entry] = row;
+        table->next[row] = DIFF_NO_ROW;
+        table->entry_of[row] = (uint32_t)entry;
+        output_cell* cells = table->cells + (size_t)row * count;
+        parse_row(side, columns->old_cols, count, cells);
+        for (int i = 0; i < count; i++) {
+            if (cells[i].kind == CELL_TEXT && (cells[i].text = arena_strdup(&table->text, cells[i].text)) == NULL) {
+                return 0;
+            }
+        }
+        table->rows++;
+    }
+    table->seen = calloc(table->rows ? table->rows : 1, 1);
+    return table->seen != NULL;
+}
+
+// A new row is matched with the next old row of its WIDF not matched yet:
+// the second row of a repeated WIDF with its second row in the old file
+static int hash_join(diff_side* old_side, diff_side* new_side, const diff_columns* columns, output_sink* sink,
+                     diff_counts* counts) {
+    diff_table table;
+    output_cell* new_cells = malloc((columns->count ? columns->count : 1) * sizeof(output_cell));
+    int ok = new_cells != NULL;
+
+    memset(&table, 0, sizeof(table));
+    ok = ok && load_old_rows(old_side, columns, &table, counts);
+    if (ok) {
+        printf("Diff: %u WIDFs of %s indexed\n", table.keys.count, old_side->path);
+    }
+    while (ok && next_row(new_side)) {
+        int64_t entry = hash_index_find(&table.keys, new_side->key);
+        uint32_t row = entry >= 0 ? table.pending[entry] : DIFF_NO_ROW;
+        parse_row(new_side, columns->new_cols, columns->count, new_cells);
+        if (row == DIFF_NO_ROW) {
+            write_one_sided(sink, columns, new_side->key, "added", new_cells, 0);
+            counts->added++;
+        } else {
+            write_pair(sink, columns, new_side->key, table.cells + (size_t)row * columns->count, new_cells, counts);
+            table.seen[row] = 1;
+            table.pending[entry] = table.next[row];
+        }
+    }
+    // What the new file never asked for, in the order of the old one
+    for (uint32_t row = 0; ok && row < table.rows; row++) {
+        if (!table.seen[row]) {
+            const char* key = table.keys.arena + table.keys.entries[table.entry_of[row]].key_offset;
+            write_one_sided(sink, columns, key, "removed", table.cells + (size_t)row * columns->count, 1);
+            counts->removed++;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: out of memory indexing %s\n", old_side->path);
+    }
+    hash_index_free(&table.keys);
+    free(table.cells);
+    free(table.next);
+    free(table.entry_of);
+    free(table.seen);
+    free(table.pending);
+    free(table.last);
+    if (table.text.chunks) {
+        arena_free(&table.text);
+    }
+    free(new_cells);
+    return ok;
+}
+
+///////////////////////// merge join /////////////////////////
+
+// Equal keys pair the rows of a repeated WIDF in order, as the hash join
+// does: a longer run on one side ends in removed or added rows
+static int merge_join(diff_side* old_side, diff_side* new_side, const diff_columns* columns, output_sink* sink,
+                      diff_counts* counts) {
+    int count = columns->count ? columns->count : 1;
+    output_cell* old_cells = malloc(count * sizeof(output_cell));
+    output_cell* new_cells = malloc(count * sizeof(output_cell));
+    int in_order = old_cells && new_cells;
+    int have_old = in_order && next_sorted_row(old_side, &in_order);
+    int have_new = in_order && next_sorted_row(new_side, &in_order);
+
+    while (in_order && (have_old || have_new)) {
+        int order = !have_old ? 1 : !have_new ? -1 : strcmp(old_side->key, new_side->key);
+        if (order < 0) {
+            parse_row(old_side, columns->old_cols, columns->count, old_cells);
+            write_one_sided(sink, columns, old_side->key, "removed", old_cells, 1);
+            counts->removed++;
+            have_old = next_sorted_row(old_side, &in_order);
+        } else if (order > 0) {
+            parse_row(new_side, columns->new_cols, columns->count, new_cells);
+            write_one_sided(sink, columns, new_side->key, "added", new_cells, 0);
+            counts->added++;
+            have_new = next_sorted_row(new_side, &in_order);
+        } else {
+            parse_row(old_side, columns->old_cols, columns->count, old_cells);
+            parse_row(new_side, columns->new_cols, columns->count, new_cells);
+            write_pair(sink, columns, new_side->key, old_cells, new_cells, counts);
+            have_old = next_sorted_row(old_side, &in_order);
+            have_new = in_order && next_sorted_row(new_side, &in_order);
+        }
+    }
+    free(old_cells);
+    free(new_cells);
+    return in_order;
+}
+
+int diff_outputs(const diff_options* options, output_sink* sink, diff_counts* counts) {
+    static const char* const header[DIFF_COLS] = { "WIDF", "change", "column", "old", "new", "delta" };
+    diff_side old_side, new_side;
+    diff_columns columns;
+    int ok;
+
+    memset(counts, 0, sizeof(diff_counts));
+    memset(&old_side, 0, sizeof(old_side));
+    memset(&new_side, 0, sizeof(new_side));
+    memset(&columns, 0, sizeof(columns));
+    old_side.rows = &counts->old_rows;
+    old_side.skipped = &counts->skipped;
+    old_side.repeated = &counts->repeated;
+    new_side.rows = &counts->new_rows;
+    new_side.skipped = &counts->skipped;
+
+    ok = open_side(&old_side, options->old_path, options->reader_threads)
+      && open_side(&new_side, options->new_path, options->reader_threads)
+      && match_columns(&old_side, &new_side, &columns);
+    if (ok) {
+        counts->columns = columns.count;
+        printf("Diff: comparing %d columns on WIDF, %s\n", columns.count,
+               options->sorted ? "merge join of the sorted files" : "hash join on the old file");
+        output_sink_write_header(sink, header, DIFF_COLS);
+        ok = options->sorted ? merge_join(&old_side, &new_side, &columns, sink, counts)
+                             : hash_join(&old_side, &new_side, &columns, sink, counts);
+    }
+    free(columns.names);
+    free(columns.old_cols);
+    free(columns.new_cols);
+    close_side(&old_side);
+    close_side(&new_side);
+    return ok;
+}
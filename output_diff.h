@@ -0,0 +1,53 @@
+#ifndef OUTPUT_DIFF_H
+#define OUTPUT_DIFF_H
+
+#include <stdint.h>
+#include "output_sink.h"
+
+/*
+ * modif diff old.xlsx new.xlsx: the rows of two outputs joined on WIDF,
+ * instead of VLOOKUPs between last week's and this week's output.xlsx.
+ *
+ * Both files are streamed once. By default the old one is read first into
+ * a hash index of its WIDFs (hash_index.h) holding the compared cells of
+ * each row, so memory follows the old file and not the new one; the new
+ * rows are then matched as they come. With sorted set both files must be
+ * sorted by WIDF (byte order) and are merge joined in step, with nothing
+ * kept but the current row of each.
+ *
+ * The columns compared are those both headers have, matched by name. Only
+ * differences are written, one row per cell:
+ *
+ *   WIDF, change, column, old, new, delta
+ *
+ * change is added, removed or changed; delta is new - old when both cells
+ * are numbers. An added or removed WIDF gets a row for each of its
+ * non-empty cells. The rows of a repeated WIDF are matched in order, the
+ * n-th new row with the n-th old row; the rest are added or removed.
+ */
+
+typedef struct {
+    const char* old_path;
+    const char* new_path;
+    int sorted;             // merge join, both files sorted by WIDF
+    int reader_threads;     // > 0: parse with the fast reader on that many threads
+} diff_options;
+
+typedef struct {
+    uint64_t old_rows;
+    uint64_t new_rows;
+    uint64_t added;         // rows with no old row of their WIDF left to match
+    uint64_t removed;       // old rows no new row matched
+    uint64_t changed;       // matched, with at least one cell changed
+    uint64_t unchanged;
+    uint64_t changed_cells;
+    uint64_t skipped;       // rows without a WIDF, not compared
+    uint64_t repeated;      // old rows whose WIDF an earlier row already had
+    int columns;            // compared
+} diff_counts;
+
+// Write the differences to sink, header included. Returns 0 if a file
+// cannot be read or has no WIDF column, or, sorted, is not sorted by WIDF.
+int diff_outputs(const diff_options* options, output_sink* sink, diff_counts* counts);
+
+#endif
@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xlsxwriter.h>
+#include "output_sink.h"
+#include "xlsx_writer.h"
+
+#define CSV_BUFFER_SIZE (1 << 20)
+// Rows per SQLite transaction
+#define SQLITE_TRANSACTION_ROWS 100000
+
+struct output_sink {
+    output_format format;
+    int ok;
+    uint64_t rows;
+    // xlsx
+    lxw_workbook* workbook;
+    lxw_worksheet* worksheet;
+    xlsx_writer* writer;    // built-in writer instead of libxlsxwriter
+    // csv
+    FILE* file;
+    char* buffer;
+    char path[4096];    // of the first sheet, the others are named after it
+    // sqlite
+    sqlite3* db;
+    int owns_db;
+    sqlite3_stmt* insert;
+    int columns;
+    int key_column;     // WIDF, indexed after the load
+    char key_name[64];
+    char first_table[64];   // output unless options name another
+    char table[128];    // being filled: the first table, then <first table>_<sheet>
+};
+
+int output_format_parse(const char* name, output_format* format) {
+    if (strcmp(name, "xlsx") == 0) {
+        *format = OUTPUT_XLSX;
+    } else if (strcmp(name, "csv") == 0) {
+        *format = OUTPUT_CSV;
+    } else if (strcmp(name, "sqlite") == 0) {
+        *format = OUTPUT_SQLITE;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+const char* output_format_default_path(output_format format) {
+    switch (format) {
+        case OUTPUT_CSV:
+            return "output.csv";
+        case OUTPUT_SQLITE:
+            return "data.db";
+        default:
+            return "output.xlsx";
+    }
+}
+
+void format_number(char* buf, size_t size, double number) {
+    for (int precision = 15; precision <= 17; precision++) {
+        snprintf(buf, size, "%.*g", precision, number);
+        if (strtod(buf, NULL) == number) {
+            break;
+        }
+    }
+}
+
+///////////////////////// xlsx /////////////////////////
+
+static int xlsx_open(output_sink* sink, const char* path, const output_sink_options* options) {
+    if (options && options->deflate_threads > 0) {
+        xlsx_writer_options writer_options;
+        writer_options.threads = options->deflate_threads;
+        writer_options.level = options->deflate_level;
+        writer_options.use_zip64 = options->use_zip64;
+        sink->writer = xlsx_writer_open(path, &writer_options);
+        return sink->writer != NULL;
+    }
+    if (options && options->streaming) {
+        lxw_workbook_options workbook_options;
+        memset(&workbook_options, 0, sizeof(workbook_options));
+        workbook_options.constant_memory = LXW_TRUE;
+        workbook_options.use_zip64 = options->use_zip64 ? LXW_TRUE : LXW_FALSE;
+        sink->workbook = workbook_new_opt(path, &workbook_options);
+    } else {
+        sink->workbook = workbook_new(path);
+    }
+    if (sink->workbook == NULL) {
+        return 0;
+    }
+    sink->worksheet = workbook_add_worksheet(sink->workbook, NULL);
+    return sink->worksheet != NULL;
+}
+
+static void xlsx_write_row(output_sink* sink, const output_cell* cells, int count) {
+    lxw_row_t row = (lxw_row_t)sink->rows;
+    if (sink->writer) {
+        for (int i = 0; i < count; i++) {
+            if (cells[i].kind == CELL_TEXT) {
+                sink->ok = xlsx_writer_write_string(sink->writer, row, (uint32_t)i, cells[i].text) && sink->ok;
+            } else if (cells[i].kind == CELL_NUMBER) {
+                sink->ok = xlsx_writer_write_number(sink->writer, row, (uint32_t)i, cells[i].number) && sink->ok;
+            }
+        }
+        return;
+    }
+    for (lxw_col_t i = 0; i < (lxw_col_t)count; i++) {
+        if (cells[i].kind == CELL_TEXT) {
+            worksheet_write_string(sink->worksheet, row, i, cells[i].text, NULL);
+        } else if (cells[i].kind == CELL_NUMBER) {
+            worksheet_write_number(sink->worksheet, row, i, cells[i].number, NULL);
+        }
+    }
+}
+
+static int xlsx_add_sheet(output_sink* sink, const char* name) {
+    if (sink->writer) {
+        return xlsx_writer_add_sheet(sink->writer, name);
+    }
+    sink->worksheet = workbook_add_worksheet(sink->workbook, name);
+    return sink->worksheet != NULL;
+}
+
+static int xlsx_close(output_sink* sink) {
+    if (sink->writer) {
+        return xlsx_writer_close(sink->writer);
+    }
+    lxw_error error = workbook_close(sink->workbook);
+    if (error != LXW_NO_ERROR) {
+        fprintf(stderr, "Error writing workbook: %s\n", lxw_strerror(error));
+        return 0;
+    }
+    return 1;
+}
+
+///////////////////////// csv /////////////////////////
+
+static int csv_open(output_sink* sink, const char* path) {
+    if ((sink->file = fopen(path, "wb")) == NULL) {
+        return 0;
+    }
+    // A large buffer turns the many small field writes into few write() calls
+    if ((sink->buffer = malloc(CSV_BUFFER_SIZE)) != NULL) {
+        setvbuf(sink->file, sink->buffer, _IOFBF, CSV_BUFFER_SIZE);
+    }
+    return 1;
+}
+
+static void csv_write_text(FILE* file, const char* text) {
+    if (strpbrk(text, ",\"\r\n") == NULL) {
+        fputs(text, file);
+        return;
+    }
+    putc('"', file);
+    for (const char* p = text; *p; p++) {
+        if (*p == '"') {
+            putc('"', file);
+        }
+        putc(*p, file);
+    }
+    putc('"', file);
+}
+
+static void csv_write_row(output_sink* sink, const output_cell* cells, int count) {
+    char number[32];
+    if (!sink->file) {
+        return;     // the file of this sheet could not be created
+    }
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            putc(',', sink->file);
+        }
+        if (cells[i].kind == CELL_TEXT) {
+            csv_write_text(sink->file, cells[i].text);
+        } else if (cells[i].kind == CELL_NUMBER) {
+            format_number(number, sizeof(number), cells[i].number);
+            fputs(number, sink->file);
+        }
+    }
+    fputs("\r\n", sink->file);
+}
+
+static int csv_close(output_sink* sink) {
+    if (!sink->file) {
+        return 0;
+    }
+    int ok = !ferror(sink->file);
+    ok = (fclose(sink->file) == 0) && ok;
+    free(sink->buffer);
+    sink->file = NULL;
+    sink->buffer = NULL;
+    return ok;
+}
+
+// A CSV holds one sheet: the next goes to a file next to the first,
+// output.csv -> output_<name>.csv
+static int csv_add_sheet(output_sink* sink, const char* name) {
+    char path[4096 + 128];
+    size_t stem = strlen(sink->path);
+    if (stem > 4 && strcmp(sink->path + stem - 4, ".csv") == 0) {
+        stem -= 4;
+    }
+    snprintf(path, sizeof(path), "%.*s_%s.csv", (int)stem, sink->path, name);
+    int ok = csv_close(sink);
+    if (!csv_open(sink, path)) {
+        fprintf(stderr, "Error creating %s\n", path);
+        return 0;
+    }
+    return ok;
+}
+
+///////////////////////// sqlite /////////////////////////
+
+static int sqlite_exec(output_sink* sink, const char* sql) {
+    char* err = NULL;
+    if (sqlite3_exec(sink->db, sql, NULL, NULL, &err) != SQLITE_OK) {
+        fprintf(stderr, "Error in '%s': %s\n", sql, err ? err : sqlite3_errmsg(sink->db));
+        sqlite3_free(err);
+        return 0;
+    }
+    return 1;
+}
+
+static void append_identifier(char* sql, size_t size, const char* name) {
+    size_t n = strlen(sql);
+    if (n + 3 >= size) {
+        return;
+    }
+    sql[n++] = '"';
+    for (const char* p = name; *p && n + 3 < size; p++) {
+        if (*p == '"') {
+            sql[n++] = '"';
+        }
+        sql[n++] = *p;
+    }
+    sql[n++] = '"';
+    sql[n] = '\0';
+}
+
+static int sqlite_open(output_sink* sink, const char* path, const output_sink_options* options) {
+    if (options && options->db) {
+        sink->db = options->db;
+        return 1;
+    }
+    if (sqlite3_open(path, &sink->db) != SQLITE_OK) {
+        fprintf(stderr, "Error opening %s: %s\n", path, sqlite3_errmsg(sink->db));
+        sqlite3_close(sink->db);
+        sink->db = NULL;
+        return 0;
+    }
+    sink->owns_db = 1;
+    return 1;
+}
+
+// Recreate the table being filled with one untyped column per header name,
+// so text and numbers are stored as they are, and prepare the INSERT
+static int sqlite_write_header(output_sink* sink, const char* const* names, int count) {
+    char sql[8192] = "CREATE TABLE ";
+    char insert[8192] = "INSERT INTO ";
+    char drop[256] = "DROP TABLE IF EXISTS ";
+
+    append_identifier(sql, sizeof(sql), sink->table);
+    strncat(sql, " (", sizeof(sql) - strlen(sql) - 1);
+    append_identifier(insert, sizeof(insert), sink->table);
+    strncat(insert, " VALUES (", sizeof(insert) - strlen(insert) - 1);
+    append_identifier(drop, sizeof(drop), sink->table);
+
+    sink->columns = count;
+    sink->key_column = -1;
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            strncat(sql, ", ", sizeof(sql) - strlen(sql) - 1);
+            strncat(insert, ", ", sizeof(insert) - strlen(insert) - 1);
+        }
+        append_identifier(sql, sizeof(sql), names[i]);
+        strncat(insert, "?", sizeof(insert) - strlen(insert) - 1);
+        if (strcmp(names[i], "WIDF") == 0) {
+            sink->key_column = i;
+            snprintf(sink->key_name, sizeof(sink->key_name), "%s", names[i]);
+        }
+    }
+    strncat(sql, ")", sizeof(sql) - strlen(sql) - 1);
+    strncat(insert, ")", sizeof(insert) - strlen(insert) - 1);
+
+    if (!sqlite_exec(sink, drop) || !sqlite_exec(sink, sql)) {
+        return 0;
+    }
+    if (sqlite3_prepare_v2(sink->db, insert, -1, &sink->insert, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Error preparing output insert: %s\n", sqlite3_errmsg(sink->db));
+        return 0;
+    }
+    return sqlite_exec(sink, "BEGIN");
+}
+
+static int sqlite_write_row(output_sink* sink, const output_cell* cells, int count) {
+    for (int i = 0; i < sink->columns; i++) {
+        if (i >= count || cells[i].kind == CELL_EMPTY) {
+            sqlite3_bind_null(sink->insert, i + 1);
+        } else if (cells[i].kind == CELL_TEXT) {
+            sqlite3_bind_text(sink->insert, i + 1, cells[i].text, -1, SQLITE_STATIC);
+        } else {
+            sqlite3_bind_double(sink->insert, i + 1, cells[i].number);
+        }
+    }
+    int rc = sqlite3_step(sink->insert);
+    sqlite3_reset(sink->insert);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Error inserting output row: %s\n", sqlite3_errmsg(sink->db));
+        return 0;
+    }
+    // Header is row 0, so this commits every SQLITE_TRANSACTION_ROWS data rows
+    if (sink->rows % SQLITE_TRANSACTION_ROWS == 0) {
+        return sqlite_exec(sink, "COMMIT") && sqlite_exec(sink, "BEGIN");
+    }
+    return 1;
+}
+
+// Commit the table being filled and index it
+static int sqlite_finish_table(output_sink* sink) {
+    int ok = sink->ok;
+    sqlite3_finalize(sink->insert);
+    if (sink->insert) {
+        ok = sqlite_exec(sink, "COMMIT") && ok;
+    }
+    // Indexing once after the load is much cheaper than maintaining it per insert
+    if (ok && sink->insert && sink->key_column >= 0) {
+        char index[256];
+        char sql[512] = "CREATE INDEX ";
+        snprintf(index, sizeof(index), "%s_WIDF_idx", sink->table);
+        append_identifier(sql, sizeof(sql), index);
+        strncat(sql, " ON ", sizeof(sql) - strlen(sql) - 1);
+        append_identifier(sql, sizeof(sql), sink->table);
+        strncat(sql, "(", sizeof(sql) - strlen(sql) - 1);
+        append_identifier(sql, sizeof(sql), sink->key_name);
+        strncat(sql, ")", sizeof(sql) - strlen(sql) - 1);
+        ok = sqlite_exec(sink, sql);
+    }
+    sink->insert = NULL;
+    return ok;
+}
+
+// The next sheet is a table of its own, output_<name>
+static int sqlite_add_sheet(output_sink* sink, const char* name) {
+    int ok = sqlite_finish_table(sink);
+    snprintf(sink->table, sizeof(sink->table), "%s_%s", sink->first_table, name);
+    return ok;
+}
+
+static int sqlite_close(output_sink* sink) {
+    int ok = sqlite_finish_table(sink);
+    if (sink->owns_db) {
+        sqlite3_close(sink->db);
+    }
+    return ok;
+}
+
+///////////////////////// dispatch /////////////////////////
+
+output_sink* output_sink_open(output_format format, const char* path, const output_sink_options* options) {
+    output_sink* sink = calloc(1, sizeof(output_sink));
+    int opened = 0;
+    if (!sink) {
+        return NULL;
+    }
+    sink->format = format;
+    sink->ok = 1;
+    snprintf(sink->path, sizeof(sink->path), "%s", path ? path : "");
+    snprintf(sink->first_table, sizeof(sink->first_table), "%s", options && options->table ? options->table : "output");
+    snprintf(sink->table, sizeof(sink->table), "%s", sink->first_table);
+    switch (format) {
+        case OUTPUT_XLSX:
+            opened = xlsx_open(sink, path, options);
+            break;
+        case OUTPUT_CSV:
+            opened = csv_open(sink, path);
+            break;
+        case OUTPUT_SQLITE:
+            opened = sqlite_open(sink, path, options);
+            break;
+    }
+    if (!opened) {
+        free(sink);
+        return NULL;
+    }
+    return sink;
+}
+
+int output_sink_write_header(output_sink* sink, const char* const* names, int count) {
+    if (sink->format == OUTPUT_SQLITE) {
+        sink->ok = sqlite_write_header(sink, names, count) && sink->ok;
+    } else {
+        output_cell* cells = malloc(count * sizeof(output_cell));
+        if (!cells) {
+            sink->ok = 0;
+            return 0;
+        }
+        for (int i = 0; i < count; i++) {
+            cells[i].kind = CELL_TEXT;
+            cells[i].text = names[i];
+        }
+        output_sink_write_row(sink, cells, count);
+        free(cells);
+        return sink->ok;
+    }
+    sink->rows++;
+    return sink->ok;
+}
+
+int output_sink_write_row(output_sink* sink, const output_cell* cells, int count) {
+    switch (sink->format) {
+        case OUTPUT_XLSX:
+            xlsx_write_row(sink, cells, count);
+            break;
+        case OUTPUT_CSV:
+            csv_write_row(sink, cells, count);
+            break;
+        case OUTPUT_SQLITE:
+            if (sink->ok && !sqlite_write_row(sink, cells, count)) {
+                sink->ok = 0;
+            }
+            break;
+    }
+    sink->rows++;
+    return sink->ok;
+}
+
+int output_sink_add_sheet(output_sink* sink, const char* name) {
+    int ok = 0;
+    switch (sink->format) {
+        case OUTPUT_XLSX:
+            ok = xlsx_add_sheet(sink, name);
+            break;
+        case OUTPUT_CSV:
+            ok = csv_add_sheet(sink, name);
+            break;
+        case OUTPUT_SQLITE:
+            ok = sqlite_add_sheet(sink, name);
+            break;
+    }
+    sink->ok = ok && sink->ok;
+    sink->rows = 0;
+    return sink->ok;
+}
+
+int output_sink_close(output_sink* sink) {
+    int ok = 0;
+    switch (sink->format) {
+        case OUTPUT_XLSX:
+            ok = xlsx_close(sink);
+            break;
+        case OUTPUT_CSV:
+            ok = csv_close(sink);
+            break;
+        case OUTPUT_SQLITE:
+            ok = sqlite_close(sink);
+            break;
+    }
+    ok = ok && sink->ok;
+    free(sink);
+    return ok;
+}
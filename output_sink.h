@@ -0,0 +1,68 @@
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <stdint.h>
+#include <sqlite3.h>
+
+/*
+ * Destination of the converted rows. The row loop hands every output row to
+ * a sink as an array of cells; the sink decides how it is encoded:
+ *
+ *   OUTPUT_XLSX    output.xlsx through libxlsxwriter, optionally streamed, or
+ *                  through xlsx_writer.c, which deflates on several threads
+ *   OUTPUT_CSV     RFC 4180 CSV through a large stdio buffer
+ *   OUTPUT_SQLITE  an `output` table, or the one named in the options,
+ *                  filled with one prepared INSERT in large transactions;
+ *                  the WIDF index is built after the load
+ *
+ * Rows must be written in order by a single thread. A sink can take more
+ * than one sheet: another xlsx worksheet, another CSV file next to the
+ * first (output_<name>.csv), another table (output_<name>).
+ */
+
+typedef enum {
+    OUTPUT_XLSX,
+    OUTPUT_CSV,
+    OUTPUT_SQLITE
+} output_format;
+
+typedef enum {
+    CELL_EMPTY,
+    CELL_TEXT,
+    CELL_NUMBER
+} cell_kind;
+
+typedef struct {
+    cell_kind kind;
+    const char* text;   // borrowed from the batch cells or a lookup table
+    double number;
+} output_cell;
+
+typedef struct {
+    int streaming;      // xlsx: libxlsxwriter constant_memory mode
+    int use_zip64;      // xlsx: allow outputs above 4 GB
+    int deflate_threads; // xlsx: > 0 for the built-in writer with that many deflate threads
+    int deflate_level;  // xlsx: zlib level of the built-in writer
+    sqlite3* db;        // sqlite: connection to reuse instead of opening path (not closed)
+    const char* table;  // sqlite: table to write, "output" when NULL
+} output_sink_options;
+
+typedef struct output_sink output_sink;
+
+// Parse "xlsx", "csv" or "sqlite"; returns 0 if unknown
+int output_format_parse(const char* name, output_format* format);
+const char* output_format_default_path(output_format format);
+
+output_sink* output_sink_open(output_format format, const char* path, const output_sink_options* options);
+int output_sink_write_header(output_sink* sink, const char* const* names, int count);
+int output_sink_write_row(output_sink* sink, const output_cell* cells, int count);
+// Finish the sheet being written and start the sheet name (a plain
+// identifier); the header and rows written next go to it
+int output_sink_add_sheet(output_sink* sink, const char* name);
+// Flush and finish the output; frees the sink. Returns 0 if anything failed.
+int output_sink_close(output_sink* sink);
+
+// Shortest "%.*g" form of a number that reads back to the same double
+void format_number(char* buf, size_t size, double number);
+
+#endif
@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perf_counters.h"
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char* name;
+} events[PERF_COUNTER_COUNT] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache_misses" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch_misses" },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page_faults" },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task_clock_ns" },
+};
+
+const char* perf_counter_name(perf_counter counter) {
+    return events[counter].name;
+}
+
+// One counter of the calling thread, user space only; a member of the
+// group of group_fd, or a new group leader when it is -1
+static int open_event(perf_counter counter, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[counter].type;
+    attr.config = events[counter].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+void perf_tracker_inert(perf_tracker* tracker) {
+    memset(tracker, 0, sizeof(perf_tracker));
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        tracker->fd[c] = -1;
+    }
+    tracker->leader = -1;
+    tracker->phase = PERF_NO_PHASE;
+}
+
+// Current counts of the group, scaled up when the kernel multiplexed it
+static int read_group(const perf_tracker* tracker, perf_values* values) {
+    // nr, time_enabled, time_running, then one value per member
+    uint64_t buf[3 + PERF_COUNTER_COUNT];
+    ssize_t size = read(tracker->leader, buf, sizeof(buf));
+    if (size < (ssize_t)((3 + tracker->opened) * sizeof(uint64_t))) {
+        return 0;
+    }
+    uint64_t enabled = buf[1];
+    uint64_t running = buf[2];
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        uint64_t value = tracker->fd[c] >= 0 ? buf[3 + tracker->slot[c]] : 0;
+        if (running > 0 && running < enabled) {
+            value = (uint64_t)((double)value * enabled / running);
+        }
+        values->count[c] = value;
+    }
+    return 1;
+}
+
+static void close_counters(perf_tracker* tracker) {
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        if (tracker->fd[c] >= 0) {
+            close(tracker->fd[c]);
+            tracker->fd[c] = -1;
+        }
+    }
+    tracker->leader = -1;
+    tracker->opened = 0;
+}
+
+// Open every counter that can be; errno of the first failure in *error
+static void open_counters(perf_tracker* tracker, int* error) {
+    perf_tracker_inert(tracker);
+    *error = 0;
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        tracker->fd[c] = open_event((perf_counter)c, tracker->leader);
+        if (tracker->fd[c] < 0) {
+            if (*error == 0) {
+                *error = errno;
+            }
+            continue;
+        }
+        if (tracker->leader < 0) {
+            tracker->leader = tracker->fd[c];
+        }
+        tracker->slot[c] = tracker->opened++;
+    }
+    if (tracker->leader >= 0 && !read_group(tracker, &tracker->last)) {
+        close_counters(tracker);
+    }
+}
+
+unsigned perf_counters_probe(char* reason, size_t size) {
+    perf_tracker tracker;
+    unsigned available = 0;
+    int error;
+
+    open_counters(&tracker, &error);
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        if (tracker.fd[c] >= 0) {
+            available |= 1u << c;
+        }
+    }
+    close_counters(&tracker);
+    if (available == 0) {
+        char paranoid[16] = "?";
+        FILE* file = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+        if (file) {
+            if (fscanf(file, "%15s", paranoid) != 1) {
+                strcpy(paranoid, "?");
+            }
+            fclose(file);
+        }
+        snprintf(reason, size, "%s (kernel.perf_event_paranoid = %s)", strerror(error ? error : ENOSYS), paranoid);
+    } else if (error) {
+        snprintf(reason, size, "%s", strerror(error));
+    } else {
+        reason[0] = '\0';
+    }
+    return available;
+}
+
+int perf_tracker_open(perf_tracker* tracker, int phase) {
+    int error;
+    open_counters(tracker, &error);
+    tracker->phase = phase;
+    return tracker->leader >= 0;
+}
+
+void perf_tracker_switch(perf_tracker* tracker, perf_values* totals, int phase) {
+    perf_values now;
+    if (tracker->leader < 0 || !read_group(tracker, &now)) {
+        return;
+    }
+    if (tracker->phase != PERF_NO_PHASE) {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            // Scaling can make a multiplexed count step back a little
+            if (now.count[c] > tracker->last.count[c]) {
+                totals[tracker->phase].count[c] += now.count[c] - tracker->last.count[c];
+            }
+        }
+    }
+    tracker->last = now;
+    tracker->phase = phase;
+}
+
+void perf_tracker_close(perf_tracker* tracker, perf_values* totals) {
+    perf_tracker_switch(tracker, totals, PERF_NO_PHASE);
+    close_counters(tracker);
+}
@@ -0,0 +1,63 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hardware and software event counters of the calling thread through
+ * perf_event_open (--perf-counters).
+ *
+ * A tracker opens one counter group on the thread that runs a phase. It
+ * counts user space only, which is all that perf_event_paranoid 2 (the
+ * default) allows. Switching the tracker to another phase adds the counts
+ * since the last switch to that phase's totals. So a thread that alternates
+ * between phases, such as the --serial row loop, splits its counts exactly.
+ *
+ * A counter the CPU or the kernel does not provide stays closed and its
+ * total stays 0; virtual machines often expose no hardware events at all.
+ * When nothing can be opened, for example because perf_event_paranoid is 3
+ * or a seccomp filter denies the call, the tracker does nothing. If the
+ * kernel multiplexes the group, the counts are scaled by the time it ran.
+ */
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_PAGE_FAULTS,       // software: where the allocator touches fresh memory
+    PERF_TASK_CLOCK,        // software: nanoseconds on a CPU
+    PERF_COUNTER_COUNT
+} perf_counter;
+
+typedef struct {
+    uint64_t count[PERF_COUNTER_COUNT];
+} perf_values;
+
+#define PERF_NO_PHASE (-1)
+
+typedef struct {
+    int fd[PERF_COUNTER_COUNT];     // -1 for a counter that is not open
+    int slot[PERF_COUNTER_COUNT];   // position of the counter in a group read
+    int leader;                     // fd of the group leader, -1 for an inert tracker
+    int opened;                     // counters in the group
+    perf_values last;               // counts at the last switch
+    int phase;                      // phase the counts go to, PERF_NO_PHASE for none
+} perf_tracker;
+
+const char* perf_counter_name(perf_counter counter);
+// A tracker that counts nothing, for a run without --perf-counters
+void perf_tracker_inert(perf_tracker* tracker);
+// Counters the calling thread can open, as a bit mask of 1 << perf_counter;
+// 0 with the reason in reason when none can
+unsigned perf_counters_probe(char* reason, size_t size);
+// Open the counters on the calling thread and count into phase; returns 0
+// and leaves an inert tracker if none can be opened
+int perf_tracker_open(perf_tracker* tracker, int phase);
+// Add the counts since the last switch to totals[current phase], then count into phase
+void perf_tracker_switch(perf_tracker* tracker, perf_values* totals, int phase);
+// Final switch, then close the counters
+void perf_tracker_close(perf_tracker* tracker, perf_values* totals);
+
+#endif
@@ -0,0 +1,299 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash_index.h"
+#include "row_cache.h"
+
+#define ROW_CACHE_BUFFER (1 << 20)
+// End of the chain of rows of a key
+#define ROW_CACHE_NO_ROW 0xFFFFFFFFu
+
+struct row_cache {
+    const unsigned char* map;
+    size_t map_size;
+    uint32_t width;
+    uint64_t rows;
+    hash_index keys;            // WIDF -> entry number
+    uint64_t* offsets;          // record of each row, in file order
+    uint32_t* next;             // next row of the same key, ROW_CACHE_NO_ROW after the last
+    uint32_t* pending;          // per entry: first row of the key not matched yet
+    unsigned char* matched;     // per entry: a row of the key was matched this run
+};
+
+struct row_cache_writer {
+    FILE* file;
+    char* buffer;
+    char path[4096];
+    char tmp_path[4096];
+    row_cache_header header;
+    int ok;
+};
+
+uint64_t row_cache_hash(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t row_cache_hash_text(uint64_t hash, const char* text) {
+    // The terminator separates consecutive texts; 0xFF never starts UTF-8
+    static const unsigned char missing = 0xFF;
+    return text ? row_cache_hash(hash, text, strlen(text) + 1) : row_cache_hash(hash, &missing, 1);
+}
+
+// Size of the cells of one record starting at offset, 0 if they run past the end
+static size_t cells_size(const row_cache* cache, size_t offset) {
+    size_t at = offset;
+    for (uint32_t i = 0; i < cache->width; i++) {
+        if (at + 1 > cache->map_size) {
+            return 0;
+        }
+        unsigned char kind = cache->map[at++];
+        if (kind == CELL_NUMBER) {
+            at += sizeof(double);
+        } else if (kind == CELL_TEXT) {
+            uint32_t size;
+            if (at + sizeof(size) > cache->map_size) {
+                return 0;
+            }
+            memcpy(&size, cache->map + at, sizeof(size));
+            at += sizeof(size) + size;
+        } else if (kind != CELL_EMPTY) {
+            return 0;
+        }
+        if (at > cache->map_size) {
+            return 0;
+        }
+    }
+    return at - offset;
+}
+
+// Walk the records once and index their keys. The rows of a WIDF that
+// PCB repeats are chained in file order, to be matched occurrence by
+// occurrence.
+static int index_records(row_cache* cache) {
+    size_t at = sizeof(row_cache_header);
+    size_t rows = cache->rows ? (size_t)cache->rows : 1;
+
+    if (cache->rows >= ROW_CACHE_NO_ROW || !hash_index_init(&cache->keys, (uint32_t)cache->rows)) {
+        return 0;
+    }
+    cache->offsets = malloc(rows * sizeof(uint64_t));
+    cache->next = malloc(rows * sizeof(uint32_t));
+    cache->pending = malloc(rows * sizeof(uint32_t));
+    cache->matched = calloc(rows, 1);
+    // Last row of each entry while the chains are built
+    uint32_t* last = malloc(rows * sizeof(uint32_t));
+    int ok = cache->offsets && cache->next && cache->pending && cache->matched && last;
+    for (uint32_t r = 0; ok && r < cache->rows; r++) {
+        uint32_t key_size;
+        cache->offsets[r] = at;
+        cache->next[r] = ROW_CACHE_NO_ROW;
+        if (at + sizeof(uint64_t) + sizeof(key_size) > cache->map_size) {
+            ok = 0;
+            break;
+        }
+        at += sizeof(uint64_t);
+        memcpy(&key_size, cache->map + at, sizeof(key_size));
+        at += sizeof(key_size);
+        if (key_size == 0 || at + key_size > cache->map_size || cache->map[at + key_size - 1] != '\0') {
+            ok = 0;
+            break;
+        }
+        const char* key = (const char*)cache->map + at;
+        at += key_size;
+        size_t size = cells_size(cache, at);
+        if (size == 0 && cache->width > 0) {
+            ok = 0;
+            break;
+        }
+        at += size;
+        int64_t entry = hash_index_find(&cache->keys, key);
+        if (entry < 0) {
+            cache->pending[cache->keys.count] = r;
+            last[cache->keys.count] = r;
+            ok = hash_index_put(&cache->keys, key, "");
+        } else {
+            cache->next[last[entry]] = r;
+            last[entry] = r;
+        }
+    }
+    free(last);
+    return ok && at == cache->map_size;
+}
+
+row_cache* row_cache_open(const char* path, uint64_t signature, uint32_t width) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(row_cache_header)) {
+        close(fd);
+        return NULL;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const row_cache_header* header = map;
+    row_cache* cache = calloc(1, sizeof(row_cache));
+    if (!cache || memcmp(header->magic, ROW_CACHE_MAGIC, sizeof(ROW_CACHE_MAGIC)) != 0
+        || header->version != ROW_CACHE_VERSION
+        || header->signature != signature
+        || header->width != width) {
+        free(cache);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    cache->map = map;
+    cache->map_size = st.st_size;
+    cache->width = width;
+    cache->rows = header->rows;
+    if (!index_records(cache)) {
+        row_cache_close(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+uint64_t row_cache_rows(const row_cache* cache) {
+    return cache->rows;
+}
+
+row_change row_cache_match(row_cache* cache, const char* key, uint64_t fingerprint, output_cell* cells) {
+    int64_t entry = hash_index_find(&cache->keys, key);
+    uint64_t stored;
+    uint32_t key_size;
+
+    if (entry < 0) {
+        return ROW_INSERTED;
+    }
+    cache->matched[entry] = 1;
+    // A key met more often than in the previous run has changed
+    if (cache->pending[entry] == ROW_CACHE_NO_ROW) {
+        return ROW_UPDATED;
+    }
+    uint32_t row = cache->pending[entry];
+    cache->pending[entry] = cache->next[row];
+    size_t at = cache->offsets[row];
+    memcpy(&stored, cache->map + at, sizeof(stored));
+    if (stored != fingerprint) {
+        return ROW_UPDATED;
+    }
+    at += sizeof(stored);
+    memcpy(&key_size, cache->map + at, sizeof(key_size));
+    at += sizeof(key_size) + key_size;
+
+    // Records were bounds checked when the cache was opened
+    for (uint32_t i = 0; i < cache->width; i++) {
+        cells[i].kind = (cell_kind)cache->map[at++];
+        if (cells[i].kind == CELL_NUMBER) {
+            memcpy(&cells[i].number, cache->map + at, sizeof(double));
+            at += sizeof(double);
+        } else if (cells[i].kind == CELL_TEXT) {
+            uint32_t size;
+            memcpy(&size, cache->map + at, sizeof(size));
+            cells[i].text = (const char*)cache->map + at + sizeof(size);
+            at += sizeof(size) + size;
+        }
+    }
+    return ROW_UNCHANGED;
+}
+
+uint64_t row_cache_unseen(const row_cache* cache, void (*fn)(const char* key, int deleted, void* data),
+                          void* data) {
+    uint64_t deleted = 0;
+    for (uint32_t e = 0; e < cache->keys.count; e++) {
+        if (cache->pending[e] != ROW_CACHE_NO_ROW) {
+            if (fn) {
+                fn(cache->keys.arena + cache->keys.entries[e].key_offset, !cache->matched[e], data);
+            }
+            deleted += !cache->matched[e];
+        }
+    }
+    return deleted;
+}
+
+void row_cache_close(row_cache* cache) {
+    if (cache) {
+        hash_index_free(&cache->keys);
+        free(cache->offsets);
+        free(cache->next);
+        free(cache->pending);
+        free(cache->matched);
+        munmap((void*)cache->map, cache->map_size);
+        free(cache);
+    }
+}
+
+row_cache_writer* row_cache_create(const char* path, uint64_t signature, uint32_t width) {
+    row_cache_writer* writer = calloc(1, sizeof(row_cache_writer));
+    if (!writer) {
+        return NULL;
+    }
+    snprintf(writer->path, sizeof(writer->path), "%s", path);
+    snprintf(writer->tmp_path, sizeof(writer->tmp_path), "%s.tmp", path);
+    if ((writer->file = fopen(writer->tmp_path, "wb")) == NULL) {
+        free(writer);
+        return NULL;
+    }
+    if ((writer->buffer = malloc(ROW_CACHE_BUFFER)) != NULL) {
+        setvbuf(writer->file, writer->buffer, _IOFBF, ROW_CACHE_BUFFER);
+    }
+    memcpy(writer->header.magic, ROW_CACHE_MAGIC, sizeof(ROW_CACHE_MAGIC));
+    writer->header.version = ROW_CACHE_VERSION;
+    writer->header.width = width;
+    writer->header.signature = signature;
+    // The row count is filled in by row_cache_finish
+    writer->ok = fwrite(&writer->header, sizeof(writer->header), 1, writer->file) == 1;
+    return writer;
+}
+
+int row_cache_add(row_cache_writer* writer, const char* key, uint64_t fingerprint, const output_cell* cells) {
+    uint32_t key_size = (uint32_t)strlen(key) + 1;
+    FILE* file = writer->file;
+    int ok = fwrite(&fingerprint, sizeof(fingerprint), 1, file) == 1
+          && fwrite(&key_size, sizeof(key_size), 1, file) == 1
+          && fwrite(key, 1, key_size, file) == key_size;
+
+    for (uint32_t i = 0; ok && i < writer->header.width; i++) {
+        unsigned char kind = (unsigned char)cells[i].kind;
+        ok = fputc(kind, file) != EOF;
+        if (ok && kind == CELL_NUMBER) {
+            ok = fwrite(&cells[i].number, sizeof(double), 1, file) == 1;
+        } else if (ok && kind == CELL_TEXT) {
+            uint32_t size = (uint32_t)strlen(cells[i].text) + 1;
+            ok = fwrite(&size, sizeof(size), 1, file) == 1 && fwrite(cells[i].text, 1, size, file) == size;
+        }
+    }
+    writer->header.rows++;
+    writer->ok = writer->ok && ok;
+    return ok;
+}
+
+int row_cache_finish(row_cache_writer* writer, int keep) {
+    int ok = writer->ok && keep
+          && fseek(writer->file, 0, SEEK_SET) == 0
+          && fwrite(&writer->header, sizeof(writer->header), 1, writer->file) == 1;
+    ok = (fclose(writer->file) == 0) && ok;
+    if (!ok || rename(writer->tmp_path, writer->path) != 0) {
+        remove(writer->tmp_path);
+        ok = 0;
+    }
+    free(writer->buffer);
+    free(writer);
+    return ok || !keep;
+}
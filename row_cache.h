@@ -0,0 +1,81 @@
+#ifndef ROW_CACHE_H
+#define ROW_CACHE_H
+
+#include <stdint.h>
+#include "output_sink.h"
+
+/*
+ * Output rows of the previous conversion, keyed by WIDF (--incremental).
+ *
+ * Every written row is stored with a fingerprint of what it was computed
+ * from: the projected PCB cells and the ABC/FB values its lookups returned.
+ * The next run looks each WIDF up; when the fingerprint is unchanged the
+ * stored cells are the result and the row is not evaluated again. A WIDF
+ * that PCB repeats is matched occurrence by occurrence: its n-th row now
+ * against its n-th row then. Keys of the previous run that no row matched
+ * were deleted from PCB; a key with more or fewer rows than before has
+ * changed.
+ *
+ * The cache is only valid for the column plan it was written with, which is
+ * identified by a signature. It is written next to the output through a
+ * temporary file and renamed into place once the output is complete, and
+ * read back with mmap; text cells point into the mapping.
+ *
+ * File layout (native endianness):
+ *   row_cache_header
+ *   per row: uint64_t fingerprint, uint32_t key size, key (NUL terminated),
+ *            then per cell a uint8_t cell_kind followed by a double for a
+ *            number or a uint32_t size and the NUL terminated text
+ */
+
+#define ROW_CACHE_MAGIC "PCBROWS"
+#define ROW_CACHE_VERSION 1
+#define ROW_CACHE_SEED 14695981039346656037ull
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;         // output columns per row
+    uint64_t signature;     // column plan the rows were computed with
+    uint64_t rows;
+} row_cache_header;
+
+typedef enum {
+    ROW_INSERTED,   // key not in the previous run
+    ROW_UPDATED,    // key known, inputs or lookup values changed, or a row more than before
+    ROW_UNCHANGED   // cached cells returned
+} row_change;
+
+// FNV-1a over data, continuing from hash (start with ROW_CACHE_SEED)
+uint64_t row_cache_hash(uint64_t hash, const void* data, size_t size);
+// Same over a NUL terminated text; a missing text hashes differently from ""
+uint64_t row_cache_hash_text(uint64_t hash, const char* text);
+
+typedef struct row_cache row_cache;
+
+// Map the cache of the previous run; NULL if missing, corrupt or written
+// for another plan (signature or width differ)
+row_cache* row_cache_open(const char* path, uint64_t signature, uint32_t width);
+uint64_t row_cache_rows(const row_cache* cache);
+// Compare a row with the next unmatched row of its key in the previous run
+// and mark that row as matched. For ROW_UNCHANGED the cached cells are decoded
+// into cells (width of them). The rows of a key must be matched in PCB
+// order, by one thread at a time.
+row_change row_cache_match(row_cache* cache, const char* key, uint64_t fingerprint, output_cell* cells);
+// Call fn once for every key of the previous run with rows no row matched:
+// deleted when none of its rows was, otherwise the key has fewer rows now.
+// Returns the number of deleted keys.
+uint64_t row_cache_unseen(const row_cache* cache, void (*fn)(const char* key, int deleted, void* data),
+                          void* data);
+void row_cache_close(row_cache* cache);
+
+typedef struct row_cache_writer row_cache_writer;
+
+// Start writing the rows of this run to path.tmp
+row_cache_writer* row_cache_create(const char* path, uint64_t signature, uint32_t width);
+int row_cache_add(row_cache_writer* writer, const char* key, uint64_t fingerprint, const output_cell* cells);
+// keep: rename the rows over path; otherwise discard them. Frees the
+// writer, returns 0 if anything failed.
+int row_cache_finish(row_cache_writer* writer, int keep);
+
+#endif
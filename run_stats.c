@@ -0,0 +1,255 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "run_stats.h"
+
+static const char* phase_names[STATS_PHASE_COUNT] = {
+    "file_checks", "abc_load", "fb_load", "pcb_header", "row_loop", "workbook_close"
+};
+
+static const char* perf_phase_names[STATS_PERF_PHASE_COUNT] = {
+    "abc_load", "fb_load", "pcb_read", "evaluate", "output"
+};
+
+double stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void run_stats_init(run_stats* stats) {
+    memset(stats, 0, sizeof(run_stats));
+    stats->started = stats_now();
+}
+
+void run_stats_add_phase(run_stats* stats, stats_phase phase, double started) {
+    stats->phase_seconds[phase] += stats_now() - started;
+}
+
+void run_stats_finish(run_stats* stats) {
+    struct rusage usage;
+    stats->total_seconds = stats_now() - stats->started;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        stats->peak_rss_kb = usage.ru_maxrss; // kilobytes on Linux
+    }
+}
+
+void run_stats_merge(run_stats* into, const run_stats* file) {
+    into->rows += file->rows;
+    into->abc.hits += file->abc.hits;
+    into->abc.misses += file->abc.misses;
+    into->fb.hits += file->fb.hits;
+    into->fb.misses += file->fb.misses;
+    into->batch_bytes += file->batch_bytes;
+    into->output_bytes += file->output_bytes;
+    into->streaming |= file->streaming;
+    into->perf_counters |= file->perf_counters;
+    for (int p = 0; p < STATS_PERF_PHASE_COUNT; p++) {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            into->perf[p].count[c] += file->perf[p].count[c];
+        }
+    }
+    into->files++;
+}
+
+static int perf_counter_opened(const run_stats* stats, int counter) {
+    return (stats->perf_counters >> counter) & 1;
+}
+
+static void print_perf_row(const run_stats* stats, FILE* out, const char* name, const perf_values* values,
+                           double divisor) {
+    fprintf(out, "%-14s", name);
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        if (!perf_counter_opened(stats, c)) {
+            fprintf(out, " %14s", "n/a");
+        } else if (divisor == 1.0) {
+            fprintf(out, " %14llu", (unsigned long long)values->count[c]);
+        } else {
+            fprintf(out, " %14.1f", values->count[c] / divisor);
+        }
+    }
+    if (perf_counter_opened(stats, PERF_CYCLES) && perf_counter_opened(stats, PERF_INSTRUCTIONS)
+        && values->count[PERF_CYCLES] > 0) {
+        fprintf(out, " %6.2f", (double)values->count[PERF_INSTRUCTIONS] / values->count[PERF_CYCLES]);
+    }
+    fprintf(out, "\n");
+}
+
+void run_stats_print_perf(const run_stats* stats, FILE* out) {
+    perf_values total;
+    memset(&total, 0, sizeof(total));
+
+    fprintf(out, "\n%-14s", "perf counters");
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        fprintf(out, " %14s", perf_counter_name((perf_counter)c));
+    }
+    if (perf_counter_opened(stats, PERF_CYCLES) && perf_counter_opened(stats, PERF_INSTRUCTIONS)) {
+        fprintf(out, " %6s", "ipc");
+    }
+    fprintf(out, "\n");
+    for (int p = 0; p < STATS_PERF_PHASE_COUNT; p++) {
+        print_perf_row(stats, out, perf_phase_names[p], &stats->perf[p], 1.0);
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            total.count[c] += stats->perf[p].count[c];
+        }
+    }
+    print_perf_row(stats, out, "total", &total, 1.0);
+    if (stats->rows == 0) {
+        return;
+    }
+    fprintf(out, "per row (%llu rows)\n", (unsigned long long)stats->rows);
+    for (int p = STATS_PERF_PCB_READ; p < STATS_PERF_PHASE_COUNT; p++) {
+        print_perf_row(stats, out, perf_phase_names[p], &stats->perf[p], (double)stats->rows);
+    }
+    print_perf_row(stats, out, "total", &total, (double)stats->rows);
+}
+
+static double hit_rate(const stats_lookup* lookup) {
+    uint64_t total = lookup->hits + lookup->misses;
+    return total ? 100.0 * lookup->hits / total : 0.0;
+}
+
+static void print_index(FILE* out, const char* name, int present, int spilled, const hash_index_stats* index) {
+    if (!present) {
+        fprintf(out, "%-6s index        not built (%s)\n", name, spilled ? "built per spilled partition" : "joined in SQL");
+        return;
+    }
+    fprintf(out, "%-6s index        %u keys, %u slots, load %.2f, probes mean %.2f max %u\n",
+            name, index->count, index->slot_count, index->load_factor, index->mean_probe, index->max_probe);
+    fprintf(out, "       probes       ");
+    for (int i = 0; i < HASH_INDEX_PROBE_BUCKETS; i++) {
+        fprintf(out, "%s%d:%u", i ? " " : "", i + 1, index->probe_histogram[i]);
+    }
+    fprintf(out, " (last bucket: >= %d)\n", HASH_INDEX_PROBE_BUCKETS);
+}
+
+void run_stats_print(const run_stats* stats, FILE* out) {
+    fprintf(out, "\n=== modif stats ===\n");
+    fprintf(out, "%-20s %12s\n", "phase", "seconds");
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+        fprintf(out, "%-20s %12.6f\n", phase_names[i], stats->phase_seconds[i]);
+    }
+    fprintf(out, "%-20s %12.6f\n", "total", stats->total_seconds);
+    fprintf(out, "\n");
+    if (stats->files > 0) {
+        fprintf(out, "files               %d on %d threads\n", stats->files, stats->threads);
+    }
+    fprintf(out, "rows                %llu", (unsigned long long)stats->rows);
+    if (stats->phase_seconds[STATS_ROW_LOOP] > 0) {
+        fprintf(out, " (%.0f rows/s in the row loop)", stats->rows / stats->phase_seconds[STATS_ROW_LOOP]);
+    }
+    fprintf(out, "\n");
+    fprintf(out, "abc lookups         %llu hits, %llu misses (%.1f%% hit)\n",
+            (unsigned long long)stats->abc.hits, (unsigned long long)stats->abc.misses, hit_rate(&stats->abc));
+    fprintf(out, "fb lookups          %llu hits, %llu misses (%.1f%% hit)\n",
+            (unsigned long long)stats->fb.hits, (unsigned long long)stats->fb.misses, hit_rate(&stats->fb));
+    if (stats->incremental) {
+        fprintf(out, "incremental         %llu rows reused, %llu inserted, %llu updated, %llu deleted\n",
+                (unsigned long long)stats->rows_reused, (unsigned long long)stats->keys_inserted,
+                (unsigned long long)stats->keys_updated, (unsigned long long)stats->keys_deleted);
+    }
+    if (stats->spill_partitions > 0) {
+        fprintf(out, "spilled join        %d partitions, %llu bytes spilled\n",
+                stats->spill_partitions, (unsigned long long)stats->spill_bytes);
+    }
+    fprintf(out, "bytes allocated     %llu (batches %llu, indexes %llu)\n",
+            (unsigned long long)(stats->batch_bytes + stats->index_bytes),
+            (unsigned long long)stats->batch_bytes, (unsigned long long)stats->index_bytes);
+    fprintf(out, "peak rss            %ld KB\n", stats->peak_rss_kb);
+    fprintf(out, "output              %llu bytes (%s)\n", (unsigned long long)stats->output_bytes,
+            stats->streaming ? "streamed" : "in memory");
+    print_index(out, "abc", stats->have_abc_index, stats->spill_partitions > 0, &stats->abc_index);
+    print_index(out, "fb", stats->have_fb_index, stats->spill_partitions > 0, &stats->fb_index);
+    if (stats->perf_counters) {
+        run_stats_print_perf(stats, out);
+    }
+}
+
+static void write_json_index(FILE* out, const char* name, int present, const hash_index_stats* index) {
+    if (!present) {
+        fprintf(out, "    \"%s\": null", name);
+        return;
+    }
+    fprintf(out, "    \"%s\": {\"keys\": %u, \"slots\": %u, \"load_factor\": %.4f, "
+                 "\"mean_probe\": %.4f, \"max_probe\": %u, \"probe_histogram\": [",
+            name, index->count, index->slot_count, index->load_factor, index->mean_probe, index->max_probe);
+    for (int i = 0; i < HASH_INDEX_PROBE_BUCKETS; i++) {
+        fprintf(out, "%s%u", i ? ", " : "", index->probe_histogram[i]);
+    }
+    fprintf(out, "]}");
+}
+
+static void write_json_perf(FILE* out, const run_stats* stats, const perf_values* values, double divisor) {
+    fprintf(out, "{");
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        fprintf(out, "%s\"%s\": ", c ? ", " : "", perf_counter_name((perf_counter)c));
+        if (!perf_counter_opened(stats, c)) {
+            fprintf(out, "null");
+        } else if (divisor == 1.0) {
+            fprintf(out, "%llu", (unsigned long long)values->count[c]);
+        } else {
+            fprintf(out, "%.3f", values->count[c] / divisor);
+        }
+    }
+    fprintf(out, "}");
+}
+
+void run_stats_write_json(const run_stats* stats, FILE* out) {
+    fprintf(out, "{\n  \"phases\": {");
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+        fprintf(out, "%s\"%s\": %.6f", i ? ", " : "", phase_names[i], stats->phase_seconds[i]);
+    }
+    fprintf(out, "},\n");
+    fprintf(out, "  \"total_seconds\": %.6f,\n", stats->total_seconds);
+    fprintf(out, "  \"files\": %d,\n", stats->files);
+    fprintf(out, "  \"threads\": %d,\n", stats->threads);
+    fprintf(out, "  \"rows\": %llu,\n", (unsigned long long)stats->rows);
+    fprintf(out, "  \"lookups\": {\"abc\": {\"hits\": %llu, \"misses\": %llu}, "
+                 "\"fb\": {\"hits\": %llu, \"misses\": %llu}},\n",
+            (unsigned long long)stats->abc.hits, (unsigned long long)stats->abc.misses,
+            (unsigned long long)stats->fb.hits, (unsigned long long)stats->fb.misses);
+    if (stats->incremental) {
+        fprintf(out, "  \"incremental\": {\"rows_reused\": %llu, \"inserted\": %llu, "
+                     "\"updated\": %llu, \"deleted\": %llu},\n",
+                (unsigned long long)stats->rows_reused, (unsigned long long)stats->keys_inserted,
+                (unsigned long long)stats->keys_updated, (unsigned long long)stats->keys_deleted);
+    } else {
+        fprintf(out, "  \"incremental\": null,\n");
+    }
+    if (stats->spill_partitions > 0) {
+        fprintf(out, "  \"spill\": {\"partitions\": %d, \"bytes\": %llu},\n",
+                stats->spill_partitions, (unsigned long long)stats->spill_bytes);
+    } else {
+        fprintf(out, "  \"spill\": null,\n");
+    }
+    if (stats->perf_counters) {
+        fprintf(out, "  \"perf\": {\"phases\": {");
+        for (int p = 0; p < STATS_PERF_PHASE_COUNT; p++) {
+            fprintf(out, "%s\"%s\": ", p ? ", " : "", perf_phase_names[p]);
+            write_json_perf(out, stats, &stats->perf[p], 1.0);
+        }
+        fprintf(out, "}, \"per_row\": {");
+        for (int p = STATS_PERF_PCB_READ; p < STATS_PERF_PHASE_COUNT; p++) {
+            fprintf(out, "%s\"%s\": ", p > STATS_PERF_PCB_READ ? ", " : "", perf_phase_names[p]);
+            if (stats->rows) {
+                write_json_perf(out, stats, &stats->perf[p], (double)stats->rows);
+            } else {
+                fprintf(out, "null");
+            }
+        }
+        fprintf(out, "}},\n");
+    } else {
+        fprintf(out, "  \"perf\": null,\n");
+    }
+    fprintf(out, "  \"bytes_allocated\": %llu,\n", (unsigned long long)(stats->batch_bytes + stats->index_bytes));
+    fprintf(out, "  \"peak_rss_kb\": %ld,\n", stats->peak_rss_kb);
+    fprintf(out, "  \"output_bytes\": %llu,\n", (unsigned long long)stats->output_bytes);
+    fprintf(out, "  \"streaming\": %s,\n", stats->streaming ? "true" : "false");
+    fprintf(out, "  \"indexes\": {\n");
+    write_json_index(out, "abc", stats->have_abc_index, &stats->abc_index);
+    fprintf(out, ",\n");
+    write_json_index(out, "fb", stats->have_fb_index, &stats->fb_index);
+    fprintf(out, "\n  }\n}\n");
+}
@@ -0,0 +1,92 @@
+#ifndef RUN_STATS_H
+#define RUN_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "hash_index.h"
+#include "perf_counters.h"
+
+/*
+ * Phase timings and counters of one modif run (--stats / --stats-json).
+ *
+ * Phases are measured with the monotonic clock. When the run is pipelined the
+ * ABC and FB loads overlap the PCB header and the row loop, so the phases do
+ * not add up to the total. Each field has a single writer thread: the loaders
+ * write their own phase, the evaluator the lookup counters and the main thread
+ * everything else, so no locking is needed. In --batch mode every file counts
+ * into its own run_stats, merged into the run's under a lock.
+ *
+ * With --perf-counters the event counts of every thread are split into the
+ * perf phases below, each counted on the threads that run it (see
+ * perf_counters.h). Per-row figures divide by the PCB rows.
+ */
+
+typedef enum {
+    STATS_FILE_CHECKS,
+    STATS_ABC_LOAD,
+    STATS_FB_LOAD,
+    STATS_PCB_HEADER,
+    STATS_ROW_LOOP,
+    STATS_WORKBOOK_CLOSE,
+    STATS_PHASE_COUNT
+} stats_phase;
+
+typedef enum {
+    STATS_PERF_ABC_LOAD,
+    STATS_PERF_FB_LOAD,
+    STATS_PERF_PCB_READ,        // parsing PCB rows into batches
+    STATS_PERF_EVALUATE,        // lookups and the column plan
+    STATS_PERF_OUTPUT,          // writing rows and closing the output
+    STATS_PERF_PHASE_COUNT
+} stats_perf_phase;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+} stats_lookup;
+
+typedef struct {
+    double started;
+    double phase_seconds[STATS_PHASE_COUNT];
+    double total_seconds;
+    uint64_t rows;
+    stats_lookup abc;
+    stats_lookup fb;
+    uint64_t batch_bytes;       // row batches and the PCB cells they hold
+    uint64_t index_bytes;       // lookup indexes and the FB matrix
+    long peak_rss_kb;
+    int streaming;              // output written in constant_memory mode
+    uint64_t output_bytes;      // size of output.xlsx
+    int incremental;            // --incremental
+    uint64_t rows_reused;       // rows taken from the row cache of the last run
+    uint64_t keys_inserted;     // WIDFs the last run did not have
+    uint64_t keys_updated;      // WIDFs whose inputs or lookup values changed
+    uint64_t keys_deleted;      // WIDFs of the last run missing from PCB
+    int spill_partitions;       // --mem-limit: partitions of the spilled join, 0 when joined in memory
+    uint64_t spill_bytes;       // bytes written to the spill files
+    unsigned perf_counters;     // --perf-counters: bit mask of the counters opened, 0 when off
+    perf_values perf[STATS_PERF_PHASE_COUNT];
+    int files;                  // PCB files converted (--batch), 0 for a single file
+    int threads;                // --batch workers
+    int have_abc_index;
+    int have_fb_index;
+    hash_index_stats abc_index;
+    hash_index_stats fb_index;
+} run_stats;
+
+double stats_now(void);
+
+void run_stats_init(run_stats* stats);
+// Add the time elapsed since started (a stats_now value) to a phase
+void run_stats_add_phase(run_stats* stats, stats_phase phase, double started);
+// Record total time and peak RSS; call once at the end of the run
+void run_stats_finish(run_stats* stats);
+// Add the row, lookup, batch and output counters of one file of a --batch run
+void run_stats_merge(run_stats* into, const run_stats* file);
+
+void run_stats_print(const run_stats* stats, FILE* out);
+// The perf counter table alone, per phase and per row (part of run_stats_print)
+void run_stats_print_perf(const run_stats* stats, FILE* out);
+void run_stats_write_json(const run_stats* stats, FILE* out);
+
+#endif
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sheet_reader.h"
+#include "xlsx_zip.h"
+
+static void free_row_values(sheet_reader* reader) {
+    for (int i = 0; i < reader->value_count; i++) {
+        free(reader->values[i]);
+    }
+    reader->value_count = 0;
+}
+
+// Open the workbook at path; threads > 0 tries the fast reader first
+int open_workbook(sheet_reader* reader, const char* path, int threads) {
+    memset(reader, 0, sizeof(sheet_reader));
+    if (threads > 0 && (reader->fast = xlsx_fast_open(path, threads)) != NULL) {
+        return 1;
+    }
+    if ((reader->xlsx = xlsxioread_open(path)) == NULL) {
+        return 0;
+    }
+    if (threads > 0) {
+        printf("Note: the fast reader cannot read %s, using xlsxio\n", path);
+    }
+    return 1;
+}
+
+// Open the first sheet for sheet_next_row; the fast reader opened it already
+int open_first_sheet(sheet_reader* reader) {
+    if (reader->fast) {
+        return 1;
+    }
+    reader->sheet = xlsxioread_sheet_open(reader->xlsx, NULL, XLSXIOREAD_SKIP_EMPTY_ROWS);
+    return reader->sheet != NULL;
+}
+
+int sheet_next_row(sheet_reader* reader) {
+    int found;
+    if (reader->fast) {
+        found = xlsx_fast_next_row(reader->fast);
+    } else {
+        free_row_values(reader);
+        found = xlsxioread_sheet_next_row(reader->sheet);
+    }
+    reader->rows_read += found;
+    return found;
+}
+
+// Next cell of the row, NULL after its last one
+const char* sheet_next_cell(sheet_reader* reader) {
+    if (reader->fast) {
+        return xlsx_fast_next_cell(reader->fast);
+    }
+    char* value = xlsxioread_sheet_next_cell(reader->sheet);
+    if (value && reader->value_count == reader->value_capacity) {
+        int capacity = reader->value_capacity ? reader->value_capacity * 2 : 64;
+        char** grown = realloc(reader->values, capacity * sizeof(char*));
+        if (!grown) {
+            free(value);
+            return NULL;
+        }
+        reader->values = grown;
+        reader->value_capacity = capacity;
+    }
+    if (value) {
+        reader->values[reader->value_count++] = value;
+    }
+    return value;
+}
+
+// Header skipping wrapper around the callbacks of xlsxioread_process
+typedef struct {
+    xlsxioread_process_cell_callback_fn cell_callback;
+    xlsxioread_process_row_callback_fn row_callback;
+    void* data;
+    int header_seen;
+} process_callbacks;
+
+static int process_cell(size_t row, size_t col, const char* value, void* data) {
+    process_callbacks* callbacks = data;
+    return callbacks->header_seen ? callbacks->cell_callback(row, col, value, callbacks->data) : 0;
+}
+
+static int process_row(size_t row, size_t maxcol, void* data) {
+    process_callbacks* callbacks = data;
+    if (!callbacks->header_seen) {
+        callbacks->header_seen = 1;
+        return 0;
+    }
+    return callbacks->row_callback(row, maxcol, callbacks->data);
+}
+
+// Push every data row (the rows after the header) through the callbacks, the
+// way xlsxioread_process does; returns 0 if the sheet could not be read or a
+// callback stopped it. xlsxio reads the sheet again from its first row, the
+// fast reader continues after the header.
+int sheet_process_rows(sheet_reader* reader, xlsxioread_process_cell_callback_fn cell_callback,
+                       xlsxioread_process_row_callback_fn row_callback, void* data) {
+    if (!reader->fast) {
+        process_callbacks callbacks = { cell_callback, row_callback, data, 0 };
+        if (reader->sheet) {
+            free_row_values(reader);
+            xlsxioread_sheet_close(reader->sheet);
+            reader->sheet = NULL;
+        }
+        return xlsxioread_process(reader->xlsx, NULL, XLSXIOREAD_SKIP_EMPTY_ROWS,
+                                  process_cell, process_row, &callbacks) == 0;
+    }
+    if (reader->rows_read == 0 && !sheet_next_row(reader)) {
+        return !xlsx_fast_failed(reader->fast);
+    }
+    while (sheet_next_row(reader)) {
+        const char* value;
+        size_t col = 0;
+        while ((value = xlsx_fast_next_cell(reader->fast)) != NULL) {
+            if (cell_callback(reader->rows_read, ++col, value, data)) {
+                return 0;
+            }
+        }
+        if (row_callback(reader->rows_read, col, data)) {
+            return 0;
+        }
+    }
+    return !xlsx_fast_failed(reader->fast);
+}
+
+void close_sheet_reader(sheet_reader* reader) {
+    if (reader->fast) {
+        xlsx_fast_close(reader->fast);
+    }
+    if (reader->sheet) {
+        xlsxioread_sheet_close(reader->sheet);
+    }
+    if (reader->xlsx) {
+        xlsxioread_close(reader->xlsx);
+    }
+    free_row_values(reader);
+    free(reader->values);
+    memset(reader, 0, sizeof(sheet_reader));
+}
+
+// Cells of the next data row at two columns, NULL when the row is shorter;
+// 0 after the last row
+int read_key_value(sheet_reader* reader, int key_col, int value_col, const char** key, const char** value) {
+    const char* cell;
+    int col = 0;
+
+    if (!sheet_next_row(reader)) {
+        return 0;
+    }
+    *key = NULL;
+    *value = NULL;
+    while ((cell = sheet_next_cell(reader)) != NULL) {
+        if (col == key_col) {
+            *key = cell;
+        } else if (col == value_col) {
+            *value = cell;
+        }
+        col++;
+    }
+    return 1;
+}
+
+// Cells of the next data row in the first col_count columns, NULL past the
+// end of the row; 0 after the last row
+int read_row_cells(sheet_reader* reader, int col_count, const char** cells) {
+    const char* value;
+    int col = 0;
+
+    if (!sheet_next_row(reader)) {
+        return 0;
+    }
+    while ((value = sheet_next_cell(reader)) != NULL) {
+        if (col < col_count) {
+            cells[col] = value;
+        }
+        col++;
+    }
+    for (int c = col; c < col_count; c++) {
+        cells[c] = NULL;
+    }
+    return 1;
+}
+
+// Expected data rows of a sheet, used to presize the tables filled from it
+uint32_t expected_data_rows(const char* path) {
+    uint32_t rows = xlsx_sheet_dimension_rows(path);
+    return rows > 0 ? rows - 1 : 0;
+}
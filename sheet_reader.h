@@ -0,0 +1,50 @@
+#ifndef SHEET_READER_H
+#define SHEET_READER_H
+
+#include <stdint.h>
+#include <xlsxio_read.h>
+#include "xlsx_fast.h"
+
+/*
+ * The first sheet of a workbook read row by row, through xlsxio or with
+ * --fast-reader by the built-in parallel reader (xlsx_fast.h), which falls
+ * back to xlsxio for a file it cannot handle. Both deliver the same rows and
+ * cells; a cell value is borrowed and stays valid until the next row is
+ * requested.
+ */
+
+typedef struct {
+    xlsxioreader xlsx;
+    xlsxioreadersheet sheet;
+    xlsx_fast_sheet* fast;
+    char** values;          // xlsxio: cells of the current row
+    int value_count;
+    int value_capacity;
+    int rows_read;
+} sheet_reader;
+
+// Open the workbook at path; threads > 0 tries the fast reader first
+int open_workbook(sheet_reader* reader, const char* path, int threads);
+// Open the first sheet for sheet_next_row; the fast reader opened it already
+int open_first_sheet(sheet_reader* reader);
+int sheet_next_row(sheet_reader* reader);
+// Next cell of the row, NULL after its last one
+const char* sheet_next_cell(sheet_reader* reader);
+// Push every data row (the rows after the header) through the callbacks, the
+// way xlsxioread_process does; returns 0 if the sheet could not be read or a
+// callback stopped it
+int sheet_process_rows(sheet_reader* reader, xlsxioread_process_cell_callback_fn cell_callback,
+                       xlsxioread_process_row_callback_fn row_callback, void* data);
+void close_sheet_reader(sheet_reader* reader);
+
+// Cells of the next data row at two columns, NULL when the row is shorter;
+// 0 after the last row
+int read_key_value(sheet_reader* reader, int key_col, int value_col, const char** key, const char** value);
+// Cells of the next data row in the first col_count columns, NULL past the
+// end of the row; 0 after the last row
+int read_row_cells(sheet_reader* reader, int col_count, const char** cells);
+
+// Expected data rows of a sheet, used to presize the tables filled from it
+uint32_t expected_data_rows(const char* path);
+
+#endif
@@ -0,0 +1,171 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+struct snapshot {
+    void* map;
+    size_t map_size;
+    hash_index index;
+};
+
+uint64_t snapshot_source_hash(const char* path, uint64_t* size) {
+    int fd = open(path, O_RDONLY);
+    unsigned char buf[65536];
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t total = 0;
+    ssize_t length;
+
+    *size = 0;
+    if (fd < 0) {
+        return 0;
+    }
+    // read() rather than mmap: the file may be rewritten while it is hashed
+    // (--watch), and touching a mapped page past a truncation raises SIGBUS
+    while ((length = read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < length; i++) {
+            hash ^= buf[i];
+            hash *= 1099511628211ull;
+        }
+        total += (uint64_t)length;
+    }
+    close(fd);
+    if (length < 0 || total == 0) {
+        return 0;
+    }
+    *size = total;
+    return hash;
+}
+
+// Every slot names an entry or is empty (and one is, so probes end), and
+// every key and value offset lies in the arena, which ends on a NUL: the
+// index can then be probed without reading past the mapping
+static int index_is_valid(const uint32_t* slots, uint32_t slot_count, const hash_index_entry* entries,
+                          uint32_t entry_count, const char* arena, uint64_t arena_size) {
+    uint32_t empty = 0;
+    for (uint32_t i = 0; i < slot_count; i++) {
+        if (slots[i] == HASH_INDEX_EMPTY_SLOT) {
+            empty++;
+        } else if (slots[i] >= entry_count) {
+            return 0;
+        }
+    }
+    if (empty == 0 || (entry_count > 0 && arena[arena_size - 1] != '\0')) {
+        return 0;
+    }
+    for (uint32_t e = 0; e < entry_count; e++) {
+        if (entries[e].key_offset >= arena_size || entries[e].value_offset >= arena_size) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+snapshot* snapshot_open(const char* path, uint64_t source_hash, uint64_t source_size, uint32_t week) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_header)) {
+        close(fd);
+        return NULL;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const snapshot_header* header = map;
+    uint64_t expected = sizeof(snapshot_header)
+                      + (uint64_t)header->slot_count * sizeof(uint32_t)
+                      + (uint64_t)header->entry_count * sizeof(hash_index_entry)
+                      + header->arena_size;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0
+        || header->version != SNAPSHOT_VERSION
+        || header->source_hash != source_hash
+        || header->source_size != source_size
+        || header->week != week
+        || header->slot_count == 0
+        || (header->slot_count & (header->slot_count - 1)) != 0
+        || expected != (uint64_t)st.st_size) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    // The index is read-only; the casts only drop const for the view struct
+    uint32_t* slots = (uint32_t*)(header + 1);
+    hash_index_entry* entries = (hash_index_entry*)(slots + header->slot_count);
+    char* arena = (char*)(entries + header->entry_count);
+    snapshot* snap = NULL;
+    if (!index_is_valid(slots, header->slot_count, entries, header->entry_count, arena, header->arena_size)
+        || (snap = malloc(sizeof(snapshot))) == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    snap->map = map;
+    snap->map_size = st.st_size;
+    hash_index_view(&snap->index, slots, header->slot_count, entries, header->entry_count,
+                    arena, header->arena_size);
+    return snap;
+}
+
+const hash_index* snapshot_index(const snapshot* snap) {
+    return &snap->index;
+}
+
+void snapshot_close(snapshot* snap) {
+    if (snap) {
+        munmap(snap->map, snap->map_size);
+        free(snap);
+    }
+}
+
+int snapshot_write(const hash_index* index, const char* path,
+                   uint64_t source_hash, uint64_t source_size, uint32_t week) {
+    snapshot_header header;
+    char tmp_path[4096];
+    FILE* file;
+    int fd, ok;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.week = week;
+    header.source_hash = source_hash;
+    header.source_size = source_size;
+    header.entry_count = index->count;
+    header.slot_count = index->slot_count;
+    header.arena_size = index->arena_size;
+
+    // A unique temporary file: a --batch job and --watch may write the same
+    // snapshot at once
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+    if ((fd = mkstemp(tmp_path)) < 0) {
+        return 0;
+    }
+    // mkstemp creates the file 0600; snapshots are as readable as their source
+    if (fchmod(fd, 0644) != 0 || (file = fdopen(fd, "wb")) == NULL) {
+        close(fd);
+        remove(tmp_path);
+        return 0;
+    }
+    ok = fwrite(&header, sizeof(header), 1, file) == 1
+      && fwrite(index->slots, sizeof(uint32_t), index->slot_count, file) == index->slot_count
+      && fwrite(index->entries, sizeof(hash_index_entry), index->count, file) == index->count
+      && fwrite(index->arena, 1, index->arena_size, file) == index->arena_size;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return 0;
+    }
+    return 1;
+}
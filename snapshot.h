@@ -0,0 +1,51 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "hash_index.h"
+
+/*
+ * Binary lookup snapshots for the ABC/FB reference tables.
+ *
+ * A snapshot is a hash_index dumped to disk: the slot array, the entries and
+ * the arena of one loaded xlsx file. Later runs mmap it and probe it in place
+ * instead of parsing the xlsx again. It is tagged with a content hash of the
+ * source file (and the FB week) and is rebuilt when the source changes.
+ *
+ * File layout (native endianness):
+ *   snapshot_header
+ *   uint32_t slots[slot_count]            entry index or HASH_INDEX_EMPTY_SLOT
+ *   hash_index_entry entries[entry_count]
+ *   char arena[arena_size]                NUL terminated keys and values
+ */
+
+#define SNAPSHOT_MAGIC "PCBSNAP"
+#define SNAPSHOT_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t week;          // FB week the values belong to, 0 for ABC
+    uint64_t source_hash;   // FNV-1a of the source xlsx contents
+    uint64_t source_size;
+    uint32_t entry_count;
+    uint32_t slot_count;    // power of two
+    uint64_t arena_size;
+} snapshot_header;
+
+typedef struct snapshot snapshot;
+
+// Content hash of a file, 0 with *size = 0 if it cannot be read
+uint64_t snapshot_source_hash(const char* path, uint64_t* size);
+
+// Map a snapshot; NULL if missing, corrupt or built from other contents.
+// The slots and entries are checked against the arena before use.
+snapshot* snapshot_open(const char* path, uint64_t source_hash, uint64_t source_size, uint32_t week);
+const hash_index* snapshot_index(const snapshot* snap);
+void snapshot_close(snapshot* snap);
+
+// Write an index atomically (unique temporary file + rename); returns 0 on failure
+int snapshot_write(const hash_index* index, const char* path,
+                   uint64_t source_hash, uint64_t source_size, uint32_t week);
+
+#endif
@@ -0,0 +1,150 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "spill.h"
+
+struct spill_set {
+    FILE* files[SPILL_MAX_PARTITIONS];
+    int partitions;
+    int bits;               // log2 of partitions
+    uint64_t bytes;
+    int failed;
+    char* scratch;          // text being read, before it is copied into an arena
+    size_t scratch_size;
+};
+
+static FILE* create_file(void) {
+    const char* dir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/modif-spill-XXXXXX", dir && *dir ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return NULL;
+    }
+    unlink(path);
+    FILE* file = fdopen(fd, "w+b");
+    if (!file) {
+        close(fd);
+    }
+    return file;
+}
+
+spill_set* spill_create(int partitions) {
+    if (partitions < 1 || partitions > SPILL_MAX_PARTITIONS || (partitions & (partitions - 1)) != 0) {
+        return NULL;
+    }
+    spill_set* set = calloc(1, sizeof(spill_set));
+    if (!set) {
+        return NULL;
+    }
+    set->partitions = partitions;
+    while ((1 << set->bits) < partitions) {
+        set->bits++;
+    }
+    for (int i = 0; i < partitions; i++) {
+        if ((set->files[i] = create_file()) == NULL) {
+            spill_close(set);
+            return NULL;
+        }
+    }
+    return set;
+}
+
+int spill_partitions(const spill_set* set) {
+    return set->partitions;
+}
+
+int spill_partition_of(const spill_set* set, uint32_t hash) {
+    return set->bits ? (int)(hash >> (32 - set->bits)) : 0;
+}
+
+void spill_write(spill_set* set, int partition, const void* data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, set->files[partition]) != size) {
+        set->failed = 1;
+    }
+    set->bytes += size;
+}
+
+void spill_write_text(spill_set* set, int partition, const char* text) {
+    uint32_t size = text ? (uint32_t)strlen(text) : SPILL_NULL_TEXT;
+    spill_write(set, partition, &size, sizeof(size));
+    if (text) {
+        spill_write(set, partition, text, size);
+    }
+}
+
+int spill_rewind(spill_set* set, int partition) {
+    FILE* file = set->files[partition];
+    if (fflush(file) != 0) {
+        set->failed = 1;
+        return 0;
+    }
+    rewind(file);
+    return 1;
+}
+
+int spill_read(spill_set* set, int partition, void* data, size_t size) {
+    return size == 0 || fread(data, 1, size, set->files[partition]) == size;
+}
+
+int spill_read_text(spill_set* set, int partition, arena* text_arena, const char** text) {
+    uint32_t size;
+    if (!spill_read(set, partition, &size, sizeof(size))) {
+        return 0;
+    }
+    if (size == SPILL_NULL_TEXT) {
+        *text = NULL;
+        return 1;
+    }
+    if (size + 1 > set->scratch_size) {
+        size_t grown_size = set->scratch_size ? set->scratch_size : 256;
+        while (grown_size < (size_t)size + 1) {
+            grown_size *= 2;
+        }
+        char* grown = realloc(set->scratch, grown_size);
+        if (!grown) {
+            return 0;
+        }
+        set->scratch = grown;
+        set->scratch_size = grown_size;
+    }
+    if (!spill_read(set, partition, set->scratch, size)) {
+        return 0;
+    }
+    set->scratch[size] = '\0';
+    *text = arena_strdup(text_arena, set->scratch);
+    return *text != NULL;
+}
+
+void spill_drop(spill_set* set, int partition) {
+    FILE* file = set->files[partition];
+    fflush(file);
+    // A failure only keeps the disk space until the set is closed
+    int truncated = ftruncate(fileno(file), 0);
+    (void)truncated;
+    rewind(file);
+}
+
+uint64_t spill_bytes(const spill_set* set) {
+    return set->bytes;
+}
+
+int spill_failed(const spill_set* set) {
+    return set->failed;
+}
+
+void spill_close(spill_set* set) {
+    if (!set) {
+        return;
+    }
+    for (int i = 0; i < set->partitions; i++) {
+        if (set->files[i]) {
+            fclose(set->files[i]);
+        }
+    }
+    free(set->scratch);
+    free(set);
+}
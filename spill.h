@@ -0,0 +1,50 @@
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+/*
+ * Temporary partition files of the memory-bounded join (--mem-limit).
+ *
+ * A spill set is a power-of-two number of partitions, each an anonymous
+ * temporary file (created in $TMPDIR, or /tmp, and unlinked at once, so
+ * nothing is left behind by a crash). Records are sequences of fields
+ * appended to one partition and read back in the order they were written:
+ *
+ *   text   uint32_t size, then the bytes; SPILL_NULL_TEXT for a NULL text
+ *   bytes  raw, the reader knows the size
+ *
+ * A key goes to the partition of the high bits of its hash_index_hash, so
+ * the keys of one partition still spread over the low bits the index uses.
+ * A set is written and read by one thread at a time.
+ */
+
+#define SPILL_MAX_PARTITIONS 128
+#define SPILL_NULL_TEXT 0xFFFFFFFFu
+
+typedef struct spill_set spill_set;
+
+// Create partitions (a power of two up to SPILL_MAX_PARTITIONS) empty files; NULL on failure
+spill_set* spill_create(int partitions);
+int spill_partitions(const spill_set* set);
+// Partition of a key hash
+int spill_partition_of(const spill_set* set, uint32_t hash);
+// Append a field to a partition. A write error is remembered (see spill_failed).
+void spill_write_text(spill_set* set, int partition, const char* text);
+void spill_write(spill_set* set, int partition, const void* data, size_t size);
+// Flush what was written and read the partition from its first record
+int spill_rewind(spill_set* set, int partition);
+// Read the next field of the partition being read; a text is copied into
+// the arena (*text NULL for a NULL text). Returns 0 at the end or on a short read.
+int spill_read_text(spill_set* set, int partition, arena* text_arena, const char** text);
+int spill_read(spill_set* set, int partition, void* data, size_t size);
+// Give the disk space of a partition back once it is consumed
+void spill_drop(spill_set* set, int partition);
+// Bytes written to all partitions so far
+uint64_t spill_bytes(const spill_set* set);
+int spill_failed(const spill_set* set);
+void spill_close(spill_set* set);
+
+#endif
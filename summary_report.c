@@ -0,0 +1,372 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash_index.h"
+#include "summary_report.h"
+
+// Columns of a group sheet: the group, rows, WSTKG, MAX, couv
+#define GROUP_SHEET_COLS 5
+
+typedef struct {
+    uint64_t rows;
+    double stock;       // sum of WSTKG
+    double max;         // sum of MAX
+    double couv_weight; // sum of MAX over the rows with a couv
+    double couv_sum;    // sum of couv * MAX over them
+} summary_group;
+
+typedef struct {
+    const char* name;   // WGES or WFOR
+    const char* sheet;
+    int column;         // output column, -1 if the output has none
+    hash_index keys;    // group name -> "", entry number = group
+    summary_group* groups;
+    uint32_t capacity;
+} summary_grouping;
+
+// A kept row: its cells with copies of their texts, in one allocation
+typedef struct {
+    double couv;
+    uint64_t order;     // output row, to break ties by output order
+    output_cell* cells;
+} summary_row;
+
+struct summary_report {
+    int count;          // columns of an output row
+    char** names;
+    int stock_col;      // WSTKG, -1 if absent
+    int max_col;        // MAX, or MAX_<week> of the first horizon week
+    int couv_col;
+    summary_grouping groupings[2];
+    summary_row* lowest;    // max-heap on (couv, order): the highest kept row on top
+    int lowest_count;
+    int lowest_limit;
+    uint64_t rows;
+};
+
+// A column by name, or with a --weeks horizon the first one named prefix_<week>
+static int find_output_column(const char* const* names, int count, const char* name) {
+    size_t length = strlen(name);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (strncmp(names[i], name, length) == 0 && names[i][length] == '_') {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int cell_number(const output_cell* cells, int column, double* value) {
+    if (column < 0 || cells[column].kind != CELL_NUMBER || !isfinite(cells[column].number)) {
+        return 0;
+    }
+    *value = cells[column].number;
+    return 1;
+}
+
+static const char* column_name_or(const summary_report* report, int column, const char* name) {
+    return column >= 0 ? report->names[column] : name;
+}
+
+summary_report* summary_report_new(const char* const* names, int count, int lowest_rows) {
+    summary_report* report = calloc(1, sizeof(summary_report));
+    if (!report) {
+        return NULL;
+    }
+    report->count = count;
+    report->stock_col = find_output_column(names, count, "WSTKG");
+    report->max_col = find_output_column(names, count, "MAX");
+    report->couv_col = find_output_column(names, count, "couv");
+    report->groupings[0].name = "WGES";
+    report->groupings[0].sheet = "by_WGES";
+    report->groupings[1].name = "WFOR";
+    report->groupings[1].sheet = "by_WFOR";
+    for (int g = 0; g < 2; g++) {
+        report->groupings[g].column = find_output_column(names, count, report->groupings[g].name);
+    }
+    report->lowest_limit = report->couv_col >= 0 && lowest_rows > 0 ? lowest_rows : 0;
+    if (report->groupings[0].column < 0 && report->groupings[1].column < 0 && report->lowest_limit == 0) {
+        free(report);
+        return NULL;
+    }
+
+    int ok = (report->names = calloc((size_t)count, sizeof(char*))) != NULL;
+    for (int i = 0; ok && i < count; i++) {
+        ok = (report->names[i] = strdup(names[i])) != NULL;
+    }
+    for (int g = 0; ok && g < 2; g++) {
+        ok = report->groupings[g].column < 0 || hash_index_init(&report->groupings[g].keys, 0);
+    }
+    if (ok && report->lowest_limit > 0) {
+        ok = (report->lowest = calloc((size_t)report->lowest_limit, sizeof(summary_row))) != NULL;
+    }
+    if (!ok) {
+        summary_report_free(report);
+        return NULL;
+    }
+    return report;
+}
+
+void summary_report_print(const summary_report* report) {
+    printf("Summary:");
+    for (int g = 0; g < 2; g++) {
+        if (report->groupings[g].column >= 0) {
+            printf(" %s totals in %s,", report->groupings[g].name, report->groupings[g].sheet);
+        }
+    }
+    if (report->lowest_limit > 0) {
+        printf(" %d lowest %s in lowest_couv,", report->lowest_limit, report->names[report->couv_col]);
+    }
+    printf(" from %s, %s and %s\n", column_name_or(report, report->stock_col, "no WSTKG"),
+           column_name_or(report, report->max_col, "no MAX"), column_name_or(report, report->couv_col, "no couv"));
+}
+
+///////////////////////// groups /////////////////////////
+
+// The group of a row: its cell as text, "" for an empty one
+static summary_group* find_group(summary_grouping* grouping, const output_cell* cell) {
+    char number[32];
+    const char* key = "";
+    if (cell->kind == CELL_TEXT) {
+        key = cell->text;
+    } else if (cell->kind == CELL_NUMBER) {
+        format_number(number, sizeof(number), cell->number);
+        key = number;
+    }
+    int64_t group = hash_index_find(&grouping->keys, key);
+    if (group >= 0) {
+        return &grouping->groups[group];
+    }
+    if (grouping->keys.count == grouping->capacity) {
+        uint32_t capacity = grouping->capacity ? grouping->capacity * 2 : 256;
+        summary_group* groups = realloc(grouping->groups, capacity * sizeof(summary_group));
+        if (!groups) {
+            return NULL;
+        }
+        grouping->groups = groups;
+        grouping->capacity = capacity;
+    }
+    group = grouping->keys.count;
+    if (!hash_index_put(&grouping->keys, key, "")) {
+        return NULL;
+    }
+    memset(&grouping->groups[group], 0, sizeof(summary_group));
+    return &grouping->groups[group];
+}
+
+///////////////////////// lowest rows /////////////////////////
+
+static int row_above(const summary_row* a, const summary_row* b) {
+    return a->couv > b->couv || (a->couv == b->couv && a->order > b->order);
+}
+
+static output_cell* copy_cells(const output_cell* cells, int count) {
+    size_t size = (size_t)count * sizeof(output_cell);
+    for (int i = 0; i < count; i++) {
+        if (cells[i].kind == CELL_TEXT) {
+            size += strlen(cells[i].text) + 1;
+        }
+    }
+    output_cell* copy = malloc(size);
+    if (!copy) {
+        return NULL;
+    }
+    char* text = (char*)(copy + count);
+    for (int i = 0; i < count; i++) {
+        copy[i] = cells[i];
+        if (cells[i].kind == CELL_TEXT) {
+            size_t length = strlen(cells[i].text) + 1;
+            memcpy(text, cells[i].text, length);
+            copy[i].text = text;
+            text += length;
+        }
+    }
+    return copy;
+}
+
+static void sift_up(summary_row* heap, int i) {
+    while (i > 0 && row_above(&heap[i], &heap[(i - 1) / 2])) {
+        summary_row parent = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = heap[i];
+        heap[i] = parent;
+        i = (i - 1) / 2;
+    }
+}
+
+static void sift_down(summary_row* heap, int count, int i) {
+    for (;;) {
+        int top = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < count && row_above(&heap[left], &heap[top])) {
+            top = left;
+        }
+        if (right < count && row_above(&heap[right], &heap[top])) {
+            top = right;
+        }
+        if (top == i) {
+            return;
+        }
+        summary_row row = heap[i];
+        heap[i] = heap[top];
+        heap[top] = row;
+        i = top;
+    }
+}
+
+static void keep_if_lowest(summary_report* report, const output_cell* cells, double couv) {
+    summary_row row = { couv, report->rows, NULL };
+    if (report->lowest_count == report->lowest_limit && !row_above(&report->lowest[0], &row)) {
+        return;
+    }
+    if ((row.cells = copy_cells(cells, report->count)) == NULL) {
+        return;
+    }
+    if (report->lowest_count < report->lowest_limit) {
+        report->lowest[report->lowest_count] = row;
+        sift_up(report->lowest, report->lowest_count++);
+    } else {
+        free(report->lowest[0].cells);
+        report->lowest[0] = row;
+        sift_down(report->lowest, report->lowest_count, 0);
+    }
+}
+
+void summary_report_add(summary_report* report, const output_cell* cells) {
+    double stock, max, couv;
+    int have_stock = cell_number(cells, report->stock_col, &stock);
+    int have_max = cell_number(cells, report->max_col, &max);
+    int have_couv = cell_number(cells, report->couv_col, &couv);
+
+    for (int g = 0; g < 2; g++) {
+        summary_grouping* grouping = &report->groupings[g];
+        summary_group* group;
+        if (grouping->column < 0 || (group = find_group(grouping, &cells[grouping->column])) == NULL) {
+            continue;
+        }
+        group->rows++;
+        group->stock += have_stock ? stock : 0;
+        group->max += have_max ? max : 0;
+        // Without a MAX column every couv weighs the same
+        if (have_couv && (have_max || report->max_col < 0)) {
+            double weight = report->max_col < 0 ? 1 : max;
+            group->couv_weight += weight;
+            group->couv_sum += couv * weight;
+        }
+    }
+    if (have_couv && report->lowest_limit > 0) {
+        keep_if_lowest(report, cells, couv);
+    }
+    report->rows++;
+}
+
+///////////////////////// sheets /////////////////////////
+
+typedef struct {
+    const char* key;
+    uint32_t group;
+} group_entry;
+
+static int compare_groups(const void* a, const void* b) {
+    return strcmp(((const group_entry*)a)->key, ((const group_entry*)b)->key);
+}
+
+static int compare_rows(const void* a, const void* b) {
+    const summary_row* x = a;
+    const summary_row* y = b;
+    return row_above(x, y) ? 1 : row_above(y, x) ? -1 : 0;
+}
+
+static output_cell number_or_empty(double value, int present) {
+    output_cell cell;
+    cell.kind = present ? CELL_NUMBER : CELL_EMPTY;
+    cell.text = NULL;
+    cell.number = value;
+    return cell;
+}
+
+static int write_group_sheet(const summary_report* report, const summary_grouping* grouping, output_sink* sink) {
+    const char* header[GROUP_SHEET_COLS] = {
+        grouping->name, "rows", column_name_or(report, report->stock_col, "WSTKG"),
+        column_name_or(report, report->max_col, "MAX"), column_name_or(report, report->couv_col, "couv")
+    };
+    uint32_t count = grouping->keys.count;
+    group_entry* order = malloc((count ? count : 1) * sizeof(group_entry));
+    if (!order) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        order[i].key = grouping->keys.arena + grouping->keys.entries[i].key_offset;
+        order[i].group = i;
+    }
+    qsort(order, count, sizeof(group_entry), compare_groups);
+
+    int ok = output_sink_add_sheet(sink, grouping->sheet)
+          && output_sink_write_header(sink, header, GROUP_SHEET_COLS);
+    for (uint32_t i = 0; ok && i < count; i++) {
+        const summary_group* group = &grouping->groups[order[i].group];
+        output_cell cells[GROUP_SHEET_COLS];
+        cells[0].kind = order[i].key[0] ? CELL_TEXT : CELL_EMPTY;
+        cells[0].text = order[i].key;
+        cells[1] = number_or_empty((double)group->rows, 1);
+        cells[2] = number_or_empty(group->stock, report->stock_col >= 0);
+        cells[3] = number_or_empty(group->max, report->max_col >= 0);
+        cells[4] = number_or_empty(group->couv_weight != 0 ? group->couv_sum / group->couv_weight : 0,
+                                   group->couv_weight != 0);
+        ok = output_sink_write_row(sink, cells, GROUP_SHEET_COLS);
+    }
+    free(order);
+    return ok;
+}
+
+int summary_report_write(summary_report* report, output_sink* sink) {
+    int ok = 1;
+    for (int g = 0; g < 2; g++) {
+        if (report->groupings[g].column >= 0) {
+            ok = write_group_sheet(report, &report->groupings[g], sink) && ok;
+        }
+    }
+    if (report->lowest_limit > 0) {
+        // Lowest first; the heap is not needed any more
+        qsort(report->lowest, (size_t)report->lowest_count, sizeof(summary_row), compare_rows);
+        ok = output_sink_add_sheet(sink, "lowest_couv")
+          && output_sink_write_header(sink, (const char* const*)report->names, report->count) && ok;
+        for (int i = 0; ok && i < report->lowest_count; i++) {
+            ok = output_sink_write_row(sink, report->lowest[i].cells, report->count);
+        }
+    }
+    return ok;
+}
+
+void summary_report_counts(const summary_report* report, uint32_t* wges_groups, uint32_t* wfor_groups,
+                           int* lowest_rows) {
+    *wges_groups = report->groupings[0].keys.count;
+    *wfor_groups = report->groupings[1].keys.count;
+    *lowest_rows = report->lowest_count;
+}
+
+void summary_report_free(summary_report* report) {
+    if (!report) {
+        return;
+    }
+    for (int g = 0; g < 2; g++) {
+        hash_index_free(&report->groupings[g].keys);
+        free(report->groupings[g].groups);
+    }
+    for (int i = 0; i < report->lowest_count; i++) {
+        free(report->lowest[i].cells);
+    }
+    free(report->lowest);
+    for (int i = 0; report->names && i < report->count; i++) {
+        free(report->names[i]);
+    }
+    free(report->names);
+    free(report);
+}
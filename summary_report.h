@@ -0,0 +1,42 @@
+#ifndef SUMMARY_REPORT_H
+#define SUMMARY_REPORT_H
+
+#include <stdint.h>
+#include "output_sink.h"
+
+/*
+ * --summary: what planners otherwise get by sorting and subtotalling
+ * output.xlsx in Excel, gathered from the output rows while they are
+ * written, in the same pass.
+ *
+ *   by_WGES, by_WFOR  per group: rows, sum of WSTKG, sum of MAX and the
+ *                     coverage weighted by MAX, sum(couv * MAX) / sum(MAX)
+ *   lowest_couv       the N output rows of lowest couv, lowest first
+ *
+ * Groups are counted in a hash index (hash_index.h) and written sorted by
+ * name. The lowest rows are kept in a max-heap of N rows on couv, so a row
+ * is only copied when it beats the highest kept one. With a --weeks horizon
+ * MAX and couv are those of the first week of the horizon.
+ *
+ * Rows are added by the thread writing the output, in output order.
+ */
+
+// Default N of the lowest couv sheet
+#define SUMMARY_LOWEST_ROWS 100
+
+typedef struct summary_report summary_report;
+
+// Resolve the columns of an output header; NULL when it has neither WGES,
+// WFOR nor couv, or out of memory
+summary_report* summary_report_new(const char* const* names, int count, int lowest_rows);
+// "Summary: ..." with the columns it reads
+void summary_report_print(const summary_report* report);
+void summary_report_add(summary_report* report, const output_cell* cells);
+// Write the sheets after the output rows; returns 0 if any failed
+int summary_report_write(summary_report* report, output_sink* sink);
+// Groups of WGES, of WFOR, and the lowest rows kept
+void summary_report_counts(const summary_report* report, uint32_t* wges_groups, uint32_t* wfor_groups,
+                           int* lowest_rows);
+void summary_report_free(summary_report* report);
+
+#endif
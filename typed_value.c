@@ -0,0 +1,52 @@
+#include <stdlib.h>
+#include "typed_value.h"
+
+number_cell number_cell_null(void) {
+    number_cell cell = { 0.0, 1 };
+    return cell;
+}
+
+number_cell number_cell_parse(const char* text) {
+    number_cell cell = { 0.0, 1 };
+    char* end;
+    if (text == NULL || *text == '\0') {
+        return cell;
+    }
+    cell.value = strtod(text, &end);
+    while (*end == ' ') {
+        end++;
+    }
+    cell.null = end == text || *end != '\0';
+    return cell;
+}
+
+number_cell number_cell_max(number_cell a, number_cell b) {
+    if (a.null) {
+        return b;
+    }
+    if (b.null) {
+        return a;
+    }
+    return a.value >= b.value ? a : b;
+}
+
+number_cell number_cell_min(number_cell a, number_cell b) {
+    if (a.null) {
+        return b;
+    }
+    if (b.null) {
+        return a;
+    }
+    return a.value <= b.value ? a : b;
+}
+
+number_cell* parse_index_values(const hash_index* index) {
+    number_cell* values = malloc((index->count ? index->count : 1) * sizeof(number_cell));
+    if (!values) {
+        return NULL;
+    }
+    for (uint32_t e = 0; e < index->count; e++) {
+        values[e] = number_cell_parse(index->arena + index->entries[e].value_offset);
+    }
+    return values;
+}
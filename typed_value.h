@@ -0,0 +1,27 @@
+#ifndef TYPED_VALUE_H
+#define TYPED_VALUE_H
+
+#include "hash_index.h"
+
+/*
+ * Numeric cells (WCMJ, WSTKG, WKQCO, FB weeks) parsed once into a double
+ * with a null flag. A cell is null when it is empty or not entirely a
+ * number; integers are exact up to 2^53, far above any quantity here.
+ */
+
+typedef struct {
+    double value;
+    int null;
+} number_cell;
+
+number_cell number_cell_parse(const char* text);
+number_cell number_cell_null(void);
+
+// max(a, b) ignoring nulls; a wins ties
+number_cell number_cell_max(number_cell a, number_cell b);
+number_cell number_cell_min(number_cell a, number_cell b);
+
+// Parse every value of a lookup index, indexed by entry number; NULL on allocation failure
+number_cell* parse_index_values(const hash_index* index);
+
+#endif
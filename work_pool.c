@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "work_pool.h"
+
+typedef struct {
+    int* items;
+    int head;
+    int tail;
+    pthread_mutex_t lock;
+} work_deque;
+
+typedef struct {
+    work_deque* deques;
+    int threads;
+    work_pool_fn fn;
+    void* data;
+} work_pool;
+
+typedef struct {
+    work_pool* pool;
+    int id;
+} work_worker;
+
+// Take an item from the front (owner) or the back (thief) of a deque
+static int deque_take(work_deque* deque, int from_back, int* item) {
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail) {
+        *item = from_back ? deque->items[--deque->tail] : deque->items[deque->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static int next_item(work_pool* pool, int id, int* item) {
+    if (deque_take(&pool->deques[id], 0, item)) {
+        return 1;
+    }
+    for (int k = 1; k < pool->threads; k++) {
+        if (deque_take(&pool->deques[(id + k) % pool->threads], 1, item)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void* worker_main(void* arg) {
+    work_worker* worker = arg;
+    int item;
+    while (next_item(worker->pool, worker->id, &item)) {
+        worker->pool->fn(item, worker->id, worker->pool->data);
+    }
+    return NULL;
+}
+
+int work_pool_run(int count, int threads, work_pool_fn fn, void* data) {
+    work_pool pool;
+    pthread_t* handles;
+    work_worker* workers;
+    int started = 0;
+
+    if (threads > count) {
+        threads = count;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    pool.threads = threads;
+    pool.fn = fn;
+    pool.data = data;
+    pool.deques = calloc(threads, sizeof(work_deque));
+    handles = malloc(threads * sizeof(pthread_t));
+    workers = malloc(threads * sizeof(work_worker));
+    int* items = malloc((count + 1) * sizeof(int));
+    if (!pool.deques || !handles || !workers || !items) {
+        free(pool.deques);
+        free(handles);
+        free(workers);
+        free(items);
+        for (int i = 0; i < count; i++) {
+            fn(i, 0, data);
+        }
+        return 1;
+    }
+
+    // Deque w holds items w, w + threads, ... contiguously in one array
+    int offset = 0;
+    for (int w = 0; w < threads; w++) {
+        work_deque* deque = &pool.deques[w];
+        deque->items = items + offset;
+        deque->head = 0;
+        deque->tail = 0;
+        for (int i = w; i < count; i += threads) {
+            deque->items[deque->tail++] = i;
+        }
+        offset += deque->tail;
+        pthread_mutex_init(&deque->lock, NULL);
+    }
+
+    for (int w = 0; w < threads; w++) {
+        workers[w].pool = &pool;
+        workers[w].id = w;
+        if (pthread_create(&handles[w], NULL, worker_main, &workers[w]) != 0) {
+            break;
+        }
+        started++;
+    }
+    // Workers that did not start leave their items to be stolen; with no
+    // worker at all the calling thread drains the deques itself
+    if (started == 0) {
+        worker_main(&workers[0]);
+    }
+    for (int w = 0; w < started; w++) {
+        pthread_join(handles[w], NULL);
+    }
+
+    for (int w = 0; w < threads; w++) {
+        pthread_mutex_destroy(&pool.deques[w].lock);
+    }
+    free(items);
+    free(pool.deques);
+    free(handles);
+    free(workers);
+    return started ? started : 1;
+}
@@ -0,0 +1,24 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+/*
+ * Work-stealing thread pool for a fixed list of independent items (--batch:
+ * one PCB file per item). Items are dealt round-robin, in the order given,
+ * onto one deque per worker. A worker takes its next item from the front of
+ * its own deque; once that is empty it steals from the back of the others,
+ * so a worker that drew small files ends up helping with the rest instead
+ * of going idle. Give the items largest first for the best balance.
+ *
+ * Items are never added while the pool runs, so a worker stops as soon as
+ * every deque is empty.
+ */
+
+// Called once per item on one of the workers (0 .. threads-1)
+typedef void (*work_pool_fn)(int item, int worker, void* data);
+
+// Run fn on items 0 .. count-1 with up to `threads` workers and wait for all
+// of them. Returns the number of threads used; items run on the calling
+// thread when no worker could be started.
+int work_pool_run(int count, int threads, work_pool_fn fn, void* data);
+
+#endif
@@ -0,0 +1,939 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "xlsx_fast.h"
+#include "xlsx_zip.h"
+
+#define FAST_CHUNK_BYTES (4u << 20)
+// Bytes kept free behind the text of a chunk: the parser looks a few bytes
+// past a '<' without checking the end, and reads the NUL it finds there
+#define FAST_CHUNK_SLACK 16
+// zlib takes at most 4 GB of input per call
+#define FAST_INFLATE_INPUT (1u << 30)
+
+typedef struct {
+    uint32_t col;           // 1 based
+    const char* value;      // in the chunk text or in the shared strings
+} fast_cell;
+
+typedef struct {
+    uint32_t first;         // first cell
+    uint32_t count;
+    uint32_t cols;          // highest column of the row
+} fast_row;
+
+typedef enum {
+    CHUNK_FREE,
+    CHUNK_FILLING,          // being inflated into
+    CHUNK_FILLED,
+    CHUNK_PARSING,
+    CHUNK_PARSED,
+    CHUNK_READING           // rows handed to the caller
+} chunk_state;
+
+typedef struct {
+    char* xml;              // whole rows of sheet1.xml, decoded in place
+    size_t size;
+    size_t capacity;
+    uint64_t seq;           // position in the sheet
+    chunk_state state;
+    fast_row* rows;
+    uint32_t row_count;
+    uint32_t row_capacity;
+    fast_cell* cells;
+    uint32_t cell_count;
+    uint32_t cell_capacity;
+    int failed;             // out of memory while parsing
+} fast_chunk;
+
+struct xlsx_fast_sheet {
+    unsigned char* map;
+    size_t map_size;
+    xlsx_zip_entry sheet_entry;
+    char* strings_xml;      // sharedStrings.xml, its texts decoded in place
+    const char** strings;
+    uint32_t string_count;
+
+    fast_chunk* chunks;
+    int chunk_count;
+    pthread_t producer;
+    pthread_t* workers;
+    int worker_count;
+    int producer_started;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint64_t filled_seq;    // chunks inflated so far
+    uint64_t parse_seq;     // next chunk for a worker
+    uint64_t read_seq;      // next chunk for the caller
+    int producer_done;
+    int stopping;
+    int failed;
+
+    // Caller side, no lock needed
+    fast_chunk* current;
+    uint32_t next_row;
+    int in_row;
+    uint32_t cell;
+    uint32_t cell_end;
+    uint32_t col;
+    uint32_t row_cols;
+    uint32_t first_row_cols;
+};
+
+///////////////////////// scanning /////////////////////////
+
+// First a or b in [p, end), end if neither occurs
+#if defined(__SSE2__)
+static char* scan_either(char* p, char* end, char a, char b) {
+    const __m128i match_a = _mm_set1_epi8(a);
+    const __m128i match_b = _mm_set1_epi8(b);
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, match_a), _mm_cmpeq_epi8(block, match_b)));
+        if (mask) {
+            return p + __builtin_ctz((unsigned)mask);
+        }
+        p += 16;
+    }
+    while (p < end && *p != a && *p != b) {
+        p++;
+    }
+    return p;
+}
+#else
+static char* scan_either(char* p, char* end, char a, char b) {
+    while (p < end && *p != a && *p != b) {
+        p++;
+    }
+    return p;
+}
+#endif
+
+static char* scan_byte(char* p, char* end, char c) {
+    return scan_either(p, end, c, c);
+}
+
+// Whether a tag name ends at p
+static int name_ends(char c) {
+    return c == ' ' || c == '>' || c == '/' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static size_t put_utf8(char* out, unsigned long code) {
+    if (code < 0x80) {
+        out[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = (char)(0xC0 | code >> 6);
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = (char)(0xE0 | code >> 12);
+        out[1] = (char)(0x80 | (code >> 6 & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | code >> 18);
+    out[1] = (char)(0x80 | (code >> 12 & 0x3F));
+    out[2] = (char)(0x80 | (code >> 6 & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+// Copy the text at src, up to the next '<', to dst (dst <= src) and decode
+// its entities; an entity never grows when decoded. Returns the end of the
+// copied text and leaves *stop on the '<' (or end).
+static char* decode_text(char* dst, char* src, char* end, char** stop) {
+    for (;;) {
+        char* next = scan_either(src, end, '<', '&');
+        size_t length = (size_t)(next - src);
+        if (dst != src) {
+            memmove(dst, src, length);
+        }
+        dst += length;
+        src = next;
+        if (src >= end || *src == '<') {
+            break;
+        }
+        char* semi = memchr(src, ';', (size_t)(end - src) < 12 ? (size_t)(end - src) : 12);
+        size_t name_length = semi ? (size_t)(semi - src - 1) : 0;
+        const char* name = src + 1;
+        if (!semi) {
+            *dst++ = *src++;
+            continue;
+        }
+        if (name_length == 2 && memcmp(name, "lt", 2) == 0) {
+            *dst++ = '<';
+        } else if (name_length == 2 && memcmp(name, "gt", 2) == 0) {
+            *dst++ = '>';
+        } else if (name_length == 3 && memcmp(name, "amp", 3) == 0) {
+            *dst++ = '&';
+        } else if (name_length == 4 && memcmp(name, "quot", 4) == 0) {
+            *dst++ = '"';
+        } else if (name_length == 4 && memcmp(name, "apos", 4) == 0) {
+            *dst++ = '\'';
+        } else if (name_length >= 2 && name[0] == '#') {
+            int hex = name[1] == 'x' || name[1] == 'X';
+            unsigned long code = strtoul(name + 1 + hex, NULL, hex ? 16 : 10);
+            dst += put_utf8(dst, code > 0x10FFFF ? 0xFFFD : code);
+        } else {
+            // Unknown entity: keep it as written
+            memmove(dst, src, (size_t)(semi + 1 - src));
+            dst += semi + 1 - src;
+        }
+        src = semi + 1;
+    }
+    *stop = src;
+    return dst;
+}
+
+// Skip to the element after the one whose name starts at p (just past '<')
+static char* skip_tag(char* p, char* end) {
+    p = scan_byte(p, end, '>');
+    return p < end ? p + 1 : end;
+}
+
+// Text of every <t> inside an element (a shared string <si> or an inline
+// <is>), concatenated in place at the first one; p is just past the opening
+// tag. Returns the text and leaves *next past the closing tag.
+static char* collect_runs(char* p, char* end, const char* closing, size_t closing_length, char** next) {
+    char* text = NULL;
+    char* write = NULL;
+    while ((p = scan_byte(p, end, '<')) < end) {
+        p++;
+        if (*p == '/' && (size_t)(end - p) > closing_length && memcmp(p + 1, closing, closing_length) == 0) {
+            p = skip_tag(p, end);
+            break;
+        }
+        char* close = scan_byte(p, end, '>');
+        if (p[0] == 't' && name_ends(p[1]) && close < end && close[-1] != '/') {
+            char* stop;
+            if (!text) {
+                text = write = close + 1;
+            }
+            write = decode_text(write, close + 1, end, &stop);
+            p = stop;
+        } else {
+            p = close < end ? close + 1 : end;
+        }
+    }
+    *next = p;
+    if (!text) {
+        // No run at all: an empty string, the NUL behind the chunk text
+        return end;
+    }
+    *write = '\0';
+    return text;
+}
+
+///////////////////////// shared strings /////////////////////////
+
+// Raw inflate of a deflated zip member into *buffer, growing it as needed
+static int inflate_all(const xlsx_zip_entry* entry, char** buffer, size_t* buffer_capacity, size_t* size) {
+    char* out = *buffer;
+    size_t capacity = *buffer_capacity;
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (entry->method != Z_DEFLATED || inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        return 0;
+    }
+    const unsigned char* input = entry->data;
+    uint64_t input_left = entry->compressed_size;
+    size_t used = 0;
+    int rc = Z_OK;
+    while (rc == Z_OK) {
+        if (capacity - used <= FAST_CHUNK_SLACK) {
+            char* grown = realloc(out, capacity * 2);
+            if (!grown) {
+                break;
+            }
+            out = grown;
+            capacity *= 2;
+        }
+        if (stream.avail_in == 0 && input_left > 0) {
+            stream.next_in = (Bytef*)input;
+            stream.avail_in = input_left < FAST_INFLATE_INPUT ? (uInt)input_left : FAST_INFLATE_INPUT;
+            input += stream.avail_in;
+            input_left -= stream.avail_in;
+        }
+        size_t room = capacity - used - FAST_CHUNK_SLACK;
+        stream.next_out = (Bytef*)out + used;
+        stream.avail_out = room < FAST_INFLATE_INPUT ? (uInt)room : FAST_INFLATE_INPUT;
+        uInt before = stream.avail_out;
+        rc = inflate(&stream, Z_NO_FLUSH);
+        used += before - stream.avail_out;
+        if (rc == Z_BUF_ERROR && stream.avail_in == 0 && input_left == 0) {
+            break;
+        }
+        if (rc == Z_BUF_ERROR) {
+            rc = Z_OK;
+        }
+    }
+    inflateEnd(&stream);
+    *buffer = out;
+    *buffer_capacity = capacity;
+    *size = used;
+    return rc == Z_STREAM_END;
+}
+
+// Inflate a zip member into a NUL terminated buffer
+static char* inflate_entry(const xlsx_zip_entry* entry, size_t* size) {
+    size_t capacity = (size_t)entry->size + FAST_CHUNK_SLACK;
+    char* out = malloc(capacity);
+    size_t used = 0;
+    if (!out) {
+        return NULL;
+    }
+    if (entry->method == 0 && entry->compressed_size == entry->size) {
+        memcpy(out, entry->data, (size_t)entry->compressed_size);
+        used = (size_t)entry->compressed_size;
+    } else if (!inflate_all(entry, &out, &capacity, &used)) {
+        free(out);
+        return NULL;
+    }
+    if (crc32(crc32(0, NULL, 0), (const Bytef*)out, (uInt)used) != entry->crc32) {
+        free(out);
+        return NULL;
+    }
+    memset(out + used, 0, FAST_CHUNK_SLACK);
+    *size = used;
+    return out;
+}
+
+static int load_shared_strings(xlsx_fast_sheet* sheet) {
+    xlsx_zip_entry entry;
+    size_t size;
+    uint32_t capacity = 0;
+
+    if (!xlsx_zip_find(sheet->map, sheet->map_size, "xl/sharedStrings.xml", &entry)) {
+        return 1;   // a sheet of numbers and inline strings only
+    }
+    if ((sheet->strings_xml = inflate_entry(&entry, &size)) == NULL) {
+        return 0;
+    }
+    char* p = sheet->strings_xml;
+    char* end = p + size;
+    while ((p = scan_byte(p, end, '<')) < end) {
+        p++;
+        if (p[0] != 's' || p[1] != 'i' || !name_ends(p[2])) {
+            p = skip_tag(p, end);
+            continue;
+        }
+        char* close = scan_byte(p, end, '>');
+        const char* text;
+        if (close < end && close[-1] == '/') {
+            text = "";
+            p = close + 1;
+        } else {
+            text = collect_runs(close + 1, end, "si", 2, &p);
+        }
+        if (sheet->string_count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            const char** grown = realloc(sheet->strings, capacity * sizeof(char*));
+            if (!grown) {
+                return 0;
+            }
+            sheet->strings = grown;
+        }
+        sheet->strings[sheet->string_count++] = text;
+    }
+    return 1;
+}
+
+///////////////////////// chunk parser /////////////////////////
+
+static uint32_t column_of(const char* ref, const char* end) {
+    uint32_t col = 0;
+    while (ref < end && *ref >= 'A' && *ref <= 'Z') {
+        col = col * 26 + (uint32_t)(*ref++ - 'A' + 1);
+    }
+    return col;
+}
+
+static int add_cell(fast_chunk* chunk, uint32_t col, const char* value) {
+    if (chunk->cell_count == chunk->cell_capacity) {
+        uint32_t capacity = chunk->cell_capacity ? chunk->cell_capacity * 2 : 65536;
+        fast_cell* cells = realloc(chunk->cells, capacity * sizeof(fast_cell));
+        if (!cells) {
+            return 0;
+        }
+        chunk->cells = cells;
+        chunk->cell_capacity = capacity;
+    }
+    chunk->cells[chunk->cell_count].col = col;
+    chunk->cells[chunk->cell_count].value = value;
+    chunk->cell_count++;
+    return 1;
+}
+
+static int add_row(fast_chunk* chunk) {
+    if (chunk->row_count == chunk->row_capacity) {
+        uint32_t capacity = chunk->row_capacity ? chunk->row_capacity * 2 : 4096;
+        fast_row* rows = realloc(chunk->rows, capacity * sizeof(fast_row));
+        if (!rows) {
+            return 0;
+        }
+        chunk->rows = rows;
+        chunk->row_capacity = capacity;
+    }
+    fast_row* row = &chunk->rows[chunk->row_count++];
+    row->first = chunk->cell_count;
+    row->count = 0;
+    row->cols = 0;
+    return 1;
+}
+
+// Close the last row; rows without a non-empty value are dropped
+static void end_row(fast_chunk* chunk, int nonempty) {
+    fast_row* row = &chunk->rows[chunk->row_count - 1];
+    if (!nonempty) {
+        chunk->cell_count = row->first;
+        chunk->row_count--;
+        return;
+    }
+    row->count = chunk->cell_count - row->first;
+    for (uint32_t i = row->first; i < chunk->cell_count; i++) {
+        if (chunk->cells[i].col > row->cols) {
+            row->cols = chunk->cells[i].col;
+        }
+    }
+}
+
+// A <c> element; p is just past "<c". Returns the position after it.
+static char* parse_cell(const xlsx_fast_sheet* sheet, fast_chunk* chunk, char* p, char* end,
+                        uint32_t* col, int* nonempty) {
+    char* close = scan_byte(p, end, '>');
+    int shared = 0, found_ref = 0;
+
+    if (close >= end) {
+        return end;
+    }
+    // Attributes: only r (column) and t (type) matter
+    for (char* a = p; a < close; ) {
+        while (a < close && (*a == ' ' || *a == '\t' || *a == '\r' || *a == '\n')) {
+            a++;
+        }
+        char* eq = scan_byte(a, close, '=');
+        if (eq >= close || eq + 1 >= close) {
+            break;
+        }
+        char quote = eq[1];
+        char* value = eq + 2;
+        char* value_end = scan_byte(value, close, quote);
+        if (eq - a == 1 && a[0] == 'r') {
+            *col = column_of(value, value_end);
+            found_ref = 1;
+        } else if (eq - a == 1 && a[0] == 't') {
+            shared = value_end - value == 1 && value[0] == 's';
+        }
+        a = value_end + 1;
+    }
+    if (!found_ref) {
+        (*col)++;
+    }
+    if (close[-1] == '/') {
+        return close + 1;   // no value
+    }
+
+    const char* text = NULL;
+    p = close + 1;
+    while ((p = scan_byte(p, end, '<')) < end) {
+        p++;
+        if (p[0] == 'v' && name_ends(p[1])) {
+            char* tag_end = scan_byte(p, end, '>');
+            if (tag_end >= end) {
+                return end;
+            }
+            if (tag_end[-1] == '/') {
+                text = "";
+                p = tag_end + 1;
+                continue;
+            }
+            char* stop;
+            char* start = tag_end + 1;
+            char* write_end = decode_text(start, start, end, &stop);
+            text = start;
+            // The '<' of </v> is not needed once stop points past it
+            p = stop + 1;
+            *write_end = '\0';
+        } else if (p[0] == 'i' && p[1] == 's' && name_ends(p[2])) {
+            char* tag_end = scan_byte(p, end, '>');
+            if (tag_end >= end) {
+                return end;
+            }
+            text = tag_end[-1] == '/' ? "" : collect_runs(tag_end + 1, end, "is", 2, &p);
+            if (tag_end[-1] == '/') {
+                p = tag_end + 1;
+            }
+        } else if (p[0] == '/' && p[1] == 'c' && p[2] == '>') {
+            p += 3;
+            break;
+        } else if (p[0] == 'f' && name_ends(p[1])) {
+            // Formula: only the cached <v> counts
+            char* tag_end = scan_byte(p, end, '>');
+            p = tag_end < end ? tag_end + 1 : end;
+            if (tag_end < end && tag_end[-1] != '/') {
+                while ((p = scan_byte(p, end, '<')) < end && !(p[1] == '/' && p[2] == 'f' && p[3] == '>')) {
+                    p++;
+                }
+                p = p < end ? p + 4 : end;
+            }
+        } else {
+            p = skip_tag(p, end);
+        }
+    }
+
+    if (text) {
+        if (shared) {
+            unsigned long index = strtoul(text, NULL, 10);
+            text = index < sheet->string_count ? sheet->strings[index] : "";
+        }
+        if (text[0]) {
+            *nonempty = 1;
+        }
+        if (!add_cell(chunk, *col, text)) {
+            chunk->failed = 1;
+        }
+    }
+    return p;
+}
+
+static void parse_chunk(const xlsx_fast_sheet* sheet, fast_chunk* chunk) {
+    char* p = chunk->xml;
+    char* end = p + chunk->size;
+    int in_row = 0, nonempty = 0;
+    uint32_t col = 0;
+
+    chunk->row_count = 0;
+    chunk->cell_count = 0;
+    chunk->failed = 0;
+    while (!chunk->failed && (p = scan_byte(p, end, '<')) < end) {
+        p++;
+        if (p[0] == 'c' && name_ends(p[1]) && in_row) {
+            p = parse_cell(sheet, chunk, p + 1, end, &col, &nonempty);
+        } else if (p[0] == 'r' && p[1] == 'o' && p[2] == 'w' && name_ends(p[3])) {
+            char* close = scan_byte(p, end, '>');
+            if (close >= end) {
+                break;
+            }
+            if (in_row) {
+                end_row(chunk, nonempty);
+            }
+            if (!add_row(chunk)) {
+                chunk->failed = 1;
+                break;
+            }
+            in_row = 1;
+            nonempty = 0;
+            col = 0;
+            if (close[-1] == '/') {
+                end_row(chunk, 0);
+                in_row = 0;
+            }
+            p = close + 1;
+        } else if (p[0] == '/' && p[1] == 'r' && p[2] == 'o' && p[3] == 'w' && p[4] == '>') {
+            if (in_row) {
+                end_row(chunk, nonempty);
+                in_row = 0;
+            }
+            p += 5;
+        } else {
+            p = skip_tag(p, end);
+        }
+    }
+    if (in_row) {
+        end_row(chunk, nonempty);
+    }
+}
+
+///////////////////////// threads /////////////////////////
+
+static fast_chunk* chunk_in_state(xlsx_fast_sheet* sheet, chunk_state state, uint64_t seq, int any_seq) {
+    for (int i = 0; i < sheet->chunk_count; i++) {
+        fast_chunk* chunk = &sheet->chunks[i];
+        if (chunk->state == state && (any_seq || chunk->seq == seq)) {
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+// End of the last complete </row> in the text, 0 if there is none
+static size_t last_row_end(const char* xml, size_t size) {
+    for (size_t i = size; i >= 6; i--) {
+        if (xml[i - 1] == '>' && memcmp(xml + i - 6, "</row>", 6) == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    z_stream stream;
+    const unsigned char* input;
+    uint64_t input_left;
+    int method;
+    uLong crc;              // of the text produced so far
+} sheet_source;
+
+// Inflate up to room bytes behind the text of a chunk; returns 1 at the end
+// of the sheet, 0 when the room is used up, -1 on a corrupt stream
+static int inflate_into(sheet_source* source, fast_chunk* chunk, size_t room) {
+    if (source->method == 0) {
+        size_t take = source->input_left < room ? (size_t)source->input_left : room;
+        memcpy(chunk->xml + chunk->size, source->input, take);
+        chunk->size += take;
+        source->input += take;
+        source->input_left -= take;
+        return source->input_left == 0;
+    }
+    while (room > 0) {
+        z_stream* stream = &source->stream;
+        if (stream->avail_in == 0 && source->input_left > 0) {
+            stream->next_in = (Bytef*)source->input;
+            stream->avail_in = source->input_left < FAST_INFLATE_INPUT ? (uInt)source->input_left : FAST_INFLATE_INPUT;
+            source->input += stream->avail_in;
+            source->input_left -= stream->avail_in;
+        }
+        stream->next_out = (Bytef*)chunk->xml + chunk->size;
+        stream->avail_out = room < FAST_INFLATE_INPUT ? (uInt)room : FAST_INFLATE_INPUT;
+        uInt before = stream->avail_out;
+        int rc = inflate(stream, Z_NO_FLUSH);
+        chunk->size += before - stream->avail_out;
+        room -= before - stream->avail_out;
+        if (rc == Z_STREAM_END) {
+            return 1;
+        }
+        if (rc != Z_OK && !(rc == Z_BUF_ERROR && (stream->avail_in > 0 || source->input_left > 0))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Fill the free space of a chunk, same result as inflate_into. A damaged
+// stream can still inflate to its end; the CRC of the zip entry catches it.
+static int fill_chunk(sheet_source* source, fast_chunk* chunk, uint32_t expected_crc) {
+    size_t filled = chunk->size;
+    int status = inflate_into(source, chunk, chunk->capacity - FAST_CHUNK_SLACK - chunk->size);
+    source->crc = crc32(source->crc, (const Bytef*)chunk->xml + filled, (uInt)(chunk->size - filled));
+    if (status == 1 && source->crc != expected_crc) {
+        return -1;
+    }
+    return status;
+}
+
+static int grow_chunk(fast_chunk* chunk, size_t capacity) {
+    char* xml = realloc(chunk->xml, capacity);
+    if (!xml) {
+        return 0;
+    }
+    chunk->xml = xml;
+    chunk->capacity = capacity;
+    return 1;
+}
+
+// Inflates sheet1.xml into free chunks, each ending after a </row>; the
+// incomplete row at the end of a chunk starts the next one
+static void* producer_main(void* arg) {
+    xlsx_fast_sheet* sheet = arg;
+    sheet_source source;
+    char* carry = NULL;
+    size_t carry_size = 0, carry_capacity = 0;
+    int ok = 1, done = 0;
+
+    memset(&source, 0, sizeof(source));
+    source.input = sheet->sheet_entry.data;
+    source.input_left = sheet->sheet_entry.compressed_size;
+    source.method = sheet->sheet_entry.method;
+    source.crc = crc32(0, NULL, 0);
+    if (source.method == Z_DEFLATED && inflateInit2(&source.stream, -MAX_WBITS) != Z_OK) {
+        ok = 0;
+    }
+
+    while (ok && !done) {
+        pthread_mutex_lock(&sheet->lock);
+        fast_chunk* chunk;
+        while (!sheet->stopping && (chunk = chunk_in_state(sheet, CHUNK_FREE, 0, 1)) == NULL) {
+            pthread_cond_wait(&sheet->changed, &sheet->lock);
+        }
+        if (sheet->stopping) {
+            pthread_mutex_unlock(&sheet->lock);
+            break;
+        }
+        chunk->state = CHUNK_FILLING;
+        pthread_mutex_unlock(&sheet->lock);
+
+        if (carry_size + FAST_CHUNK_SLACK >= chunk->capacity / 2
+            && !grow_chunk(chunk, (carry_size + FAST_CHUNK_SLACK) * 2)) {
+            ok = 0;
+        }
+        if (ok) {
+            memcpy(chunk->xml, carry, carry_size);
+        }
+        chunk->size = ok ? carry_size : 0;
+        size_t split = 0;
+        while (ok) {
+            int status = fill_chunk(&source, chunk, sheet->sheet_entry.crc32);
+            if (status < 0) {
+                ok = 0;
+            } else if (status > 0) {
+                split = chunk->size;
+                done = 1;
+                break;
+            } else if ((split = last_row_end(chunk->xml, chunk->size)) > 0) {
+                break;
+            } else if (!grow_chunk(chunk, chunk->capacity * 2)) {
+                // A single row larger than the chunk
+                ok = 0;
+            }
+        }
+        if (ok) {
+            carry_size = chunk->size - split;
+            if (carry_size > carry_capacity) {
+                char* grown = realloc(carry, carry_size);
+                if (!grown) {
+                    ok = 0;
+                } else {
+                    carry = grown;
+                    carry_capacity = carry_size;
+                }
+            }
+            if (ok) {
+                memcpy(carry, chunk->xml + split, carry_size);
+            }
+        }
+        chunk->size = ok ? split : 0;
+        memset(chunk->xml + chunk->size, 0, FAST_CHUNK_SLACK);
+
+        pthread_mutex_lock(&sheet->lock);
+        chunk->seq = sheet->filled_seq++;
+        chunk->state = CHUNK_FILLED;
+        pthread_cond_broadcast(&sheet->changed);
+        pthread_mutex_unlock(&sheet->lock);
+    }
+
+    if (source.method == Z_DEFLATED) {
+        inflateEnd(&source.stream);
+    }
+    free(carry);
+    pthread_mutex_lock(&sheet->lock);
+    sheet->producer_done = 1;
+    sheet->failed |= !ok;
+    pthread_cond_broadcast(&sheet->changed);
+    pthread_mutex_unlock(&sheet->lock);
+    return NULL;
+}
+
+static void* worker_main(void* arg) {
+    xlsx_fast_sheet* sheet = arg;
+
+    pthread_mutex_lock(&sheet->lock);
+    for (;;) {
+        fast_chunk* chunk = NULL;
+        while (!sheet->stopping
+               && (chunk = chunk_in_state(sheet, CHUNK_FILLED, sheet->parse_seq, 0)) == NULL
+               && !(sheet->producer_done && sheet->parse_seq == sheet->filled_seq)) {
+            pthread_cond_wait(&sheet->changed, &sheet->lock);
+        }
+        if (sheet->stopping || !chunk) {
+            break;
+        }
+        chunk->state = CHUNK_PARSING;
+        sheet->parse_seq++;
+        pthread_mutex_unlock(&sheet->lock);
+
+        parse_chunk(sheet, chunk);
+
+        pthread_mutex_lock(&sheet->lock);
+        chunk->state = CHUNK_PARSED;
+        pthread_cond_broadcast(&sheet->changed);
+    }
+    pthread_mutex_unlock(&sheet->lock);
+    return NULL;
+}
+
+///////////////////////// public interface /////////////////////////
+
+static void stop_threads(xlsx_fast_sheet* sheet) {
+    pthread_mutex_lock(&sheet->lock);
+    sheet->stopping = 1;
+    pthread_cond_broadcast(&sheet->changed);
+    pthread_mutex_unlock(&sheet->lock);
+    if (sheet->producer_started) {
+        pthread_join(sheet->producer, NULL);
+        sheet->producer_started = 0;
+    }
+    for (int i = 0; i < sheet->worker_count; i++) {
+        pthread_join(sheet->workers[i], NULL);
+    }
+    sheet->worker_count = 0;
+}
+
+void xlsx_fast_close(xlsx_fast_sheet* sheet) {
+    if (!sheet) {
+        return;
+    }
+    stop_threads(sheet);
+    for (int i = 0; i < sheet->chunk_count; i++) {
+        free(sheet->chunks[i].xml);
+        free(sheet->chunks[i].rows);
+        free(sheet->chunks[i].cells);
+    }
+    free(sheet->chunks);
+    free(sheet->workers);
+    free(sheet->strings);
+    free(sheet->strings_xml);
+    pthread_cond_destroy(&sheet->changed);
+    pthread_mutex_destroy(&sheet->lock);
+    if (sheet->map) {
+        munmap(sheet->map, sheet->map_size);
+    }
+    free(sheet);
+}
+
+xlsx_fast_sheet* xlsx_fast_open(const char* path, int threads) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    xlsx_fast_sheet* sheet = calloc(1, sizeof(xlsx_fast_sheet));
+    if (!sheet) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    sheet->map = map;
+    sheet->map_size = st.st_size;
+    pthread_mutex_init(&sheet->lock, NULL);
+    pthread_cond_init(&sheet->changed, NULL);
+    if (threads < 1) {
+        threads = 1;
+    }
+    // Enough chunks for every worker to have one while more are inflated and read
+    sheet->chunk_count = threads * 2 + 2;
+    sheet->chunks = calloc(sheet->chunk_count, sizeof(fast_chunk));
+    sheet->workers = calloc(threads, sizeof(pthread_t));
+    if (!sheet->chunks || !sheet->workers
+        || !xlsx_zip_find(sheet->map, sheet->map_size, "xl/worksheets/sheet1.xml", &sheet->sheet_entry)
+        || (sheet->sheet_entry.method != 0 && sheet->sheet_entry.method != Z_DEFLATED)
+        || !load_shared_strings(sheet)) {
+        xlsx_fast_close(sheet);
+        return NULL;
+    }
+    for (int i = 0; i < sheet->chunk_count; i++) {
+        if (!grow_chunk(&sheet->chunks[i], FAST_CHUNK_BYTES + FAST_CHUNK_SLACK)) {
+            xlsx_fast_close(sheet);
+            return NULL;
+        }
+    }
+
+    if (pthread_create(&sheet->producer, NULL, producer_main, sheet) != 0) {
+        xlsx_fast_close(sheet);
+        return NULL;
+    }
+    sheet->producer_started = 1;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&sheet->workers[i], NULL, worker_main, sheet) != 0) {
+            break;
+        }
+        sheet->worker_count++;
+    }
+    if (sheet->worker_count == 0) {
+        xlsx_fast_close(sheet);
+        return NULL;
+    }
+    return sheet;
+}
+
+// Hand the rows of the current chunk back and wait for the next one
+static fast_chunk* next_chunk(xlsx_fast_sheet* sheet) {
+    fast_chunk* chunk = NULL;
+
+    pthread_mutex_lock(&sheet->lock);
+    if (sheet->current) {
+        sheet->current->state = CHUNK_FREE;
+        sheet->current = NULL;
+        pthread_cond_broadcast(&sheet->changed);
+    }
+    while (!sheet->failed && (chunk = chunk_in_state(sheet, CHUNK_PARSED, sheet->read_seq, 0)) == NULL
+           && !(sheet->producer_done && sheet->read_seq == sheet->filled_seq)) {
+        pthread_cond_wait(&sheet->changed, &sheet->lock);
+    }
+    if (chunk && chunk->failed) {
+        sheet->failed = 1;
+    }
+    if (sheet->failed) {
+        chunk = NULL;
+    }
+    if (chunk) {
+        chunk->state = CHUNK_READING;
+        sheet->read_seq++;
+    }
+    pthread_mutex_unlock(&sheet->lock);
+    return chunk;
+}
+
+int xlsx_fast_next_row(xlsx_fast_sheet* sheet) {
+    sheet->in_row = 0;
+    while (!sheet->current || sheet->next_row == sheet->current->row_count) {
+        if ((sheet->current = next_chunk(sheet)) == NULL) {
+            return 0;
+        }
+        sheet->next_row = 0;
+    }
+    const fast_row* row = &sheet->current->rows[sheet->next_row++];
+    if (sheet->first_row_cols == 0) {
+        sheet->first_row_cols = row->cols;
+    }
+    sheet->cell = row->first;
+    sheet->cell_end = row->first + row->count;
+    sheet->row_cols = row->cols > sheet->first_row_cols ? row->cols : sheet->first_row_cols;
+    sheet->col = 0;
+    sheet->in_row = 1;
+    return 1;
+}
+
+const char* xlsx_fast_next_cell(xlsx_fast_sheet* sheet) {
+    if (!sheet->in_row || sheet->col >= sheet->row_cols) {
+        return NULL;
+    }
+    uint32_t col = ++sheet->col;
+    const fast_cell* cells = sheet->current->cells;
+    // Cells come in column order; a repeated column keeps its first value
+    while (sheet->cell < sheet->cell_end && cells[sheet->cell].col < col) {
+        sheet->cell++;
+    }
+    if (sheet->cell < sheet->cell_end && cells[sheet->cell].col == col) {
+        return cells[sheet->cell++].value;
+    }
+    return "";
+}
+
+int xlsx_fast_failed(const xlsx_fast_sheet* sheet) {
+    return sheet->failed;
+}
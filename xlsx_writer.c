@@ -0,0 +1,845 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <zlib.h>
+#include "output_sink.h"
+#include "xlsx_writer.h"
+
+// Sheet XML per deflate chunk, and chunks in flight per thread
+#define WRITER_CHUNK_BYTES (256u << 10)
+#define WRITER_CHUNKS_PER_THREAD 2
+// Deflate window: the history a chunk is primed with
+#define WRITER_WINDOW (32u << 10)
+// Room for a deflated chunk and its flush marker
+#define WRITER_CHUNK_OUTPUT (compressBound(WRITER_CHUNK_BYTES) + 64)
+#define WRITER_FILE_BUFFER (1u << 20)
+#define WRITER_MAX_MEMBERS 16
+// Longest dimension reference, "A1:XFD1048576"
+#define WRITER_DIMENSION_SIZE 13
+
+#define ZIP_LOCAL_SIGNATURE 0x04034b50u
+#define ZIP_CENTRAL_SIGNATURE 0x02014b50u
+#define ZIP_EOCD_SIGNATURE 0x06054b50u
+#define ZIP64_EOCD_SIGNATURE 0x06064b50u
+#define ZIP64_LOCATOR_SIGNATURE 0x07064b50u
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP64_EXTRA_SIZE 20     // header and both sizes, in a local header
+
+typedef enum {
+    CHUNK_FREE,
+    CHUNK_FILLING,          // taking sheet XML
+    CHUNK_QUEUED,
+    CHUNK_DEFLATING,
+    CHUNK_DEFLATED          // waiting to be written to the file
+} chunk_state;
+
+typedef struct {
+    unsigned char* input;
+    size_t size;
+    unsigned char* window;  // end of the chunk before, the dictionary
+    size_t window_size;
+    unsigned char* output;
+    size_t output_size;
+    uint64_t seq;           // position in the sheet
+    uint32_t crc;           // of the input
+    int last;               // ends the deflate stream
+    int failed;
+    chunk_state state;
+} deflate_chunk;
+
+typedef struct {
+    char name[32];
+    uint64_t offset;        // of the local header
+    uint32_t crc;
+    uint64_t size;
+    uint64_t compressed_size;
+    int zip64;
+} zip_member;
+
+struct xlsx_writer {
+    FILE* file;
+    char* file_buffer;
+    int level;
+    int zip64;
+    uint16_t dos_time;
+    uint16_t dos_date;
+    zip_member members[WRITER_MAX_MEMBERS];
+    int member_count;
+    z_stream stream;        // small members, and the chunks when no thread started
+    int stream_ready;
+
+    // Sheet names; the one being written is the last
+    char sheet_names[XLSX_WRITER_MAX_SHEETS][32];
+    int sheet_count;
+    // Sheets after the first, whole in memory until the next one starts
+    char* extra;
+    size_t extra_size;
+    size_t extra_capacity;
+
+    // sheet1.xml: the stored block holding its start, then the chunks
+    zip_member* sheet;
+    uint64_t prologue_offset;
+    uint64_t body_size;
+    uint64_t body_compressed;
+    uint32_t body_crc;
+
+    deflate_chunk* chunks;
+    int chunk_count;
+    pthread_t* workers;
+    int worker_count;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint64_t fill_seq;      // chunk being filled
+    uint64_t deflate_seq;   // next chunk for a worker
+    int stopping;
+    int failed;
+
+    // Writer side, no lock needed
+    deflate_chunk* current;
+    int in_row;
+    uint32_t row;
+    int have_cell;
+    uint32_t last_row;      // extent of the cells written
+    uint32_t last_col;
+};
+
+///////////////////////// zip records /////////////////////////
+
+static unsigned char* put_u16(unsigned char* p, uint16_t value) {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+    return p + 2;
+}
+
+static unsigned char* put_u32(unsigned char* p, uint32_t value) {
+    p = put_u16(p, (uint16_t)value);
+    return put_u16(p, (uint16_t)(value >> 16));
+}
+
+static unsigned char* put_u64(unsigned char* p, uint64_t value) {
+    p = put_u32(p, (uint32_t)value);
+    return put_u32(p, (uint32_t)(value >> 32));
+}
+
+static void write_bytes(xlsx_writer* writer, const void* data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, writer->file) != size) {
+        writer->failed = 1;
+    }
+}
+
+// Local header of a member; a zip64 one carries its sizes in an extra field
+static void write_local_header(xlsx_writer* writer, const zip_member* member) {
+    unsigned char header[ZIP_LOCAL_HEADER_SIZE + ZIP64_EXTRA_SIZE];
+    size_t name_size = strlen(member->name);
+    unsigned char* p = put_u32(header, ZIP_LOCAL_SIGNATURE);
+    p = put_u16(p, member->zip64 ? 45 : 20);
+    p = put_u16(p, 0);
+    p = put_u16(p, Z_DEFLATED);
+    p = put_u16(p, writer->dos_time);
+    p = put_u16(p, writer->dos_date);
+    p = put_u32(p, member->crc);
+    p = put_u32(p, member->zip64 ? 0xFFFFFFFFu : (uint32_t)member->compressed_size);
+    p = put_u32(p, member->zip64 ? 0xFFFFFFFFu : (uint32_t)member->size);
+    p = put_u16(p, (uint16_t)name_size);
+    p = put_u16(p, member->zip64 ? ZIP64_EXTRA_SIZE : 0);
+    write_bytes(writer, header, ZIP_LOCAL_HEADER_SIZE);
+    write_bytes(writer, member->name, name_size);
+    if (member->zip64) {
+        p = put_u16(header, 1);
+        p = put_u16(p, 16);
+        p = put_u64(p, member->size);
+        p = put_u64(p, member->compressed_size);
+        write_bytes(writer, header, ZIP64_EXTRA_SIZE);
+    }
+}
+
+static void write_central_header(xlsx_writer* writer, const zip_member* member) {
+    unsigned char header[46];
+    unsigned char extra[28];
+    size_t name_size = strlen(member->name);
+    unsigned char* p = put_u32(header, ZIP_CENTRAL_SIGNATURE);
+    p = put_u16(p, member->zip64 ? 45 : 20);
+    p = put_u16(p, member->zip64 ? 45 : 20);
+    p = put_u16(p, 0);
+    p = put_u16(p, Z_DEFLATED);
+    p = put_u16(p, writer->dos_time);
+    p = put_u16(p, writer->dos_date);
+    p = put_u32(p, member->crc);
+    p = put_u32(p, member->zip64 ? 0xFFFFFFFFu : (uint32_t)member->compressed_size);
+    p = put_u32(p, member->zip64 ? 0xFFFFFFFFu : (uint32_t)member->size);
+    p = put_u16(p, (uint16_t)name_size);
+    p = put_u16(p, member->zip64 ? sizeof(extra) : 0);
+    p = put_u16(p, 0);      // comment
+    p = put_u16(p, 0);      // disk
+    p = put_u16(p, 0);      // internal attributes
+    p = put_u32(p, 0);      // external attributes
+    p = put_u32(p, member->zip64 ? 0xFFFFFFFFu : (uint32_t)member->offset);
+    write_bytes(writer, header, sizeof(header));
+    write_bytes(writer, member->name, name_size);
+    if (member->zip64) {
+        p = put_u16(extra, 1);
+        p = put_u16(p, 24);
+        p = put_u64(p, member->size);
+        p = put_u64(p, member->compressed_size);
+        p = put_u64(p, member->offset);
+        write_bytes(writer, extra, sizeof(extra));
+    }
+}
+
+// Central directory and end records, zip64 ones when asked for
+static void write_directory(xlsx_writer* writer) {
+    unsigned char record[56];
+    uint64_t directory_offset = (uint64_t)ftello(writer->file);
+    for (int i = 0; i < writer->member_count; i++) {
+        write_central_header(writer, &writer->members[i]);
+    }
+    uint64_t end_offset = (uint64_t)ftello(writer->file);
+    uint64_t directory_size = end_offset - directory_offset;
+    unsigned char* p;
+
+    if (writer->zip64) {
+        p = put_u32(record, ZIP64_EOCD_SIGNATURE);
+        p = put_u64(p, 44);
+        p = put_u16(p, 45);
+        p = put_u16(p, 45);
+        p = put_u32(p, 0);
+        p = put_u32(p, 0);
+        p = put_u64(p, (uint64_t)writer->member_count);
+        p = put_u64(p, (uint64_t)writer->member_count);
+        p = put_u64(p, directory_size);
+        p = put_u64(p, directory_offset);
+        write_bytes(writer, record, 56);
+        p = put_u32(record, ZIP64_LOCATOR_SIGNATURE);
+        p = put_u32(p, 0);
+        p = put_u64(p, end_offset);
+        p = put_u32(p, 1);
+        write_bytes(writer, record, 20);
+    }
+    p = put_u32(record, ZIP_EOCD_SIGNATURE);
+    p = put_u16(p, 0);
+    p = put_u16(p, 0);
+    p = put_u16(p, (uint16_t)writer->member_count);
+    p = put_u16(p, (uint16_t)writer->member_count);
+    p = put_u32(p, directory_size > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)directory_size);
+    p = put_u32(p, directory_offset > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)directory_offset);
+    p = put_u16(p, 0);
+    write_bytes(writer, record, 22);
+}
+
+static zip_member* add_member(xlsx_writer* writer, const char* name) {
+    zip_member* member = &writer->members[writer->member_count++];
+    memset(member, 0, sizeof(zip_member));
+    snprintf(member->name, sizeof(member->name), "%s", name);
+    member->offset = (uint64_t)ftello(writer->file);
+    return member;
+}
+
+// A whole member deflated at once
+static void write_member(xlsx_writer* writer, const char* name, const char* text) {
+    size_t size = strlen(text);
+    uLong capacity = compressBound((uLong)size);
+    unsigned char* output = malloc(capacity);
+    zip_member* member = add_member(writer, name);
+
+    if (!output || deflateReset(&writer->stream) != Z_OK) {
+        free(output);
+        writer->failed = 1;
+        return;
+    }
+    writer->stream.next_in = (unsigned char*)text;
+    writer->stream.avail_in = (uInt)size;
+    writer->stream.next_out = output;
+    writer->stream.avail_out = (uInt)capacity;
+    if (deflate(&writer->stream, Z_FINISH) != Z_STREAM_END) {
+        writer->failed = 1;
+    }
+    member->crc = (uint32_t)crc32(0, (const unsigned char*)text, (uInt)size);
+    member->size = size;
+    member->compressed_size = capacity - writer->stream.avail_out;
+    write_local_header(writer, member);
+    write_bytes(writer, output, (size_t)member->compressed_size);
+    free(output);
+}
+
+///////////////////////// package parts /////////////////////////
+
+#define XML_DECLARATION "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+#define SPREADSHEET_NS "http://schemas.openxmlformats.org/spreadsheetml/2006/main"
+#define RELATIONSHIP_NS "http://schemas.openxmlformats.org/officeDocument/2006/relationships"
+
+static const char content_types_start_xml[] =
+    XML_DECLARATION
+    "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">"
+    "<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>"
+    "<Default Extension=\"xml\" ContentType=\"application/xml\"/>"
+    "<Override PartName=\"/xl/workbook.xml\""
+    " ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet.main+xml\"/>"
+    "<Override PartName=\"/xl/styles.xml\""
+    " ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.styles+xml\"/>";
+
+static const char root_rels_xml[] =
+    XML_DECLARATION
+    "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+    "<Relationship Id=\"rId1\" Type=\"" RELATIONSHIP_NS "/officeDocument\" Target=\"xl/workbook.xml\"/>"
+    "</Relationships>";
+
+static const char workbook_start_xml[] =
+    XML_DECLARATION
+    "<workbook xmlns=\"" SPREADSHEET_NS "\" xmlns:r=\"" RELATIONSHIP_NS "\"><sheets>";
+
+// The styles are rId1, the sheets rId2 and up
+static const char workbook_rels_start_xml[] =
+    XML_DECLARATION
+    "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+    "<Relationship Id=\"rId1\" Type=\"" RELATIONSHIP_NS "/styles\" Target=\"styles.xml\"/>";
+
+// The default style only, as Excel requires one
+static const char styles_xml[] =
+    XML_DECLARATION
+    "<styleSheet xmlns=\"" SPREADSHEET_NS "\">"
+    "<fonts count=\"1\"><font><sz val=\"11\"/><name val=\"Calibri\"/><family val=\"2\"/></font></fonts>"
+    "<fills count=\"2\"><fill><patternFill patternType=\"none\"/></fill>"
+    "<fill><patternFill patternType=\"gray125\"/></fill></fills>"
+    "<borders count=\"1\"><border><left/><right/><top/><bottom/><diagonal/></border></borders>"
+    "<cellStyleXfs count=\"1\"><xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\" borderId=\"0\"/></cellStyleXfs>"
+    "<cellXfs count=\"1\"><xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\"/></cellXfs>"
+    "<cellStyles count=\"1\"><cellStyle name=\"Normal\" xfId=\"0\" builtinId=\"0\"/></cellStyles>"
+    "</styleSheet>";
+
+static const char sheet_end_xml[] = "</sheetData></worksheet>";
+
+// [Content_Types].xml, xl/workbook.xml and its rels, which list the sheets
+static void write_sheet_list(xlsx_writer* writer) {
+    char types[2048], workbook[2048], rels[2048];
+    snprintf(types, sizeof(types), "%s", content_types_start_xml);
+    snprintf(workbook, sizeof(workbook), "%s", workbook_start_xml);
+    snprintf(rels, sizeof(rels), "%s", workbook_rels_start_xml);
+    for (int i = 0; i < writer->sheet_count; i++) {
+        size_t n = strlen(types);
+        snprintf(types + n, sizeof(types) - n, "<Override PartName=\"/xl/worksheets/sheet%d.xml\""
+                 " ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml\"/>",
+                 i + 1);
+        n = strlen(workbook);
+        snprintf(workbook + n, sizeof(workbook) - n, "<sheet name=\"%s\" sheetId=\"%d\" r:id=\"rId%d\"/>",
+                 writer->sheet_names[i], i + 1, i + 2);
+        n = strlen(rels);
+        snprintf(rels + n, sizeof(rels) - n, "<Relationship Id=\"rId%d\" Type=\"" RELATIONSHIP_NS "/worksheet\""
+                 " Target=\"worksheets/sheet%d.xml\"/>", i + 2, i + 1);
+    }
+    strncat(types, "</Types>", sizeof(types) - strlen(types) - 1);
+    strncat(workbook, "</sheets></workbook>", sizeof(workbook) - strlen(workbook) - 1);
+    strncat(rels, "</Relationships>", sizeof(rels) - strlen(rels) - 1);
+    write_member(writer, "[Content_Types].xml", types);
+    write_member(writer, "xl/workbook.xml", workbook);
+    write_member(writer, "xl/_rels/workbook.xml.rels", rels);
+}
+
+// Column letters of a 0 based column; returns their count
+static int column_name(uint32_t col, char* out) {
+    char reversed[4];
+    int n = 0;
+    col++;
+    while (col > 0 && n < 4) {
+        reversed[n++] = (char)('A' + (col - 1) % 26);
+        col = (col - 1) / 26;
+    }
+    for (int i = 0; i < n; i++) {
+        out[i] = reversed[n - 1 - i];
+    }
+    return n;
+}
+
+// Start of sheet1.xml up to <sheetData>, always of the same length: the
+// dimension reference is padded with spaces before the "/>"
+static size_t sheet_prologue(const xlsx_writer* writer, char* out, size_t size) {
+    char ref[WRITER_DIMENSION_SIZE + 1] = "A1";
+    if (writer->have_cell) {
+        char last[4];
+        int letters = column_name(writer->last_col, last);
+        snprintf(ref, sizeof(ref), "A1:%.*s%u", letters, last, writer->last_row + 1);
+    }
+    int n = snprintf(out, size, XML_DECLARATION "<worksheet xmlns=\"" SPREADSHEET_NS "\" xmlns:r=\"" RELATIONSHIP_NS "\">"
+                     "<dimension ref=\"%s\"%*s/><sheetData>", ref, (int)(WRITER_DIMENSION_SIZE - strlen(ref)), "");
+    return n > 0 ? (size_t)n : 0;
+}
+
+// The prologue as a stored, not final deflate block
+static void write_prologue(xlsx_writer* writer, uint32_t* crc, size_t* size) {
+    char prologue[512];
+    unsigned char block[5];
+    uint16_t length = (uint16_t)sheet_prologue(writer, prologue, sizeof(prologue));
+    block[0] = 0;
+    put_u16(put_u16(block + 1, length), (uint16_t)~length);
+    write_bytes(writer, block, sizeof(block));
+    write_bytes(writer, prologue, length);
+    *crc = (uint32_t)crc32(0, (const unsigned char*)prologue, length);
+    *size = length;
+}
+
+///////////////////////// deflate threads /////////////////////////
+
+static int deflate_init(z_stream* stream, int level) {
+    memset(stream, 0, sizeof(z_stream));
+    return deflateInit2(stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+// Deflate a chunk so that it continues the stream of the chunks before it
+static void deflate_chunk_data(z_stream* stream, deflate_chunk* chunk) {
+    size_t capacity = WRITER_CHUNK_OUTPUT;
+    int rc = deflateReset(stream);
+    if (rc == Z_OK && chunk->window_size > 0) {
+        rc = deflateSetDictionary(stream, chunk->window, (uInt)chunk->window_size);
+    }
+    stream->next_in = chunk->input;
+    stream->avail_in = (uInt)chunk->size;
+    stream->next_out = chunk->output;
+    stream->avail_out = (uInt)capacity;
+    if (rc == Z_OK) {
+        // A sync flush ends the chunk on a byte boundary without ending the stream
+        rc = deflate(stream, chunk->last ? Z_FINISH : Z_SYNC_FLUSH);
+    }
+    chunk->failed = chunk->last ? rc != Z_STREAM_END : (rc != Z_OK || stream->avail_in != 0);
+    chunk->output_size = capacity - stream->avail_out;
+    chunk->crc = (uint32_t)crc32(0, chunk->input, (uInt)chunk->size);
+}
+
+typedef struct {
+    xlsx_writer* writer;
+    z_stream stream;
+} deflate_worker;
+
+static void* deflate_worker_main(void* arg) {
+    deflate_worker* worker = arg;
+    xlsx_writer* writer = worker->writer;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        deflate_chunk* chunk = &writer->chunks[writer->deflate_seq % (uint64_t)writer->chunk_count];
+        if (chunk->state == CHUNK_QUEUED && chunk->seq == writer->deflate_seq) {
+            writer->deflate_seq++;
+            chunk->state = CHUNK_DEFLATING;
+            pthread_mutex_unlock(&writer->lock);
+            deflate_chunk_data(&worker->stream, chunk);
+            pthread_mutex_lock(&writer->lock);
+            chunk->state = CHUNK_DEFLATED;
+            pthread_cond_broadcast(&writer->changed);
+        } else if (writer->stopping) {
+            break;
+        } else {
+            pthread_cond_wait(&writer->changed, &writer->lock);
+        }
+    }
+    pthread_mutex_unlock(&writer->lock);
+    deflateEnd(&worker->stream);
+    free(worker);
+    return NULL;
+}
+
+// Wait until a chunk is deflated and append it to the sheet; the chunks
+// before it are already written
+static void flush_chunk(xlsx_writer* writer, deflate_chunk* chunk) {
+    pthread_mutex_lock(&writer->lock);
+    while (chunk->state == CHUNK_QUEUED || chunk->state == CHUNK_DEFLATING) {
+        pthread_cond_wait(&writer->changed, &writer->lock);
+    }
+    chunk_state state = chunk->state;
+    pthread_mutex_unlock(&writer->lock);
+    if (state != CHUNK_DEFLATED) {
+        return;
+    }
+    if (chunk->failed) {
+        writer->failed = 1;
+    }
+    write_bytes(writer, chunk->output, chunk->output_size);
+    writer->body_crc = (uint32_t)crc32_combine(writer->body_crc, chunk->crc, (z_off_t)chunk->size);
+    writer->body_size += chunk->size;
+    writer->body_compressed += chunk->output_size;
+    pthread_mutex_lock(&writer->lock);
+    chunk->state = CHUNK_FREE;
+    pthread_mutex_unlock(&writer->lock);
+}
+
+// Hand the chunk being filled to the threads and start the next one, primed
+// with the end of this one
+static void submit_chunk(xlsx_writer* writer, int last) {
+    deflate_chunk* chunk = writer->current;
+    chunk->last = last;
+    if (writer->worker_count == 0) {
+        deflate_chunk_data(&writer->stream, chunk);
+        pthread_mutex_lock(&writer->lock);
+        chunk->state = CHUNK_DEFLATED;
+        pthread_mutex_unlock(&writer->lock);
+        flush_chunk(writer, chunk);
+    } else {
+        pthread_mutex_lock(&writer->lock);
+        chunk->state = CHUNK_QUEUED;
+        pthread_cond_broadcast(&writer->changed);
+        pthread_mutex_unlock(&writer->lock);
+    }
+    writer->current = NULL;
+    if (last) {
+        return;
+    }
+
+    deflate_chunk* next = &writer->chunks[++writer->fill_seq % (uint64_t)writer->chunk_count];
+    flush_chunk(writer, next);
+    next->size = 0;
+    next->window_size = chunk->size < WRITER_WINDOW ? chunk->size : WRITER_WINDOW;
+    memcpy(next->window, chunk->input + chunk->size - next->window_size, next->window_size);
+    pthread_mutex_lock(&writer->lock);
+    next->seq = writer->fill_seq;
+    next->state = CHUNK_FILLING;
+    pthread_mutex_unlock(&writer->lock);
+    writer->current = next;
+}
+
+static void put_text(xlsx_writer* writer, const char* text, size_t size) {
+    if (writer->sheet_count > 1) {
+        if (writer->extra_size + size + 1 > writer->extra_capacity) {
+            size_t capacity = writer->extra_capacity ? writer->extra_capacity : 4096;
+            while (capacity < writer->extra_size + size + 1) {
+                capacity *= 2;
+            }
+            char* extra = realloc(writer->extra, capacity);
+            if (!extra) {
+                writer->failed = 1;
+                return;
+            }
+            writer->extra = extra;
+            writer->extra_capacity = capacity;
+        }
+        memcpy(writer->extra + writer->extra_size, text, size);
+        writer->extra_size += size;
+        writer->extra[writer->extra_size] = '\0';
+        return;
+    }
+    while (size > 0) {
+        deflate_chunk* chunk = writer->current;
+        size_t room = WRITER_CHUNK_BYTES - chunk->size;
+        size_t n = size < room ? size : room;
+        memcpy(chunk->input + chunk->size, text, n);
+        chunk->size += n;
+        text += n;
+        size -= n;
+        if (chunk->size == WRITER_CHUNK_BYTES) {
+            submit_chunk(writer, 0);
+        }
+    }
+}
+
+static void put_string(xlsx_writer* writer, const char* text) {
+    put_text(writer, text, strlen(text));
+}
+
+///////////////////////// cells /////////////////////////
+
+// Close the open row and open the one of the cell
+static int begin_cell(xlsx_writer* writer, uint32_t row, uint32_t col) {
+    char tag[32];
+    if (writer->failed) {
+        return 0;
+    }
+    if (row >= XLSX_WRITER_MAX_ROWS || col >= XLSX_WRITER_MAX_COLS) {
+        fprintf(stderr, "Error: cell %u:%u is outside an xlsx sheet (%u rows, %u columns)\n",
+                row + 1, col + 1, XLSX_WRITER_MAX_ROWS, XLSX_WRITER_MAX_COLS);
+        writer->failed = 1;
+        return 0;
+    }
+    if (!writer->in_row || row != writer->row) {
+        if (writer->in_row) {
+            put_string(writer, "</row>");
+        }
+        snprintf(tag, sizeof(tag), "<row r=\"%u\">", row + 1);
+        put_string(writer, tag);
+        writer->in_row = 1;
+        writer->row = row;
+    }
+    if (!writer->have_cell || row > writer->last_row) {
+        writer->last_row = row;
+    }
+    if (!writer->have_cell || col > writer->last_col) {
+        writer->last_col = col;
+    }
+    writer->have_cell = 1;
+    return 1;
+}
+
+// <c r="B7"
+static void put_cell_start(xlsx_writer* writer, uint32_t row, uint32_t col) {
+    char start[32] = "<c r=\"";
+    int n = 6 + column_name(col, start + 6);
+    snprintf(start + n, sizeof(start) - n, "%u\"", row + 1);
+    put_string(writer, start);
+}
+
+// Text with the XML entities escaped, and control characters as _xHHHH_
+// the way Excel stores them
+static void put_escaped(xlsx_writer* writer, const char* text) {
+    const char* run = text;
+    for (const char* p = text; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        const char* entity = NULL;
+        char control[8];
+        if (c == '&') {
+            entity = "&amp;";
+        } else if (c == '<') {
+            entity = "&lt;";
+        } else if (c == '>') {
+            entity = "&gt;";
+        } else if (c < 0x20 && c != '\t' && c != '\n') {
+            snprintf(control, sizeof(control), "_x%04X_", c);
+            entity = control;
+        }
+        if (entity) {
+            put_text(writer, run, (size_t)(p - run));
+            put_string(writer, entity);
+            run = p + 1;
+        }
+    }
+    put_string(writer, run);
+}
+
+int xlsx_writer_write_string(xlsx_writer* writer, uint32_t row, uint32_t col, const char* text) {
+    if (!begin_cell(writer, row, col)) {
+        return 0;
+    }
+    size_t size = strlen(text);
+    int preserve = size > 0 && (text[0] == ' ' || text[0] == '\t' || text[0] == '\n'
+                                || text[size - 1] == ' ' || text[size - 1] == '\t' || text[size - 1] == '\n');
+    put_cell_start(writer, row, col);
+    put_string(writer, preserve ? " t=\"inlineStr\"><is><t xml:space=\"preserve\">" : " t=\"inlineStr\"><is><t>");
+    put_escaped(writer, text);
+    put_string(writer, "</t></is></c>");
+    return !writer->failed;
+}
+
+int xlsx_writer_write_number(xlsx_writer* writer, uint32_t row, uint32_t col, double number) {
+    char value[40];
+    if (!begin_cell(writer, row, col)) {
+        return 0;
+    }
+    put_cell_start(writer, row, col);
+    if (isfinite(number)) {
+        format_number(value, sizeof(value), number);
+        put_string(writer, "><v>");
+        put_string(writer, value);
+        put_string(writer, "</v></c>");
+    } else {
+        // No xlsx number is infinite
+        put_string(writer, " t=\"e\"><v>#NUM!</v></c>");
+    }
+    return !writer->failed;
+}
+
+///////////////////////// open and close /////////////////////////
+
+static void free_writer(xlsx_writer* writer) {
+    for (int i = 0; i < writer->chunk_count; i++) {
+        free(writer->chunks[i].input);
+        free(writer->chunks[i].window);
+        free(writer->chunks[i].output);
+    }
+    free(writer->chunks);
+    free(writer->workers);
+    free(writer->extra);
+    if (writer->stream_ready) {
+        deflateEnd(&writer->stream);
+    }
+    if (writer->file) {
+        fclose(writer->file);
+    }
+    free(writer->file_buffer);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->changed);
+    free(writer);
+}
+
+static void set_dos_time(xlsx_writer* writer) {
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    writer->dos_time = (uint16_t)(local.tm_hour << 11 | local.tm_min << 5 | local.tm_sec / 2);
+    writer->dos_date = (uint16_t)((local.tm_year - 80) << 9 | (local.tm_mon + 1) << 5 | local.tm_mday);
+}
+
+xlsx_writer* xlsx_writer_open(const char* path, const xlsx_writer_options* options) {
+    xlsx_writer* writer = calloc(1, sizeof(xlsx_writer));
+    int threads = options->threads > 0 ? options->threads : 1;
+    if (!writer) {
+        return NULL;
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+    writer->level = options->level;
+    writer->zip64 = options->use_zip64;
+    writer->stream_ready = deflate_init(&writer->stream, writer->level);
+    writer->chunk_count = threads * WRITER_CHUNKS_PER_THREAD + 1;
+    writer->chunks = calloc((size_t)writer->chunk_count, sizeof(deflate_chunk));
+    writer->workers = malloc((size_t)threads * sizeof(pthread_t));
+    if (!writer->stream_ready || !writer->chunks || !writer->workers) {
+        free_writer(writer);
+        return NULL;
+    }
+    for (int i = 0; i < writer->chunk_count; i++) {
+        deflate_chunk* chunk = &writer->chunks[i];
+        chunk->input = malloc(WRITER_CHUNK_BYTES);
+        chunk->window = malloc(WRITER_WINDOW);
+        chunk->output = malloc(WRITER_CHUNK_OUTPUT);
+        if (!chunk->input || !chunk->window || !chunk->output) {
+            free_writer(writer);
+            return NULL;
+        }
+    }
+    if ((writer->file = fopen(path, "wb")) == NULL) {
+        free_writer(writer);
+        return NULL;
+    }
+    if ((writer->file_buffer = malloc(WRITER_FILE_BUFFER)) != NULL) {
+        setvbuf(writer->file, writer->file_buffer, _IOFBF, WRITER_FILE_BUFFER);
+    }
+    set_dos_time(writer);
+
+    // The parts listing the sheets are written on close
+    write_member(writer, "_rels/.rels", root_rels_xml);
+    write_member(writer, "xl/styles.xml", styles_xml);
+
+    // The first sheet's header and prologue are rewritten once it is finished
+    snprintf(writer->sheet_names[0], sizeof(writer->sheet_names[0]), "Sheet1");
+    writer->sheet_count = 1;
+    writer->sheet = add_member(writer, "xl/worksheets/sheet1.xml");
+    writer->sheet->zip64 = writer->zip64;
+    write_local_header(writer, writer->sheet);
+    writer->prologue_offset = (uint64_t)ftello(writer->file);
+    uint32_t crc;
+    size_t size;
+    write_prologue(writer, &crc, &size);
+
+    writer->current = &writer->chunks[0];
+    writer->current->state = CHUNK_FILLING;
+    // Threads that fail to start are done without; with none the chunks are
+    // deflated on the calling thread
+    for (int i = 0; i < threads; i++) {
+        deflate_worker* worker = malloc(sizeof(deflate_worker));
+        if (!worker || !deflate_init(&worker->stream, writer->level)) {
+            free(worker);
+            break;
+        }
+        worker->writer = writer;
+        if (pthread_create(&writer->workers[writer->worker_count], NULL, deflate_worker_main, worker) != 0) {
+            deflateEnd(&worker->stream);
+            free(worker);
+            break;
+        }
+        writer->worker_count++;
+    }
+    return writer;
+}
+
+// Deflate the rest of the first sheet, stop the threads and rewrite its
+// prologue and header now that its extent and sizes are known
+static void finish_first_sheet(xlsx_writer* writer) {
+    submit_chunk(writer, 1);
+    // Every chunk not written yet, oldest first
+    uint64_t first = writer->fill_seq >= (uint64_t)writer->chunk_count
+                   ? writer->fill_seq - (uint64_t)writer->chunk_count + 1 : 0;
+    for (uint64_t seq = first; seq <= writer->fill_seq; seq++) {
+        flush_chunk(writer, &writer->chunks[seq % (uint64_t)writer->chunk_count]);
+    }
+    pthread_mutex_lock(&writer->lock);
+    writer->stopping = 1;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+    for (int i = 0; i < writer->worker_count; i++) {
+        pthread_join(writer->workers[i], NULL);
+    }
+
+    // Now that the extent and the sizes are known: the prologue, the header
+    uint64_t end = (uint64_t)ftello(writer->file);
+    zip_member* sheet = writer->sheet;
+    uint32_t prologue_crc;
+    size_t prologue_size;
+    if (fseeko(writer->file, (off_t)writer->prologue_offset, SEEK_SET) != 0) {
+        writer->failed = 1;
+    }
+    write_prologue(writer, &prologue_crc, &prologue_size);
+    sheet->crc = (uint32_t)crc32_combine(prologue_crc, writer->body_crc, (z_off_t)writer->body_size);
+    sheet->size = prologue_size + writer->body_size;
+    sheet->compressed_size = 5 + prologue_size + writer->body_compressed;
+    if (!sheet->zip64 && (sheet->size > 0xFFFFFFFFu || sheet->compressed_size > 0xFFFFFFFFu)) {
+        fprintf(stderr, "Error: the sheet takes %llu bytes, more than a zip without ZIP64 holds\n",
+                (unsigned long long)sheet->size);
+        writer->failed = 1;
+    }
+    if (fseeko(writer->file, (off_t)sheet->offset, SEEK_SET) != 0) {
+        writer->failed = 1;
+    }
+    write_local_header(writer, sheet);
+    if (fseeko(writer->file, (off_t)end, SEEK_SET) != 0) {
+        writer->failed = 1;
+    }
+}
+
+// A later sheet is written whole from memory: its prologue, then its rows
+static void finish_extra_sheet(xlsx_writer* writer) {
+    char prologue[512];
+    char name[32];
+    size_t prologue_size = sheet_prologue(writer, prologue, sizeof(prologue));
+    char* text = malloc(prologue_size + writer->extra_size + 1);
+    if (!text) {
+        writer->failed = 1;
+        return;
+    }
+    memcpy(text, prologue, prologue_size);
+    memcpy(text + prologue_size, writer->extra, writer->extra_size);
+    text[prologue_size + writer->extra_size] = '\0';
+    snprintf(name, sizeof(name), "xl/worksheets/sheet%d.xml", writer->sheet_count);
+    write_member(writer, name, text);
+    free(text);
+}
+
+static void finish_sheet(xlsx_writer* writer) {
+    if (writer->in_row) {
+        put_string(writer, "</row>");
+    }
+    put_text(writer, sheet_end_xml, sizeof(sheet_end_xml) - 1);
+    if (writer->sheet_count == 1) {
+        finish_first_sheet(writer);
+    } else {
+        finish_extra_sheet(writer);
+    }
+    writer->in_row = 0;
+    writer->have_cell = 0;
+    writer->last_row = 0;
+    writer->last_col = 0;
+    writer->extra_size = 0;
+}
+
+int xlsx_writer_add_sheet(xlsx_writer* writer, const char* name) {
+    if (writer->sheet_count == XLSX_WRITER_MAX_SHEETS) {
+        fprintf(stderr, "Error: an xlsx of the built-in writer holds at most %d sheets\n", XLSX_WRITER_MAX_SHEETS);
+        writer->failed = 1;
+        return 0;
+    }
+    finish_sheet(writer);
+    snprintf(writer->sheet_names[writer->sheet_count], sizeof(writer->sheet_names[0]), "%s", name);
+    writer->sheet_count++;
+    return !writer->failed;
+}
+
+int xlsx_writer_close(xlsx_writer* writer) {
+    finish_sheet(writer);
+    write_sheet_list(writer);
+    write_directory(writer);
+
+    int ok = !writer->failed && !ferror(writer->file);
+    ok = fclose(writer->file) == 0 && ok;
+    writer->file = NULL;
+    free_writer(writer);
+    return ok;
+}
@@ -0,0 +1,53 @@
+#ifndef XLSX_WRITER_H
+#define XLSX_WRITER_H
+
+#include <stdint.h>
+
+/*
+ * Built-in writer of an .xlsx (--fast-writer), an alternative to
+ * libxlsxwriter whose close deflates the whole sheet on one core.
+ *
+ * Rows are written in order straight into xl/worksheets/sheet1.xml, texts
+ * as inline strings as in libxlsxwriter's constant_memory mode. The sheet
+ * XML is cut into chunks that worker threads deflate while the rows keep
+ * coming, pigz style: each chunk is raw deflate primed with the 32 KB before
+ * it and ends on a sync flush, so the chunks concatenate into one deflate
+ * stream, and their CRCs are combined with crc32_combine. Closing only
+ * deflates the last chunks, then writes the zip directory.
+ *
+ * The <dimension> of the sheet is only known at the end: it sits in a
+ * stored block of fixed size ahead of the chunks, rewritten on close.
+ *
+ * The first sheet is the streamed one. Sheets added after it (--summary)
+ * are small: each is kept in memory and deflated whole once the next one
+ * starts or the writer closes.
+ */
+
+// xlsx limits
+#define XLSX_WRITER_MAX_ROWS 1048576
+#define XLSX_WRITER_MAX_COLS 16384
+// Sheets of one workbook
+#define XLSX_WRITER_MAX_SHEETS 8
+
+typedef struct {
+    int threads;    // deflate threads, at least 1
+    int level;      // zlib level 0-9
+    int use_zip64;  // allow a sheet above 4 GB
+} xlsx_writer_options;
+
+typedef struct xlsx_writer xlsx_writer;
+
+// Create path and write everything but the sheet; NULL on failure
+xlsx_writer* xlsx_writer_open(const char* path, const xlsx_writer_options* options);
+// Cells go row by row and column by column, rows and columns 0 based.
+// Return 0 once anything failed.
+int xlsx_writer_write_string(xlsx_writer* writer, uint32_t row, uint32_t col, const char* text);
+int xlsx_writer_write_number(xlsx_writer* writer, uint32_t row, uint32_t col, double number);
+// Finish the sheet being written and start another one named name (no XML
+// special characters); its rows start at 0 again
+int xlsx_writer_add_sheet(xlsx_writer* writer, const char* name);
+// Finish the sheet and the zip, stop the threads and free the writer;
+// returns 0 if anything failed
+int xlsx_writer_close(xlsx_writer* writer);
+
+#endif
@@ -0,0 +1,182 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "xlsx_zip.h"
+
+#define ZIP_EOCD_SIGNATURE 0x06054b50u
+#define ZIP_CENTRAL_SIGNATURE 0x02014b50u
+#define ZIP_LOCAL_SIGNATURE 0x04034b50u
+
+static uint32_t read_u32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t read_u16(const unsigned char* p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint64_t read_u64(const unsigned char* p) {
+    return (uint64_t)read_u32(p) | (uint64_t)read_u32(p + 4) << 32;
+}
+
+#define ZIP64_EOCD_SIGNATURE 0x06064b50u
+#define ZIP64_LOCATOR_SIGNATURE 0x07064b50u
+#define ZIP64_EXTRA_ID 0x0001
+
+// Sizes and offset a zip64 extra field replaces (those stored as 0xFFFFFFFF)
+static void read_zip64_extra(const unsigned char* extra, size_t length,
+                             uint64_t* size, uint64_t* compressed_size, uint64_t* local) {
+    size_t at = 0;
+    while (at + 4 <= length) {
+        uint16_t id = read_u16(extra + at);
+        uint16_t field_length = read_u16(extra + at + 2);
+        const unsigned char* field = extra + at + 4;
+        if (id == ZIP64_EXTRA_ID && at + 4 + field_length <= length) {
+            size_t used = 0;
+            if (*size == 0xFFFFFFFFu && used + 8 <= field_length) {
+                *size = read_u64(field + used);
+                used += 8;
+            }
+            if (*compressed_size == 0xFFFFFFFFu && used + 8 <= field_length) {
+                *compressed_size = read_u64(field + used);
+                used += 8;
+            }
+            if (*local == 0xFFFFFFFFu && used + 8 <= field_length) {
+                *local = read_u64(field + used);
+            }
+            return;
+        }
+        at += 4 + field_length;
+    }
+}
+
+int xlsx_zip_find(const unsigned char* data, size_t size, const char* name, xlsx_zip_entry* entry) {
+    size_t name_length = strlen(name);
+    size_t eocd;
+
+    if (size < 22) {
+        return 0;
+    }
+    // The end of central directory record sits behind an optional comment (< 64 KB)
+    for (eocd = size - 22; ; eocd--) {
+        if (read_u32(data + eocd) == ZIP_EOCD_SIGNATURE) {
+            break;
+        }
+        if (eocd == 0 || size - eocd > 22 + 65535) {
+            return 0;
+        }
+    }
+
+    uint64_t entries = read_u16(data + eocd + 10);
+    uint64_t offset = read_u32(data + eocd + 16);
+    // Archives above 4 GB keep the directory in a zip64 end record
+    if ((offset == 0xFFFFFFFFu || entries == 0xFFFF) && eocd >= 20
+        && read_u32(data + eocd - 20) == ZIP64_LOCATOR_SIGNATURE) {
+        uint64_t record = read_u64(data + eocd - 20 + 8);
+        if (record + 56 <= size && read_u32(data + record) == ZIP64_EOCD_SIGNATURE) {
+            entries = read_u64(data + record + 32);
+            offset = read_u64(data + record + 48);
+        }
+    }
+    for (uint64_t i = 0; i < entries; i++) {
+        if (offset + 46 > size || read_u32(data + offset) != ZIP_CENTRAL_SIGNATURE) {
+            return 0;
+        }
+        uint16_t file_name_length = read_u16(data + offset + 28);
+        uint16_t extra_length = read_u16(data + offset + 30);
+        uint16_t comment_length = read_u16(data + offset + 32);
+        if (file_name_length == name_length && offset + 46 + name_length + extra_length <= size
+            && memcmp(data + offset + 46, name, name_length) == 0) {
+            uint64_t compressed_size = read_u32(data + offset + 20);
+            uint64_t uncompressed_size = read_u32(data + offset + 24);
+            uint64_t local = read_u32(data + offset + 42);
+            read_zip64_extra(data + offset + 46 + name_length, extra_length,
+                             &uncompressed_size, &compressed_size, &local);
+            if (local + 30 > size || read_u32(data + local) != ZIP_LOCAL_SIGNATURE) {
+                return 0;
+            }
+            uint64_t start = local + 30 + read_u16(data + local + 26) + read_u16(data + local + 28);
+            if (start + compressed_size > size) {
+                return 0;
+            }
+            entry->data = data + start;
+            entry->compressed_size = compressed_size;
+            entry->size = uncompressed_size;
+            entry->crc32 = read_u32(data + offset + 16);
+            entry->method = read_u16(data + offset + 10);
+            return 1;
+        }
+        offset += 46 + file_name_length + extra_length + comment_length;
+    }
+    return 0;
+}
+
+// Parse the row number after the ':' of a range reference such as A1:X2691
+static uint32_t dimension_rows(const char* xml) {
+    const char* ref = strstr(xml, "<dimension ref=\"");
+    if (!ref) {
+        return 0;
+    }
+    ref += strlen("<dimension ref=\"");
+    const char* end = strchr(ref, '"');
+    const char* colon = strchr(ref, ':');
+    const char* p = (colon && end && colon < end) ? colon + 1 : ref;
+    while (*p >= 'A' && *p <= 'Z') {
+        p++;
+    }
+    return (uint32_t)strtoul(p, NULL, 10);
+}
+
+uint32_t xlsx_sheet_dimension_rows(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    uint32_t rows = 0;
+
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    const unsigned char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+
+    xlsx_zip_entry entry;
+    if (xlsx_zip_find(data, st.st_size, "xl/worksheets/sheet1.xml", &entry)) {
+        // The dimension element comes first, so inflating the head of the sheet is enough
+        char head[4096];
+        size_t head_size = 0;
+        if (entry.method == 0) {
+            head_size = entry.compressed_size < sizeof(head) - 1 ? entry.compressed_size : sizeof(head) - 1;
+            memcpy(head, entry.data, head_size);
+        } else if (entry.method == Z_DEFLATED) {
+            z_stream stream;
+            memset(&stream, 0, sizeof(stream));
+            if (inflateInit2(&stream, -MAX_WBITS) == Z_OK) {
+                stream.next_in = (Bytef*)entry.data;
+                // The head of the sheet is in the first compressed bytes
+                stream.avail_in = entry.compressed_size < (1u << 30) ? (uInt)entry.compressed_size : (1u << 30);
+                stream.next_out = (Bytef*)head;
+                stream.avail_out = sizeof(head) - 1;
+                inflate(&stream, Z_SYNC_FLUSH);
+                head_size = sizeof(head) - 1 - stream.avail_out;
+                inflateEnd(&stream);
+            }
+        }
+        head[head_size] = '\0';
+        rows = dimension_rows(head);
+    }
+    munmap((void*)data, st.st_size);
+    return rows;
+}
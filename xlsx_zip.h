@@ -0,0 +1,28 @@
+#ifndef XLSX_ZIP_H
+#define XLSX_ZIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Small helpers that look inside the zip container of an .xlsx without
+ * going through xlsxio, for information xlsxio does not expose.
+ */
+
+// One member of the zip container, pointing into the caller's copy of it
+typedef struct {
+    const unsigned char* data;  // compressed bytes
+    uint64_t compressed_size;
+    uint64_t size;              // uncompressed
+    uint32_t crc32;             // of the uncompressed bytes
+    int method;                 // 0 stored, 8 deflate
+} xlsx_zip_entry;
+
+// Find a member of a zip (zip64 included) held in memory; returns 0 if absent
+int xlsx_zip_find(const unsigned char* data, size_t size, const char* name, xlsx_zip_entry* entry);
+
+// Rows declared by <dimension ref="A1:X2691"/> in the first worksheet,
+// header included; 0 when the file or the element is missing
+uint32_t xlsx_sheet_dimension_rows(const char* path);
+
+#endif